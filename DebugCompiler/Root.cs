@@ -119,6 +119,8 @@ namespace DebugCompiler
             root.AddCommand(ConsoleKey.T, "Toggle Text History", root.cmd_ToggleNoClear);
             root.AddCommand(ConsoleKey.C, "Compile Script [path] <T7|T8>", root.cmd_Compile);
             root.AddCommand(ConsoleKey.I, "Inject Script [path] <T7|T8> <inject path>", root.cmd_Inject);
+            root.AddCommand(ConsoleKey.S, "Detour Stats <refresh ms>", root.cmd_DetourStats);
+            root.AddCommand(ConsoleKey.P, "Opcode Profile <refresh ms> <--timing>", root.cmd_OpcodeProfile);
             while (true)
             {
                 try { root.Exec(root.PrintOptions()); }
@@ -468,6 +470,116 @@ namespace DebugCompiler
             return -1;
         }
 
+        private const int DetourStatsMax = 1024;
+        private const int DetourStatsRecordSize = 88;
+
+        private int cmd_DetourStats(string[] args, string[] opts)
+        {
+            int refresh = 1000;
+            if (args.Length > 0 && !int.TryParse(args[0], out refresh))
+            {
+                return Error("Invalid arguments. Refresh interval must be in milliseconds.");
+            }
+
+            ProcessEx bo3 = T7ProcessName;
+            if (bo3 == null)
+            {
+                return Error("No game process found for Black Ops III.");
+            }
+            if (bo3["t7cinternal.dll"] is null)
+            {
+                return Error("t7cinternal.dll is not loaded. Inject a script first.");
+            }
+            bo3.OpenHandle();
+            bo3.SetDefaultCallType(ExCallThreadType.XCTT_QUAPC);
+            var hGetStats = bo3.GetProcAddress(@"t7cinternal.dll", @"GetDetourStats");
+
+            // live table until a key is pressed
+            while (!Console.KeyAvailable)
+            {
+                byte[] records = new byte[DetourStatsMax * DetourStatsRecordSize];
+                int count = bo3.Call<int>(hGetStats, records, DetourStatsMax);
+
+                Console.Clear();
+                Console.WriteLine($"{"Script",-48} {"Namespace",-10} {"Function",-10} {"Linked",-7} {"Sites",-8} {"Calls",-12}");
+                for (int i = 0; i < count; i++)
+                {
+                    int offset = i * DetourStatsRecordSize;
+                    string script = DecodeAscii(records, offset + 0x18);
+                    Console.ForegroundColor = BitConverter.ToInt32(records, offset + 0x8) != 0 ? ConsoleColor.Green : ConsoleColor.Red;
+                    Console.WriteLine($"{(script.Length > 0 ? script : "<builtin>"),-48} {BitConverter.ToUInt32(records, offset),-10:X8} {BitConverter.ToUInt32(records, offset + 0x4),-10:X8} {(BitConverter.ToInt32(records, offset + 0x8) != 0 ? "yes" : "no"),-7} {BitConverter.ToInt32(records, offset + 0xC),-8} {BitConverter.ToInt64(records, offset + 0x10),-12}");
+                }
+                Console.ForegroundColor = ConsoleColor.White;
+                Console.WriteLine($"\n{count} detours. Press any key to stop...");
+                System.Threading.Thread.Sleep(refresh);
+            }
+            Console.ReadKey(true);
+            bo3.CloseHandle();
+            return 0;
+        }
+
+        private const int OpcodeHistogramMax = 512;
+        private const int OpcodeHistogramRecordSize = 32;
+        private const int OpcodeHistogramRows = 40;
+
+        private int cmd_OpcodeProfile(string[] args, string[] opts)
+        {
+            int refresh = 1000;
+            if (args.Length > 0 && !int.TryParse(args[0], out refresh))
+            {
+                return Error("Invalid arguments. Refresh interval must be in milliseconds.");
+            }
+            bool timing = opts.Contains("--timing");
+
+            ProcessEx bo3 = T7ProcessName;
+            if (bo3 == null)
+            {
+                return Error("No game process found for Black Ops III.");
+            }
+            if (bo3["t7cinternal.dll"] is null)
+            {
+                return Error("t7cinternal.dll is not loaded. Inject a script first.");
+            }
+            bo3.OpenHandle();
+            bo3.SetDefaultCallType(ExCallThreadType.XCTT_QUAPC);
+            var hGetHistogram = bo3.GetProcAddress(@"t7cinternal.dll", @"GetOpcodeHistogram");
+            if (!bo3.Call<bool>(bo3.GetProcAddress(@"t7cinternal.dll", @"InstallOpcodeProfiler"), timing))
+            {
+                bo3.CloseHandle();
+                return Error("The opcode profiler is already running.");
+            }
+
+            // live table until a key is pressed, the profiler is removed when we stop
+            while (!Console.KeyAvailable)
+            {
+                byte[] records = new byte[OpcodeHistogramMax * OpcodeHistogramRecordSize];
+                int count = bo3.Call<int>(hGetHistogram, records, OpcodeHistogramMax);
+                long total = 0;
+                for (int i = 0; i < count; i++)
+                {
+                    total += BitConverter.ToInt64(records, i * OpcodeHistogramRecordSize + 0x10);
+                }
+
+                Console.Clear();
+                Console.WriteLine($"{"Handler",-18} {"Opcode",-8} {"Aliases",-8} {"Count",-14} {"%",-7} {(timing ? "Cycles/op" : "")}");
+                for (int i = 0; i < Math.Min(count, OpcodeHistogramRows); i++)
+                {
+                    int offset = i * OpcodeHistogramRecordSize;
+                    long calls = BitConverter.ToInt64(records, offset + 0x10);
+                    long cycles = BitConverter.ToInt64(records, offset + 0x18);
+                    string percent = total > 0 ? (calls * 100.0 / total).ToString("F2") : "0";
+                    string latency = timing && calls > 0 ? (cycles / calls).ToString() : "";
+                    Console.WriteLine($"{BitConverter.ToInt64(records, offset):X16}   {BitConverter.ToInt32(records, offset + 0x8),-8:X4} {BitConverter.ToInt32(records, offset + 0xC),-8} {calls,-14} {percent,-7} {latency}");
+                }
+                Console.WriteLine($"\n{count} handlers, {total} dispatches. Press any key to stop...");
+                System.Threading.Thread.Sleep(refresh);
+            }
+            Console.ReadKey(true);
+            bo3.Call<VOID>(bo3.GetProcAddress(@"t7cinternal.dll", @"UninstallOpcodeProfiler"));
+            bo3.CloseHandle();
+            return 0;
+        }
+
         private int cmd_StatDump(string[] args, string[] opts)
         {
             return -1;
@@ -529,6 +641,7 @@ namespace DebugCompiler
             bool noruntime = false;
             bool buildScript = false;
             bool compileOnly = false;
+            bool directbuiltins = true;
 
             foreach (string opt in opts)
             {
@@ -595,6 +708,9 @@ namespace DebugCompiler
                         case "noruntime":
                             noruntime = split[1].ToLower().Trim() == "true";
                             break;
+                        case "directbuiltins":
+                            directbuiltins = split[1].ToLower().Trim() == "true";
+                            break;
                     }
                 }
             }
@@ -681,7 +797,9 @@ namespace DebugCompiler
                 return Error(e.Message);
             }
 
-            code = Compiler.Compile(platform, game, Modes.MP, false, source);
+            // dedicated builtin defs need the runtime dll, so only emit them when it will be loaded and knows about them
+            directbuiltins = directbuiltins && isT7 && !noruntime && RuntimeHasExport("GetDirectBuiltinSupport");
+            code = Compiler.Compile(platform, game, Modes.MP, false, source, "", directbuiltins);
             if (code.Error != null && code.Error.Length > 0)
             {
                 if(code.Error.LastIndexOf("line=") < 0)
@@ -751,6 +869,11 @@ namespace DebugCompiler
 
             byte[] data = code.CompiledScript;
 
+            // hotloads keep an image of what the runtime linked so the next build can send only the functions that changed
+            HotloadImagePath = (hot != hotmode.none) ? $"{outName}.{hot}.hotimage" : null;
+            HotloadLazyFunctions = code.LazyFunctions;
+            HotloadSuspendingFunctions = code.SuspendingFunctions;
+
             PointerEx injresult = InjectScript(replaceScript, code.CompiledScript, game, hot, noruntime);
             Console.WriteLine();
             Console.ForegroundColor = !injresult ? ConsoleColor.Green : ConsoleColor.Red;
@@ -801,6 +924,9 @@ namespace DebugCompiler
         private int InjectedBuffSize;
         private T7SPT InjectedScript;
         private int OriginalPID = 0;
+        private string HotloadImagePath;
+        private Dictionary<uint, uint> HotloadLazyFunctions;
+        private HashSet<ulong> HotloadSuspendingFunctions;
         private int InjectScript(string replacePath, byte[] buffer, Games game, hotmode hot, bool noruntime)
         {
             LastGameInjected = game;
@@ -812,9 +938,37 @@ namespace DebugCompiler
             return Error("Invalid game provided to inject.");
         }
 
+        private static bool RuntimeHasExport(string export)
+        {
+            try
+            {
+                string exeFilePath = Assembly.GetExecutingAssembly().Location;
+                var pe = new System.PEStructures.PEImage(File.ReadAllBytes(Path.Combine(Path.GetDirectoryName(exeFilePath), "t7cinternal.dll")));
+                return pe.Exports[export] != null;
+            }
+            catch
+            {
+                return false;
+            }
+        }
+
         private class GSICInfo
         {
             public List<T7ScriptObject.ScriptDetour> Detours = new List<T7ScriptObject.ScriptDetour>();
+            public byte[] DetourManifest;
+            public uint DirectBuiltinFallback;
+            public List<int> DirectBuiltinImports = new List<int>();
+
+            /// <summary>
+            /// Points every dedicated builtin import back at isprofilebuild, for when the runtime cant resolve them
+            /// </summary>
+            public void UndirectBuiltins(byte[] script)
+            {
+                foreach(int import in DirectBuiltinImports)
+                {
+                    BitConverter.GetBytes(DirectBuiltinFallback).CopyTo(script, import);
+                }
+            }
 
             public byte[] PackDetours()
             {
@@ -825,6 +979,15 @@ namespace DebugCompiler
                 }
                 return data.ToArray();
             }
+
+            /// <summary>
+            /// Everything registered with the runtime next to the script, a hotload delta is only possible while this stays the same
+            /// </summary>
+            public string HotloadEnvironment()
+            {
+                var detours = Detours.Select(detour => $"{detour.FixupName:X}>{detour}").OrderBy(detour => detour);
+                return string.Join(";", detours);
+            }
         }
 
         private class GSICInfoT8
@@ -880,6 +1043,17 @@ namespace DebugCompiler
                                     gsi.Detours.Add(detour);
                                 }
                                 break;
+                            case T7ScriptObject.GSIFields.DetourManifest:
+                                gsi.DetourManifest = reader.ReadBytes(reader.ReadInt32());
+                                break;
+                            case T7ScriptObject.GSIFields.DirectBuiltins:
+                                int numimports = reader.ReadInt32();
+                                gsi.DirectBuiltinFallback = reader.ReadUInt32();
+                                for(; numimports > 0; numimports--)
+                                {
+                                    gsi.DirectBuiltinImports.Add(reader.ReadInt32());
+                                }
+                                break;
                         }
                     }
                     buffer = buffer.Skip((int)reader.BaseStream.Position).ToArray();
@@ -889,6 +1063,10 @@ namespace DebugCompiler
                     return Error("Script is not a valid compiled script. Please use a script compiled for Black Ops III.");
                 }
             }
+            if(noruntime && gsi != null)
+            {
+                gsi.UndirectBuiltins(buffer);
+            }
             ProcessEx bo3 = T7ProcessName;
             if (bo3 == null)
             {
@@ -898,6 +1076,11 @@ namespace DebugCompiler
             bo3.OpenHandle();
             bo3.SetDefaultCallType(ExCallThreadType.XCTT_QUAPC);
             OriginalPID = bo3.BaseProcess.Id;
+            if (hot != hotmode.none && !noruntime && HotloadImagePath != null && RuntimeHasExport("HotloadScriptDelta") && HotloadDeltaT7(bo3, buffer, gsi, hot))
+            {
+                return 0;
+            }
+            bool undirected = false;
             PointerEx off = IsWindowsStore ? 0xF3B1330 : 0x9407AB0;
             Console.WriteLine($"s_assetPool:ScriptParseTree => {bo3["blackops3.exe"][off]}");
             var sptGlob = bo3.GetValue<ulong>(bo3["blackops3.exe"][off]);
@@ -955,10 +1138,26 @@ namespace DebugCompiler
                                 if (gsi != null)
                                 {
                                     // detours
-                                    if (gsi.Detours.Count > 0)
+                                    if (gsi.DetourManifest != null)
+                                    {
+                                        bo3.Call<VOID>(bo3.GetProcAddress(@"t7cinternal.dll", @"RegisterDetoursCompact"), gsi.DetourManifest, (long)entry.lpBuffer);
+                                    }
+                                    else if (gsi.Detours.Count > 0)
                                     {
                                         bo3.Call<VOID>(bo3.GetProcAddress(@"t7cinternal.dll", @"RegisterDetours"), gsi.PackDetours(), gsi.Detours.Count, (long)entry.lpBuffer);
                                     }
+
+                                    // dedicated builtin defs, falling back to isprofilebuild if this runtime couldnt hook the lookup
+                                    if (gsi.DirectBuiltinImports.Count > 0)
+                                    {
+                                        var hSupport = bo3.GetProcAddress(@"t7cinternal.dll", @"GetDirectBuiltinSupport");
+                                        if (!hSupport || bo3.Call<int>(hSupport) <= 0)
+                                        {
+                                            gsi.UndirectBuiltins(buffer);
+                                            bo3.SetBytes(entry.lpBuffer, buffer);
+                                            undirected = true;
+                                        }
+                                    }
                                 }
                             }
                             catch (Exception e)
@@ -968,7 +1167,38 @@ namespace DebugCompiler
                             }
                         }
                         
-                        if(hot != hotmode.none)
+                        // the runtime keeps its string references and the last linked object between hotloads, the copied function cant
+                        if(hot != hotmode.none && !noruntime && RuntimeHasExport("HotloadScriptCached"))
+                        {
+                            byte[] error_data = new byte[4];
+                            try
+                            {
+                                bool result = bo3.Call<bool>(bo3.GetProcAddress(@"t7cinternal.dll", @"HotloadScriptCached"), entry.lpBuffer, buffer.Length, (hot == hotmode.csc) ? 1 : 0, error_data);
+                                if (!result)
+                                {
+                                    switch (BitConverter.ToInt32(error_data, 0))
+                                    {
+                                        case 1:
+                                            Console.WriteLine("HOTLOAD: Invalid script");
+                                            break;
+                                        case 6:
+                                            Console.WriteLine("HOTLOAD: Scripts using animtrees can't be hotloaded");
+                                            break;
+                                    }
+                                    NoExcept(() => File.Delete(HotloadImagePath));
+                                }
+                                else
+                                {
+                                    Console.WriteLine("Successfully hotloaded script!");
+                                    NoExcept(() => T7HotloadImage.FromFullHotload(buffer, HotloadLazyFunctions, HotloadSuspendingFunctions, gsi?.HotloadEnvironment(), undirected).Save(HotloadImagePath));
+                                }
+                            }
+                            catch (Exception e)
+                            {
+                                Console.WriteLine(e.ToString());
+                            }
+                        }
+                        else if(hot != hotmode.none)
                         {
                             string exeFilePath = Assembly.GetExecutingAssembly().Location;
                             var pe = new System.PEStructures.PEImage(File.ReadAllBytes(Path.Combine(Path.GetDirectoryName(exeFilePath), "t7cinternal.dll")));
@@ -1024,6 +1254,73 @@ namespace DebugCompiler
             return 2;
         }
 
+        /// <summary>
+        /// Sends only the functions that changed since the last hotload, returns false if the whole script has to be sent instead
+        /// </summary>
+        private bool HotloadDeltaT7(ProcessEx bo3, byte[] buffer, GSICInfo gsi, hotmode hot)
+        {
+            T7HotloadImage live = T7HotloadImage.Load(HotloadImagePath);
+            if (live == null)
+            {
+                return false;
+            }
+
+            // the new script has to look exactly like the full hotload would have sent it, runtime fallbacks included
+            byte[] script = buffer.ToArray();
+            if (live.Undirected && gsi != null)
+            {
+                gsi.UndirectBuiltins(script);
+            }
+            BitConverter.GetBytes(OriginalSourceChecksum).CopyTo(script, 0x8);
+
+            byte[] delta;
+            int numChanged;
+            T7HotloadImage next;
+            try
+            {
+                next = T7HotloadImage.FromFullHotload(script, HotloadLazyFunctions, HotloadSuspendingFunctions, gsi?.HotloadEnvironment(), live.Undirected);
+                delta = T7HotloadDelta.Create(live, next, out numChanged);
+            }
+            catch (Exception e)
+            {
+                Console.WriteLine(e.ToString());
+                return false;
+            }
+
+            if (delta == null)
+            {
+                Console.WriteLine("HOTLOAD: Script layout changed, sending the whole script");
+                return false;
+            }
+
+            try
+            {
+                string exeFilePath = Assembly.GetExecutingAssembly().Location;
+                var result = bo3.Call<long>(bo3.GetProcAddress(@"kernel32.dll", @"LoadLibraryA"), Path.Combine(Path.GetDirectoryName(exeFilePath), "t7cinternal.dll"));
+                bo3.Refresh();
+                if (result <= 0)
+                {
+                    return false;
+                }
+
+                byte[] error_data = new byte[4];
+                if (!bo3.Call<bool>(bo3.GetProcAddress(@"t7cinternal.dll", @"HotloadScriptDelta"), delta, delta.Length, (hot == hotmode.csc) ? 1 : 0, error_data))
+                {
+                    Console.WriteLine($"HOTLOAD: Delta rejected ({BitConverter.ToInt32(error_data, 0)}), sending the whole script");
+                    return false;
+                }
+            }
+            catch (Exception e)
+            {
+                Console.WriteLine(e.ToString());
+                return false;
+            }
+
+            NoExcept(() => next.Save(HotloadImagePath));
+            Console.WriteLine($"Successfully hotloaded script! ({numChanged} changed functions, {delta.Length} bytes)");
+            return true;
+        }
+
         private T8InjectCache InjectCache;
 
         private int InjectT8(string replacePath, byte[] buffer)
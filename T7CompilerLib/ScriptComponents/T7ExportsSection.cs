@@ -89,6 +89,20 @@ namespace T7CompilerLib.ScriptComponents
             goto start;
         }
 
+        /// <summary>
+        /// Keys ((namespace << 32) | function id) of every export a thread can be left suspended in
+        /// </summary>
+        public HashSet<ulong> CollectSuspendingFunctions()
+        {
+            HashSet<ulong> keys = new HashSet<ulong>();
+            foreach (var export in ScriptExports.Values)
+            {
+                if (export.CanSuspend())
+                    keys.Add(((ulong)export.Namespace << 32) | export.FunctionID);
+            }
+            return keys;
+        }
+
         /// <summary>
         /// Serialization was overriden in this class because it makes no sense to serialize the bytecode section when not commiting
         /// </summary>
@@ -502,6 +516,32 @@ namespace T7CompilerLib.ScriptComponents
             //set FirstOpCode
         }
 
+        /// <summary>
+        /// True when a thread can be left suspended inside this function, at a wait of its own or in a script call that hasnt returned yet
+        /// </summary>
+        public bool CanSuspend()
+        {
+            foreach (var op in GetOpcodes())
+            {
+                switch (op.GetOpCode())
+                {
+                    case ScriptOpCode.Wait:
+                    case ScriptOpCode.RealWait:
+                    case ScriptOpCode.WaitRealTime:
+                    case ScriptOpCode.WaitTill:
+                    case ScriptOpCode.WaitTillMatch:
+                    case ScriptOpCode.WaitTillFrameEnd:
+                    case ScriptOpCode.ScriptFunctionCall:
+                    case ScriptOpCode.ScriptFunctionCallPointer:
+                    case ScriptOpCode.ScriptMethodCall:
+                    case ScriptOpCode.ScriptMethodCallPointer:
+                    case ScriptOpCode.ClassFunctionCall:
+                        return true;
+                }
+            }
+            return false;
+        }
+
         public T7OpCode[] GetOpcodes()
         {
             T7OpCode currOp = Locals;
@@ -101,6 +101,22 @@ namespace T7CompilerLib.ScriptComponents
             return data;
         }
 
+        /// <summary>
+        /// Script offsets of the function hash of every import naming one of the given functions, in serialized order
+        /// </summary>
+        public IEnumerable<uint> GetFunctionOffsets(HashSet<uint> functions)
+        {
+            uint offset = GetBaseAddress();
+            foreach (ulong key in Imports.Keys)
+            {
+                var import = Imports[key];
+                if (functions.Contains(import.Function))
+                    yield return offset;
+
+                offset += 12 + (uint)(import.References.Count * 4);
+            }
+        }
+
         public override uint Size()
         {
             uint count = 0;
@@ -67,6 +67,22 @@ namespace T7CompilerLib.ScriptComponents
             }
         }
 
+        /// <summary>
+        /// Collects every lazy function opcode address and the emission location of the script name it points at
+        /// </summary>
+        public Dictionary<uint, uint> CollectLazyFunctions()
+        {
+            Dictionary<uint, uint> sites = new Dictionary<uint, uint>();
+            foreach (var entry in TableEntries.Values)
+            {
+                foreach (var lazy in entry.LazyReferences)
+                {
+                    sites[lazy.CommitAddress] = entry.EmissionLocation;
+                }
+            }
+            return sites;
+        }
+
         public override uint Size()
         {
             uint count = 0;
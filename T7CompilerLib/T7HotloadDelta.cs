@@ -0,0 +1,499 @@
+﻿using System;
+using System.Collections.Generic;
+using System.IO;
+using System.Linq;
+using System.Text;
+
+namespace T7CompilerLib
+{
+    /// <summary>
+    /// The last script handed to the runtime hotload cache, kept between builds so the next one can send only the functions that changed
+    /// </summary>
+    public sealed class T7HotloadImage
+    {
+        private const uint ImageMagic = 0x494C4448; // HDLI
+        private const int ImageVersion = 1;
+
+        /// <summary>
+        /// What the runtime reports as linked, a delta is only accepted against this
+        /// </summary>
+        public ulong Hash;
+
+        /// <summary>
+        /// The unwrapped script exactly as sent, before the runtime linked it
+        /// </summary>
+        public byte[] Script;
+
+        /// <summary>
+        /// Lazy function opcode addresses in <see cref="Script"/> and the script name string each one points at
+        /// </summary>
+        public Dictionary<uint, uint> LazyFunctions = new Dictionary<uint, uint>();
+
+        /// <summary>
+        /// Functions in <see cref="Script"/> a thread can be suspended in, keyed like the delta keys them
+        /// </summary>
+        public HashSet<ulong> SuspendingFunctions = new HashSet<ulong>();
+
+        /// <summary>
+        /// Strings of the object the runtime actually linked, which is still the last full hotload after any number of deltas
+        /// </summary>
+        public Dictionary<string, uint> LiveStrings = new Dictionary<string, uint>();
+
+        /// <summary>
+        /// Everything the injector registered alongside the script (detours), a delta cant change any of it
+        /// </summary>
+        public string Environment = string.Empty;
+
+        /// <summary>
+        /// Runtime fallbacks applied to <see cref="Script"/> before it was sent, later scripts need the same ones to compare equal
+        /// </summary>
+        public bool Undirected;
+
+        /// <summary>
+        /// Same hash the runtime computes over the buffer it is handed
+        /// </summary>
+        public static ulong ComputeHash(byte[] data)
+        {
+            unchecked
+            {
+                ulong hash = 0xCBF29CE484222325 ^ (ulong)data.Length;
+                int i = 0;
+                for (; i + 8 <= data.Length; i += 8)
+                {
+                    hash ^= BitConverter.ToUInt64(data, i);
+                    hash *= 0x100000001B3;
+                    hash ^= hash >> 29;
+                }
+                for (; i < data.Length; i++)
+                {
+                    hash ^= data[i];
+                    hash *= 0x100000001B3;
+                }
+                return hash;
+            }
+        }
+
+        /// <summary>
+        /// Image of a script the runtime is about to link in full
+        /// </summary>
+        public static T7HotloadImage FromFullHotload(byte[] script, Dictionary<uint, uint> lazyFunctions, HashSet<ulong> suspendingFunctions, string environment, bool undirected)
+        {
+            T7HotloadImage image = new T7HotloadImage()
+            {
+                Hash = ComputeHash(script),
+                Script = script.ToArray(),
+                LazyFunctions = new Dictionary<uint, uint>(lazyFunctions ?? new Dictionary<uint, uint>()),
+                SuspendingFunctions = new HashSet<ulong>(suspendingFunctions ?? new HashSet<ulong>()),
+                Environment = environment ?? string.Empty,
+                Undirected = undirected
+            };
+
+            int at = BitConverter.ToInt32(script, 0x18);
+            for (int i = BitConverter.ToUInt16(script, 0x38); i > 0; i--)
+            {
+                int text = BitConverter.ToInt32(script, at);
+                image.LiveStrings[ReadString(script, text)] = (uint)text;
+                at += 8 + script[at + 4] * 4;
+            }
+
+            // lazy only strings never make it into the fixup table
+            foreach (uint text in image.LazyFunctions.Values)
+            {
+                image.LiveStrings[ReadString(script, (int)text)] = text;
+            }
+            return image;
+        }
+
+        public void Save(string path)
+        {
+            using (BinaryWriter writer = new BinaryWriter(File.Create(path)))
+            {
+                writer.Write(ImageMagic);
+                writer.Write(ImageVersion);
+                writer.Write(Hash);
+                writer.Write(Script.Length);
+                writer.Write(Script);
+                writer.Write(LazyFunctions.Count);
+                foreach (var lazy in LazyFunctions)
+                {
+                    writer.Write(lazy.Key);
+                    writer.Write(lazy.Value);
+                }
+                writer.Write(SuspendingFunctions.Count);
+                foreach (ulong key in SuspendingFunctions)
+                {
+                    writer.Write(key);
+                }
+                writer.Write(LiveStrings.Count);
+                foreach (var text in LiveStrings)
+                {
+                    writer.Write(text.Key);
+                    writer.Write(text.Value);
+                }
+                writer.Write(Environment);
+                writer.Write(Undirected);
+            }
+        }
+
+        /// <summary>
+        /// Loads a saved image, or null if there isnt a usable one
+        /// </summary>
+        public static T7HotloadImage Load(string path)
+        {
+            try
+            {
+                using (BinaryReader reader = new BinaryReader(File.OpenRead(path)))
+                {
+                    if (reader.ReadUInt32() != ImageMagic || reader.ReadInt32() != ImageVersion)
+                    {
+                        return null;
+                    }
+
+                    T7HotloadImage image = new T7HotloadImage();
+                    image.Hash = reader.ReadUInt64();
+                    image.Script = reader.ReadBytes(reader.ReadInt32());
+                    for (int i = reader.ReadInt32(); i > 0; i--)
+                    {
+                        image.LazyFunctions[reader.ReadUInt32()] = reader.ReadUInt32();
+                    }
+                    for (int i = reader.ReadInt32(); i > 0; i--)
+                    {
+                        image.SuspendingFunctions.Add(reader.ReadUInt64());
+                    }
+                    for (int i = reader.ReadInt32(); i > 0; i--)
+                    {
+                        image.LiveStrings[reader.ReadString()] = reader.ReadUInt32();
+                    }
+                    image.Environment = reader.ReadString();
+                    image.Undirected = reader.ReadBoolean();
+                    return image;
+                }
+            }
+            catch
+            {
+                return null;
+            }
+        }
+
+        internal static string ReadString(byte[] data, int offset)
+        {
+            int end = offset;
+            while (data[end] != 0)
+            {
+                end++;
+            }
+            return Encoding.ASCII.GetString(data, offset, end - offset);
+        }
+    }
+
+    /// <summary>
+    /// Builds the function level patch the runtime applies with HotloadScriptDelta
+    /// </summary>
+    public static class T7HotloadDelta
+    {
+        private const uint DeltaMagic = 0x544C4448; // HDLT
+        private const ushort DeltaVersion = 1;
+        private const byte ImportCall = 0x6; // IsFunction | IsMethod
+        private const byte HintSuspends = 0x1; // HOTLOAD_DELTA_SUSPENDS
+
+        private sealed class ScriptFunction
+        {
+            public uint Namespace;
+            public uint Name;
+            public byte Params;
+            public byte Flags;
+            public int Start;
+            public int End;
+            public List<(int Offset, string Text)> Strings = new List<(int, string)>();
+            public List<(int Offset, uint Function, uint Namespace, byte Params, byte Flags)> Imports = new List<(int, uint, uint, byte, byte)>();
+            public List<(int Offset, string Script)> Lazy = new List<(int, string)>();
+            public byte[] Body;
+
+            public ulong Key => ((ulong)Namespace << 32) | Name;
+
+            /// <summary>
+            /// The body with everything the runtime writes while linking cleared, so moving strings or imports around isnt a change
+            /// </summary>
+            public byte[] Masked()
+            {
+                byte[] masked = Body.ToArray();
+                foreach (var text in Strings)
+                {
+                    Array.Clear(masked, text.Offset, 4);
+                }
+                foreach (var import in Imports)
+                {
+                    Array.Clear(masked, import.Offset, 2);
+                    Array.Clear(masked, ImportOperand(Start + import.Offset, import.Flags) - Start, 8);
+                }
+                foreach (var lazy in Lazy)
+                {
+                    Array.Clear(masked, LazyOperand(Start + lazy.Offset) - Start, 4);
+                }
+                return masked;
+            }
+
+            public bool SameAs(ScriptFunction other)
+            {
+                return Params == other.Params && Flags == other.Flags
+                    && Strings.SequenceEqual(other.Strings) && Imports.SequenceEqual(other.Imports) && Lazy.SequenceEqual(other.Lazy)
+                    && Masked().SequenceEqual(other.Masked());
+            }
+        }
+
+        /// <summary>
+        /// Creates the delta bringing the object <paramref name="live"/> describes up to <paramref name="next"/>.
+        /// Returns null when the change cant be expressed as patched functions (added or removed functions, includes, detours) and the whole script has to be sent.
+        /// On success <paramref name="next"/> is updated to describe what the runtime will be running.
+        /// </summary>
+        public static byte[] Create(T7HotloadImage live, T7HotloadImage next, out int numChanged)
+        {
+            numChanged = 0;
+            if (live?.Script == null || next?.Script == null || live.Environment != next.Environment)
+            {
+                return null;
+            }
+
+            var liveFunctions = ReadFunctions(live);
+            var nextFunctions = ReadFunctions(next);
+            if (liveFunctions == null || nextFunctions == null || liveFunctions.Count != nextFunctions.Count || !ReadIncludes(live.Script).SequenceEqual(ReadIncludes(next.Script)))
+            {
+                return null;
+            }
+
+            List<ScriptFunction> changed = new List<ScriptFunction>();
+            foreach (var function in nextFunctions.Values)
+            {
+                if (!liveFunctions.TryGetValue(function.Key, out ScriptFunction previous) || previous.Params != function.Params || previous.Flags != function.Flags)
+                {
+                    return null;
+                }
+                if (!previous.SameAs(function))
+                {
+                    changed.Add(function);
+                }
+            }
+
+            if (changed.Count > short.MaxValue)
+            {
+                return null;
+            }
+
+            // strings are sent as text and interned by the runtime, lazy functions have to find their script name in the object it linked
+            List<byte> strings = new List<byte>();
+            Dictionary<string, int> stringIndices = new Dictionary<string, int>();
+            int AddString(string text)
+            {
+                if (!stringIndices.TryGetValue(text, out int index))
+                {
+                    index = strings.Count;
+                    stringIndices[text] = index;
+                    strings.AddRange(Encoding.ASCII.GetBytes(text));
+                    strings.Add(0);
+                }
+                return index;
+            }
+
+            List<byte> delta = new List<byte>();
+            delta.AddRange(BitConverter.GetBytes(DeltaMagic));
+            delta.AddRange(BitConverter.GetBytes(DeltaVersion));
+            delta.AddRange(BitConverter.GetBytes((short)changed.Count));
+            delta.AddRange(BitConverter.GetBytes(live.Hash));
+            delta.AddRange(BitConverter.GetBytes(next.Hash));
+            delta.AddRange(BitConverter.GetBytes(0)); // strings size
+            delta.AddRange(BitConverter.GetBytes(0)); // pad
+
+            foreach (var function in changed)
+            {
+                if (function.Strings.Count > short.MaxValue || function.Imports.Count > short.MaxValue || function.Lazy.Count > short.MaxValue)
+                {
+                    return null;
+                }
+
+                delta.AddRange(BitConverter.GetBytes(function.Namespace));
+                delta.AddRange(BitConverter.GetBytes(function.Name));
+                delta.AddRange(BitConverter.GetBytes(function.Body.Length));
+                delta.AddRange(BitConverter.GetBytes((short)function.Strings.Count));
+                delta.AddRange(BitConverter.GetBytes((short)function.Imports.Count));
+                delta.AddRange(BitConverter.GetBytes((short)function.Lazy.Count));
+                delta.Add(function.Flags);
+
+                // what matters is the body being replaced, threads are parked in that one and never in the new one yet
+                delta.Add(live.SuspendingFunctions.Contains(function.Key) ? HintSuspends : (byte)0);
+
+                foreach (var text in function.Strings)
+                {
+                    delta.AddRange(BitConverter.GetBytes(text.Offset));
+                    delta.AddRange(BitConverter.GetBytes(AddString(text.Text)));
+                }
+                foreach (var import in function.Imports)
+                {
+                    delta.AddRange(BitConverter.GetBytes(import.Offset));
+                    delta.AddRange(BitConverter.GetBytes(import.Function));
+                    delta.AddRange(BitConverter.GetBytes(import.Namespace));
+                    delta.Add(import.Params);
+                    delta.Add(import.Flags);
+                    delta.AddRange(BitConverter.GetBytes((short)0));
+                }
+                foreach (var lazy in function.Lazy)
+                {
+                    if (!live.LiveStrings.TryGetValue(lazy.Script, out uint target))
+                    {
+                        return null;
+                    }
+                    delta.AddRange(BitConverter.GetBytes(lazy.Offset));
+                    delta.AddRange(BitConverter.GetBytes(target));
+                }
+
+                delta.AddRange(function.Body);
+                while (delta.Count % 8 != 0)
+                {
+                    delta.Add(0);
+                }
+            }
+
+            byte[] stringsSize = BitConverter.GetBytes(strings.Count);
+            for (int i = 0; i < stringsSize.Length; i++)
+            {
+                delta[0x18 + i] = stringsSize[i];
+            }
+            delta.AddRange(strings);
+
+            next.LiveStrings = live.LiveStrings;
+            numChanged = changed.Count;
+            return delta.ToArray();
+        }
+
+        private static int ImportOperand(int site, byte flags)
+        {
+            return (site + 2 + ((flags & ImportCall) != 0 ? 2 : 0)).AlignValue(0x8);
+        }
+
+        private static int LazyOperand(int site)
+        {
+            return (site + 2).AlignValue(0x4) + 0x8;
+        }
+
+        private static List<string> ReadIncludes(byte[] script)
+        {
+            List<string> includes = new List<string>();
+            int at = BitConverter.ToInt32(script, 0xC);
+            for (int i = script[0x44]; i > 0; i--, at += 4)
+            {
+                includes.Add(T7HotloadImage.ReadString(script, BitConverter.ToInt32(script, at)));
+            }
+            return includes;
+        }
+
+        /// <summary>
+        /// Splits the script into its exports, each spanning up to the nulls in front of the next one like the runtime sees them, with the fixups that land in it
+        /// </summary>
+        private static Dictionary<ulong, ScriptFunction> ReadFunctions(T7HotloadImage image)
+        {
+            byte[] script = image.Script;
+            try
+            {
+                int bytecodeEnd = BitConverter.ToInt32(script, 0x14) + BitConverter.ToInt32(script, 0x30);
+                List<ScriptFunction> functions = new List<ScriptFunction>();
+                int at = BitConverter.ToInt32(script, 0x20);
+                for (int i = BitConverter.ToUInt16(script, 0x3A); i > 0; i--, at += 20)
+                {
+                    functions.Add(new ScriptFunction()
+                    {
+                        Start = BitConverter.ToInt32(script, at + 4),
+                        Name = BitConverter.ToUInt32(script, at + 8),
+                        Namespace = BitConverter.ToUInt32(script, at + 12),
+                        Params = script[at + 16],
+                        Flags = script[at + 17]
+                    });
+                }
+
+                functions.Sort((a, b) => a.Start.CompareTo(b.Start));
+                for (int i = 0; i < functions.Count; i++)
+                {
+                    functions[i].End = (i + 1 < functions.Count) ? functions[i + 1].Start - 8 : bytecodeEnd;
+                    if (functions[i].Start <= 0 || functions[i].End <= functions[i].Start || functions[i].End > script.Length)
+                    {
+                        return null;
+                    }
+                    functions[i].Body = script.Skip(functions[i].Start).Take(functions[i].End - functions[i].Start).ToArray();
+                }
+
+                int[] starts = functions.Select(f => f.Start).ToArray();
+                ScriptFunction Owner(int site, int size)
+                {
+                    int index = Array.BinarySearch(starts, site);
+                    index = (index < 0) ? ~index - 1 : index;
+                    return (index >= 0 && site + size <= functions[index].End) ? functions[index] : null;
+                }
+
+                at = BitConverter.ToInt32(script, 0x18);
+                for (int i = BitConverter.ToUInt16(script, 0x38); i > 0; i--)
+                {
+                    string text = T7HotloadImage.ReadString(script, BitConverter.ToInt32(script, at));
+                    int numSites = script[at + 4];
+                    at += 8;
+                    for (; numSites > 0; numSites--, at += 4)
+                    {
+                        int site = BitConverter.ToInt32(script, at);
+                        Owner(site, 4)?.Strings.Add((site, text));
+                    }
+                }
+
+                at = BitConverter.ToInt32(script, 0x24);
+                for (int i = BitConverter.ToUInt16(script, 0x3C); i > 0; i--)
+                {
+                    uint function = BitConverter.ToUInt32(script, at);
+                    uint ns = BitConverter.ToUInt32(script, at + 4);
+                    int numSites = BitConverter.ToUInt16(script, at + 8);
+                    byte numParams = script[at + 10];
+                    byte flags = script[at + 11];
+                    at += 12;
+                    for (; numSites > 0; numSites--, at += 4)
+                    {
+                        int site = BitConverter.ToInt32(script, at);
+                        ScriptFunction owner = Owner(site, 2);
+                        if (owner == null || ImportOperand(site, flags) + 8 > owner.End)
+                        {
+                            return null;
+                        }
+                        owner.Imports.Add((site, function, ns, numParams, flags));
+                    }
+                }
+
+                foreach (var lazy in image.LazyFunctions)
+                {
+                    ScriptFunction owner = Owner((int)lazy.Key, 2);
+                    if (owner == null || LazyOperand((int)lazy.Key) + 4 > owner.End)
+                    {
+                        return null;
+                    }
+                    owner.Lazy.Add(((int)lazy.Key, T7HotloadImage.ReadString(script, (int)lazy.Value)));
+                }
+
+                Dictionary<ulong, ScriptFunction> result = new Dictionary<ulong, ScriptFunction>();
+                foreach (var function in functions)
+                {
+                    // offsets relative to the body from here on, which is what the runtime and the comparison want
+                    function.Strings = function.Strings.Select(s => (s.Offset - function.Start, s.Text)).OrderBy(s => s.Item1).ToList();
+                    function.Imports = function.Imports.Select(s => (s.Offset - function.Start, s.Function, s.Namespace, s.Params, s.Flags)).OrderBy(s => s.Item1).ToList();
+                    function.Lazy = function.Lazy.Select(s => (s.Offset - function.Start, s.Script)).OrderBy(s => s.Item1).ToList();
+                    if (result.ContainsKey(function.Key))
+                    {
+                        return null;
+                    }
+                    result[function.Key] = function;
+                }
+                return result;
+            }
+            catch (ArgumentException)
+            {
+                return null;
+            }
+            catch (IndexOutOfRangeException)
+            {
+                return null;
+            }
+        }
+    }
+}
@@ -20,8 +20,18 @@ namespace T7CompilerLib
         private const bool AllowPeekWrites = false;
         public readonly bool LittleEndian;
         public bool UseMasking = false;
+        public bool UseDirectBuiltins = false;
         public uint BuiltinExport => ScriptHash("isprofilebuild");
         public uint BuiltinNamespace => ScriptHash("compiler");
+        public HashSet<uint> DirectBuiltinImports = new HashSet<uint>();
+
+        /// <summary>
+        /// Canon id the runtime registers a dedicated builtin def under for compiler::name(), so the call skips the isprofilebuild multiplexer
+        /// </summary>
+        public uint DirectBuiltinId(uint hash)
+        {
+            return unchecked((hash ^ 0x3C6EF372u) * 0x1000193u);
+        }
 
         public byte[] RawData;
         internal Dictionary<uint, string> HashMap = new Dictionary<uint, string>();
@@ -198,6 +208,7 @@ namespace T7CompilerLib
             Header.Commit(ref DataBuffer, ref __header__);
             Header.CommitHeader(ref DataBuffer, ScriptMetadata.Magic);
             Strings.FixupLazyFunctions(DataBuffer);
+            UsingGSI |= DirectBuiltinImports.Count > 0;
             if (UsingGSI && !Header.IsStub)
             {
                 EmitGSIHeader(ref DataBuffer);
@@ -387,6 +398,49 @@ namespace T7CompilerLib
                 return toReturn.ToArray();
             }
 
+            private const uint ManifestMagic = 0x54445347; // GSDT
+            private const ushort ManifestVersion = 1;
+            private const ushort ManifestRecordSize = 5 * 4;
+
+            /// <summary>
+            /// Packs detours into the compact manifest format: a header, a deduplicated string table of replace script names, then fixed 20 byte records.
+            /// </summary>
+            public static byte[] PackManifest(IEnumerable<ScriptDetour> detours)
+            {
+                List<byte> strings = new List<byte>();
+                List<byte> records = new List<byte>();
+                Dictionary<string, int> stringOffsets = new Dictionary<string, int>();
+                int count = 0;
+                foreach(ScriptDetour detour in detours)
+                {
+                    int nameOffset = -1;
+                    if(detour.ReplaceScript != null && !stringOffsets.TryGetValue(detour.ReplaceScript, out nameOffset))
+                    {
+                        nameOffset = strings.Count;
+                        stringOffsets[detour.ReplaceScript] = nameOffset;
+                        strings.AddRange(Encoding.ASCII.GetBytes(detour.ReplaceScript));
+                        strings.Add(0);
+                    }
+
+                    records.AddRange(BitConverter.GetBytes(detour.ReplaceNamespace));
+                    records.AddRange(BitConverter.GetBytes(detour.ReplaceFunction));
+                    records.AddRange(BitConverter.GetBytes(detour.FixupOffset));
+                    records.AddRange(BitConverter.GetBytes(detour.FixupSize));
+                    records.AddRange(BitConverter.GetBytes(nameOffset));
+                    count++;
+                }
+
+                List<byte> toReturn = new List<byte>();
+                toReturn.AddRange(BitConverter.GetBytes(ManifestMagic));
+                toReturn.AddRange(BitConverter.GetBytes(ManifestVersion));
+                toReturn.AddRange(BitConverter.GetBytes(ManifestRecordSize));
+                toReturn.AddRange(BitConverter.GetBytes(count));
+                toReturn.AddRange(BitConverter.GetBytes(strings.Count));
+                toReturn.AddRange(strings);
+                toReturn.AddRange(records);
+                return toReturn.ToArray();
+            }
+
             public void Deserialize(BinaryReader reader)
             {
                 FixupName = reader.ReadUInt32();
@@ -405,7 +459,9 @@ namespace T7CompilerLib
 
         public enum GSIFields
         { 
-            Detours = 0
+            Detours = 0,
+            DetourManifest = 1,
+            DirectBuiltins = 2
         }
 
         private void EmitGSIHeader(ref byte[] data)
@@ -434,6 +490,27 @@ namespace T7CompilerLib
                     // each detour should be exactly 256 bytes
                     NewHeader.AddRange(detour.Serialize());
                 }
+
+                // compact form of the same detours, prefixed with its size so readers can skip it
+                numFields++;
+                byte[] manifest = ScriptDetour.PackManifest(Detours.Values);
+                NewHeader.AddRange(BitConverter.GetBytes((int)GSIFields.DetourManifest));
+                NewHeader.AddRange(BitConverter.GetBytes(manifest.Length));
+                NewHeader.AddRange(manifest);
+            }
+
+            // import entries naming a dedicated builtin, so the injector can point them back at isprofilebuild
+            if(DirectBuiltinImports.Count > 0)
+            {
+                numFields++;
+                var offsets = Imports.GetFunctionOffsets(DirectBuiltinImports).ToList();
+                NewHeader.AddRange(BitConverter.GetBytes((int)GSIFields.DirectBuiltins));
+                NewHeader.AddRange(BitConverter.GetBytes(offsets.Count));
+                NewHeader.AddRange(BitConverter.GetBytes(BuiltinExport));
+                foreach(uint offset in offsets)
+                {
+                    NewHeader.AddRange(BitConverter.GetBytes(offset));
+                }
             }
 
             // copy the header
@@ -8,12 +8,12 @@ namespace TreyarchCompiler
     //NOTE: this class system will no longer work as of bo3, because each platform has unique opcodes.
     public class Compiler
     {
-        public static CompiledCode Compile(Platforms platform, Enums.Games game, Modes mode, bool uset8masking, string code, string path = "")
+        public static CompiledCode Compile(Platforms platform, Enums.Games game, Modes mode, bool uset8masking, string code, string path = "", bool usedirectbuiltins = false)
         {
             switch(platform)
             {
                 case Platforms.PC:
-                    return CompilePC(game, mode, code, path, uset8masking)?.Compile();
+                    return CompilePC(game, mode, code, path, uset8masking, usedirectbuiltins)?.Compile();
 
                 case Platforms.Xbox:
                 case Platforms.PS3:
@@ -27,12 +27,12 @@ namespace TreyarchCompiler
             return null;
         }
 
-        private static ICompiler CompilePC(Enums.Games game, Modes mode, string code, string path, bool uset8masking)
+        private static ICompiler CompilePC(Enums.Games game, Modes mode, string code, string path, bool uset8masking, bool usedirectbuiltins)
         {
             switch(game)
             {
                 case Enums.Games.T7:
-                    return new GSCCompiler(mode, code, path, Platforms.PC, game, false);
+                    return new GSCCompiler(mode, code, path, Platforms.PC, game, false, usedirectbuiltins);
                 case Enums.Games.T8:
                     return new T89Compiler(game, code);
             }
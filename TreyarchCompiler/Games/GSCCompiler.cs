@@ -48,7 +48,7 @@ namespace TreyarchCompiler.Games
         private Dictionary<string, string> Func_StatProtectMap = new Dictionary<string, string>();
         private HashSet<string> CustomInjects = new HashSet<string>();
 
-        public GSCCompiler(Modes mode, string code, string path, Platforms platform, Enums.Games game, bool uset8masking)
+        public GSCCompiler(Modes mode, string code, string path, Platforms platform, Enums.Games game, bool uset8masking, bool usedirectbuiltins = false)
         {
             Game = game;
             Platform = platform;
@@ -62,6 +62,7 @@ namespace TreyarchCompiler.Games
 
             Script = NewScript;
             Script.UseMasking = uset8masking;
+            Script.UseDirectBuiltins = usedirectbuiltins;
 
             if (game == Enums.Games.T7)
             {
@@ -120,6 +121,8 @@ namespace TreyarchCompiler.Games
                 data.HashMap = Script.GetHashMap();
                 data.RequiresGSI = (Game == Enums.Games.T7) ? T7().UsingGSI : false;
                 data.OpcodeEmissions = T7().Header.OpcodeEmissions;
+                data.LazyFunctions = T7().Strings.CollectLazyFunctions();
+                data.SuspendingFunctions = T7().Exports.CollectSuspendingFunctions();
                 
                 if(StubbedScript != null)
                 {
@@ -995,8 +998,18 @@ namespace TreyarchCompiler.Games
             {
                 (CurrentFunction as T7ScriptExport).AddGetNumber((int)fhash);
                 t7_ns = ScriptNamespace;
-                fhash = Script.BuiltinExport;
                 paramCount++;
+
+                // the runtime can give each builtin its own def, the hash stays as the first parameter either way
+                if (Script.UseDirectBuiltins && !HasContext(Context, ScriptContext.HasCaller) && !HasContext(Context, ScriptContext.IsPointer))
+                {
+                    fhash = Script.DirectBuiltinId(fhash);
+                    Script.DirectBuiltinImports.Add(fhash);
+                }
+                else
+                {
+                    fhash = Script.BuiltinExport;
+                }
             }
 
             if (HasContext(Context, ScriptContext.HasCaller))
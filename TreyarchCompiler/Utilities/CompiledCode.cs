@@ -16,6 +16,8 @@ namespace TreyarchCompiler.Utilities
         public Dictionary<uint, string> HashMap;
         public List<uint> OpcodeEmissions;
         public string StubbedScript;
+        public Dictionary<uint, uint> LazyFunctions;
+        public HashSet<ulong> SuspendingFunctions;
 
         internal CompiledCode()
         {
@@ -28,6 +30,8 @@ namespace TreyarchCompiler.Utilities
             OpcodeEmissions = new List<uint>();
             StubbedScript = null;
             StubScriptData = null;
+            LazyFunctions = null;
+            SuspendingFunctions = null;
         }
     }
 }
\ No newline at end of file
@@ -0,0 +1,433 @@
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#endif
+#include "asynclog.h"
+#include <cstdio>
+#include <string>
+#include <chrono>
+
+#ifdef _WIN32
+#define LOG_NEWLINE "\r\n"
+#else
+#define LOG_NEWLINE "\n"
+#endif
+
+// lines are batched into one sink write, flushed when this fills or the ring runs dry
+#define LOG_BATCH_SIZE 0x2000
+
+MpscRing<LogRecord, LOG_RING_SIZE> AsyncLog::Ring;
+LogSink* AsyncLog::Sink = nullptr;
+std::atomic<uint64_t> AsyncLog::Dropped(0);
+std::atomic<LogSink*> AsyncLog::PendingSink(nullptr);
+std::atomic<bool> AsyncLog::Started(false);
+std::atomic<bool> AsyncLog::Running(false);
+std::atomic<bool> AsyncLog::Draining(false);
+
+class FileLogSink : public LogSink
+{
+public:
+	FileLogSink(const char* path)
+	{
+		File = fopen(path, "ab");
+	}
+
+	~FileLogSink()
+	{
+		if (File)
+		{
+			fclose(File);
+		}
+	}
+
+	void Write(const char* text, size_t length) override
+	{
+		if (File)
+		{
+			fwrite(text, 1, length, File);
+		}
+	}
+
+	void Flush() override
+	{
+		if (File)
+		{
+			fflush(File);
+		}
+	}
+
+private:
+	FILE* File;
+};
+
+#ifdef _WIN32
+// reconnects on the next batch if the reader went away
+class PipeLogSink : public LogSink
+{
+public:
+	PipeLogSink(const char* name) : Name(name), Pipe(INVALID_HANDLE_VALUE) {}
+
+	~PipeLogSink()
+	{
+		if (Pipe != INVALID_HANDLE_VALUE)
+		{
+			CloseHandle(Pipe);
+		}
+	}
+
+	void Write(const char* text, size_t length) override
+	{
+		if (Pipe == INVALID_HANDLE_VALUE)
+		{
+			Pipe = CreateFile(Name.c_str(), GENERIC_WRITE, 0, NULL, OPEN_EXISTING, 0, NULL);
+			if (Pipe == INVALID_HANDLE_VALUE)
+			{
+				return;
+			}
+		}
+
+		DWORD written;
+		if (!WriteFile(Pipe, text, (DWORD)length, &written, NULL))
+		{
+			CloseHandle(Pipe);
+			Pipe = INVALID_HANDLE_VALUE;
+		}
+	}
+
+private:
+	std::string Name;
+	HANDLE Pipe;
+};
+
+// the original nlog target, an open untitled notepad window
+class NotepadLogSink : public LogSink
+{
+public:
+	void Write(const char* text, size_t length) override
+	{
+		HWND notepad = FindWindow(NULL, "Untitled - Notepad");
+		if (!notepad)
+		{
+			notepad = FindWindow(NULL, "*Untitled - Notepad");
+		}
+		if (!notepad)
+		{
+			return;
+		}
+		HWND edit = FindWindowEx(notepad, NULL, "EDIT", NULL);
+		std::string line(text, length);
+		SendMessage(edit, EM_REPLACESEL, TRUE, (LPARAM)line.c_str());
+	}
+};
+
+// built into both the t7 and t8 runtime, so it cant lean on either framework.h
+extern "C" __declspec(dllexport) bool SetLogSink(INT32 type, const char* target)
+{
+	auto sink = AsyncLog::CreateSink(type, target);
+	if (!sink)
+	{
+		return false;
+	}
+	AsyncLog::SetSink(sink);
+	return true;
+}
+#endif
+
+LogSink* AsyncLog::CreateSink(int type, const char* target)
+{
+	switch (type)
+	{
+#ifdef _WIN32
+	case LOG_SINK_NOTEPAD:
+		return new NotepadLogSink();
+	case LOG_SINK_PIPE:
+		return target ? new PipeLogSink(target) : nullptr;
+#endif
+	case LOG_SINK_FILE:
+		return target ? new FileLogSink(target) : nullptr;
+	}
+	return nullptr;
+}
+
+void AsyncLog::EncodeArg(LogRecord& record, const char* value)
+{
+	if (record.NumArgs >= LOG_MAX_ARGS)
+	{
+		return;
+	}
+
+	// copied now, script strings can be freed before the drain thread gets to them
+	uint16_t offset = record.TextSize;
+	if (value && offset < sizeof(record.Text))
+	{
+		size_t length = strnlen(value, sizeof(record.Text) - offset - 1);
+		memcpy(record.Text + offset, value, length);
+		record.Text[offset + length] = 0;
+		record.TextSize += (uint16_t)(length + 1);
+	}
+	record.TextOffsets[record.NumArgs] = value ? offset : 0xFFFF;
+	Push(record, LOG_ARG_STRING, (uint64_t)(uintptr_t)value);
+}
+
+static bool IsSignedConversion(char c)
+{
+	return c == 'd' || c == 'i';
+}
+
+static bool IsUnsignedConversion(char c)
+{
+	return c == 'u' || c == 'x' || c == 'X' || c == 'o';
+}
+
+static bool IsFloatConversion(char c)
+{
+	return c == 'f' || c == 'F' || c == 'e' || c == 'E' || c == 'g' || c == 'G' || c == 'a' || c == 'A';
+}
+
+size_t AsyncLog::Format(const LogRecord& record, char* out, size_t size)
+{
+	if (!size)
+	{
+		return 0;
+	}
+
+	size_t length = 0;
+	uint8_t arg = 0;
+	auto append = [&](const char* text, size_t count)
+	{
+		count = (count < size - 1 - length) ? count : (size - 1 - length);
+		memcpy(out + length, text, count);
+		length += count;
+	};
+
+	for (const char* c = record.Format; *c && length < size - 1;)
+	{
+		if (*c != '%')
+		{
+			const char* next = strchr(c, '%');
+			size_t count = next ? (size_t)(next - c) : strlen(c);
+			append(c, count);
+			c += count;
+			continue;
+		}
+
+		if (c[1] == '%')
+		{
+			append("%", 1);
+			c += 2;
+			continue;
+		}
+
+		// %[flags][width][.precision][length]conversion, rebuilt with our own length modifier
+		const char* start = c++;
+		char spec[32];
+		size_t specLength = 0;
+		spec[specLength++] = '%';
+		while (*c && strchr("-+ #0123456789.", *c) && specLength < sizeof(spec) - 4)
+		{
+			spec[specLength++] = *c++;
+		}
+		while (*c && strchr("hljztLI", *c))
+		{
+			c += (*c == 'I' && c[1] == '6' && c[2] == '4') ? 3 : ((*c == 'I' && c[1] == '3' && c[2] == '2') ? 3 : 1);
+		}
+
+		char conversion = *c;
+		bool known = conversion && (IsSignedConversion(conversion) || IsUnsignedConversion(conversion) || IsFloatConversion(conversion) || conversion == 'c' || conversion == 's' || conversion == 'p');
+		if (!known || arg >= record.NumArgs)
+		{
+			// left as written, like a bad format or a missing argument would have been
+			if (conversion)
+			{
+				c++;
+			}
+			append(start, c - start);
+			continue;
+		}
+		c++;
+
+		uint8_t type = record.Types[arg];
+		uint64_t value = record.Args[arg];
+		bool narrow = (type == LOG_ARG_INT || type == LOG_ARG_UINT);
+		char piece[512];
+		int written = 0;
+		if (IsSignedConversion(conversion) || IsUnsignedConversion(conversion))
+		{
+			spec[specLength++] = 'l';
+			spec[specLength++] = 'l';
+			spec[specLength++] = conversion;
+			spec[specLength] = 0;
+			if (type == LOG_ARG_DOUBLE)
+			{
+				double d;
+				memcpy(&d, &value, sizeof(d));
+				value = (uint64_t)(int64_t)d;
+			}
+			if (IsSignedConversion(conversion))
+			{
+				written = snprintf(piece, sizeof(piece), spec, narrow ? (long long)(int32_t)value : (long long)value);
+			}
+			else
+			{
+				written = snprintf(piece, sizeof(piece), spec, narrow ? (unsigned long long)(uint32_t)value : (unsigned long long)value);
+			}
+		}
+		else if (IsFloatConversion(conversion))
+		{
+			spec[specLength++] = conversion;
+			spec[specLength] = 0;
+			double d;
+			if (type == LOG_ARG_DOUBLE)
+			{
+				memcpy(&d, &value, sizeof(d));
+			}
+			else
+			{
+				d = (type == LOG_ARG_INT || type == LOG_ARG_INT64) ? (double)(int64_t)value : (double)value;
+			}
+			written = snprintf(piece, sizeof(piece), spec, d);
+		}
+		else if (conversion == 'c')
+		{
+			spec[specLength++] = 'c';
+			spec[specLength] = 0;
+			written = snprintf(piece, sizeof(piece), spec, (int)value);
+		}
+		else if (conversion == 's')
+		{
+			spec[specLength++] = 's';
+			spec[specLength] = 0;
+			const char* text = "(null)";
+			if (type == LOG_ARG_STRING && record.TextOffsets[arg] != 0xFFFF)
+			{
+				text = record.Text + record.TextOffsets[arg];
+			}
+			written = snprintf(piece, sizeof(piece), spec, text);
+		}
+		else
+		{
+			spec[specLength++] = 'p';
+			spec[specLength] = 0;
+			written = snprintf(piece, sizeof(piece), spec, (void*)(uintptr_t)value);
+		}
+		arg++;
+
+		if (written > 0)
+		{
+			append(piece, ((size_t)written < sizeof(piece)) ? (size_t)written : sizeof(piece) - 1);
+		}
+	}
+
+	out[length] = 0;
+	return length;
+}
+
+void AsyncLog::SetSink(LogSink* sink)
+{
+	delete PendingSink.exchange(sink, std::memory_order_acq_rel);
+	EnsureStarted();
+}
+
+void AsyncLog::Start()
+{
+	bool expected = false;
+	if (!Started.compare_exchange_strong(expected, true, std::memory_order_acq_rel))
+	{
+		return;
+	}
+	Running.store(true, std::memory_order_release);
+	Draining.store(true, std::memory_order_release);
+
+	// detached, a joinable thread object still alive when the dll unloads would terminate the game
+	std::thread(Drain).detach();
+}
+
+void AsyncLog::Stop(bool threadsTerminated)
+{
+	if (!Started.load(std::memory_order_acquire))
+	{
+		return;
+	}
+	RequestStop();
+	if (threadsTerminated)
+	{
+		// the drain thread was killed wherever it was, at worst a batch it had already popped is lost
+		Drain();
+	}
+	while (Draining.load(std::memory_order_acquire))
+	{
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+	Started.store(false, std::memory_order_release);
+}
+
+void AsyncLog::RequestStop()
+{
+	Running.store(false, std::memory_order_release);
+}
+
+void AsyncLog::Drain()
+{
+#ifdef _WIN32
+	if (!Sink)
+	{
+		Sink = new NotepadLogSink();
+	}
+#endif
+	std::string batch;
+	batch.reserve(LOG_BATCH_SIZE);
+	char line[LOG_RECORD_SIZE * 2];
+	uint64_t reportedDrops = 0;
+	int idle = 0;
+
+	for (;;)
+	{
+		LogSink* pending = PendingSink.exchange(nullptr, std::memory_order_acq_rel);
+		if (pending)
+		{
+			delete Sink;
+			Sink = pending;
+		}
+
+		bool running = Running.load(std::memory_order_acquire);
+		while (batch.size() < LOG_BATCH_SIZE && Ring.TryPop([&](const LogRecord& record)
+		{
+			size_t length = Format(record, line, sizeof(line));
+			batch.append(line, length);
+			batch.append(LOG_NEWLINE);
+		}));
+
+		uint64_t dropped = Dropped.load(std::memory_order_relaxed);
+		if (dropped != reportedDrops)
+		{
+			snprintf(line, sizeof(line), "[log] dropped %llu lines, the ring was full" LOG_NEWLINE, (unsigned long long)(dropped - reportedDrops));
+			batch.append(line);
+			reportedDrops = dropped;
+		}
+
+		if (!batch.empty())
+		{
+			if (Sink)
+			{
+				Sink->Write(batch.data(), batch.size());
+				Sink->Flush();
+			}
+			batch.clear();
+			idle = 0;
+			continue;
+		}
+
+		// nothing left, and stop was requested before we emptied the ring
+		if (!running)
+		{
+			break;
+		}
+
+		// back off the longer the ring stays empty, producers never signal us
+		std::this_thread::sleep_for(std::chrono::milliseconds((idle < 8) ? 1 : 10));
+		idle++;
+	}
+	delete Sink;
+	Sink = nullptr;
+	Draining.store(false, std::memory_order_release);
+}
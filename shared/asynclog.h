@@ -0,0 +1,238 @@
+#pragma once
+#include <atomic>
+#include <thread>
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <type_traits>
+
+// levels below LOG_MIN_LEVEL are compiled out, their arguments are never evaluated
+#define LOG_LEVEL_TRACE 0
+#define LOG_LEVEL_DEBUG 1
+#define LOG_LEVEL_INFO 2
+#define LOG_LEVEL_WARN 3
+#define LOG_LEVEL_ERROR 4
+
+#ifndef LOG_MIN_LEVEL
+#define LOG_MIN_LEVEL LOG_LEVEL_INFO
+#endif
+
+#define LOG_AT(level, fmt, ...) do { if ((level) >= LOG_MIN_LEVEL) AsyncLog::Write((level), fmt, ##__VA_ARGS__); } while (0)
+#define LOG_TRACE(fmt, ...) LOG_AT(LOG_LEVEL_TRACE, fmt, ##__VA_ARGS__)
+#define LOG_DEBUG(fmt, ...) LOG_AT(LOG_LEVEL_DEBUG, fmt, ##__VA_ARGS__)
+#define LOG_INFO(fmt, ...) LOG_AT(LOG_LEVEL_INFO, fmt, ##__VA_ARGS__)
+#define LOG_WARN(fmt, ...) LOG_AT(LOG_LEVEL_WARN, fmt, ##__VA_ARGS__)
+#define LOG_ERROR(fmt, ...) LOG_AT(LOG_LEVEL_ERROR, fmt, ##__VA_ARGS__)
+
+#define LOG_RING_SIZE 1024 // records, power of two
+#define LOG_MAX_ARGS 8
+#define LOG_RECORD_SIZE 512
+
+#define LOG_SINK_NOTEPAD 0
+#define LOG_SINK_FILE 1
+#define LOG_SINK_PIPE 2
+
+// bounded multi producer single consumer queue. producers claim a slot with one cas and never wait on the consumer, a full ring fails the push
+template <typename T, size_t Capacity>
+class MpscRing
+{
+	static_assert((Capacity & (Capacity - 1)) == 0, "ring capacity must be a power of two");
+
+public:
+	MpscRing()
+	{
+		for (size_t i = 0; i < Capacity; i++)
+		{
+			Slots[i].Sequence.store(i, std::memory_order_relaxed);
+		}
+		EnqueuePos.store(0, std::memory_order_relaxed);
+		DequeuePos = 0;
+	}
+
+	template <typename Fill>
+	bool TryPush(Fill&& fill)
+	{
+		size_t pos = EnqueuePos.load(std::memory_order_relaxed);
+		Slot* slot;
+		for (;;)
+		{
+			slot = &Slots[pos & (Capacity - 1)];
+			intptr_t diff = (intptr_t)slot->Sequence.load(std::memory_order_acquire) - (intptr_t)pos;
+			if (!diff)
+			{
+				if (EnqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+				{
+					break;
+				}
+			}
+			else if (diff < 0)
+			{
+				return false; // full
+			}
+			else
+			{
+				pos = EnqueuePos.load(std::memory_order_relaxed);
+			}
+		}
+		fill(slot->Value);
+		slot->Sequence.store(pos + 1, std::memory_order_release);
+		return true;
+	}
+
+	// consumer thread only
+	template <typename Consume>
+	bool TryPop(Consume&& consume)
+	{
+		Slot& slot = Slots[DequeuePos & (Capacity - 1)];
+		if (slot.Sequence.load(std::memory_order_acquire) != DequeuePos + 1)
+		{
+			return false;
+		}
+		consume(slot.Value);
+		slot.Sequence.store(DequeuePos + Capacity, std::memory_order_release);
+		DequeuePos++;
+		return true;
+	}
+
+private:
+	struct Slot
+	{
+		std::atomic<size_t> Sequence;
+		T Value;
+	};
+
+	Slot Slots[Capacity];
+	alignas(64) std::atomic<size_t> EnqueuePos;
+	alignas(64) size_t DequeuePos;
+};
+
+enum LogArgType : uint8_t
+{
+	LOG_ARG_INT, // 32 bit or smaller, sign extended
+	LOG_ARG_UINT,
+	LOG_ARG_INT64,
+	LOG_ARG_UINT64,
+	LOG_ARG_DOUBLE,
+	LOG_ARG_POINTER,
+	LOG_ARG_STRING, // value is the pointer, the text is copied into the record
+};
+
+// a log line as the producer left it. the format has to outlive the record, so only string literals are accepted as formats
+struct LogRecordHeader
+{
+	const char* Format;
+	uint8_t Level;
+	uint8_t NumArgs;
+	uint8_t Types[LOG_MAX_ARGS];
+	uint16_t TextOffsets[LOG_MAX_ARGS];
+	uint16_t TextSize;
+	uint64_t Args[LOG_MAX_ARGS];
+};
+
+struct LogRecord : LogRecordHeader
+{
+	char Text[LOG_RECORD_SIZE - sizeof(LogRecordHeader)];
+};
+
+class LogSink
+{
+public:
+	virtual ~LogSink() {}
+	virtual void Write(const char* text, size_t length) = 0;
+	virtual void Flush() {}
+};
+
+class AsyncLog
+{
+public:
+	template <typename... Args>
+	static void Write(uint8_t level, const char* format, Args... args)
+	{
+		// ring is full, the drain thread reports how many lines went missing
+		if (!Ring.TryPush([&](LogRecord& record) { Encode(record, level, format, args...); }))
+		{
+			Dropped.fetch_add(1, std::memory_order_relaxed);
+		}
+		EnsureStarted();
+	}
+
+	// formats a record the same way printf would, returns the length written
+	static size_t Format(const LogRecord& record, char* out, size_t size);
+	// takes ownership of the sink, the drain thread switches over before its next batch
+	static void SetSink(LogSink* sink);
+	static LogSink* CreateSink(int type, const char* target);
+	// drains whatever is left and waits for the drain thread to exit. on process exit the thread is already gone,
+	// pass threadsTerminated and the caller drains instead
+	static void Stop(bool threadsTerminated = false);
+	// tells the drain thread to finish without waiting for it, for DllMain where waiting would be under the loader lock
+	static void RequestStop();
+
+private:
+	template <typename... Args>
+	static void Encode(LogRecord& record, uint8_t level, const char* format, Args... args)
+	{
+		record.Format = format;
+		record.Level = level;
+		record.NumArgs = 0;
+		record.TextSize = 0;
+		int expand[] = { 0, (EncodeArg(record, args), 0)... };
+		(void)expand;
+	}
+
+	template <typename T>
+	static typename std::enable_if<std::is_integral<T>::value || std::is_enum<T>::value>::type EncodeArg(LogRecord& record, T value)
+	{
+		bool isSigned = std::is_signed<T>::value || std::is_enum<T>::value;
+		LogArgType type = (sizeof(T) > 4) ? (isSigned ? LOG_ARG_INT64 : LOG_ARG_UINT64) : (isSigned ? LOG_ARG_INT : LOG_ARG_UINT);
+		Push(record, type, isSigned ? (uint64_t)(int64_t)value : (uint64_t)value);
+	}
+
+	template <typename T>
+	static typename std::enable_if<std::is_floating_point<T>::value>::type EncodeArg(LogRecord& record, T value)
+	{
+		double d = (double)value;
+		uint64_t bits;
+		memcpy(&bits, &d, sizeof(bits));
+		Push(record, LOG_ARG_DOUBLE, bits);
+	}
+
+	template <typename T>
+	static void EncodeArg(LogRecord& record, T* value)
+	{
+		Push(record, LOG_ARG_POINTER, (uint64_t)(uintptr_t)value);
+	}
+
+	static void EncodeArg(LogRecord& record, const char* value);
+	static void EncodeArg(LogRecord& record, char* value)
+	{
+		EncodeArg(record, (const char*)value);
+	}
+
+	static void Push(LogRecord& record, LogArgType type, uint64_t value)
+	{
+		if (record.NumArgs >= LOG_MAX_ARGS)
+		{
+			return;
+		}
+		record.Types[record.NumArgs] = type;
+		record.Args[record.NumArgs++] = value;
+	}
+
+	static void EnsureStarted()
+	{
+		if (!Started.load(std::memory_order_acquire))
+		{
+			Start();
+		}
+	}
+
+	static void Start();
+	static void Drain();
+	static MpscRing<LogRecord, LOG_RING_SIZE> Ring;
+	static LogSink* Sink; // drain thread only
+	static std::atomic<uint64_t> Dropped;
+	static std::atomic<LogSink*> PendingSink;
+	static std::atomic<bool> Started;
+	static std::atomic<bool> Running;
+	static std::atomic<bool> Draining;
+};
@@ -0,0 +1,78 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#ifndef _WIN32
+#include "pal.h"
+#endif
+
+typedef void(__fastcall* tScriptBuiltin)(int scriptInst);
+
+struct BuiltinDef
+{
+	uint32_t Hash;
+	tScriptBuiltin Func;
+	// script visible parameter counts, not including the builtin hash. only t7 registers direct builtins,
+	// t8 leaves them 0
+	int MinArgs;
+	int MaxArgs;
+};
+
+// 64 slots, a used slot mask fits in one qword while searching for a seed
+#define BUILTIN_DISPATCH_BITS 6
+#define BUILTIN_DISPATCH_SIZE (1 << BUILTIN_DISPATCH_BITS)
+#define BUILTIN_DISPATCH_MAX_SEEDS 0x10000
+
+// collision free multiplicative hash of the builtin names, built at compile time so a call is a single probe
+struct BuiltinDispatch
+{
+	uint32_t Seed;
+	BuiltinDef Slots[BUILTIN_DISPATCH_SIZE];
+
+	static constexpr uint32_t Slot(uint32_t hash, uint32_t seed)
+	{
+		return (hash * seed) >> (32 - BUILTIN_DISPATCH_BITS);
+	}
+
+	constexpr tScriptBuiltin Find(uint32_t hash) const
+	{
+		return (Slots[Slot(hash, Seed)].Hash == hash) ? Slots[Slot(hash, Seed)].Func : nullptr;
+	}
+};
+
+template <size_t N>
+constexpr bool IsBuiltinSeedPerfect(const BuiltinDef(&defs)[N], uint32_t seed)
+{
+	uint64_t used = 0;
+	for (size_t i = 0; i < N; i++)
+	{
+		uint64_t slot = 1ull << BuiltinDispatch::Slot(defs[i].Hash, seed);
+		if (used & slot)
+		{
+			return false;
+		}
+		used |= slot;
+	}
+	return true;
+}
+
+// leaves Seed at 0 if no seed works (usually a name registered twice), callers static_assert on it
+template <size_t N>
+constexpr BuiltinDispatch MakeBuiltinDispatch(const BuiltinDef(&defs)[N])
+{
+	static_assert(N <= BUILTIN_DISPATCH_SIZE / 2, "too many builtins for the dispatch table");
+	BuiltinDispatch dispatch{};
+	for (uint32_t seed = 0x9E3779B1, i = 0; i < BUILTIN_DISPATCH_MAX_SEEDS; seed += 2, i++)
+	{
+		if (!IsBuiltinSeedPerfect(defs, seed))
+		{
+			continue;
+		}
+		dispatch.Seed = seed;
+		for (size_t j = 0; j < N; j++)
+		{
+			dispatch.Slots[BuiltinDispatch::Slot(defs[j].Hash, seed)] = defs[j];
+		}
+		break;
+	}
+	return dispatch;
+}
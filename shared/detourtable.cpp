@@ -0,0 +1,67 @@
+#include "detourtable.h"
+
+#define DETOURTABLE_MIN_SLOTS_LOG2 4
+#define DETOURTABLE_MIN_FILTER_LOG2 12 // 4096 bits, 512 bytes
+
+DetourTable::DetourTable()
+{
+	Clear();
+}
+
+void DetourTable::Clear()
+{
+	Slots.assign(1ull << DETOURTABLE_MIN_SLOTS_LOG2, { 0, NULL });
+	Filter.assign((1ull << DETOURTABLE_MIN_FILTER_LOG2) >> 6, 0);
+	SlotMask = Slots.size() - 1;
+	SlotShift = 64 - DETOURTABLE_MIN_SLOTS_LOG2;
+	FilterShift = 64 - DETOURTABLE_MIN_FILTER_LOG2;
+	NumEntries = 0;
+}
+
+void DetourTable::Build(const std::vector<std::pair<long long, ScriptDetour*>>& entries)
+{
+	// keep the load factor at or below 50% and give the filter ~16 bits per entry
+	uint32_t slotsLog2 = DETOURTABLE_MIN_SLOTS_LOG2;
+	while ((1ull << slotsLog2) < entries.size() * 2)
+	{
+		slotsLog2++;
+	}
+
+	uint32_t filterLog2 = DETOURTABLE_MIN_FILTER_LOG2;
+	while ((1ull << filterLog2) < entries.size() * 16)
+	{
+		filterLog2++;
+	}
+
+	Slots.assign(1ull << slotsLog2, { 0, NULL });
+	Filter.assign((1ull << filterLog2) >> 6, 0);
+	SlotMask = Slots.size() - 1;
+	SlotShift = 64 - slotsLog2;
+	FilterShift = 64 - filterLog2;
+	NumEntries = 0;
+
+	for (auto it = entries.begin(); it != entries.end(); it++)
+	{
+		if (!it->first)
+		{
+			continue; // null is our empty slot marker
+		}
+
+		unsigned long long i = SlotHash(it->first) >> SlotShift;
+		while (Slots[i].Target && Slots[i].Target != it->first)
+		{
+			i = (i + 1) & SlotMask;
+		}
+
+		// later entries win, same as the map assignment this replaced
+		if (!Slots[i].Target)
+		{
+			NumEntries++;
+		}
+		Slots[i].Target = it->first;
+		Slots[i].Detour = it->second;
+
+		unsigned long long bit = FilterHash(it->first) >> FilterShift;
+		Filter[bit >> 6] |= 1ull << (bit & 63);
+	}
+}
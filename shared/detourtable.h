@@ -0,0 +1,57 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+// built into both the t7 and t8 runtime, so it cant lean on either framework.h. targets are long long to match INT64 on both
+
+struct ScriptDetour;
+
+// immutable open addressing table of linked target pointer -> detour. rebuilt whenever detours are linked.
+// a bitset over the target pointers rejects the common (non-detoured) case before we touch any slots.
+class DetourTable
+{
+public:
+	DetourTable();
+	void Build(const std::vector<std::pair<long long, ScriptDetour*>>& entries);
+	void Clear();
+	uint32_t Count() const { return NumEntries; }
+
+	inline ScriptDetour* Find(long long target) const
+	{
+		unsigned long long bit = FilterHash(target) >> FilterShift;
+		if (!(Filter[bit >> 6] & (1ull << (bit & 63))))
+		{
+			return NULL;
+		}
+		for (unsigned long long i = SlotHash(target) >> SlotShift; ; i = (i + 1) & SlotMask)
+		{
+			if (Slots[i].Target == target)
+			{
+				return Slots[i].Detour;
+			}
+			if (!Slots[i].Target)
+			{
+				return NULL;
+			}
+		}
+	}
+
+private:
+	struct Slot
+	{
+		long long Target;
+		ScriptDetour* Detour;
+	};
+
+	// fibonacci hashing, we only consume the high bits so pointer alignment doesnt matter
+	static inline unsigned long long SlotHash(long long target) { return (unsigned long long)target * 0x9E3779B97F4A7C15ull; }
+	static inline unsigned long long FilterHash(long long target) { return (unsigned long long)target * 0xC2B2AE3D27D4EB4Full; }
+
+	std::vector<Slot> Slots;
+	std::vector<unsigned long long> Filter;
+	unsigned long long SlotMask;
+	uint32_t SlotShift;
+	uint32_t FilterShift;
+	uint32_t NumEntries;
+};
@@ -0,0 +1,384 @@
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+#include "eventchannel.h"
+#include <chrono>
+#include <vector>
+
+MpscRing<ChannelEvent, EVENT_CHANNEL_QUEUE_SIZE> EventChannel::Queue;
+EventTransport* EventChannel::Transport = nullptr;
+std::mutex EventChannel::WakeLock;
+std::condition_variable EventChannel::Wake;
+std::atomic<bool> EventChannel::Started(false);
+std::atomic<bool> EventChannel::Running(false);
+std::atomic<bool> EventChannel::Stopped(true);
+std::atomic<int64_t> EventChannel::Posted(0);
+std::atomic<int64_t> EventChannel::Sent(0);
+std::atomic<int64_t> EventChannel::Dropped(0);
+std::atomic<int64_t> EventChannel::Connects(0);
+std::atomic<int64_t> EventChannel::LastLatency(0);
+std::atomic<int64_t> EventChannel::MaxLatency(0);
+std::atomic<bool> EventChannel::SplitTiming(false);
+int64_t EventChannel::RunStart = 0;
+
+#ifdef _WIN32
+class PipeTransport : public EventTransport
+{
+public:
+	PipeTransport(const char* name) : Name(name), Pipe(INVALID_HANDLE_VALUE) {}
+
+	~PipeTransport()
+	{
+		Close();
+	}
+
+	bool Connect() override
+	{
+		Pipe = CreateFile(Name.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_WRITE, NULL, OPEN_EXISTING, 0, NULL);
+		return Pipe != INVALID_HANDLE_VALUE;
+	}
+
+	bool Send(const char* data, size_t length) override
+	{
+		DWORD written;
+		return WriteFile(Pipe, data, (DWORD)length, &written, NULL) && written == length;
+	}
+
+	void Close() override
+	{
+		if (Pipe != INVALID_HANDLE_VALUE)
+		{
+			CloseHandle(Pipe);
+			Pipe = INVALID_HANDLE_VALUE;
+		}
+	}
+
+private:
+	std::string Name;
+	HANDLE Pipe;
+};
+
+// built into both the t7 and t8 runtime, so it cant lean on either framework.h
+extern "C" __declspec(dllexport) void GetEventChannelStats(EventChannelStats* stats)
+{
+	EventChannel::GetStats(stats);
+}
+#else
+class UnixSocketTransport : public EventTransport
+{
+public:
+	UnixSocketTransport(const char* path) : Path(path), Socket(-1) {}
+
+	~UnixSocketTransport()
+	{
+		Close();
+	}
+
+	bool Connect() override
+	{
+		Socket = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (Socket < 0)
+		{
+			return false;
+		}
+		sockaddr_un address = {};
+		address.sun_family = AF_UNIX;
+		strncpy(address.sun_path, Path.c_str(), sizeof(address.sun_path) - 1);
+		if (connect(Socket, (sockaddr*)&address, sizeof(address)) < 0)
+		{
+			Close();
+			return false;
+		}
+		return true;
+	}
+
+	bool Send(const char* data, size_t length) override
+	{
+		while (length)
+		{
+			ssize_t written = send(Socket, data, length, MSG_NOSIGNAL);
+			if (written <= 0)
+			{
+				return false;
+			}
+			data += written;
+			length -= written;
+		}
+		return true;
+	}
+
+	void Close() override
+	{
+		if (Socket >= 0)
+		{
+			close(Socket);
+			Socket = -1;
+		}
+	}
+
+private:
+	std::string Path;
+	int Socket;
+};
+#endif
+
+EventTransport* EventChannel::CreateDefaultTransport()
+{
+#ifdef _WIN32
+	return new PipeTransport(EVENT_CHANNEL_LIVESPLIT);
+#else
+	return new UnixSocketTransport(EVENT_CHANNEL_LIVESPLIT);
+#endif
+}
+
+int64_t EventChannel::Now()
+{
+	return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+bool EventChannel::Post(const char* text)
+{
+	if (!text)
+	{
+		return false;
+	}
+
+	// the time is taken before anything else so queueing and io never show up in it
+	int64_t timestamp = Now();
+	size_t length = strnlen(text, EVENT_CHANNEL_MAX_TEXT - 2);
+	bool queued = Queue.TryPush([&](ChannelEvent& event)
+	{
+		event.Timestamp = timestamp;
+		memcpy(event.Text, text, length);
+
+		// the reader splits on lines, the connection doesnt close between events anymore
+		if (!length || event.Text[length - 1] != '\n')
+		{
+			event.Text[length++] = '\r';
+			event.Text[length++] = '\n';
+		}
+		event.Length = (uint16_t)length;
+	});
+
+	if (!queued)
+	{
+		Dropped.fetch_add(1, std::memory_order_relaxed);
+		return false;
+	}
+	Posted.fetch_add(1, std::memory_order_relaxed);
+
+	if (!Started.load(std::memory_order_acquire))
+	{
+		Start();
+	}
+
+	// taking the lock closes the window between the thread checking the queue and going to sleep
+	{
+		std::lock_guard<std::mutex> lock(WakeLock);
+	}
+	Wake.notify_one();
+	return true;
+}
+
+void EventChannel::SetSplitTiming(bool enabled)
+{
+	SplitTiming.store(enabled, std::memory_order_relaxed);
+}
+
+void EventChannel::SetTransport(EventTransport* transport)
+{
+	if (Started.load(std::memory_order_acquire))
+	{
+		delete transport;
+		return;
+	}
+	delete Transport;
+	Transport = transport;
+}
+
+void EventChannel::Start()
+{
+	bool expected = false;
+	if (!Started.compare_exchange_strong(expected, true, std::memory_order_acq_rel))
+	{
+		return;
+	}
+	if (!Transport)
+	{
+		Transport = CreateDefaultTransport();
+	}
+	Running.store(true, std::memory_order_release);
+	Stopped.store(false, std::memory_order_release);
+	std::thread(Run).detach();
+}
+
+void EventChannel::Stop(bool threadsTerminated)
+{
+	if (!Started.load(std::memory_order_acquire))
+	{
+		return;
+	}
+	if (threadsTerminated)
+	{
+		// whatever the dead thread was holding back for a reconnect is lost, the queue still goes out. it may have died
+		// holding WakeLock, Run never takes it once Running is clear
+		Running.store(false, std::memory_order_release);
+		Transport->Close();
+		Run();
+	}
+	else
+	{
+		RequestStop();
+	}
+	while (!Stopped.load(std::memory_order_acquire))
+	{
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+	Started.store(false, std::memory_order_release);
+}
+
+void EventChannel::RequestStop()
+{
+	Running.store(false, std::memory_order_release);
+	{
+		std::lock_guard<std::mutex> lock(WakeLock);
+	}
+	Wake.notify_one();
+}
+
+static bool IsCommand(const ChannelEvent& event, const char* command)
+{
+	size_t length = strlen(command);
+	return event.Length > length && !strncmp(event.Text, command, length) && strchr(" \r\n", event.Text[length]);
+}
+
+void EventChannel::Frame(const ChannelEvent& event, std::string& out)
+{
+	if (!SplitTiming.load(std::memory_order_relaxed))
+	{
+		RunStart = 0;
+		out.append(event.Text, event.Length);
+		return;
+	}
+
+	bool start = IsCommand(event, "starttimer") || (!RunStart && IsCommand(event, "startorsplit"));
+	if (IsCommand(event, "reset"))
+	{
+		RunStart = 0;
+	}
+	else if (!start && RunStart && (IsCommand(event, "split") || IsCommand(event, "startorsplit")))
+	{
+		char timing[EVENT_CHANNEL_MAX_TIMING];
+		int64_t elapsed = event.Timestamp - RunStart;
+		out.append(timing, snprintf(timing, sizeof(timing), "setgametime %lld.%06lld\r\n", (long long)(elapsed / 1000000), (long long)(elapsed % 1000000)));
+	}
+
+	out.append(event.Text, event.Length);
+	if (start)
+	{
+		RunStart = event.Timestamp;
+		out.append("initgametime\r\nsetgametime 0\r\n");
+	}
+}
+
+void EventChannel::Run()
+{
+	std::string pending;
+	std::vector<int64_t> timestamps;
+	bool connected = false;
+	int backoff = 0;
+
+	for (;;)
+	{
+		bool running = Running.load(std::memory_order_acquire);
+		while (Queue.TryPop([&](const ChannelEvent& event)
+		{
+			if (pending.size() + event.Length + EVENT_CHANNEL_MAX_TIMING > EVENT_CHANNEL_MAX_PENDING)
+			{
+				Dropped.fetch_add(1, std::memory_order_relaxed);
+				return;
+			}
+			Frame(event, pending);
+			timestamps.push_back(event.Timestamp);
+		}));
+
+		if (!pending.empty())
+		{
+			if (!connected)
+			{
+				connected = Transport->Connect();
+				if (connected)
+				{
+					Connects.fetch_add(1, std::memory_order_relaxed);
+					backoff = 0;
+				}
+			}
+
+			if (connected && Transport->Send(pending.data(), pending.size()))
+			{
+				int64_t now = Now();
+				for (int64_t timestamp : timestamps)
+				{
+					int64_t latency = now - timestamp;
+					LastLatency.store(latency, std::memory_order_relaxed);
+					if (latency > MaxLatency.load(std::memory_order_relaxed))
+					{
+						MaxLatency.store(latency, std::memory_order_relaxed);
+					}
+				}
+				Sent.fetch_add((int64_t)timestamps.size(), std::memory_order_relaxed);
+				pending.clear();
+				timestamps.clear();
+				continue;
+			}
+
+			// the reader is gone, keep the events and retry after a while
+			if (connected)
+			{
+				Transport->Close();
+				connected = false;
+			}
+			if (!running)
+			{
+				Dropped.fetch_add((int64_t)timestamps.size(), std::memory_order_relaxed);
+				break;
+			}
+			backoff = (backoff < 1000) ? (backoff + 50) : backoff;
+		}
+		else if (!running)
+		{
+			break;
+		}
+
+		std::unique_lock<std::mutex> lock(WakeLock);
+		if (backoff && !pending.empty())
+		{
+			Wake.wait_for(lock, std::chrono::milliseconds(backoff), [] { return !Running.load(std::memory_order_acquire); });
+		}
+		else
+		{
+			Wake.wait_for(lock, std::chrono::milliseconds(100));
+		}
+	}
+
+	if (connected)
+	{
+		Transport->Close();
+	}
+	Stopped.store(true, std::memory_order_release);
+}
+
+void EventChannel::GetStats(EventChannelStats* stats)
+{
+	stats->Posted = Posted.load(std::memory_order_relaxed);
+	stats->Sent = Sent.load(std::memory_order_relaxed);
+	stats->Dropped = Dropped.load(std::memory_order_relaxed);
+	stats->Connects = Connects.load(std::memory_order_relaxed);
+	stats->LastLatency = LastLatency.load(std::memory_order_relaxed);
+	stats->MaxLatency = MaxLatency.load(std::memory_order_relaxed);
+}
@@ -0,0 +1,86 @@
+#pragma once
+#include "asynclog.h"
+#include <mutex>
+#include <condition_variable>
+#include <string>
+
+#define EVENT_CHANNEL_QUEUE_SIZE 256 // events, power of two
+#define EVENT_CHANNEL_MAX_TEXT 240
+#define EVENT_CHANNEL_MAX_PENDING 0x10000 // bytes held back while the reader is gone
+#define EVENT_CHANNEL_MAX_TIMING 64 // bytes of game time commands written in front of one event
+
+#ifdef _WIN32
+#define EVENT_CHANNEL_LIVESPLIT "\\\\.\\pipe\\LiveSplit"
+#else
+#define EVENT_CHANNEL_LIVESPLIT "/tmp/LiveSplit"
+#endif
+
+struct ChannelEvent
+{
+	int64_t Timestamp; // microseconds, taken when the script posted it
+	uint16_t Length;
+	char Text[EVENT_CHANNEL_MAX_TEXT];
+};
+
+struct EventChannelStats
+{
+	int64_t Posted;
+	int64_t Sent;
+	int64_t Dropped;
+	int64_t Connects;
+	int64_t LastLatency; // microseconds between the post and the write that carried it
+	int64_t MaxLatency;
+};
+
+// how events leave the process. a named pipe on windows, a unix domain socket stand-in elsewhere
+class EventTransport
+{
+public:
+	virtual ~EventTransport() {}
+	virtual bool Connect() = 0;
+	virtual bool Send(const char* data, size_t length) = 0;
+	virtual void Close() = 0;
+};
+
+// one persistent connection fed by a lock-free queue. the vm thread only timestamps and queues, a background thread batches the writes and reconnects
+class EventChannel
+{
+public:
+	static bool Post(const char* text);
+	static void GetStats(EventChannelStats* stats);
+	// takes ownership of the transport, only valid before the first post
+	static void SetTransport(EventTransport* transport);
+	static EventTransport* CreateDefaultTransport();
+	// off by default, events go out as the script posted them. when on, starts are followed by initgametime and
+	// splits preceded by the time since the start as the script posted them, so livesplit game time leaves out
+	// the time an event spent queued
+	static void SetSplitTiming(bool enabled);
+	static int64_t Now();
+	// sends whatever is queued and waits for the channel thread to exit. on process exit the thread is already gone,
+	// pass threadsTerminated and the caller sends instead
+	static void Stop(bool threadsTerminated = false);
+	// tells the channel thread to send what is queued and exit without waiting for it, for DllMain where waiting
+	// would be under the loader lock
+	static void RequestStop();
+
+private:
+	static void Start();
+	static void Run();
+	// appends the event as it goes on the wire, with the game time commands when SplitTiming is on
+	static void Frame(const ChannelEvent& event, std::string& out);
+	static std::atomic<bool> SplitTiming;
+	static int64_t RunStart; // timestamp of the start command, 0 while no run is going. channel thread only
+	static MpscRing<ChannelEvent, EVENT_CHANNEL_QUEUE_SIZE> Queue;
+	static EventTransport* Transport;
+	static std::mutex WakeLock;
+	static std::condition_variable Wake;
+	static std::atomic<bool> Started;
+	static std::atomic<bool> Running;
+	static std::atomic<bool> Stopped;
+	static std::atomic<int64_t> Posted;
+	static std::atomic<int64_t> Sent;
+	static std::atomic<int64_t> Dropped;
+	static std::atomic<int64_t> Connects;
+	static std::atomic<int64_t> LastLatency;
+	static std::atomic<int64_t> MaxLatency;
+};
@@ -0,0 +1,304 @@
+#ifndef _WIN32
+#include "pal.h"
+#include <sys/mman.h>
+#include <unistd.h>
+#include <time.h>
+#include <errno.h>
+#include <map>
+#include <mutex>
+
+uint64_t PAL_ImageBase = 0;
+
+// windows hands out reservations on this granularity and the runtime relies on it when it searches for free memory
+#define PAL_ALLOCATION_GRANULARITY 0x10000ull
+
+static std::mutex ReservationsLock;
+static std::map<uintptr_t, size_t> Reservations;
+static DWORD LastError = 0;
+
+static uintptr_t PageSize()
+{
+	static uintptr_t size = (uintptr_t)sysconf(_SC_PAGESIZE);
+	return size;
+}
+
+static int ToProt(DWORD protect)
+{
+	switch (protect & 0xFF)
+	{
+		case PAGE_READONLY: return PROT_READ;
+		case PAGE_READWRITE: case PAGE_WRITECOPY: return PROT_READ | PROT_WRITE;
+		case PAGE_EXECUTE: return PROT_EXEC;
+		case PAGE_EXECUTE_READ: return PROT_READ | PROT_EXEC;
+		case PAGE_EXECUTE_READWRITE: case PAGE_EXECUTE_WRITECOPY: return PROT_READ | PROT_WRITE | PROT_EXEC;
+		default: return PROT_NONE;
+	}
+}
+
+static DWORD FromProt(const char* perms)
+{
+	bool r = perms[0] == 'r', w = perms[1] == 'w', x = perms[2] == 'x';
+	if (x)
+	{
+		return w ? PAGE_EXECUTE_READWRITE : r ? PAGE_EXECUTE_READ : PAGE_EXECUTE;
+	}
+	return w ? PAGE_READWRITE : r ? PAGE_READONLY : PAGE_NOACCESS;
+}
+
+// finds the mapping containing address, or the gap it falls in. there is no other way to ask linux what a page is.
+static bool QueryMapping(uintptr_t address, uintptr_t* start, uintptr_t* end, DWORD* protect)
+{
+	FILE* maps = fopen("/proc/self/maps", "r");
+	if (!maps)
+	{
+		return false;
+	}
+
+	bool found = false;
+	uintptr_t gapStart = 0;
+	uintptr_t gapEnd = 0x800000000000ull;
+	char line[512];
+	while (fgets(line, sizeof(line), maps))
+	{
+		unsigned long long lo, hi;
+		char perms[5];
+		if (sscanf(line, "%llx-%llx %4s", &lo, &hi, perms) != 3)
+		{
+			continue;
+		}
+		if (address >= lo && address < hi)
+		{
+			*start = (uintptr_t)lo;
+			*end = (uintptr_t)hi;
+			*protect = FromProt(perms);
+			found = true;
+			break;
+		}
+		if (hi <= address)
+		{
+			gapStart = (uintptr_t)hi;
+		}
+		else
+		{
+			gapEnd = (uintptr_t)lo;
+			break;
+		}
+	}
+	fclose(maps);
+
+	if (!found)
+	{
+		*start = gapStart;
+		*end = gapEnd;
+		*protect = 0;
+	}
+	return found;
+}
+
+BOOL VirtualProtect(LPVOID address, SIZE_T size, DWORD protect, DWORD* oldProtect)
+{
+	uintptr_t first = (uintptr_t)address & ~(PageSize() - 1);
+	uintptr_t last = ((uintptr_t)address + size + PageSize() - 1) & ~(PageSize() - 1);
+
+	uintptr_t start, end;
+	DWORD current = PAGE_NOACCESS;
+	if (!QueryMapping(first, &start, &end, &current))
+	{
+		LastError = EFAULT;
+		return FALSE;
+	}
+	if (oldProtect)
+	{
+		*oldProtect = current;
+	}
+	if (mprotect((void*)first, last - first, ToProt(protect)))
+	{
+		LastError = errno;
+		return FALSE;
+	}
+	return TRUE;
+}
+
+LPVOID VirtualAlloc(LPVOID address, SIZE_T size, DWORD type, DWORD protect)
+{
+	if (!size || (type & MEM_LARGE_PAGES))
+	{
+		LastError = EINVAL;
+		return NULL;
+	}
+
+	// committing part of an existing reservation
+	if (address && !(type & MEM_RESERVE))
+	{
+		uintptr_t first = (uintptr_t)address & ~(PageSize() - 1);
+		uintptr_t last = ((uintptr_t)address + size + PageSize() - 1) & ~(PageSize() - 1);
+		if (mprotect((void*)first, last - first, ToProt(protect)))
+		{
+			LastError = errno;
+			return NULL;
+		}
+		return (LPVOID)first;
+	}
+
+	int prot = (type & MEM_COMMIT) ? ToProt(protect) : PROT_NONE;
+	size_t length = (size + PAL_ALLOCATION_GRANULARITY - 1) & ~(PAL_ALLOCATION_GRANULARITY - 1);
+	uintptr_t base;
+	if (address)
+	{
+		void* at = (void*)((uintptr_t)address & ~(PAL_ALLOCATION_GRANULARITY - 1));
+		void* mapped = mmap(at, length, prot, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED_NOREPLACE, -1, 0);
+		if (mapped == MAP_FAILED || mapped != at)
+		{
+			if (mapped != MAP_FAILED)
+			{
+				munmap(mapped, length);
+			}
+			LastError = ENOMEM;
+			return NULL;
+		}
+		base = (uintptr_t)mapped;
+	}
+	else
+	{
+		// over map and trim so the result lands on the allocation granularity
+		size_t padded = length + PAL_ALLOCATION_GRANULARITY;
+		void* mapped = mmap(NULL, padded, prot, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+		if (mapped == MAP_FAILED)
+		{
+			LastError = ENOMEM;
+			return NULL;
+		}
+		base = ((uintptr_t)mapped + PAL_ALLOCATION_GRANULARITY - 1) & ~(PAL_ALLOCATION_GRANULARITY - 1);
+		if (base > (uintptr_t)mapped)
+		{
+			munmap(mapped, base - (uintptr_t)mapped);
+		}
+		uintptr_t tail = base + length;
+		uintptr_t mappedEnd = (uintptr_t)mapped + padded;
+		if (mappedEnd > tail)
+		{
+			munmap((void*)tail, mappedEnd - tail);
+		}
+	}
+
+	std::lock_guard<std::mutex> lock(ReservationsLock);
+	Reservations[base] = length;
+	return (LPVOID)base;
+}
+
+BOOL VirtualFree(LPVOID address, SIZE_T size, DWORD type)
+{
+	if (type & MEM_RELEASE)
+	{
+		std::lock_guard<std::mutex> lock(ReservationsLock);
+		auto found = Reservations.find((uintptr_t)address);
+		if (found == Reservations.end() || size)
+		{
+			LastError = EINVAL;
+			return FALSE;
+		}
+		munmap(address, found->second);
+		Reservations.erase(found);
+		return TRUE;
+	}
+
+	uintptr_t first = (uintptr_t)address & ~(PageSize() - 1);
+	uintptr_t last = ((uintptr_t)address + size + PageSize() - 1) & ~(PageSize() - 1);
+	madvise((void*)first, last - first, MADV_DONTNEED);
+	return mprotect((void*)first, last - first, PROT_NONE) == 0;
+}
+
+SIZE_T VirtualQuery(const void* address, MEMORY_BASIC_INFORMATION* info, SIZE_T length)
+{
+	if (length < sizeof(MEMORY_BASIC_INFORMATION))
+	{
+		return 0;
+	}
+
+	uintptr_t page = (uintptr_t)address & ~(PageSize() - 1);
+	uintptr_t start, end;
+	DWORD protect;
+	bool mapped = QueryMapping(page, &start, &end, &protect);
+	if (!mapped && start == 0 && end == 0)
+	{
+		return 0;
+	}
+
+	memset(info, 0, sizeof(*info));
+	info->BaseAddress = (PVOID)page;
+	info->RegionSize = end - page;
+	if (mapped)
+	{
+		info->AllocationBase = (PVOID)start;
+		info->State = (protect == PAGE_NOACCESS) ? MEM_RESERVE : MEM_COMMIT;
+		info->Protect = (protect == PAGE_NOACCESS) ? 0 : protect;
+		info->AllocationProtect = protect;
+	}
+	else
+	{
+		info->State = MEM_FREE;
+		info->Protect = PAGE_NOACCESS;
+	}
+	return sizeof(*info);
+}
+
+BOOL FlushInstructionCache(HANDLE process, const void* address, SIZE_T size)
+{
+	__builtin___clear_cache((char*)address, (char*)address + size);
+	return TRUE;
+}
+
+HANDLE GetCurrentProcess()
+{
+	return (HANDLE)(intptr_t)-1;
+}
+
+DWORD GetLastError()
+{
+	return LastError;
+}
+
+BOOL CloseHandle(HANDLE handle)
+{
+	return TRUE;
+}
+
+SIZE_T GetLargePageMinimum()
+{
+	return 0;
+}
+
+BOOL OpenProcessToken(HANDLE process, DWORD access, HANDLE* token)
+{
+	return FALSE;
+}
+
+BOOL LookupPrivilegeValue(const char* system, const char* name, LUID* luid)
+{
+	return FALSE;
+}
+
+BOOL AdjustTokenPrivileges(HANDLE token, BOOL disableAll, TOKEN_PRIVILEGES* state, DWORD length, TOKEN_PRIVILEGES* previous, DWORD* returnLength)
+{
+	return FALSE;
+}
+
+BOOL QueryPerformanceCounter(LARGE_INTEGER* count)
+{
+	timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	count->QuadPart = (LONGLONG)now.tv_sec * 1000000000ll + now.tv_nsec;
+	return TRUE;
+}
+
+BOOL QueryPerformanceFrequency(LARGE_INTEGER* frequency)
+{
+	frequency->QuadPart = 1000000000ll;
+	return TRUE;
+}
+
+void Sleep(DWORD milliseconds)
+{
+	usleep(milliseconds * 1000);
+}
+#endif
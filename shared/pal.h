@@ -0,0 +1,176 @@
+#pragma once
+// stands in for the parts of windows.h the runtime uses so the portable parts can be built and tested off windows.
+// only ever included on non windows builds, the dlls keep using the real headers.
+#ifndef _WIN32
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <cstdio>
+#include <cstdarg>
+#include <x86intrin.h>
+
+#define __int64 long long
+#define __int32 int
+#define __int16 short
+#define __int8 char
+#define __fastcall
+#define __declspec(x)
+#define __forceinline inline __attribute__((always_inline))
+
+typedef int8_t INT8;
+typedef int16_t INT16;
+typedef int32_t INT32;
+typedef long long INT64;
+typedef uint8_t UINT8;
+typedef uint16_t UINT16;
+typedef uint32_t UINT32;
+typedef unsigned long long UINT64;
+typedef unsigned char BYTE;
+typedef uint32_t DWORD;
+typedef int BOOL;
+typedef int32_t LONG;
+typedef int64_t LONGLONG;
+typedef size_t SIZE_T;
+typedef uintptr_t ULONG_PTR;
+typedef void* PVOID;
+typedef void* LPVOID;
+typedef void* HANDLE;
+typedef void* HMODULE;
+
+typedef union
+{
+	struct
+	{
+		DWORD LowPart;
+		LONG HighPart;
+	};
+	LONGLONG QuadPart;
+} LARGE_INTEGER;
+
+#define TRUE 1
+#define FALSE 0
+#define WINAPI
+#define APIENTRY
+#define NTAPI
+#define EXTERN_C extern "C"
+#define MAX_PATH 260
+#define ARRAYSIZE(a) (sizeof(a) / sizeof((a)[0]))
+#define ERROR_SUCCESS 0
+
+#define PAGE_NOACCESS 0x01
+#define PAGE_READONLY 0x02
+#define PAGE_READWRITE 0x04
+#define PAGE_WRITECOPY 0x08
+#define PAGE_EXECUTE 0x10
+#define PAGE_EXECUTE_READ 0x20
+#define PAGE_EXECUTE_READWRITE 0x40
+#define PAGE_EXECUTE_WRITECOPY 0x80
+#define PAGE_GUARD 0x100
+
+#define MEM_COMMIT 0x1000
+#define MEM_RESERVE 0x2000
+#define MEM_DECOMMIT 0x4000
+#define MEM_RELEASE 0x8000
+#define MEM_FREE 0x10000
+#define MEM_LARGE_PAGES 0x20000000
+
+typedef struct
+{
+	PVOID BaseAddress;
+	PVOID AllocationBase;
+	DWORD AllocationProtect;
+	SIZE_T RegionSize;
+	DWORD State;
+	DWORD Protect;
+	DWORD Type;
+} MEMORY_BASIC_INFORMATION;
+
+// large pages are never granted off windows, these only exist so the privilege request compiles
+#define TOKEN_ADJUST_PRIVILEGES 0x20
+#define TOKEN_QUERY 0x8
+#define SE_PRIVILEGE_ENABLED 0x2
+#define SE_LOCK_MEMORY_NAME "SeLockMemoryPrivilege"
+
+typedef struct
+{
+	DWORD LowPart;
+	LONG HighPart;
+} LUID;
+
+typedef struct
+{
+	LUID Luid;
+	DWORD Attributes;
+} LUID_AND_ATTRIBUTES;
+
+typedef struct
+{
+	DWORD PrivilegeCount;
+	LUID_AND_ATTRIBUTES Privileges[1];
+} TOKEN_PRIVILEGES;
+
+BOOL VirtualProtect(LPVOID address, SIZE_T size, DWORD protect, DWORD* oldProtect);
+LPVOID VirtualAlloc(LPVOID address, SIZE_T size, DWORD type, DWORD protect);
+BOOL VirtualFree(LPVOID address, SIZE_T size, DWORD type);
+SIZE_T VirtualQuery(const void* address, MEMORY_BASIC_INFORMATION* info, SIZE_T length);
+BOOL FlushInstructionCache(HANDLE process, const void* address, SIZE_T size);
+HANDLE GetCurrentProcess();
+DWORD GetLastError();
+BOOL CloseHandle(HANDLE handle);
+SIZE_T GetLargePageMinimum();
+BOOL OpenProcessToken(HANDLE process, DWORD access, HANDLE* token);
+BOOL LookupPrivilegeValue(const char* system, const char* name, LUID* luid);
+BOOL AdjustTokenPrivileges(HANDLE token, BOOL disableAll, TOKEN_PRIVILEGES* state, DWORD length, TOKEN_PRIVILEGES* previous, DWORD* returnLength);
+BOOL QueryPerformanceCounter(LARGE_INTEGER* count);
+BOOL QueryPerformanceFrequency(LARGE_INTEGER* frequency);
+void Sleep(DWORD milliseconds);
+
+// long is 32 bits on windows, so these only ever touch the low dword
+inline long _InterlockedOr(volatile long* target, long value)
+{
+	return __atomic_fetch_or((volatile int32_t*)target, (int32_t)value, __ATOMIC_SEQ_CST);
+}
+
+inline long _InterlockedDecrement(volatile long* target)
+{
+	return __atomic_sub_fetch((volatile int32_t*)target, 1, __ATOMIC_SEQ_CST);
+}
+
+inline long _InterlockedIncrement(volatile long* target)
+{
+	return __atomic_add_fetch((volatile int32_t*)target, 1, __ATOMIC_SEQ_CST);
+}
+
+inline unsigned char _InterlockedCompareExchange128(volatile long long* destination, long long high, long long low, long long* comparand)
+{
+	__int128 expected = ((__int128)comparand[1] << 64) | (unsigned long long)comparand[0];
+	__int128 desired = ((__int128)high << 64) | (unsigned long long)low;
+	bool swapped = __atomic_compare_exchange_n((volatile __int128*)destination, &expected, desired, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+	comparand[0] = (long long)expected;
+	comparand[1] = (long long)(expected >> 64);
+	return swapped;
+}
+
+#define _TRUNCATE ((size_t)-1)
+
+template <size_t N> inline int strncpy_s(char (&dest)[N], const char* src, size_t count)
+{
+	size_t length = strnlen(src, (count == _TRUNCATE || count > N - 1) ? N - 1 : count);
+	memcpy(dest, src, length);
+	dest[length] = 0;
+	return 0;
+}
+
+template <size_t N> inline int sprintf_s(char (&dest)[N], const char* format, ...)
+{
+	va_list args;
+	va_start(args, format);
+	int result = vsnprintf(dest, N, format, args);
+	va_end(args);
+	return result;
+}
+
+// base of the emulated game image. REBASE resolves against this instead of the loaded module,
+// so whatever hosts the runtime (the test emulator) decides what lives at each game offset.
+extern uint64_t PAL_ImageBase;
+#endif
@@ -2,24 +2,35 @@
 #include "offsets.h"
 #include "detours.h"
 #include "builtins.h"
+#include "exportindex.h"
+#include "assetcache.h"
+#include "vmframe.h"
+
+std::mutex Opcodes::LazySitesLock;
+std::unordered_map<INT64, LazySite> Opcodes::LazySites;
+LazyTarget Opcodes::LazyTargets[LAZY_TARGET_MAX];
+INT32 Opcodes::NumLazyTargets = 0;
 
 void Opcodes::Init()
 {
 	// note: on windows store these are RDATA!!
 	
 	// Change Opcode Handler 0x16 to VM_OP_GetLazyFunction
-	chgmem<uint64_t>(0x16 * 8 + OFF_ScrVm_Opcodes, (uint64_t)VM_OP_GetLazyFunction);
+	chgmem<uint64_t>(OP_GetLazyFunction * 8 + OFF_ScrVm_Opcodes, (uint64_t)VM_OP_GetLazyFunction);
 
 	// Change Opcode Handler 0x17 to VM_OP_GetLocalFunction
-	chgmem<uint64_t>(0x17 * 8 + OFF_ScrVm_Opcodes, (uint64_t)VM_OP_GetLocalFunction);
+	chgmem<uint64_t>(OP_GetLocalFunction * 8 + OFF_ScrVm_Opcodes, (uint64_t)VM_OP_GetLocalFunction);
 
 	// Change Opcode Handler 0x1A to VM_OP_NOP
-	chgmem<uint64_t>(0x1A * 8 + OFF_ScrVm_Opcodes, (uint64_t)VM_OP_NOP);
+	chgmem<uint64_t>(OP_NOP * 8 + OFF_ScrVm_Opcodes, (uint64_t)VM_OP_NOP);
+
+	// Change Opcode Handler 0x1D to VM_OP_GetResolvedFunction (never emitted by the compiler, lazy references are rewritten to it)
+	chgmem<uint64_t>(OP_GetResolvedFunction * 8 + OFF_ScrVm_Opcodes, (uint64_t)VM_OP_GetResolvedFunction);
 }
 
 void Opcodes::VM_OP_GetLazyFunction(INT32 inst, INT64* fs_0, INT64 vmc, bool* terminate)
 {
-	INT64 base = (*fs_0 + 3) & 0xFFFFFFFFFFFFFFFCLL;
+	INT64 base = VM_Operand(fs_0, 4);
 	INT32 Namespace = *(INT32*)base;
 	INT32 Function = *(INT32*)(base + 4);
 	char* script = (char*)(*fs_0 + (*(INT32*)(base + 8)));
@@ -27,57 +38,116 @@ void Opcodes::VM_OP_GetLazyFunction(INT32 inst, INT64* fs_0, INT64 vmc, bool* te
 
 	if (!asset)
 	{
-		*(INT32*)(fs_0[1] + 0x18) = 0x0; // undefined
-		fs_0[1] += 0x10; // change stack top
+		VM_PushUndefined(fs_0);
 		*fs_0 = base + 0xC; // move past the data
 		return;
 	}
 
 	auto buffer = *(char**)(asset + 0x10);
-	auto exportsOffset = *(INT32*)(buffer + 0x20);
-	auto exports = (INT64)(exportsOffset + buffer);
-	auto numExports = *(INT16*)(buffer + 0x3A);
-	__t7export* currentExport = (__t7export*)exports;
-	bool found = false;
+	auto bytecodeOffset = ExportIndex::FindExport(buffer, Namespace, Function);
 
-	for (INT16 i = 0; i < numExports; i++, currentExport++)
+	if (!bytecodeOffset)
 	{
-		if (currentExport->funcName != Function)
+		VM_PushUndefined(fs_0);
+		*fs_0 = base + 0xC; // move past the data
+		return;
+	}
+
+	QuickenLazySite(VM_OpcodePos(fs_0), base, asset, (INT64)buffer + bytecodeOffset);
+
+	VM_Push(fs_0, VM_TYPE_FUNCTION, (INT64)buffer + bytecodeOffset);
+	*fs_0 = base + 0xC; // move past the data
+}
+
+// the 0xC bytes of lazy data always contain an aligned qword for the pointer. the other dword holds the LazyTargets
+// index of the script the pointer is into and the low bits of the generation it was resolved in.
+#define RESOLVED_PTR(base) (((base) + 7) & ~7LL)
+#define RESOLVED_TAG(base) ((RESOLVED_PTR(base) == (base)) ? ((base) + 8) : (base))
+#define RESOLVED_TAG_MAKE(target, generation) (((UINT32)(target) << 16) | ((UINT32)(generation) & 0xFFFF))
+
+void Opcodes::VM_OP_GetResolvedFunction(INT32 inst, INT64* fs_0, INT64 vmc, bool* terminate)
+{
+	INT64 base = VM_Operand(fs_0, 4);
+	UINT32 tag = *(UINT32*)RESOLVED_TAG(base);
+	auto& owner = LazyTargets[tag >> 16];
+	auto spt = (SPTEntry*)owner.Asset;
+
+	// the generation catches ui level and pool changes once a lookup has seen them, but the pool count can come back around and
+	// a script can be swapped for another copy without it moving, so the asset has to still hold the buffer the pointer was taken from.
+	// the published generation is a plain atomic load, this runs as often as GetLocalFunction and cant take the cache lock
+	if ((tag & 0xFFFF) != ((UINT32)ScriptAssetCache::PublishedGeneration() & 0xFFFF) || spt->Buffer != owner.Buffer || spt->Name != owner.Name || *(INT32*)(owner.Buffer + 0x8) != owner.Checksum)
+	{
+		// scripts were loaded or unloaded since this was resolved, so put the lazy reference back and resolve it again
+		if (RestoreLazySite(VM_OpcodePos(fs_0)))
 		{
-			continue;
+			VM_OP_GetLazyFunction(inst, fs_0, vmc, terminate);
+			return;
 		}
-		if (currentExport->funcNS != Namespace)
+		VM_PushUndefined(fs_0);
+		*fs_0 = base + 0xC; // move past the data
+		return;
+	}
+
+	VM_Push(fs_0, VM_TYPE_FUNCTION, *(INT64*)RESOLVED_PTR(base));
+	*fs_0 = base + 0xC; // move past the data
+}
+
+void Opcodes::QuickenLazySite(INT64 opPos, INT64 base, INT64 asset, INT64 target)
+{
+	std::lock_guard<std::mutex> lock(LazySitesLock);
+	auto spt = (SPTEntry*)asset;
+
+	// one slot per loaded copy of a script. slots are never reused, sites tagged with a stale one just fail the check
+	INT32 index = 0;
+	INT32 checksum = *(INT32*)(spt->Buffer + 0x8);
+	while (index < NumLazyTargets && (LazyTargets[index].Asset != asset || LazyTargets[index].Buffer != spt->Buffer || LazyTargets[index].Name != spt->Name || LazyTargets[index].Checksum != checksum))
+	{
+		index++;
+	}
+	if (index == NumLazyTargets)
+	{
+		if (NumLazyTargets == LAZY_TARGET_MAX)
 		{
-			continue;
+			return; // stays lazy
 		}
-		found = true;
-		break;
+		LazyTargets[NumLazyTargets++] = { asset, spt->Buffer, spt->Name, checksum };
 	}
 
-	if (!found)
+	// keyed by address, so a site in a script that was unloaded is simply replaced if the address gets reused
+	auto& site = LazySites[opPos];
+	site.OriginalOp = *(INT16*)opPos;
+	memcpy(site.Original, (void*)base, sizeof(site.Original));
+
+	// data first so the opcode never points at a half written operand
+	*(INT64*)RESOLVED_PTR(base) = target;
+	*(UINT32*)RESOLVED_TAG(base) = RESOLVED_TAG_MAKE(index, ScriptAssetCache::Generation());
+	*(INT16*)opPos = OP_GetResolvedFunction;
+}
+
+bool Opcodes::RestoreLazySite(INT64 opPos)
+{
+	std::lock_guard<std::mutex> lock(LazySitesLock);
+	auto found = LazySites.find(opPos);
+	if (found == LazySites.end())
 	{
-		*(INT32*)(fs_0[1] + 0x18) = 0x0; // undefined
-		fs_0[1] += 0x10; // change stack top
-		*fs_0 = base + 0xC; // move past the data
-		return;
+		return false;
 	}
 
-	*(INT32*)(fs_0[1] + 0x18) = 0xE; // assign the top variable's type
-	*(INT64*)(fs_0[1] + 0x10) = (INT64)buffer + currentExport->bytecodeOffset; // assign the top variable's value
-	fs_0[1] += 0x10; // change stack top
-	*fs_0 = base + 0xC; // move past the data
+	INT64 base = (opPos + 2 + 3) & 0xFFFFFFFFFFFFFFFCLL;
+	memcpy((void*)base, found->second.Original, sizeof(found->second.Original));
+	*(INT16*)opPos = found->second.OriginalOp;
+	LazySites.erase(found);
+	return true;
 }
 
 void Opcodes::VM_OP_GetLocalFunction(INT32 inst, INT64* fs_0, INT64 vmc, bool* terminate)
 {
-	INT64 base = (*fs_0 + 3) & 0xFFFFFFFFFFFFFFFCLL;
+	INT64 base = VM_Operand(fs_0, 4);
 	INT32 jumpOffset = *(INT32*)base;
 	*fs_0 = base + 0x4; // move past the data
 
 	INT64 fnPtr = *fs_0 + jumpOffset;
-	*(INT32*)(fs_0[1] + 0x18) = 0xE; // assign the top variable's type
-	*(INT64*)(fs_0[1] + 0x10) = (INT64)fnPtr; // assign the top variable's value
-	fs_0[1] += 0x10; // change stack top
+	VM_Push(fs_0, VM_TYPE_FUNCTION, fnPtr);
 }
 
 void Opcodes::VM_OP_NOP(INT32 inst, INT64* fs_0, INT64 vmc, bool* terminate)
@@ -1,11 +1,44 @@
 #pragma once
 #include "framework.h"
+#include <unordered_map>
+#include <mutex>
+
+#define OP_GetLazyFunction 0x16
+#define OP_GetLocalFunction 0x17
+#define OP_NOP 0x1A
+#define OP_GetResolvedFunction 0x1D
+
+// original bytes of a lazy function reference that was rewritten to OP_GetResolvedFunction
+struct LazySite
+{
+	INT16 OriginalOp;
+	BYTE Original[0xC];
+};
+
+// a script buffer quickened lazy references point into, checked against its asset on every execution
+#define LAZY_TARGET_MAX 0x1000
+struct LazyTarget
+{
+	INT64 Asset;
+	char* Buffer;
+	char* Name;
+	INT32 Checksum; // a reloaded copy can land at the same address
+};
 
 class Opcodes
 {
 public:
 	static void Init();
 	static void VM_OP_GetLazyFunction(INT32 inst, INT64* fs_0, INT64 vmc, bool* terminate);
+	static void VM_OP_GetResolvedFunction(INT32 inst, INT64* fs_0, INT64 vmc, bool* terminate);
 	static void VM_OP_GetLocalFunction(INT32 inst, INT64* fs_0, INT64 vmc, bool* terminate);
 	static void VM_OP_NOP(INT32 inst, INT64* fs_0, INT64 vmc, bool* terminate);
-};
\ No newline at end of file
+
+private:
+	static void QuickenLazySite(INT64 opPos, INT64 base, INT64 asset, INT64 target);
+	static bool RestoreLazySite(INT64 opPos);
+	static std::mutex LazySitesLock; // sites are quickened and restored from both vm threads
+	static std::unordered_map<INT64, LazySite> LazySites;
+	static LazyTarget LazyTargets[LAZY_TARGET_MAX];
+	static INT32 NumLazyTargets;
+};
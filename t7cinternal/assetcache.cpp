@@ -0,0 +1,147 @@
+#include "assetcache.h"
+#include "detours.h"
+#include "offsets.h"
+
+std::mutex ScriptAssetCache::Lock;
+std::unordered_map<UINT64, ScriptAssetCache::Entry> ScriptAssetCache::Entries;
+ScriptAssetCacheStats ScriptAssetCache::Stats = { 0 };
+BYTE ScriptAssetCache::LastUILevel = 0;
+INT32 ScriptAssetCache::LastPoolCount = -1;
+std::atomic<INT32> ScriptAssetCache::CurrentGeneration(0);
+INT32 ScriptAssetCache::CurrentVmGeneration = 0;
+bool ScriptAssetCache::LinksTracked = false;
+
+EXPORT void GetScriptAssetCacheStats(ScriptAssetCacheStats* stats)
+{
+	ScriptAssetCache::GetStats(stats);
+}
+
+UINT64 ScriptAssetCache::NameHash(const char* name)
+{
+	UINT64 hash = 0xCBF29CE484222325;
+	for (const char* c = name; *c; c++)
+	{
+		hash ^= (BYTE)*c;
+		hash *= 0x100000001B3;
+	}
+	return hash;
+}
+
+void ScriptAssetCache::CheckState()
+{
+	// map loads change the pool, ui transitions unload the game scripts, and either one can turn a miss into a hit
+	BYTE uiLevel = *(BYTE*)(OFF_s_runningUILevel);
+	INT32 poolCount = *(INT32*)(OFF_xAssetScriptParseTree + 0x14);
+	if (uiLevel != LastUILevel || poolCount != LastPoolCount)
+	{
+		Drop();
+		LastUILevel = uiLevel;
+		LastPoolCount = poolCount;
+		CurrentVmGeneration++;
+	}
+}
+
+INT64 ScriptAssetCache::Find(const char* name, tScriptAssetLookup lookup)
+{
+	std::lock_guard<std::mutex> lock(Lock);
+	CheckState();
+
+	UINT64 key = NameHash(name);
+	auto found = Entries.find(key);
+	if (found != Entries.end())
+	{
+		auto& entry = found->second;
+		if (!entry.Asset)
+		{
+			if (entry.Name == name)
+			{
+				Stats.NegativeHits++;
+				return 0;
+			}
+		}
+		else
+		{
+			auto spt = (SPTEntry*)entry.Asset;
+			if (spt->Buffer == entry.Buffer && spt->Name && !strcmp(spt->Name, name))
+			{
+				Stats.Hits++;
+				return entry.Asset;
+			}
+		}
+		Stats.Stale++;
+	}
+
+	Stats.Misses++;
+	INT64 asset = lookup(name);
+	if (!asset && !LinksTracked)
+	{
+		// without the link hook nothing tells us when a missing script shows up, and the pool count alone can come back around
+		Entries.erase(key);
+		return 0;
+	}
+	Entries[key] = { asset, asset ? ((SPTEntry*)asset)->Buffer : NULL, asset ? std::string() : std::string(name) };
+	return asset;
+}
+
+void ScriptAssetCache::ScriptLinked()
+{
+	std::lock_guard<std::mutex> lock(Lock);
+	for (auto it = Entries.begin(); it != Entries.end();)
+	{
+		if (it->second.Asset)
+		{
+			it++;
+			continue;
+		}
+		it = Entries.erase(it);
+	}
+}
+
+void ScriptAssetCache::TrackLinks(bool enabled)
+{
+	std::lock_guard<std::mutex> lock(Lock);
+	LinksTracked = enabled;
+	if (!enabled)
+	{
+		Drop();
+	}
+}
+
+INT32 ScriptAssetCache::Generation()
+{
+	std::lock_guard<std::mutex> lock(Lock);
+	CheckState();
+	return CurrentGeneration.load(std::memory_order_relaxed);
+}
+
+INT32 ScriptAssetCache::VmGeneration()
+{
+	std::lock_guard<std::mutex> lock(Lock);
+	CheckState();
+	return CurrentVmGeneration;
+}
+
+void ScriptAssetCache::Invalidate()
+{
+	std::lock_guard<std::mutex> lock(Lock);
+	Drop();
+}
+
+void ScriptAssetCache::Drop()
+{
+	CurrentGeneration.fetch_add(1, std::memory_order_release);
+	if (Entries.empty())
+	{
+		return;
+	}
+	Entries.clear();
+	Stats.Invalidations++;
+}
+
+void ScriptAssetCache::GetStats(ScriptAssetCacheStats* stats)
+{
+	std::lock_guard<std::mutex> lock(Lock);
+	*stats = Stats;
+	stats->NumEntries = (INT32)Entries.size();
+	stats->pad = 0;
+}
@@ -0,0 +1,65 @@
+#pragma once
+#include "framework.h"
+#include <unordered_map>
+#include <string>
+#include <mutex>
+#include <atomic>
+
+typedef INT64(__fastcall* tScriptAssetLookup)(const char* name);
+
+struct ScriptAssetCacheStats
+{
+	INT64 Hits;
+	INT64 NegativeHits;
+	INT64 Misses;
+	INT64 Stale; // positive entries whose asset no longer held the same buffer
+	INT64 Invalidations;
+	INT32 NumEntries;
+	INT32 pad;
+};
+
+EXPORT void GetScriptAssetCacheStats(ScriptAssetCacheStats* stats);
+
+// script name -> scriptparsetree asset header, including misses. dropped whenever the ui level or the scriptparsetree pool changes.
+// the gsc and csc vm threads both look scripts up through here, so everything is behind Lock.
+class ScriptAssetCache
+{
+public:
+	static INT64 Find(const char* name, tScriptAssetLookup lookup);
+	// a script was linked, so any cached miss may be stale. misses are only cached while something calls this on every link
+	static void ScriptLinked();
+	static void TrackLinks(bool enabled);
+	// bumped every time the cache is dropped. anything derived from a lookup is only valid for the generation it was made in
+	static INT32 Generation();
+	// the same generation as of the last lookup or invalidation, without taking Lock or probing the game state. only for hot
+	// paths that have checks of their own to fall back on when a change hasnt been seen yet
+	static inline INT32 PublishedGeneration()
+	{
+		return CurrentGeneration.load(std::memory_order_acquire);
+	}
+	// bumped only when the ui level or the scriptparsetree pool changes, the vm and everything linked into it went with it.
+	// Invalidate drops lookups but leaves this alone, so state that lives as long as the vm keys on it instead
+	static INT32 VmGeneration();
+	static void Invalidate();
+	static void GetStats(ScriptAssetCacheStats* stats);
+
+private:
+	struct Entry
+	{
+		INT64 Asset; // 0 for a cached miss
+		char* Buffer;
+		std::string Name; // misses have no asset to compare the name against
+	};
+
+	static void CheckState();
+	static void Drop();
+	static UINT64 NameHash(const char* name);
+	static std::mutex Lock;
+	static std::unordered_map<UINT64, Entry> Entries;
+	static ScriptAssetCacheStats Stats;
+	static BYTE LastUILevel;
+	static INT32 LastPoolCount;
+	static std::atomic<INT32> CurrentGeneration;
+	static INT32 CurrentVmGeneration;
+	static bool LinksTracked;
+};
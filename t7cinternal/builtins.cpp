@@ -1,80 +1,183 @@
 #include "builtins.h"
 #include "offsets.h"
 #include "detours.h"
+#include "eventchannel.h"
+#include "exportindex.h"
+#include "inlinehook.h"
+#include "bytecodepatch.h"
+#include "scrvarpool.h"
+#include "scrvarbench.h"
+#include "scrvarsnapshot.h"
 
 std::unordered_map<int, void*> GSCBuiltins::CustomFunctions;
+std::unordered_map<INT32, BuiltinFunctionDef> GSCBuiltins::DirectBuiltins;
+std::shared_mutex GSCBuiltins::CustomLock;
+std::atomic<bool> GSCBuiltins::HasCustomFunctions(false);
+std::vector<uint8_t> GSCBuiltins::HeapSnapshots[2];
+tScr_GetFunction GSCBuiltins::Scr_GetFunction_Original = NULL;
+bool GSCBuiltins::DirectBuiltinsInstalled = false;
 tScrVm_GetString GSCBuiltins::ScrVm_GetString;
 tScrVm_GetInt GSCBuiltins::ScrVm_GetInt;
 tScrVar_AllocVariableInternal GSCBuiltins::ScrVar_AllocVariableInternal;
 tScrVm_GetFunc GSCBuiltins::ScrVm_GetFunc;
 
 // add all custom builtins here
-void GSCBuiltins::Generate()
+constexpr BuiltinDef GSCBuiltins::Builtins[] =
 {
 	// Compiler related functions //
 
 	// compiler::detour()
 	// Link and execute detours included in loaded scripts.
-	AddCustomFunction("detour", GSCBuiltins::GScr_detour);
-	
+	{ fnv1a("detour"), GSCBuiltins::GScr_detour, 0, 0 },
+
 	// compiler::relinkdetours()
 	// Re-link any detours that did not get linked previously due to script load order, etc.
-	AddCustomFunction("relinkdetours", GSCBuiltins::GScr_relinkDetours);
+	{ fnv1a("relinkdetours"), GSCBuiltins::GScr_relinkDetours, 0, 0 },
+
+	// compiler::eagerdetours()
+	// Patch every call site of a detoured function in all loaded scripts when detours are linked, instead of on first execution.
+	{ fnv1a("eagerdetours"), GSCBuiltins::GScr_eagerDetours, 0, 0 },
 
 	// General purpose //
-	
+
 	// compiler::livesplit(str_split_name);
-	// Send a split signal to livesplit through named pipe access.
+	// Send a split signal to livesplit through named pipe access. Queued, the pipe stays open between splits.
+	// Splits are sent with the time since the run started as game time, measured from when the script called this.
 	// <str_split_name>: Name of the split to send to livesplit
-	AddCustomFunction("livesplit", GSCBuiltins::GScr_livesplit);
+	{ fnv1a("livesplit"), GSCBuiltins::GScr_livesplit, 1, 1 },
 
 	// compiler::nprintln(str_message)
 	// Prints a line of text to an open, untitled notepad window.
 	// <str_message>: Text to print
-	AddCustomFunction("nprintln", GSCBuiltins::GScr_nprintln);
-
-	AddCustomFunction("patchbyte", GSCBuiltins::GScr_patchbyte);
-	AddCustomFunction("setmempoolsize", GSCBuiltins::GScr_setmempool);
-	AddCustomFunction("debugallocvariables", GSCBuiltins::GScr_debugallocvariables);
-	AddCustomFunction("script_detour", GSCBuiltins::GScr_runtimedetour);
+	{ fnv1a("nprintln"), GSCBuiltins::GScr_nprintln, 1, 1 },
+
+	// compiler::patchbyte(str_script, int_offset, int_value)
+	// Writes one byte of a loaded script. Between patchbegin() and patchcommit() the byte is only queued.
+	{ fnv1a("patchbyte"), GSCBuiltins::GScr_patchbyte, 3, 3 },
+
+	// compiler::patchbegin()
+	// Starts a patch batch. patchbyte() calls are queued until patchcommit().
+	{ fnv1a("patchbegin"), GSCBuiltins::GScr_patchbegin, 0, 0 },
+
+	// compiler::patchcommit()
+	// Validates and writes every queued byte in one pass, or none of them if any is out of bounds.
+	// Returns the number of bytes written, or a negative error.
+	{ fnv1a("patchcommit"), GSCBuiltins::GScr_patchcommit, 0, 0 },
+
+	// compiler::patchundo()
+	// Rolls back the last patch batch. Every batch is rolled back automatically when the map changes.
+	{ fnv1a("patchundo"), GSCBuiltins::GScr_patchundo, 0, 0 },
+
+	// compiler::setmempoolsize(int_size, [b_largepages]);
+	// Grows the script variable pool to at least int_size bytes (0x40 per variable). Can be called again to grow it further,
+	// and the pool keeps growing on its own once installed. b_largepages commits the whole size up front in large pages, if the account is allowed to.
+	{ fnv1a("setmempoolsize"), GSCBuiltins::GScr_setmempool, 1, 2 },
+	{ fnv1a("debugallocvariables"), GSCBuiltins::GScr_debugallocvariables, 1, 1 },
+
+	// compiler::benchmarkvariables(int_pattern, int_iterations, [int_size], [int_liveset]);
+	// Runs an alloc/free pattern against a copy of the variable pool and logs allocation locality, free list and occupancy stats.
+	// Returns the mean index distance between consecutive allocations. The copy is not the game's allocator, so nothing is timed.
+	// int_pattern: 0 bursty arrays, 1 long lived structs, 2 churn
+	// int_size: variables per array or struct. int_liveset: arrays kept alive for 0, live variables for 2
+	{ fnv1a("benchmarkvariables"), GSCBuiltins::GScr_benchmarkvariables, 2, 4 },
+
+	// compiler::heapsnapshot([str_path]);
+	// Captures a snapshot of the variable pool and logs what grew since the previous call, or a summary on the first call. Returns the live variable count.
+	// str_path: optional file to write the snapshot to, for offline diffing with scrvardiff
+	{ fnv1a("heapsnapshot"), GSCBuiltins::GScr_heapsnapshot, 0, 1 },
+	{ fnv1a("script_detour"), GSCBuiltins::GScr_runtimedetour, 4, 4 },
 
 	// compiler::erasefunc(str_script, int_namespace, int_function);
 	// Replaces a function in a given script with OP_END
 	// str_script: script affected, ex: "scripts/my/script.gsc"
 	// int_namespace: fnv hash of the namespace the function is in
 	// int_function: fnv hash of the function to replace
-	AddCustomFunction("erasefunc", GSCBuiltins::GScr_erasefunc);
+	{ fnv1a("erasefunc"), GSCBuiltins::GScr_erasefunc, 3, 3 },
 
-	AddCustomFunction("abort", GSCBuiltins::GScr_abort);
-	AddCustomFunction("catch_exit", GSCBuiltins::GScr_catch_exit);
+	// compiler::erasefuncs(str_script, int_namespace, int_function, ...);
+	// Erases every listed function in a given script in one pass. Returns the number of functions erased.
+	{ fnv1a("erasefuncs"), GSCBuiltins::GScr_erasefuncs, 3, 254 },
 
-	//// compiler::setmempoolsize(int_size);
-	//// Resizes the script memory pool. Note: default size is 10MB. Increasing this too much can cause performance issues and break the vm. Use this carefully.
-	//// int_size: size in bytes to set the memory pool. Will get clamped to be at least the default size, and will always be a multiple of 0x40.
-	//AddCustomFunction("setmempoolsize", GSCBuiltins::GScr_setmempool);
+	{ fnv1a("abort"), GSCBuiltins::GScr_abort, 0, 0 },
+	{ fnv1a("catch_exit"), GSCBuiltins::GScr_catch_exit, 0, 0 },
 
-	AddCustomFunction("enableonlinematch", GSCBuiltins::GScr_enableonlinematch);
-}
+	{ fnv1a("enableonlinematch"), GSCBuiltins::GScr_enableonlinematch, 0, 0 },
+};
+
+constexpr BuiltinDispatch GSCBuiltins::Dispatch = MakeBuiltinDispatch(GSCBuiltins::Builtins);
 
 void GSCBuiltins::Init()
 {
-	GSCBuiltins::Generate();
+	static_assert(Dispatch.Seed, "no collision free seed for the builtin table, is a builtin registered twice?");
 	auto builtinFunction = (BuiltinFunctionDef*)OFF_IsProfileBuild;
 	builtinFunction->max_args = 255;
-	builtinFunction->actionFunc = GSCBuiltins::Exec;
+	builtinFunction->actionFunc = (void*)GSCBuiltins::Exec;
 
 	builtinFunction = (BuiltinFunctionDef*)OFF_BID_Scr_CastInt;
-	builtinFunction->actionFunc = GSCBuiltins::Scr_CastInt_Wrapper;
+	builtinFunction->actionFunc = (void*)GSCBuiltins::Scr_CastInt_Wrapper;
 
 	ScrVm_GetString = (tScrVm_GetString)OFF_ScrVm_GetString;
 	ScrVm_GetInt = (tScrVm_GetInt)OFF_ScrVm_GetInt;
 	ScrVar_AllocVariableInternal = (tScrVar_AllocVariableInternal)OFF_ScrVar_AllocVariableInternal;
 	ScrVm_GetFunc = (tScrVm_GetFunc)OFF_ScrVm_GetFunc;
+
+	{
+		std::unique_lock<std::shared_mutex> lock(CustomLock);
+		for (auto& builtin : Builtins)
+		{
+			AddDirectBuiltin(builtin.Hash, (void*)builtin.Func, builtin.MinArgs, builtin.MaxArgs);
+		}
+	}
+
+	// no Scr_GetFunction offset for the store build, those scripts keep going through isprofilebuild
+	if (OFF_Scr_GetFunction)
+	{
+		Scr_GetFunction_Original = (tScr_GetFunction)InlineHook::Install(OFF_Scr_GetFunction, (INT64)Scr_GetFunction_Hook);
+		DirectBuiltinsInstalled = Scr_GetFunction_Original != NULL;
+	}
 }
 
 void GSCBuiltins::AddCustomFunction(const char* name, void* funcPtr)
 {
-	CustomFunctions[fnv1a(name)] = funcPtr;
+	{
+		std::unique_lock<std::shared_mutex> lock(CustomLock);
+		CustomFunctions[fnv1a(name)] = funcPtr;
+		AddDirectBuiltin(fnv1a(name), funcPtr, 0, 254);
+	}
+	HasCustomFunctions.store(true, std::memory_order_release);
+}
+
+// caller holds CustomLock exclusively
+void GSCBuiltins::AddDirectBuiltin(uint32_t hash, void* func, int minArgs, int maxArgs)
+{
+	// same shape as the isprofilebuild def, plus one for the hash parameter
+	auto& def = DirectBuiltins[DirectBuiltinId(hash)];
+	def.canonId = DirectBuiltinId(hash);
+	def.min_args = minArgs + 1;
+	def.max_args = maxArgs + 1;
+	def.actionFunc = (void*)func;
+	def.type = ((BuiltinFunctionDef*)OFF_IsProfileBuild)->type;
+}
+
+INT64 GSCBuiltins::Scr_GetFunction_Hook(INT32 canonID, INT32* type, INT32* min_args, INT32* max_args)
+{
+	{
+		std::shared_lock<std::shared_mutex> lock(CustomLock);
+		auto found = DirectBuiltins.find(canonID);
+		if (found != DirectBuiltins.end())
+		{
+			*type = found->second.type;
+			*min_args = found->second.min_args;
+			*max_args = found->second.max_args;
+			return (INT64)found->second.actionFunc;
+		}
+	}
+	return Scr_GetFunction_Original(canonID, type, min_args, max_args);
+}
+
+EXPORT INT32 GetDirectBuiltinSupport()
+{
+	return GSCBuiltins::DirectBuiltinsInstalled ? BUILTIN_DIRECT_VERSION : 0;
 }
 
 EXPORT void AddCustomFunction(const char* name, void* funcPtr)
@@ -82,16 +185,42 @@ EXPORT void AddCustomFunction(const char* name, void* funcPtr)
 	GSCBuiltins::AddCustomFunction(name, funcPtr);
 }
 
+EXPORT void SetLiveSplitGameTime(bool enabled)
+{
+	EventChannel::SetSplitTiming(enabled);
+}
+
 void GSCBuiltins::Exec(int scriptInst)
 {
 	INT32 func = ScrVm_GetInt(scriptInst, 0);
-	if (CustomFunctions.find(func) == CustomFunctions.end())
+
+	// runtime additions can replace a builtin, so they win when there are any
+	if (HasCustomFunctions.load(std::memory_order_acquire))
+	{
+		void* custom = NULL;
+		{
+			std::shared_lock<std::shared_mutex> lock(CustomLock);
+			auto found = CustomFunctions.find(func);
+			if (found != CustomFunctions.end())
+			{
+				custom = found->second;
+			}
+		}
+		if (custom)
+		{
+			reinterpret_cast<void(__fastcall*)(int)>(custom)(scriptInst);
+			return;
+		}
+	}
+
+	auto builtin = Dispatch.Find(func);
+	if (!builtin)
 	{
 		// unknown builtin
 		nlog("unknown builtin %h", func);
 		return;
 	}
-	reinterpret_cast<void(__fastcall*)(int)>(CustomFunctions[func])(scriptInst);
+	builtin(scriptInst);
 }
 
 void Scr_Error(uint32_t inst, const char* error, uint8_t force_terminal)
@@ -110,9 +239,7 @@ uint32_t Scr_GetType(uint32_t inst, uint32_t index)
 {
 	static char err_buff[256]{ 0 };
 
-	signed int v2; // ebx
 	uint64_t v3; // rax
-	const char* v5; // rax
 
 	v3 = 0x8A40llu * inst;
 	if (index < *(uint32_t*)(REBASE(0x51A3840, 0x3F66B50) + v3 + 56))
@@ -123,6 +250,12 @@ uint32_t Scr_GetType(uint32_t inst, uint32_t index)
 	return 0;
 }
 
+// includes the builtin hash when called through isprofilebuild
+uint32_t Scr_GetNumParam(uint32_t inst)
+{
+	return *(uint32_t*)(REBASE(0x51A3840, 0x3F66B50) + 0x8A40llu * inst + 56);
+}
+
 void Scr_AddInt(int scriptInst, uint32_t val)
 {
 	if (IS_WINSTORE)
@@ -169,6 +302,7 @@ void GSCBuiltins::GScr_detour(int scriptInst)
 		return;
 	}
 	ScriptDetours::DetoursEnabled = true;
+	ScriptDetours::InstallHooks();
 }
 
 void GSCBuiltins::GScr_relinkDetours(int scriptInst)
@@ -180,22 +314,28 @@ void GSCBuiltins::GScr_relinkDetours(int scriptInst)
 	ScriptDetours::LinkDetours();
 }
 
-void GSCBuiltins::GScr_livesplit(int scriptInst)
+void GSCBuiltins::GScr_eagerDetours(int scriptInst)
 {
 	if (scriptInst)
 	{
 		return;
 	}
+	ScriptDetours::EagerFixups = true;
+	if (ScriptDetours::DetoursLinked)
+	{
+		ScriptDetours::ApplyEagerFixups();
+	}
+}
 
-	HANDLE livesplit = CreateFile("\\\\.\\pipe\\LiveSplit", GENERIC_READ | GENERIC_WRITE, FILE_SHARE_WRITE, NULL, OPEN_EXISTING, 0, NULL);
-	if (!livesplit)
+void GSCBuiltins::GScr_livesplit(int scriptInst)
+{
+	if (scriptInst)
 	{
 		return;
 	}
 
-	const char* message = ScrVm_GetString(0, 1);
-	WriteFile(livesplit, message, strlen(message), nullptr, NULL);
-	CloseHandle(livesplit);
+	// timestamped and queued here, the pipe is written from the channel thread
+	EventChannel::Post(ScrVm_GetString(0, 1));
 }
 
 // str_path, n_offset, char_value
@@ -210,19 +350,29 @@ void GSCBuiltins::GScr_patchbyte(int scriptInst)
 		return; // bad inputs
 	}
 
-	auto asset = ScriptDetours::FindScriptParsetree(str_file);
-	if (!asset)
+	if (BytecodePatcher::Staging(scriptInst))
 	{
-		return; // couldn't find asset, quit
+		BytecodePatcher::Stage(scriptInst, str_file, n_offset, (BYTE)n_value);
+		return;
 	}
-	auto buffer = *(char**)(asset + 0x10);
 
-	if (!buffer)
-	{
-		return; // buffer doesnt exist
-	}
+	// bounds checked like a batch, and journaled with the patchbyte calls right before it
+	BytecodePatcher::PatchByte(str_file, n_offset, (BYTE)n_value);
+}
 
-	*(BYTE*)(buffer + n_offset) = (BYTE)n_value;
+void GSCBuiltins::GScr_patchbegin(int scriptInst)
+{
+	BytecodePatcher::Begin(scriptInst);
+}
+
+void GSCBuiltins::GScr_patchcommit(int scriptInst)
+{
+	Scr_AddInt(scriptInst, BytecodePatcher::Commit(scriptInst));
+}
+
+void GSCBuiltins::GScr_patchundo(int scriptInst)
+{
+	BytecodePatcher::Undo(1);
 }
 
 // str_file, int_namespace, int_func
@@ -237,174 +387,144 @@ void GSCBuiltins::GScr_erasefunc(int scriptInst)
 		return; // bad inputs
 	}
 
-	auto asset = ScriptDetours::FindScriptParsetree(str_file);
-	if (!asset)
-	{
-		return; // couldn't find asset, quit
-	}
-	auto buffer = *(char**)(asset + 0x10);
+	INT32 func[2] = { n_namespace, n_func };
+	BytecodePatcher::EraseFunctions(str_file, func, 1);
+}
 
-	if (!buffer)
-	{
-		return; // buffer doesnt exist
-	}
+// str_file, int_namespace, int_func...
+void GSCBuiltins::GScr_erasefuncs(int scriptInst)
+{
+	char* str_file = ScrVm_GetString(scriptInst, 1);
+	int n_namespace = ScrVm_GetInt(scriptInst, 2);
 
-	auto exportsOffset = *(INT32*)(buffer + 0x20);
-	auto exports = (INT64)(exportsOffset + buffer);
-	auto numExports = *(INT16*)(buffer + 0x3A);
-	__t7export* currentExport = (__t7export*)exports;
-	bool b_found = false;
-	for (INT16 i = 0; i < numExports; i++, currentExport++)
+	if (!str_file || !n_namespace)
 	{
-		if (currentExport->funcName != n_func)
-		{
-			continue;
-		}
-		if (currentExport->funcNS != n_namespace)
-		{
-			continue;
-		}
-		b_found = true;
-		break;
+		Scr_AddInt(scriptInst, 0);
+		return; // bad inputs
 	}
 
-	if (!b_found)
+	std::vector<INT32> funcs;
+	for (uint32_t i = 3; i < Scr_GetNumParam(scriptInst); i++)
 	{
-		return; // couldnt find the function
+		funcs.push_back(n_namespace);
+		funcs.push_back((INT32)ScrVm_GetInt(scriptInst, i));
 	}
+	Scr_AddInt(scriptInst, BytecodePatcher::EraseFunctions(str_file, funcs.data(), (INT32)funcs.size() / 2));
+}
+
+// int_size, [b_largepages]
+void GSCBuiltins::GScr_setmempool(int scriptInst)
+{
+	INT64 numBytes = ScrVm_GetInt(scriptInst, 1);
+	numBytes = (numBytes < 0) ? 0 : ((numBytes > (INT64)(SCRVAR_POOL_RESERVE * sizeof(ScrVar_t))) ? (INT64)(SCRVAR_POOL_RESERVE * sizeof(ScrVar_t)) : numBytes);
+	INT32 numVars = (INT32)((numBytes + sizeof(ScrVar_t) - 1) / sizeof(ScrVar_t));
+	bool largePages = Scr_GetNumParam(scriptInst) > 2 && ScrVm_GetInt(scriptInst, 2);
+	ScrVarPool::Grow(scriptInst, numVars, largePages);
+}
 
-	INT32 target = currentExport->bytecodeOffset;
-	char* fPos = buffer + currentExport->bytecodeOffset;
+void GSCBuiltins::GScr_debugallocvariables(int scriptInst)
+{
+	int numVariables = ScrVm_GetInt(scriptInst, 1);
+	int varIndex = 0;
 
-	b_found = false;
-	currentExport = (__t7export*)exports;
-	__t7export* lowest = NULL;
-	for (INT16 i = 0; i < numExports; i++, currentExport++)
+	ScrVar_t* variables = (ScrVar_t*)*(INT64*)((char*)OFF_ScrVarGlob + 128 + (scriptInst << 8));
+	for (int i = 0; i < numVariables; i++)
 	{
-		if (currentExport->bytecodeOffset <= target)
-		{
-			continue;
-		}
-		if (!lowest || (currentExport->bytecodeOffset < lowest->bytecodeOffset))
-		{
-			lowest = currentExport;
-			b_found = true;
-		}
+		varIndex = ScrVar_AllocVariableInternal(scriptInst, 1, 0, varIndex);
+		variables[varIndex].value.type = VAR_UNDEFINED;
 	}
+}
 
-	// dont erase prologue
-
-	auto code = *(UINT16*)fPos;
-
-	if (code == 0xD || code == 0x200D) // CheckClearParams
-	{
-		fPos += 2;
+// int_pattern, int_iterations, [int_size], [int_liveset]
+void GSCBuiltins::GScr_benchmarkvariables(int scriptInst)
+{
+	ScrVarBenchConfig config = {};
+	config.Pattern = (INT32)ScrVm_GetInt(scriptInst, 1);
+	config.Iterations = (INT32)ScrVm_GetInt(scriptInst, 2);
+	config.BurstSize = (Scr_GetNumParam(scriptInst) > 3) ? (INT32)ScrVm_GetInt(scriptInst, 3) : 0;
+	config.LiveSet = (Scr_GetNumParam(scriptInst) > 4) ? (INT32)ScrVm_GetInt(scriptInst, 4) : 0;
+	config.Seed = 0x9E3779B9; // fixed so runs are comparable
+
+	ScrVarHeapStats before;
+	GetScrVarHeapStats(scriptInst, &before);
+	ScrVarBenchResult result;
+	if (!ScrVarBench::Run(scriptInst, config, &result))
+	{
+		Scr_AddInt(scriptInst, 0);
+		return;
 	}
-	else
+
+	nlog("[scrvar] pool %d, %d free, free list %d long, avg distance %.1f", before.Capacity, before.FreeCount, before.FreeListLength, before.AvgFreeListDistance);
+	nlog("[scrvar] pattern %d: %lld allocs, %lld frees, %lld failed, avg alloc distance %.1f",
+		config.Pattern, result.Allocs, result.Frees, result.Failed, result.AvgAllocDistance);
+	nlog("[scrvar] after: %d free, free list %d long, avg distance %.1f", result.After.FreeCount, result.After.FreeListLength, result.After.AvgFreeListDistance);
+	for (INT32 type = 0; type < VAR_COUNT; type++)
 	{
-		fPos += 2;
-		BYTE numParams = *(BYTE*)fPos;
-		fPos += 2;
-		for (BYTE i = 0; i < numParams; i++)
-		{
-			fPos = (char*)((INT64)fPos + 3 & 0xFFFFFFFFFFFFFFFCLL) + 4;
-			fPos += 1; // type
-		}
-		if ((INT64)fPos & 1)
+		if (result.After.Occupancy[type] != before.Occupancy[type])
 		{
-			fPos++;
+			nlog("[scrvar] type %d: %d -> %d", type, before.Occupancy[type], result.After.Occupancy[type]);
 		}
 	}
-
-	char* fStart = fPos;
-	char* fEnd = b_found ? (lowest->bytecodeOffset + buffer) : (fStart + 2); // cant erase entire functions if we dont know the end
-
-	while (fStart < fEnd)
-	{
-		*(UINT16*)fStart = 0x10; // OP_END
-		fStart += 2;
-	}
-
-
+	Scr_AddInt(scriptInst, (uint32_t)(result.AvgAllocDistance + 0.5));
 }
 
-// type_free = 27 (0x1B)
-// (void*)(51A5500 + 128 * (inst << 8)) = malloc
-// memset to 0
-// vars are 0x40, stock has 130,000 of them
-// copy the original memory
-// change the pointer to the malloc'd memory
-// change final one to not be null
-// initialize all new variables
-// change final entry in list to have 0 for index (+0x18) and type (0x8)??
-
-#define MEM_SCRVAR_COUNT 130000
-#define MEM_SCRVAR_CSC_COUNT 65000
-#define MEM_SCRVAR_SPACE(inst) (sizeof(ScrVar_t) * (inst ? MEM_SCRVAR_CSC_COUNT : MEM_SCRVAR_COUNT))
-
-char* newVarMemPool = NULL;
-void GSCBuiltins::GScr_setmempool(int scriptInst)
+// [str_path]
+void GSCBuiltins::GScr_heapsnapshot(int scriptInst)
 {
-	UINT64* llpScrVarMemPool = (UINT64*)((char*)OFF_ScrVarGlob + 128 + (scriptInst << 8));
-	if (*llpScrVarMemPool == (UINT64)newVarMemPool)
+	ScrVar_t* vars = *SCRVAR_POOL_PTR(scriptInst);
+	if (!vars)
 	{
-		return; // already allocated
+		Scr_AddInt(scriptInst, 0);
+		return;
 	}
 
-	int numBytes = ScrVm_GetInt(scriptInst, 1);
+	ScrVarPoolStats pool;
+	ScrVarPool::GetStats(scriptInst, &pool);
 
-	if (numBytes % sizeof(ScrVar_t))
-	{
-		numBytes += sizeof(ScrVar_t) - (numBytes % sizeof(ScrVar_t));
-	}
+	LARGE_INTEGER start, end, frequency;
+	QueryPerformanceCounter(&start);
+	std::vector<uint8_t> snapshot;
+	ScrVarSnapshot::Capture(vars, pool.Linked, (uint16_t)scriptInst, snapshot);
+	QueryPerformanceCounter(&end);
+	QueryPerformanceFrequency(&frequency);
 
-	if (numBytes < MEM_SCRVAR_SPACE(scriptInst))
+	const char* path = (Scr_GetNumParam(scriptInst) > 1) ? ScrVm_GetString(scriptInst, 1) : NULL;
+	if (path && *path)
 	{
-		numBytes = MEM_SCRVAR_SPACE(scriptInst);
+		FILE* file = fopen(path, "wb");
+		if (file)
+		{
+			fwrite(snapshot.data(), 1, snapshot.size(), file);
+			fclose(file);
+		}
 	}
 
-	void* oldPool = newVarMemPool;
-	newVarMemPool = (char*)_aligned_malloc(numBytes, 128);
-	if (newVarMemPool <= 0)
+	ScrVarSnapshotData current, previous;
+	ScrVarSnapshot::Parse(snapshot.data(), snapshot.size(), current);
+	nlog("[heap] snapshot of %d variables took %lld us, %d bytes", pool.Linked, ((end.QuadPart - start.QuadPart) * 1000000) / frequency.QuadPart, (INT32)snapshot.size());
+
+	std::string text;
+	auto& last = HeapSnapshots[scriptInst ? 1 : 0];
+	if (ScrVarSnapshot::Parse(last.data(), last.size(), previous))
 	{
-		nlog("Failed to allocate memory! Pointer was null");
-		return;
+		ScrVarSnapshotDiff diff;
+		ScrVarSnapshot::Diff(previous, current, diff);
+		ScrVarSnapshot::FormatDiff(diff, current, 8, text);
 	}
-
-	memset(newVarMemPool, 0, numBytes);
-	memcpy(newVarMemPool, (void*)*llpScrVarMemPool, MEM_SCRVAR_SPACE(scriptInst));
-
-	int newCount = (numBytes / sizeof(ScrVar_t));
-	ScrVar_t* currentRef = (ScrVar_t*)(newVarMemPool);
-
-	// ALOG("numbytes %X, sizeof scrvar %X, newcount %d, %p (%p) mempool, var.o (%x)", numBytes, sizeof(ScrVar_t), newCount, newVarMemPool, &currentRef[MEM_SCRVAR_COUNT - 1], offsetof(ScrVar_t, o));
-
-	currentRef[(scriptInst ? MEM_SCRVAR_CSC_COUNT : MEM_SCRVAR_COUNT) - 1].value.type = VAR_FREE;
-	currentRef[(scriptInst ? MEM_SCRVAR_CSC_COUNT : MEM_SCRVAR_COUNT) - 1].o.size = scriptInst ? MEM_SCRVAR_CSC_COUNT : MEM_SCRVAR_COUNT;
-
-	for (int i = (scriptInst ? MEM_SCRVAR_CSC_COUNT : MEM_SCRVAR_COUNT); i < newCount; i++)
+	else
 	{
-		currentRef[i].value.type = VAR_FREE;
-		currentRef[i].o.size = i + 1;
+		ScrVarSnapshot::FormatSummary(current, 8, text);
 	}
 
-	// clear last variable so the vm knows where to stop
-	currentRef[newCount - 1].o.size = 0;
-
-	*llpScrVarMemPool = (INT64)newVarMemPool;
-}
-
-void GSCBuiltins::GScr_debugallocvariables(int scriptInst)
-{
-	int numVariables = ScrVm_GetInt(scriptInst, 1);
-	int varIndex = 0;
-
-	ScrVar_t* variables = (ScrVar_t*)*(INT64*)((char*)OFF_ScrVarGlob + 128 + (scriptInst << 8));
-	for (int i = 0; i < numVariables; i++)
+	for (size_t at = 0, next; at < text.size(); at = next + 1)
 	{
-		varIndex = ScrVar_AllocVariableInternal(scriptInst, 1, 0, varIndex);
-		variables[varIndex].value.type = VAR_UNDEFINED;
+		next = text.find('\n', at);
+		next = (next == std::string::npos) ? text.size() : next;
+		nlog("[heap] %s", text.substr(at, next - at).c_str());
 	}
+
+	Scr_AddInt(scriptInst, current.Header.NumLive);
+	last.swap(snapshot);
 }
 
 void GSCBuiltins::GScr_runtimedetour(int scriptInst)
@@ -431,27 +551,8 @@ void GSCBuiltins::GScr_runtimedetour(int scriptInst)
 		return; // buffer doesnt exist
 	}
 
-	auto exportsOffset = *(INT32*)(buffer + 0x20);
-	auto exports = (INT64)(exportsOffset + buffer);
-	auto numExports = *(INT16*)(buffer + 0x3A);
-	__t7export* currentExport = (__t7export*)exports;
-	bool b_found = false;
-	for (INT16 i = 0; i < numExports; i++, currentExport++)
-	{
-		if (currentExport->funcName != n_func)
-		{
-			continue;
-		}
-		if (currentExport->funcNS != n_namespace)
-		{
-			continue;
-		}
-		b_found = true;
-		break;
-	}
-
-	char* fPos = buffer + currentExport->bytecodeOffset;
-	ScriptDetours::RegisterRuntimeDetour((INT64)funcHandle, n_func, n_namespace, str_file, b_found ? fPos : NULL);
+	INT32 bytecodeOffset = ExportIndex::FindExport(buffer, n_namespace, n_func);
+	ScriptDetours::RegisterRuntimeDetour((INT64)funcHandle, n_func, n_namespace, str_file, bytecodeOffset ? (buffer + bytecodeOffset) : NULL);
 }
 
 void GSCBuiltins::GScr_enableonlinematch(int scriptInst)
@@ -471,23 +572,4 @@ void GSCBuiltins::GScr_catch_exit(int scriptInst)
 void GSCBuiltins::GScr_abort(int scriptInst)
 {
 	((void(__fastcall*)())REBASE(0, 0))();
-}
-
-void GSCBuiltins::nlog(const char* str, ...)
-{
-	va_list ap;
-	HWND notepad, edit;
-	char buf[256];
-
-	va_start(ap, str);
-	vsprintf(buf, str, ap);
-	va_end(ap);
-	strcat_s(buf, 256, "\r\n");
-	notepad = FindWindow(NULL, "Untitled - Notepad");
-	if (!notepad)
-	{
-		notepad = FindWindow(NULL, "*Untitled - Notepad");
-	}
-	edit = FindWindowEx(notepad, NULL, "EDIT", NULL);
-	SendMessage(edit, EM_REPLACESEL, TRUE, (LPARAM)buf);
 }
\ No newline at end of file
@@ -1,7 +1,15 @@
 #pragma once
 #include "framework.h"
+#ifdef _WIN32
 #include <winnt.h>
+#endif
 #include <unordered_map>
+#include <shared_mutex>
+#include <atomic>
+#include "builtindispatch.h"
+#include "asynclog.h"
+#include "detours.h"
+#include "scrvar.h"
 
 struct alignas(8) BuiltinFunctionDef
 {
@@ -12,6 +20,20 @@ struct alignas(8) BuiltinFunctionDef
 	int type;
 };
 
+// compiler::name() calls get their own canon id so the linker resolves them to a dedicated def instead of isprofilebuild.
+// the hash is still passed as the first parameter, so a builtin works the same through either path.
+#define BUILTIN_DIRECT_SALT 0x3C6EF372
+#define BUILTIN_DIRECT_VERSION 1
+
+constexpr INT32 DirectBuiltinId(uint32_t hash)
+{
+	return (INT32)((hash ^ BUILTIN_DIRECT_SALT) * 0x1000193);
+}
+
+EXPORT INT32 GetDirectBuiltinSupport();
+// opt in to game time commands around livesplit starts and splits, see EventChannel::SetSplitTiming
+EXPORT void SetLiveSplitGameTime(bool enabled);
+
 typedef INT64(__fastcall* tScrVm_GetInt)(unsigned int inst, unsigned int index);
 typedef char* (__fastcall* tScrVm_GetString)(unsigned int inst, unsigned int index);
 typedef INT32(__fastcall* tScrVar_AllocVariableInternal)(unsigned int inst, unsigned int nameType, __int64 a3, unsigned int a4);
@@ -26,152 +48,52 @@ public:
 	static tScrVm_GetString ScrVm_GetString;
 	static tScrVm_GetFunc ScrVm_GetFunc;
 	static tScrVar_AllocVariableInternal ScrVar_AllocVariableInternal;
+	static bool DirectBuiltinsInstalled;
 
 private:
 	static void Exec(int scriptInst);
 	static void Scr_CastInt_Wrapper(int scriptInst);
-	static void Generate();
+	static const BuiltinDef Builtins[];
+	static const BuiltinDispatch Dispatch;
+	// builtins added at runtime through AddCustomFunction
 	static std::unordered_map<int, void*> CustomFunctions;
+	// canon id -> def handed to the linker, one per builtin
+	static std::unordered_map<INT32, BuiltinFunctionDef> DirectBuiltins;
+	// guards both maps, AddCustomFunction is called from the injector thread while the vm links and runs
+	static std::shared_mutex CustomLock;
+	static std::atomic<bool> HasCustomFunctions;
+	static void AddDirectBuiltin(uint32_t hash, void* func, int minArgs, int maxArgs);
+	static INT64 Scr_GetFunction_Hook(INT32 canonID, INT32* type, INT32* min_args, INT32* max_args);
+	static tScr_GetFunction Scr_GetFunction_Original;
+	// last compiler::heapsnapshot() per vm, diffed against the next one
+	static std::vector<uint8_t> HeapSnapshots[2];
 
 private:
 	static void GScr_nprintln(int scriptInst);
 	static void GScr_detour(int scriptInst);
 	static void GScr_relinkDetours(int scriptInst);
+	static void GScr_eagerDetours(int scriptInst);
 	static void GScr_livesplit(int scriptInst);
 	static void GScr_patchbyte(int scriptInst);
+	static void GScr_patchbegin(int scriptInst);
+	static void GScr_patchcommit(int scriptInst);
+	static void GScr_patchundo(int scriptInst);
 	static void GScr_erasefunc(int scriptInst);
+	static void GScr_erasefuncs(int scriptInst);
 	static void GScr_setmempool(int scriptInst);
 	static void GScr_debugallocvariables(int scriptInst);
+	static void GScr_benchmarkvariables(int scriptInst);
+	static void GScr_heapsnapshot(int scriptInst);
 	static void GScr_runtimedetour(int scriptInst);
 	static void GScr_catch_exit(int scriptInst);
 	static void GScr_abort(int scriptInst);
 	static void GScr_enableonlinematch(int scriptInst);
 
 public:
-	static void nlog(const char* str, ...);
-};
-
-typedef uint32_t ScrVarIndex_t;
-typedef uint32_t ScrString_t;
-typedef uint64_t ScrVarNameIndex_t;
-typedef uint32_t ScrVarCannonicalName_t;
-
-enum ScrVarType_t
-{
-	VAR_UNDEFINED = 0,
-	VAR_POINTER = 1,
-	VAR_STRING = 2,
-	VAR_ISTRING = 3,
-	VAR_VECTOR = 4,
-	VAR_HASH = 5,
-	VAR_FLOAT = 6,
-	VAR_INTEGER = 7,
-	VAR_UINT64 = 8,
-	VAR_UINTPTR = 9,
-	VAR_ENTITYOFFSET = 10,
-	VAR_CODEPOS = 11,
-	VAR_PRECODEPOS = 12,
-	VAR_APIFUNCTION = 13,
-	VAR_FUNCTION = 14,
-	VAR_STACK = 15,
-	VAR_ANIMATION = 16,
-	VAR_THREAD = 17,
-	VAR_NOTIFYTHREAD = 18,
-	VAR_TIMETHREAD = 19,
-	VAR_CHILDTHREAD = 20,
-	VAR_CLASS = 21,
-	VAR_STRUCT = 22,
-	VAR_REMOVEDENTITY = 23,
-	VAR_ENTITY = 24,
-	VAR_ARRAY = 25,
-	VAR_REMOVEDTHREAD = 26,
-	VAR_FREE = 27,
-	VAR_THREADLIST = 28,
-	VAR_ENTLIST = 29,
-	VAR_COUNT = 30
-};
-
-struct ScrVarChildPair_t
-{
-	ScrVarIndex_t firstChild;
-	ScrVarIndex_t lastChild;
-};
-
-struct ScrVarStackBuffer_t
-{
-	BYTE* pos;
-	BYTE* creationPos;
-	unsigned __int16 size;
-	unsigned __int16 bufLen;
-	ScrVarIndex_t threadId;
-	BYTE buf[1];
-};
-
-union ScrVarValueUnion_t
-{
-	int64_t intValue;
-	int32_t hashValue;
-	uintptr_t uintptrValue;
-	float floatValue;
-	ScrString_t stringValue;
-	const float* vectorValue;
-	BYTE* codePosValue;
-	ScrVarIndex_t pointerValue;
-	ScrVarStackBuffer_t* stackValue;
-	ScrVarChildPair_t childPair;
-};
-
-__declspec(align(8)) struct ScrVarValue_t
-{
-	ScrVarValueUnion_t u;
-	ScrVarType_t type;
-	uint32_t pad;
-};
-
-struct ScrVarRuntimeInfo_t
-{
-	unsigned __int32 nameType : 3;
-	unsigned __int32 flags : 5;
-	unsigned __int32 refCount : 24;
-};
-
-union EntRefUnion
-{
-	uint64_t val;
-};
-
-__declspec(align(8)) union ScrVarObjectInfo_t
-{
-	uint64_t object_o;
-	unsigned int size;
-	EntRefUnion entRefUnion;
-	ScrVarIndex_t nextEntId;
-	ScrVarIndex_t self;
-	ScrVarIndex_t free;
-};
-
-struct ScrVarEntityInfo_t
-{
-	unsigned __int16 classNum;
-	unsigned __int16 clientNum;
-};
-
-union ScrVarObjectW_t
-{
-	uint32_t object_w;
-	ScrVarEntityInfo_t varEntityInfo;
-	ScrVarIndex_t stackId;
-};
-
-struct ScrVar_t
-{
-	ScrVarValue_t value; // 0 (size 10)
-	ScrVarRuntimeInfo_t info; // 10 (size 4)
-	ScrVarObjectInfo_t o; // 18 (size 8)
-	ScrVarObjectW_t w; // 20 (size 4)
-	ScrVarNameIndex_t nameIndex; // 28 (size 8)
-	ScrVarIndex_t nextSibling; // 30 (size 4)
-	ScrVarIndex_t prevSibling; // 34 (size 4)
-	ScrVarIndex_t parentId; // 38 (size 4)
-	ScrVarIndex_t nameSearchHashList; // 3C (size 4)
+	// queued for the log drain thread, never blocks the vm
+	template <typename... Args>
+	static void nlog(const char* str, Args... args)
+	{
+		AsyncLog::Write(LOG_LEVEL_INFO, str, args...);
+	}
 };
\ No newline at end of file
@@ -0,0 +1,392 @@
+#include "bytecodepatch.h"
+#include "detours.h"
+#include "assetcache.h"
+#include "exportindex.h"
+#include <algorithm>
+
+std::mutex BytecodePatcher::JournalLock;
+std::vector<BytecodePatcher::JournalBatch> BytecodePatcher::Journal;
+INT32 BytecodePatcher::JournalGeneration = 0;
+BytecodePatcher::StagedBatch BytecodePatcher::Staged[2];
+
+struct ProtectedRegion
+{
+	char* Start;
+	SIZE_T Size;
+	DWORD OldProtect;
+};
+
+static void RestoreRegions(std::vector<ProtectedRegion>& regions)
+{
+	// reverse order, regions of neighbouring buffers can share a page
+	DWORD discard;
+	for (auto it = regions.rbegin(); it != regions.rend(); it++)
+	{
+		VirtualProtect(it->Start, it->Size, it->OldProtect, &discard);
+	}
+	regions.clear();
+}
+
+EXPORT INT32 ApplyBytecodePatches(void* batch)
+{
+	auto header = (PatchBatchHeader*)batch;
+	if (header->Magic != PATCH_BATCH_MAGIC || header->Version != PATCH_BATCH_VERSION || header->RecordSize != sizeof(PatchBatchRecord))
+	{
+		return PATCH_ERROR_BADBATCH;
+	}
+	if (header->NumPatches < 0 || header->StringTableSize < 0 || header->DataSize < 0)
+	{
+		return PATCH_ERROR_BADBATCH;
+	}
+
+	const char* strings = (const char*)(header + 1);
+	auto record = (PatchBatchRecord*)(strings + header->StringTableSize);
+	auto data = (const BYTE*)(record + header->NumPatches);
+
+	std::vector<BytecodeEdit> edits;
+	edits.reserve(header->NumPatches);
+	for (INT32 i = 0; i < header->NumPatches; i++, record++)
+	{
+		if (record->ScriptName < 0 || record->ScriptName >= header->StringTableSize)
+		{
+			return PATCH_ERROR_BADBATCH;
+		}
+		const char* name = strings + record->ScriptName;
+		if (strnlen(name, header->StringTableSize - record->ScriptName) == (size_t)(header->StringTableSize - record->ScriptName))
+		{
+			return PATCH_ERROR_BADBATCH; // unterminated name
+		}
+		edits.push_back({ name, record->Offset, record->Size, record->Data });
+	}
+
+	return BytecodePatcher::Apply(edits.data(), (INT32)edits.size(), data, header->DataSize);
+}
+
+EXPORT INT32 UndoBytecodePatches(INT32 numBatches)
+{
+	return BytecodePatcher::Undo(numBatches);
+}
+
+EXPORT INT32 EraseScriptFunctions(const char* script, const INT32* funcs, INT32 count)
+{
+	return BytecodePatcher::EraseFunctions(script, funcs, count);
+}
+
+INT32 BytecodePatcher::Apply(const BytecodeEdit* edits, INT32 count, const BYTE* data, INT32 dataSize)
+{
+	std::lock_guard<std::mutex> lock(JournalLock);
+	return ApplyLocked(edits, count, data, dataSize, false);
+}
+
+INT32 BytecodePatcher::PatchByte(const char* script, INT32 offset, BYTE value)
+{
+	BytecodeEdit edit = { script, offset, 1, 0 };
+	std::lock_guard<std::mutex> lock(JournalLock);
+	return ApplyLocked(&edit, 1, &value, 1, true);
+}
+
+INT32 BytecodePatcher::ApplyLocked(const BytecodeEdit* edits, INT32 count, const BYTE* data, INT32 dataSize, bool loose)
+{
+	CheckGeneration();
+
+	struct ResolvedEdit
+	{
+		INT64 Asset;
+		char* Buffer;
+		const BytecodeEdit* Edit;
+	};
+
+	// validate every edit before touching a single byte. consecutive edits usually name the same script, so only look it up when it changes
+	std::vector<ResolvedEdit> resolved;
+	resolved.reserve(count);
+	const char* lastName = NULL;
+	INT64 lastAsset = 0;
+	for (INT32 i = 0; i < count; i++)
+	{
+		auto& edit = edits[i];
+		if (!edit.Script)
+		{
+			return PATCH_ERROR_BADBATCH;
+		}
+		if (!lastName || (edit.Script != lastName && strcmp(edit.Script, lastName)))
+		{
+			lastAsset = ScriptDetours::FindScriptParsetree(edit.Script);
+			lastName = edit.Script;
+		}
+
+		auto spt = (SPTEntry*)lastAsset;
+		if (!spt || !spt->Buffer)
+		{
+			return PATCH_ERROR_NOSCRIPT;
+		}
+		if (edit.Size <= 0 || edit.Offset < 0 || edit.Offset > spt->buffSize - edit.Size)
+		{
+			return PATCH_ERROR_BOUNDS;
+		}
+		if (edit.Data < 0 || edit.Data > dataSize - edit.Size)
+		{
+			return PATCH_ERROR_BADBATCH;
+		}
+		resolved.push_back({ lastAsset, spt->Buffer, &edit });
+	}
+
+	if (resolved.empty())
+	{
+		return 0;
+	}
+
+	// stable so overlapping edits still land in submission order
+	std::stable_sort(resolved.begin(), resolved.end(), [](const ResolvedEdit& a, const ResolvedEdit& b)
+	{
+		return (a.Buffer != b.Buffer) ? (a.Buffer < b.Buffer) : (a.Edit->Offset < b.Edit->Offset);
+	});
+
+	// one protection change per buffer, spanning every edit made to it
+	std::vector<ProtectedRegion> regions;
+	for (size_t i = 0; i < resolved.size();)
+	{
+		char* buffer = resolved[i].Buffer;
+		INT32 start = resolved[i].Edit->Offset;
+		INT32 end = start;
+		for (; i < resolved.size() && resolved[i].Buffer == buffer; i++)
+		{
+			INT32 editEnd = resolved[i].Edit->Offset + resolved[i].Edit->Size;
+			end = (editEnd > end) ? editEnd : end;
+		}
+
+		ProtectedRegion region = { buffer + start, (SIZE_T)(end - start), 0 };
+		if (!VirtualProtect(region.Start, region.Size, PAGE_READWRITE, &region.OldProtect))
+		{
+			RestoreRegions(regions);
+			return PATCH_ERROR_PROTECT;
+		}
+		regions.push_back(region);
+	}
+
+	// originals are all taken before the first write, so undoing in reverse gives back the bytes from before the batch
+	JournalBatch batch;
+	INT32 written = 0;
+	for (auto& entry : resolved)
+	{
+		auto edit = entry.Edit;
+		batch.Records.push_back({ entry.Asset, entry.Buffer, edit->Offset, edit->Size, (INT32)batch.Originals.size() });
+		batch.Originals.insert(batch.Originals.end(), entry.Buffer + edit->Offset, entry.Buffer + edit->Offset + edit->Size);
+	}
+	for (auto& entry : resolved)
+	{
+		memcpy(entry.Buffer + entry.Edit->Offset, data + entry.Edit->Data, entry.Edit->Size);
+		written += entry.Edit->Size;
+	}
+	RestoreRegions(regions);
+
+	char* lastBuffer = NULL;
+	for (auto& entry : resolved)
+	{
+		if (entry.Buffer != lastBuffer)
+		{
+			ExportIndex::Invalidate(entry.Buffer);
+			lastBuffer = entry.Buffer;
+		}
+	}
+
+	// appended records come after the ones already there, UndoBatch walks back to front so they are undone first
+	if (loose && !Journal.empty() && Journal.back().Loose)
+	{
+		auto& open = Journal.back();
+		for (auto& record : batch.Records)
+		{
+			record.Original += (INT32)open.Originals.size();
+			open.Records.push_back(record);
+		}
+		open.Originals.insert(open.Originals.end(), batch.Originals.begin(), batch.Originals.end());
+		return written;
+	}
+	batch.Loose = loose;
+	Journal.push_back(std::move(batch));
+	return written;
+}
+
+INT32 BytecodePatcher::EraseFunctions(const char* script, const INT32* funcs, INT32 count)
+{
+	auto spt = (SPTEntry*)ScriptDetours::FindScriptParsetree(script);
+	if (!spt || !spt->Buffer)
+	{
+		return PATCH_ERROR_NOSCRIPT;
+	}
+
+	std::vector<BytecodeEdit> edits;
+	INT32 longest = 0;
+	for (INT32 i = 0; i < count; i++)
+	{
+		// missing functions are skipped, same as erasing one at a time
+		FunctionExtent extent;
+		if (!ExportIndex::FindExtent(spt->Buffer, funcs[i * 2], funcs[i * 2 + 1], &extent))
+		{
+			continue;
+		}
+
+		// whole opcodes only, the prologue is kept so the vm still sets up the frame it expects
+		INT32 size = (extent.End - extent.PrologueEnd) & ~1;
+		if (size <= 0)
+		{
+			continue;
+		}
+		edits.push_back({ script, extent.PrologueEnd, size, 0 });
+		longest = (size > longest) ? size : longest;
+	}
+
+	if (edits.empty())
+	{
+		return 0;
+	}
+
+	// every edit shares the same run of OP_END
+	std::vector<BYTE> ends(longest);
+	for (INT32 i = 0; i < longest; i += 2)
+	{
+		*(UINT16*)(ends.data() + i) = 0x10; // OP_END
+	}
+
+	INT32 result = Apply(edits.data(), (INT32)edits.size(), ends.data(), longest);
+	return (result < 0) ? result : (INT32)edits.size();
+}
+
+void BytecodePatcher::UndoBatch(JournalBatch& batch)
+{
+	// back to front, a loose batch can hold several edits of the same bytes in the order they were made
+	std::vector<ProtectedRegion> regions;
+	for (size_t i = batch.Records.size(); i > 0;)
+	{
+		size_t last = i;
+		auto& tail = batch.Records[last - 1];
+		INT32 start = tail.Offset;
+		INT32 end = start;
+		for (; i > 0 && batch.Records[i - 1].Buffer == tail.Buffer; i--)
+		{
+			INT32 recordEnd = batch.Records[i - 1].Offset + batch.Records[i - 1].Size;
+			start = (batch.Records[i - 1].Offset < start) ? batch.Records[i - 1].Offset : start;
+			end = (recordEnd > end) ? recordEnd : end;
+		}
+
+		// the script was reloaded or unloaded since, nothing of ours is left in it
+		if (((SPTEntry*)tail.Asset)->Buffer != tail.Buffer)
+		{
+			continue;
+		}
+
+		ProtectedRegion region = { tail.Buffer + start, (SIZE_T)(end - start), 0 };
+		if (!VirtualProtect(region.Start, region.Size, PAGE_READWRITE, &region.OldProtect))
+		{
+			continue;
+		}
+		regions.push_back(region);
+
+		for (size_t j = last; j > i; j--)
+		{
+			auto& record = batch.Records[j - 1];
+			memcpy(record.Buffer + record.Offset, batch.Originals.data() + record.Original, record.Size);
+		}
+		ExportIndex::Invalidate(tail.Buffer);
+	}
+	RestoreRegions(regions);
+}
+
+INT32 BytecodePatcher::Undo(INT32 numBatches)
+{
+	std::lock_guard<std::mutex> lock(JournalLock);
+	CheckGeneration();
+
+	INT32 undone = 0;
+	while (!Journal.empty() && (numBatches < 0 || undone < numBatches))
+	{
+		UndoBatch(Journal.back());
+		Journal.pop_back();
+		undone++;
+	}
+	return undone;
+}
+
+void BytecodePatcher::UndoAll()
+{
+	while (!Journal.empty())
+	{
+		UndoBatch(Journal.back());
+		Journal.pop_back();
+	}
+}
+
+void BytecodePatcher::Reset()
+{
+	{
+		std::lock_guard<std::mutex> lock(JournalLock);
+		UndoAll();
+	}
+	for (auto& staged : Staged)
+	{
+		staged.Clear();
+	}
+}
+
+void BytecodePatcher::CheckGeneration()
+{
+	// a map change or ui transition happened since the last batch, roll back whatever survived it
+	INT32 generation = ScriptAssetCache::Generation();
+	if (generation == JournalGeneration)
+	{
+		return;
+	}
+	UndoAll();
+	JournalGeneration = generation;
+}
+
+void BytecodePatcher::StagedBatch::Clear()
+{
+	IsStaging = false;
+	Edits.clear();
+	Data.clear();
+	Names.clear();
+}
+
+void BytecodePatcher::Begin(int inst)
+{
+	Staged[inst].Clear();
+	Staged[inst].IsStaging = true;
+}
+
+bool BytecodePatcher::Staging(int inst)
+{
+	return Staged[inst].IsStaging;
+}
+
+void BytecodePatcher::Stage(int inst, const char* script, INT32 offset, BYTE value)
+{
+	auto& staged = Staged[inst];
+	const char* name = staged.Names.emplace(script).first->c_str();
+
+	// runs of bytes in the same script become one edit
+	if (!staged.Edits.empty())
+	{
+		auto& last = staged.Edits.back();
+		if (last.Script == name && last.Offset + last.Size == offset && last.Data + last.Size == (INT32)staged.Data.size())
+		{
+			last.Size++;
+			staged.Data.push_back(value);
+			return;
+		}
+	}
+
+	staged.Edits.push_back({ name, offset, 1, (INT32)staged.Data.size() });
+	staged.Data.push_back(value);
+}
+
+INT32 BytecodePatcher::Commit(int inst)
+{
+	auto& staged = Staged[inst];
+	if (!staged.IsStaging)
+	{
+		return 0;
+	}
+	INT32 result = Apply(staged.Edits.data(), (INT32)staged.Edits.size(), staged.Data.data(), (INT32)staged.Data.size());
+	staged.Clear();
+	return result;
+}
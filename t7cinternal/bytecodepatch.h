@@ -0,0 +1,105 @@
+#pragma once
+#include "framework.h"
+#include <vector>
+#include <string>
+#include <unordered_set>
+#include <mutex>
+
+#define PATCH_BATCH_MAGIC 0x48435450 // PTCH
+#define PATCH_BATCH_VERSION 1
+
+#define PATCH_ERROR_BADBATCH -1
+#define PATCH_ERROR_NOSCRIPT -2
+#define PATCH_ERROR_BOUNDS -3
+#define PATCH_ERROR_PROTECT -4
+
+// header, string table of script names, NumPatches records, then DataSize bytes of patch data
+struct PatchBatchHeader
+{
+	INT32 Magic;
+	INT16 Version;
+	INT16 RecordSize;
+	INT32 NumPatches;
+	INT32 StringTableSize;
+	INT32 DataSize;
+};
+
+struct PatchBatchRecord
+{
+	INT32 ScriptName; // offset into the string table
+	INT32 Offset;
+	INT32 Size;
+	INT32 Data; // offset into the patch data
+};
+
+struct BytecodeEdit
+{
+	const char* Script;
+	INT32 Offset;
+	INT32 Size;
+	INT32 Data;
+};
+
+// returns the number of bytes written, or a PATCH_ERROR if nothing was
+EXPORT INT32 ApplyBytecodePatches(void* batch);
+// returns the number of batches rolled back, -1 for all of them
+EXPORT INT32 UndoBytecodePatches(INT32 numBatches);
+// funcs is count pairs of (namespace, function). returns the number of functions erased, or a PATCH_ERROR
+EXPORT INT32 EraseScriptFunctions(const char* script, const INT32* funcs, INT32 count);
+
+// applies sets of edits to script buffers all or nothing, and journals every batch so it can be rolled back
+class BytecodePatcher
+{
+public:
+	static INT32 Apply(const BytecodeEdit* edits, INT32 count, const BYTE* data, INT32 dataSize);
+	static INT32 Undo(INT32 numBatches);
+	// rolls back every batch, called when the scripts are about to be unloaded
+	static void Reset();
+	// fills the body of every function after its prologue with OP_END, as one batch
+	static INT32 EraseFunctions(const char* script, const INT32* funcs, INT32 count);
+	// compiler::patchbyte() outside a batch. consecutive calls share one journal batch, so one undo takes back the run
+	static INT32 PatchByte(const char* script, INT32 offset, BYTE value);
+
+	// script side batches, built one compiler::patchbyte() at a time and applied on commit. one per vm
+	static void Begin(int inst);
+	static bool Staging(int inst);
+	static void Stage(int inst, const char* script, INT32 offset, BYTE value);
+	static INT32 Commit(int inst);
+
+private:
+	struct UndoRecord
+	{
+		INT64 Asset;
+		char* Buffer;
+		INT32 Offset;
+		INT32 Size;
+		INT32 Original; // offset into the batch originals
+	};
+
+	struct JournalBatch
+	{
+		std::vector<UndoRecord> Records; // grouped by buffer
+		std::vector<BYTE> Originals;
+		bool Loose = false; // built from unbatched patchbyte calls, the next one appends to it
+	};
+
+	struct StagedBatch
+	{
+		bool IsStaging = false;
+		std::vector<BytecodeEdit> Edits;
+		std::vector<BYTE> Data;
+		std::unordered_set<std::string> Names;
+		void Clear();
+	};
+
+	// callers hold JournalLock
+	static INT32 ApplyLocked(const BytecodeEdit* edits, INT32 count, const BYTE* data, INT32 dataSize, bool loose);
+	static void CheckGeneration();
+	static void UndoBatch(JournalBatch& batch);
+	static void UndoAll();
+	// the exports run on the injector thread, patchbyte and the reset on the vm threads
+	static std::mutex JournalLock;
+	static std::vector<JournalBatch> Journal;
+	static INT32 JournalGeneration;
+	static StagedBatch Staged[2];
+};
@@ -2,11 +2,19 @@
 #include "detours.h"
 #include "offsets.h"
 #include "builtins.h"
+#include "exportindex.h"
+#include "inlinehook.h"
+#include "assetcache.h"
+#include "opcodeprofiler.h"
+#include "vmframe.h"
+#include "bytecodepatch.h"
+#include "hotloaddelta.h"
 
 //#define DETOUR_LOGGING 1
 //#define ALOG(fmt, ...) printf(fmt "\n", __VA_ARGS__)
 
-// Note: Some auto-exec scripts will not get detoured due to the way linking works in the game
+// Note: Script detours whose target is not loaded when detours are linked are resolved when Scr_GscObjLink links the target.
+// If that hook cant be installed, compiler::relinkdetours() is the fallback.
 
 struct ReadScriptDetour
 {
@@ -21,11 +29,15 @@ tScr_GetFunction ScriptDetours::Scr_GetFunction = NULL;
 tScr_GetMethod ScriptDetours::Scr_GetMethod = NULL;
 tDB_FindXAssetHeader ScriptDetours::DB_FindXAssetHeader = NULL;
 tScr_GscObjLink ScriptDetours::Scr_GscObjLink = NULL;
+tScr_GscObjLink ScriptDetours::Scr_GscObjLink_Original = NULL;
 char* ScriptDetours::GSC_OBJ = NULL;
 
-std::vector<ScriptDetour*> ScriptDetours::RegisteredDetours;
-std::unordered_map<INT64, ScriptDetour*> ScriptDetours::LinkedDetours;
-std::unordered_map<INT64*, INT64> ScriptDetours::AppliedFixups;
+std::deque<ScriptDetour> ScriptDetours::RegisteredDetours;
+std::unordered_set<std::string> ScriptDetours::ScriptNames;
+std::vector<std::pair<INT64, ScriptDetour*>> ScriptDetours::LinkedEntries;
+DetourTable ScriptDetours::LinkedDetours;
+DetourTable ScriptDetours::FixupTargets;
+FixupJournal ScriptDetours::AppliedFixups;
 tVM_Opcode ScriptDetours::VM_OP_GetFunction_Old = NULL;
 tVM_Opcode ScriptDetours::VM_OP_GetAPIFunction_Old = NULL;
 tVM_Opcode ScriptDetours::VM_OP_ScriptFunctionCall_Old = NULL;
@@ -37,54 +49,99 @@ tVM_Opcode ScriptDetours::VM_OP_CallBuiltinMethod_Old = NULL;
 bool ScriptDetours::DetoursLinked = false;
 bool ScriptDetours::DetoursReset = true;
 bool ScriptDetours::DetoursEnabled = false;
-
-bool _IsBadReadPtr(void* p)
-{
-	MEMORY_BASIC_INFORMATION mbi = { 0 };
-	if (::VirtualQuery(p, &mbi, sizeof(mbi)))
-	{
-		DWORD mask = (PAGE_READONLY | PAGE_READWRITE | PAGE_WRITECOPY | PAGE_EXECUTE_READ | PAGE_EXECUTE_READWRITE | PAGE_EXECUTE_WRITECOPY);
-		bool b = !(mbi.Protect & mask);
-		// check the page is not a guard page
-		if (mbi.Protect & (PAGE_GUARD | PAGE_NOACCESS)) b = true;
-
-		return b;
-	}
-	return true;
-}
+bool ScriptDetours::EagerFixups = false;
+bool ScriptDetours::HooksInstalled = false;
+bool ScriptDetours::LinkHookInstalled = false;
+std::vector<std::pair<INT64, INT64>> ScriptDetours::HookedSlots;
+std::unordered_map<const char*, std::vector<ScriptDetour*>> ScriptDetours::PendingDetours;
 
 void ScriptDetours::ResetDetours()
 {
 #ifdef DETOUR_LOGGING
 	ALOG("Resetting detours...");
 #endif
-	for (auto it = ScriptDetours::AppliedFixups.begin(); it != ScriptDetours::AppliedFixups.end(); it++)
-	{
-		if (_IsBadReadPtr(it->first))
-		{
-			continue;
-		}
-		*it->first = it->second;
-	}
-	ScriptDetours::AppliedFixups.clear();
+	ScriptDetours::AppliedFixups.Restore();
+#ifdef DETOUR_LOGGING
+	FixupJournalStats stats;
+	ScriptDetours::AppliedFixups.GetStats(&stats);
+	ALOG("Restored %d fixups (%d skipped) in %lldus", stats.LastRestored, stats.LastSkipped, stats.LastRestoreMicroseconds);
+#endif
+	BytecodePatcher::Reset();
+	ExportIndex::Clear();
+	ScriptAssetCache::Invalidate();
 	ScriptDetours::DetoursReset = true;
 	ScriptDetours::DetoursLinked = false;
 	ScriptDetours::DetoursEnabled = false;
+	ScriptDetours::RemoveHooks();
+}
+
+const char* ScriptDetours::InternScriptName(const char* name, size_t maxLength)
+{
+	return ScriptNames.emplace(name, strnlen(name, maxLength)).first->c_str();
 }
 
 void ScriptDetours::RegisterRuntimeDetour(INT64 hFixup, INT32 replaceFunc, INT32 replaceNS, const char* replaceName, char* fPosOrNull)
 {
-	ScriptDetour* detour = new ScriptDetour();
-	detour->hFixup = hFixup;
-	detour->ReplaceFunction = replaceFunc;
-	detour->ReplaceNamespace = replaceNS;
-	detour->FixupSize = 0;
-	memcpy_s(detour->ReplaceScriptName, sizeof(detour->ReplaceScriptName), replaceName, strlen(replaceName) + 1);
-	ScriptDetours::RegisteredDetours.push_back(detour);
-	if (fPosOrNull)
+	const char* scriptName = InternScriptName(replaceName, MAX_PATH);
+
+	// repeated calls for the same target just retarget the existing runtime detour
+	ScriptDetour* detour = NULL;
+	for (auto it = RegisteredDetours.begin(); it != RegisteredDetours.end(); it++)
+	{
+		if (!it->FixupSize && it->ReplaceFunction == replaceFunc && it->ReplaceNamespace == replaceNS && it->ReplaceScriptName == scriptName)
+		{
+			detour = &*it;
+			detour->hFixup = hFixup;
+			break;
+		}
+	}
+
+	if (!detour)
+	{
+		detour = AddDetour({ scriptName, replaceNS, replaceFunc, hFixup, 0, NextStatsIndex() });
+	}
+
+	if (fPosOrNull && LinkedDetours.Find((INT64)fPosOrNull) != detour)
+	{
+		LinkedEntries.push_back({ (INT64)fPosOrNull, detour }); // skip relinking if we dont have to!
+		DetourStats::SetResolved(detour->StatsIndex);
+		BuildLinkTables();
+		if (EagerFixups && DetoursLinked)
+		{
+			ApplyEagerFixups();
+		}
+	}
+}
+
+ScriptDetour* ScriptDetours::AddDetour(const ScriptDetour& detour)
+{
+	RegisteredDetours.push_back(detour);
+	DetourStats::Publish(RegisteredDetours.back());
+	return &RegisteredDetours.back();
+}
+
+// a detour body moved, point everything that redirected to the old one at the new one
+INT32 ScriptDetours::RetargetFixup(INT64 hFixup, INT64 hNewFixup, INT32 newSize)
+{
+	INT32 numRetargeted = 0;
+	for (auto it = RegisteredDetours.begin(); it != RegisteredDetours.end(); it++)
+	{
+		if (it->hFixup == hFixup)
+		{
+			it->hFixup = hNewFixup;
+			if (it->FixupSize)
+			{
+				it->FixupSize = newSize;
+			}
+			numRetargeted++;
+		}
+	}
+
+	if (numRetargeted)
 	{
-		LinkedDetours[(INT64)fPosOrNull] = detour; // skip relinking if we dont have to!
+		BuildLinkTables();
 	}
+	return numRetargeted;
 }
 
 EXPORT void RemoveDetours()
@@ -92,13 +149,21 @@ EXPORT void RemoveDetours()
 #ifdef DETOUR_LOGGING
 	ALOG("Removing detours...");
 #endif
-	for (auto it = ScriptDetours::RegisteredDetours.begin(); it != ScriptDetours::RegisteredDetours.end(); it++)
-	{
-		free(*it);
-	}
 	ScriptDetours::ResetDetours();
+	ScriptDetours::LinkedEntries.clear();
+	ScriptDetours::LinkedDetours.Clear();
+	ScriptDetours::FixupTargets.Clear();
+	ScriptDetours::PendingDetours.clear();
+	DetourStats::Clear();
 	ScriptDetours::RegisteredDetours.clear();
+	ScriptDetours::ScriptNames.clear();
 	ScriptDetours::DetoursLinked = false;
+	HotloadDelta::DetoursRemoved();
+}
+
+EXPORT void GetFixupJournalStats(FixupJournalStats* stats)
+{
+	ScriptDetours::AppliedFixups.GetStats(stats);
 }
 
 EXPORT bool RegisterDetours(void* DetourData, int NumDetours, INT64 scriptOffset)
@@ -114,16 +179,53 @@ EXPORT bool RegisterDetours(void* DetourData, int NumDetours, INT64 scriptOffset
 	for (int i = 0; i < NumDetours; i++)
 	{
 		ReadScriptDetour* read_detour = (ReadScriptDetour*)(base + (i * 256));
-		ScriptDetour* detour = new ScriptDetour();
-		detour->hFixup = read_detour->FixupOffset + scriptOffset;
-		detour->ReplaceFunction = read_detour->ReplaceFunction;
-		detour->ReplaceNamespace = read_detour->ReplaceNamespace;
-		detour->FixupSize = read_detour->FixupSize;
+		const char* scriptName = ScriptDetours::InternScriptName((char*)((INT64)read_detour + sizeof(ReadScriptDetour)), 256 - sizeof(ReadScriptDetour));
+		ScriptDetours::AddDetour({ scriptName, read_detour->ReplaceNamespace, read_detour->ReplaceFunction, read_detour->FixupOffset + scriptOffset, read_detour->FixupSize, ScriptDetours::NextStatsIndex() });
 #ifdef DETOUR_LOGGING
+		ScriptDetour* detour = &ScriptDetours::RegisteredDetours.back();
 		ALOG("Detour Parsed: {FixupName:%x, ReplaceNamespace:%x, ReplaceFunction:%x, FixupOffset:%x, FixupSize:%x} {FixupMin:%p, FixupMax:%p}", read_detour->FixupName, read_detour->ReplaceNamespace, read_detour->ReplaceFunction, read_detour->FixupOffset, read_detour->FixupSize, detour->hFixup, detour->hFixup + detour->FixupSize);
 #endif
-		memcpy_s(detour->ReplaceScriptName, sizeof(detour->ReplaceScriptName), (void*)((INT64)read_detour + sizeof(ReadScriptDetour)), 256 - sizeof(ReadScriptDetour));
-		ScriptDetours::RegisteredDetours.push_back(detour);
+	}
+
+	ScriptDetours::DetoursLinked = false;
+	return true;
+}
+
+// header, string table of script names, then fixed 20 byte records. emitted by T7ScriptObject as GSIFields.DetourManifest
+EXPORT bool RegisterDetoursCompact(void* Manifest, INT64 scriptOffset)
+{
+	auto header = (DetourManifestHeader*)Manifest;
+	if (header->Magic != DETOUR_MANIFEST_MAGIC || header->Version != DETOUR_MANIFEST_VERSION || header->RecordSize != sizeof(DetourManifestRecord))
+	{
+		return false;
+	}
+
+	RemoveDetours();
+	ScriptDetours::GSC_OBJ = (char*)scriptOffset;
+
+#ifdef DETOUR_LOGGING
+	ALOG("Registering %d detours in script %p...", header->NumDetours, scriptOffset);
+#endif
+
+	const char* strings = (const char*)(header + 1);
+	auto record = (DetourManifestRecord*)(strings + header->StringTableSize);
+	const char* builtinName = ScriptDetours::InternScriptName("", 1);
+
+	// names are interned per string table entry, not per record
+	std::unordered_map<INT32, const char*> names;
+	for (int i = 0; i < header->NumDetours; i++, record++)
+	{
+		const char* scriptName = builtinName;
+		if (record->ReplaceScriptName >= 0 && record->ReplaceScriptName < header->StringTableSize)
+		{
+			auto found = names.find(record->ReplaceScriptName);
+			if (found == names.end())
+			{
+				found = names.emplace(record->ReplaceScriptName, ScriptDetours::InternScriptName(strings + record->ReplaceScriptName, header->StringTableSize - record->ReplaceScriptName)).first;
+			}
+			scriptName = found->second;
+		}
+		ScriptDetours::AddDetour({ scriptName, record->ReplaceNamespace, record->ReplaceFunction, record->FixupOffset + scriptOffset, record->FixupSize, ScriptDetours::NextStatsIndex() });
 	}
 
 	ScriptDetours::DetoursLinked = false;
@@ -175,7 +277,7 @@ INT64 Scr_GetFunction_(INT32 canonID, INT32* type, INT32* min_args, INT32* max_a
 	return result;
 }
 
-void ScriptDetours::InstallHooks()
+void ScriptDetours::Init()
 {
 	// initialize methods
 
@@ -193,68 +295,139 @@ void ScriptDetours::InstallHooks()
 	DB_FindXAssetHeader = (tDB_FindXAssetHeader)OFF_DB_FindXAssetHeader;
 	Scr_GscObjLink = (tScr_GscObjLink)OFF_Scr_GscObjLink;
 
+	VM_OP_GetAPIFunction_Old = (tVM_Opcode)OFF_VM_OP_GetAPIFunction;
+	VM_OP_GetFunction_Old = (tVM_Opcode)OFF_VM_OP_GetFunction;
+	VM_OP_ScriptFunctionCall_Old = (tVM_Opcode)OFF_VM_OP_ScriptFunctionCall;
+	VM_OP_ScriptMethodCall_Old = (tVM_Opcode)OFF_VM_OP_ScriptMethodCall;
+	VM_OP_ScriptThreadCall_Old = (tVM_Opcode)OFF_VM_OP_ScriptThreadCall;
+	VM_OP_ScriptMethodThreadCall_Old = (tVM_Opcode)OFF_VM_OP_ScriptMethodThreadCall;
+	VM_OP_CallBuiltin_Old = (tVM_Opcode)OFF_VM_OP_CallBuiltin;
+	VM_OP_CallBuiltinMethod_Old = (tVM_Opcode)OFF_VM_OP_CallBuiltinMethod;
+
+	// script load events. installed with the asset cache rather than with the opcode hooks, cached misses depend on it
+	// in every session and detours targeting scripts that link later dont need a relink
+	if (!LinkHookInstalled)
+	{
+		Scr_GscObjLink_Original = (tScr_GscObjLink)InlineHook::Install((INT64)Scr_GscObjLink, (INT64)Scr_GscObjLink_Hook);
+		LinkHookInstalled = Scr_GscObjLink_Original != NULL;
+		ScriptAssetCache::TrackLinks(LinkHookInstalled);
+#ifdef DETOUR_LOGGING
+		if (!LinkHookInstalled)
+		{
+			ALOG("Unable to hook Scr_GscObjLink, late scripts need compiler::relinkdetours()");
+		}
+#endif
+	}
+}
+
+// hooks are only installed while detours are enabled so unmodded sessions run the stock handlers directly
+void ScriptDetours::InstallHooks()
+{
+	if (HooksInstalled)
+	{
+		return;
+	}
+
+	// the profiler hides the stock handlers behind its trampolines, so give them back while we search for them
+	bool profiling = OpcodeProfiler::Suspend();
+
 	// opcodes to hook:
-	VTableReplace(OFF_VM_OP_GetAPIFunction, VM_OP_GetAPIFunction, &VM_OP_GetAPIFunction_Old);
-	VTableReplace(OFF_VM_OP_GetFunction, VM_OP_GetFunction, &VM_OP_GetFunction_Old);
-	VTableReplace(OFF_VM_OP_ScriptFunctionCall, VM_OP_ScriptFunctionCall, &VM_OP_ScriptFunctionCall_Old);
-	VTableReplace(OFF_VM_OP_ScriptMethodCall, VM_OP_ScriptMethodCall, &VM_OP_ScriptMethodCall_Old);
-	VTableReplace(OFF_VM_OP_ScriptThreadCall, VM_OP_ScriptThreadCall, &VM_OP_ScriptThreadCall_Old);
-	VTableReplace(OFF_VM_OP_ScriptMethodThreadCall, VM_OP_ScriptMethodThreadCall, &VM_OP_ScriptMethodThreadCall_Old);
-	VTableReplace(OFF_VM_OP_CallBuiltin, VM_OP_CallBuiltin, &VM_OP_CallBuiltin_Old);
-	VTableReplace(OFF_VM_OP_CallBuiltinMethod, VM_OP_CallBuiltinMethod, &VM_OP_CallBuiltinMethod_Old);
+	VTableReplace(OFF_VM_OP_GetAPIFunction, VM_OP_GetAPIFunction);
+	VTableReplace(OFF_VM_OP_GetFunction, VM_OP_GetFunction);
+	VTableReplace(OFF_VM_OP_ScriptFunctionCall, VM_OP_ScriptFunctionCall);
+	VTableReplace(OFF_VM_OP_ScriptMethodCall, VM_OP_ScriptMethodCall);
+	VTableReplace(OFF_VM_OP_ScriptThreadCall, VM_OP_ScriptThreadCall);
+	VTableReplace(OFF_VM_OP_ScriptMethodThreadCall, VM_OP_ScriptMethodThreadCall);
+	VTableReplace(OFF_VM_OP_CallBuiltin, VM_OP_CallBuiltin);
+	VTableReplace(OFF_VM_OP_CallBuiltinMethod, VM_OP_CallBuiltinMethod);
+	if (profiling)
+	{
+		OpcodeProfiler::Resume();
+	}
+	HooksInstalled = true;
+}
+
+void ScriptDetours::RemoveHooks()
+{
+	if (!HooksInstalled)
+	{
+		return;
+	}
+
+	bool profiling = OpcodeProfiler::Suspend();
+	for (auto it = HookedSlots.rbegin(); it != HookedSlots.rend(); it++)
+	{
+		chgmem<uint64_t>(it->first, (uint64_t)it->second);
+	}
+	HookedSlots.clear();
+	if (profiling)
+	{
+		OpcodeProfiler::Resume();
+	}
+	HooksInstalled = false;
 }
 
-INT64 ScriptDetours::FindScriptParsetree(char* name)
+INT64 ScriptDetours::FindScriptParsetree(const char* name)
 {
-	return DB_FindXAssetHeader(0x36, name, false, 0);
+	return ScriptAssetCache::Find(name, LookupScriptParsetree);
 }
 
-void ScriptDetours::LinkDetours()
+INT64 ScriptDetours::LookupScriptParsetree(const char* name)
 {
-	LinkedDetours.clear();
-	for (auto it = RegisteredDetours.begin(); it != RegisteredDetours.end(); it++)
+	return DB_FindXAssetHeader(0x36, (char*)name, false, 0);
+}
+
+INT32 ScriptDetours::LinkScriptDetours(char* buffer, const std::vector<ScriptDetour*>& detours)
+{
+	INT32 numLinked = 0;
+	for (auto it = detours.begin(); it != detours.end(); it++)
 	{
 		auto detour = *it;
-		if (detour->ReplaceScriptName[0]) // not a builtin
+		// locate the target export to link
+		auto bytecodeOffset = ExportIndex::FindExport(buffer, detour->ReplaceNamespace, detour->ReplaceFunction);
+		if (bytecodeOffset)
 		{
 #ifdef DETOUR_LOGGING
-			ALOG("Linking replacement %x<%s>::%x...", detour->ReplaceNamespace, detour->ReplaceScriptName, detour->ReplaceFunction);
+			ALOG("Found export %x<%s>::%x at %p!", detour->ReplaceNamespace, detour->ReplaceScriptName, detour->ReplaceFunction, (INT64)buffer + bytecodeOffset);
 #endif
-			// locate the script to replace
-			auto asset = FindScriptParsetree(detour->ReplaceScriptName);
-			if (!asset)
-			{
-#ifdef DETOUR_LOGGING
-				ALOG("Failed to locate %s...", detour->ReplaceScriptName);
-#endif
-				continue;
-			}
+			LinkedEntries.push_back({ (INT64)buffer + bytecodeOffset, detour });
+			DetourStats::SetResolved(detour->StatsIndex);
+			numLinked++;
+		}
+	}
+	return numLinked;
+}
 
-#ifdef DETOUR_LOGGING
-			ALOG("Located xAssetHeader...");
-#endif
-			// locate the target export to link
-			auto buffer = *(char**)(asset + 0x10);
-			auto exportsOffset = *(INT32*)(buffer + 0x20);
-			auto exports = (INT64)(exportsOffset + buffer);
-			auto numExports = *(INT16*)(buffer + 0x3A);
-			__t7export* currentExport = (__t7export*)exports;
-			for (INT16 i = 0; i < numExports; i++, currentExport++)
-			{
-				if (currentExport->funcName != detour->ReplaceFunction)
-				{
-					continue;
-				}
-				if (currentExport->funcNS != detour->ReplaceNamespace)
-				{
-					continue;
-				}
-#ifdef DETOUR_LOGGING
-				ALOG("Found export at %p!", (INT64)buffer + currentExport->bytecodeOffset);
-#endif
-				LinkedDetours[(INT64)buffer + currentExport->bytecodeOffset] = detour;
-				break;
-			}
+void ScriptDetours::BuildLinkTables()
+{
+	LinkedDetours.Build(LinkedEntries);
+
+	std::vector<std::pair<INT64, ScriptDetour*>> fixups;
+	fixups.reserve(LinkedEntries.size());
+	for (auto it = LinkedEntries.begin(); it != LinkedEntries.end(); it++)
+	{
+		if (it->second->hFixup)
+		{
+			fixups.push_back({ it->second->hFixup, it->second });
+		}
+	}
+	FixupTargets.Build(fixups);
+}
+
+void ScriptDetours::LinkDetours()
+{
+	LinkedEntries.clear();
+	PendingDetours.clear();
+	DetourStats::ClearResolved();
+
+	// names are interned, so grouping by pointer means each target script is only looked up once
+	std::unordered_map<const char*, std::vector<ScriptDetour*>> scripts;
+	for (auto it = RegisteredDetours.begin(); it != RegisteredDetours.end(); it++)
+	{
+		auto detour = &*it;
+		if (detour->ReplaceScriptName[0]) // not a builtin
+		{
+			scripts[detour->ReplaceScriptName].push_back(detour);
 		}
 		else
 		{
@@ -274,21 +447,213 @@ void ScriptDetours::LinkDetours()
 #ifdef DETOUR_LOGGING
 				ALOG("Found function definition at %p!", hReplace);
 #endif
-				LinkedDetours[hReplace] = detour;
+				LinkedEntries.push_back({ hReplace, detour });
+				DetourStats::SetResolved(detour->StatsIndex);
 			}
 		}
 	}
+
+	for (auto it = scripts.begin(); it != scripts.end(); it++)
+	{
+#ifdef DETOUR_LOGGING
+		ALOG("Linking %d replacements in %s...", (INT32)it->second.size(), it->first);
+#endif
+		// locate the script to replace
+		auto asset = FindScriptParsetree(it->first);
+		if (!asset)
+		{
+#ifdef DETOUR_LOGGING
+			ALOG("Failed to locate %s, waiting for it to link...", it->first);
+#endif
+			PendingDetours[it->first] = std::move(it->second);
+			continue;
+		}
+		LinkScriptDetours(*(char**)(asset + 0x10), it->second);
+	}
+
+	BuildLinkTables();
 	DetoursLinked = true;
+
+	if (EagerFixups)
+	{
+		ApplyEagerFixups();
+	}
 }
 
-void ScriptDetours::VTableReplace(INT64 stub_final, tVM_Opcode ReplaceFunc, tVM_Opcode* OutOld)
+INT64 ScriptDetours::Scr_GscObjLink_Hook(int inst, char* gsc_obj)
+{
+	INT64 result = Scr_GscObjLink_Original(inst, gsc_obj);
+	ScriptAssetCache::ScriptLinked();
+	if (inst || !gsc_obj || !HooksInstalled || !DetoursLinked || PendingDetours.empty())
+	{
+		return result;
+	}
+
+	auto name = ScriptNames.find(gsc_obj + *(INT32*)(gsc_obj + 0x34));
+	if (name == ScriptNames.end())
+	{
+		return result;
+	}
+
+	auto pending = PendingDetours.find(name->c_str());
+	if (pending == PendingDetours.end())
+	{
+		return result;
+	}
+
+#ifdef DETOUR_LOGGING
+	ALOG("Linking %d pending replacements in %s...", (INT32)pending->second.size(), pending->first);
+#endif
+	INT32 numLinked = LinkScriptDetours(gsc_obj, pending->second);
+	PendingDetours.erase(pending);
+	if (numLinked)
+	{
+		BuildLinkTables();
+		if (EagerFixups)
+		{
+			ApplyEagerFixups();
+		}
+	}
+	return result;
+}
+
+struct EagerCallOpcode
+{
+	INT64 Hook;
+	INT64 Original;
+	INT32 Offset; // same meaning as the CheckDetour offset
+	INT16 Spoof; // opcode to rewrite to when a builtin call becomes a script call, 0 to leave it alone
+};
+
+static EagerCallOpcode EagerCallOpcodes[8];
+
+void ScriptDetours::ApplyEagerFixups()
+{
+	// the table may hold either our hooks or the stock handlers depending on if hooks are installed, so match both
+	EagerCallOpcodes[0] = { (INT64)VM_OP_GetFunction, (INT64)VM_OP_GetFunction_Old, 0, 0 };
+	EagerCallOpcodes[1] = { (INT64)VM_OP_GetAPIFunction, (INT64)VM_OP_GetAPIFunction_Old, 0, 0x7e };
+	EagerCallOpcodes[2] = { (INT64)VM_OP_ScriptFunctionCall, (INT64)VM_OP_ScriptFunctionCall_Old, 1, 0 };
+	EagerCallOpcodes[3] = { (INT64)VM_OP_ScriptMethodCall, (INT64)VM_OP_ScriptMethodCall_Old, 1, 0 };
+	EagerCallOpcodes[4] = { (INT64)VM_OP_ScriptThreadCall, (INT64)VM_OP_ScriptThreadCall_Old, 1, 0 };
+	EagerCallOpcodes[5] = { (INT64)VM_OP_ScriptMethodThreadCall, (INT64)VM_OP_ScriptMethodThreadCall_Old, 1, 0 };
+	EagerCallOpcodes[6] = { (INT64)VM_OP_CallBuiltin, (INT64)VM_OP_CallBuiltin_Old, 1, 0x203 };
+	EagerCallOpcodes[7] = { (INT64)VM_OP_CallBuiltinMethod, (INT64)VM_OP_CallBuiltinMethod_Old, 1, 0x207 };
+
+	// nothing is restored on map change unless detours are enabled, so dont touch anything until they are
+	if (!DetoursEnabled || !LinkedDetours.Count())
+	{
+		return;
+	}
+
+	// opcodes are matched by the handler in the table, which is a trampoline while the profiler is wrapping it
+	bool profiling = OpcodeProfiler::Suspend();
+	INT32 numPatched = 0;
+	SPTEntry* currentSpt = (SPTEntry*)*(INT64*)OFF_xAssetScriptParseTree;
+	INT32 sptCount = *(INT32*)(OFF_xAssetScriptParseTree + 0x14);
+	for (int i = 0; i < sptCount; i++, currentSpt++)
+	{
+		if (!currentSpt->Name) continue;
+		if (!currentSpt->Buffer) continue;
+		if (!currentSpt->buffSize) continue;
+		if (IsClientScript(currentSpt->Name)) continue; // csc isnt detoured, same as CheckDetour, and builtins it shares with gsc would be sent into gsc code
+		numPatched += PatchScriptBuffer(currentSpt->Buffer, currentSpt->buffSize);
+	}
+	if (profiling)
+	{
+		OpcodeProfiler::Resume();
+	}
+
+#ifdef DETOUR_LOGGING
+	ALOG("Eagerly patched %d call sites", numPatched);
+#endif
+}
+
+bool ScriptDetours::IsClientScript(const char* name)
+{
+	size_t length = strlen(name);
+	return length >= 4 && !strcmp(name + length - 4, ".csc");
+}
+
+INT32 ScriptDetours::PatchScriptBuffer(char* buffer, INT32 size)
+{
+	// only walk the bytecode section. call operands are always qword aligned absolute pointers once linked,
+	// so any aligned qword that points at a linked target is a candidate, and the opcode in front of it confirms it.
+	INT64 bytecodeStart = (INT64)buffer + *(INT32*)(buffer + 0x14);
+	INT64 bytecodeEnd = bytecodeStart + *(INT32*)(buffer + 0x30);
+	if (bytecodeStart < (INT64)buffer || bytecodeEnd > (INT64)buffer + size)
+	{
+		return 0;
+	}
+
+	INT32 numPatched = 0;
+	INT64 handler_table = OFF_ScrVm_Opcodes;
+	for (INT64* fixupPtr = (INT64*)((bytecodeStart + 7) & 0xFFFFFFFFFFFFFFF8); (INT64)(fixupPtr + 1) <= bytecodeEnd; fixupPtr++)
+	{
+		ScriptDetour* detour = LinkedDetours.Find(*fixupPtr);
+		if (!detour || !detour->hFixup)
+		{
+			continue;
+		}
+
+		// the opcode sits 2 to 10 bytes in front of the operand depending on the offset and alignment. prefer the closest.
+		for (INT64 op = (INT64)fixupPtr - 2; op >= (INT64)fixupPtr - 10 && op >= bytecodeStart; op -= 2)
+		{
+			UINT16 code = *(UINT16*)op;
+			if (code >= 0x2000)
+			{
+				continue;
+			}
+
+			INT64 handler = *(INT64*)(handler_table + (code * 8));
+			EagerCallOpcode* match = NULL;
+			for (int i = 0; i < (int)ARRAYSIZE(EagerCallOpcodes); i++)
+			{
+				if (EagerCallOpcodes[i].Hook != handler && EagerCallOpcodes[i].Original != handler)
+				{
+					continue;
+				}
+				if (((op + 2 + 7 + EagerCallOpcodes[i].Offset) & ~7LL) != (INT64)fixupPtr)
+				{
+					continue;
+				}
+				match = &EagerCallOpcodes[i];
+				break;
+			}
+
+			if (!match)
+			{
+				continue;
+			}
+
+			INT64 fs_pos = op + 2;
+			if (detour->hFixup <= fs_pos && fs_pos < (detour->hFixup + detour->FixupSize))
+			{
+				break; // call from inside the detour itself, leave it alone
+			}
+
+			AppliedFixups.Append(fixupPtr, *fixupPtr, (INT16*)op);
+			*fixupPtr = detour->hFixup;
+			DetourStats::AddPatchedSite(detour->StatsIndex);
+			if (match->Spoof)
+			{
+				*(INT16*)op = match->Spoof;
+			}
+			DetoursReset = false;
+			numPatched++;
+			break;
+		}
+	}
+	return numPatched;
+}
+
+void ScriptDetours::VTableReplace(INT64 stub_final, tVM_Opcode ReplaceFunc)
 {
 	INT64 handler_table = OFF_ScrVm_Opcodes;
-	*OutOld = (tVM_Opcode)stub_final;
 	for (int i = 0; i < 0x2000; i++)
 	{
 		if (*(INT64*)(handler_table + (i * 8)) == stub_final)
 		{
+			HookedSlots.push_back({ handler_table + (i * 8), stub_final });
 			chgmem<uint64_t>(handler_table + (i * 8), (uint64_t)ReplaceFunc);
 		}
 	}
@@ -299,6 +664,7 @@ void ScriptDetours::VTableReplace(INT64 stub_final, tVM_Opcode ReplaceFunc, tVM_
 	{
 		if (*(INT64*)(handler_table + (i * 8)) == stub_final)
 		{
+			HookedSlots.push_back({ handler_table + (i * 8), stub_final });
 			chgmem<uint64_t>(handler_table + (i * 8), (uint64_t)ReplaceFunc);
 		}
 	}
@@ -315,7 +681,7 @@ void ScriptDetours::VM_OP_GetAPIFunction(INT32 inst, INT64* fs_0, INT64 vmc, boo
 	if (CheckDetour(inst, fs_0))
 	{
 		// spoof opcode to GetFunction (because we are no longer calling a builtin)
-		*(INT16*)(*fs_0 - 2) = 0x7e;
+		*(INT16*)VM_OpcodePos(fs_0) = 0x7e;
 		VM_OP_GetFunction_Old(inst, fs_0, vmc, terminate);
 		return;
 	}
@@ -351,7 +717,7 @@ void ScriptDetours::VM_OP_CallBuiltin(INT32 inst, INT64* fs_0, INT64 vmc, bool*
 	if (CheckDetour(inst, fs_0, 1))
 	{
 		// spoof opcode to ScriptFunctionCall (because we are no longer calling a builtin)
-		*(INT16*)(*fs_0 - 2) = 0x203;
+		*(INT16*)VM_OpcodePos(fs_0) = 0x203;
 		VM_OP_ScriptFunctionCall_Old(inst, fs_0, vmc, terminate);
 		return;
 	}
@@ -363,7 +729,7 @@ void ScriptDetours::VM_OP_CallBuiltinMethod(INT32 inst, INT64* fs_0, INT64 vmc,
 	if (CheckDetour(inst, fs_0, 1))
 	{
 		// spoof opcode to ScriptMethodCall (because we are no longer calling a builtin)
-		*(INT16*)(*fs_0 - 2) = 0x207;
+		*(INT16*)VM_OpcodePos(fs_0) = 0x207;
 		VM_OP_ScriptMethodCall_Old(inst, fs_0, vmc, terminate);
 		return;
 	}
@@ -391,25 +757,46 @@ bool ScriptDetours::CheckDetour(INT32 inst, INT64* fs_0, INT32 offset)
 		return false;
 	}
 	bool fixupApplied = false;
+	INT64* fixupPtr = (INT64*)((*fs_0 + 7 + offset) & 0xFFFFFFFFFFFFFFF8);
+	INT64 ptrval = *fixupPtr;
 	if (!DetoursLinked)
 	{
 		LinkDetours();
+		if (*fixupPtr != ptrval)
+		{
+			if (ScriptDetour* patched = FixupTargets.Find(*fixupPtr))
+			{
+				DetourStats::AddInvocation(patched->StatsIndex);
+			}
+			return true; // the eager pass already patched this call site
+		}
 	}
-	INT64 ptrval = *(INT64*)((*fs_0 + 7 + offset) & 0xFFFFFFFFFFFFFFF8);
-	if (LinkedDetours.find(ptrval) != LinkedDetours.end() && LinkedDetours[ptrval]->hFixup)
+	ScriptDetour* detour = LinkedDetours.Find(ptrval);
+	if (!detour)
+	{
+		// call sites we already redirected only need counting
+		if ((detour = FixupTargets.Find(ptrval)) != NULL)
+		{
+			DetourStats::AddInvocation(detour->StatsIndex);
+		}
+		return false;
+	}
+	if (detour->hFixup)
 	{
 		INT64 fs_pos = *fs_0;
 		// if pointer is below fixup or above it, the pointer is not within the detour and thus can be fixed up
-		if (LinkedDetours[ptrval]->hFixup > fs_pos || ((LinkedDetours[ptrval]->hFixup + LinkedDetours[ptrval]->FixupSize) <= fs_pos))
+		if (detour->hFixup > fs_pos || ((detour->hFixup + detour->FixupSize) <= fs_pos))
 		{
 #ifdef DETOUR_LOGGING
-			ALOG("Replaced call at %p to fixup %p! Opcode: %x", (INT64)((*fs_0 + 7 + offset) & 0xFFFFFFFFFFFFFFF8), LinkedDetours[ptrval]->hFixup, *(INT16*)(*fs_0 - 2));
+			ALOG("Replaced call at %p to fixup %p! Opcode: %x", (INT64)fixupPtr, detour->hFixup, *(INT16*)VM_OpcodePos(fs_0));
 #endif
-			AppliedFixups[(INT64*)((*fs_0 + 7 + offset) & 0xFFFFFFFFFFFFFFF8)] = ptrval;
-			*(INT64*)((*fs_0 + 7 + offset) & 0xFFFFFFFFFFFFFFF8) = LinkedDetours[ptrval]->hFixup;
+			AppliedFixups.Append(fixupPtr, ptrval, (INT16*)VM_OpcodePos(fs_0));
+			*fixupPtr = detour->hFixup;
+			DetourStats::AddPatchedSite(detour->StatsIndex);
+			DetourStats::AddInvocation(detour->StatsIndex);
 			DetoursReset = false;
 			fixupApplied = true;
 		}
 	}
 	return fixupApplied;
-}
+}
\ No newline at end of file
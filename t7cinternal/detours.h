@@ -1,15 +1,22 @@
 #pragma once
 #include "framework.h"
+#include "detourtable.h"
+#include "fixupjournal.h"
+#include "detourstats.h"
 #include <vector>
+#include <deque>
+#include <string>
 #include <unordered_map>
+#include <unordered_set>
 
 struct ScriptDetour
 {
-	char ReplaceScriptName[256];
+	const char* ReplaceScriptName; // interned, empty for builtins
 	INT32 ReplaceNamespace;
 	INT32 ReplaceFunction;
 	INT64 hFixup;
 	INT32 FixupSize;
+	INT32 StatsIndex; // slot in the DetourStats block, -1 if untracked
 };
 
 struct __t7export
@@ -37,26 +44,74 @@ typedef INT64(__fastcall* tScr_GscObjLink)(int inst, char* gsc_obj);
 
 //#define DETOUR_LOGGING
 
+#define DETOUR_MANIFEST_MAGIC 0x54445347 // GSDT
+#define DETOUR_MANIFEST_VERSION 1
+
+struct DetourManifestHeader
+{
+	INT32 Magic;
+	INT16 Version;
+	INT16 RecordSize;
+	INT32 NumDetours;
+	INT32 StringTableSize;
+};
+
+struct DetourManifestRecord
+{
+	INT32 ReplaceNamespace;
+	INT32 ReplaceFunction;
+	INT32 FixupOffset;
+	INT32 FixupSize;
+	INT32 ReplaceScriptName; // offset into the string table, -1 for builtins
+};
+
 EXPORT bool RegisterDetours(void* DetourData, int NumDetours, INT64 scriptOffset);
+EXPORT bool RegisterDetoursCompact(void* Manifest, INT64 scriptOffset);
+EXPORT void GetFixupJournalStats(FixupJournalStats* stats);
 
 class ScriptDetours
 {
 public:
-	static std::vector<ScriptDetour*> RegisteredDetours;
-	static std::unordered_map<INT64, ScriptDetour*> LinkedDetours;
-	static std::unordered_map<INT64*, INT64> AppliedFixups;
-	static INT64 FindScriptParsetree(char* name);
+	static std::deque<ScriptDetour> RegisteredDetours;
+	static std::unordered_set<std::string> ScriptNames; // backing storage for ScriptDetour::ReplaceScriptName
+	static std::vector<std::pair<INT64, ScriptDetour*>> LinkedEntries;
+	static DetourTable LinkedDetours;
+	static DetourTable FixupTargets; // hFixup -> detour, for counting calls through already redirected sites
+	// script detours whose target script has not been linked yet, keyed by interned script name
+	static std::unordered_map<const char*, std::vector<ScriptDetour*>> PendingDetours;
+	static FixupJournal AppliedFixups;
+	static INT64 FindScriptParsetree(const char* name);
+	static const char* InternScriptName(const char* name, size_t maxLength);
+	// appends to RegisteredDetours and publishes its stats slot, pointers stay valid until RemoveDetours
+	static ScriptDetour* AddDetour(const ScriptDetour& detour);
+	static inline INT32 NextStatsIndex()
+	{
+		return (RegisteredDetours.size() < DETOUR_STATS_MAX) ? (INT32)RegisteredDetours.size() : -1;
+	}
 	static bool DetoursLinked;
 	static bool DetoursReset;
 	static bool DetoursEnabled;
+	static bool EagerFixups;
+	static bool HooksInstalled;
 	static char* GSC_OBJ;
+	static void Init();
 	static void InstallHooks();
+	static void RemoveHooks();
 	static void LinkDetours();
+	static bool LinkHookInstalled;
+	static void ApplyEagerFixups();
 	static void ResetDetours();
 	static void RegisterRuntimeDetour(INT64 hFixup, INT32 replaceFunc, INT32 replaceNS, const char* replaceScriptName, char* fPosOrNull);
+	static INT32 RetargetFixup(INT64 hFixup, INT64 hNewFixup, INT32 newSize);
 
 private:
-	static void VTableReplace(INT64 stub_final, tVM_Opcode ReplaceFunc, tVM_Opcode* OutOld);
+	static void VTableReplace(INT64 stub_final, tVM_Opcode ReplaceFunc);
+	static std::vector<std::pair<INT64, INT64>> HookedSlots;
+	static INT32 LinkScriptDetours(char* buffer, const std::vector<ScriptDetour*>& detours);
+	static INT64 Scr_GscObjLink_Hook(int inst, char* gsc_obj);
+	static INT64 LookupScriptParsetree(const char* name);
+	static void BuildLinkTables();
+	static tScr_GscObjLink Scr_GscObjLink_Original;
 	static void VM_OP_GetFunction(INT32 inst, INT64* fs_0, INT64 vmc, bool* terminate);
 	static void VM_OP_GetAPIFunction(INT32 inst, INT64* fs_0, INT64 vmc, bool* terminate);
 	static void VM_OP_ScriptFunctionCall(INT32 inst, INT64* fs_0, INT64 vmc, bool* terminate);
@@ -66,6 +121,8 @@ private:
 	static void VM_OP_CallBuiltin(INT32 inst, INT64* fs_0, INT64 vmc, bool* terminate);
 	static void VM_OP_CallBuiltinMethod(INT32 inst, INT64* fs_0, INT64 vmc, bool* terminate);
 	static bool CheckDetour(INT32 inst, INT64* fs_0, INT32 offset = 0);
+	static INT32 PatchScriptBuffer(char* buffer, INT32 size);
+	static bool IsClientScript(const char* name);
 	static tScr_GetFunction Scr_GetFunction;
 	static tScr_GetMethod Scr_GetMethod;
 	static tScr_GscObjLink Scr_GscObjLink;
@@ -0,0 +1,72 @@
+#include "detourstats.h"
+#include "detours.h"
+
+DetourStats::Counters DetourStats::Block[DETOUR_STATS_MAX];
+DetourStats::Identity DetourStats::Names[DETOUR_STATS_MAX];
+std::atomic<INT32> DetourStats::NumPublished(0);
+
+EXPORT INT32 GetDetourStats(DetourStatsRecord* records, INT32 maxRecords)
+{
+	return DetourStats::Snapshot(records, maxRecords);
+}
+
+void DetourStats::Publish(const ScriptDetour& detour)
+{
+	if (detour.StatsIndex < 0)
+	{
+		return;
+	}
+
+	auto& name = Names[detour.StatsIndex];
+	name.ReplaceNamespace = detour.ReplaceNamespace;
+	name.ReplaceFunction = detour.ReplaceFunction;
+	strncpy_s(name.ReplaceScriptName, detour.ReplaceScriptName, _TRUNCATE);
+
+	// indices are handed out in order, so everything below the count is filled in
+	if (detour.StatsIndex >= NumPublished.load(std::memory_order_relaxed))
+	{
+		NumPublished.store(detour.StatsIndex + 1, std::memory_order_release);
+	}
+}
+
+INT32 DetourStats::Snapshot(DetourStatsRecord* records, INT32 maxRecords)
+{
+	INT32 count = NumPublished.load(std::memory_order_acquire);
+	if (count > maxRecords)
+	{
+		count = maxRecords;
+	}
+
+	for (INT32 i = 0; i < count; i++)
+	{
+		auto& counters = Block[i];
+		auto record = &records[i];
+		record->ReplaceNamespace = Names[i].ReplaceNamespace;
+		record->ReplaceFunction = Names[i].ReplaceFunction;
+		record->Resolved = counters.Resolved.load(std::memory_order_relaxed);
+		record->PatchedSites = counters.PatchedSites.load(std::memory_order_relaxed);
+		record->Invocations = counters.Invocations.load(std::memory_order_relaxed);
+		memcpy(record->ReplaceScriptName, Names[i].ReplaceScriptName, DETOUR_STATS_NAME_LENGTH);
+		record->ReplaceScriptName[DETOUR_STATS_NAME_LENGTH - 1] = 0;
+	}
+	return count;
+}
+
+void DetourStats::ClearResolved()
+{
+	for (int i = 0; i < DETOUR_STATS_MAX; i++)
+	{
+		Block[i].Resolved.store(0, std::memory_order_relaxed);
+	}
+}
+
+void DetourStats::Clear()
+{
+	NumPublished.store(0, std::memory_order_release);
+	for (int i = 0; i < DETOUR_STATS_MAX; i++)
+	{
+		Block[i].Resolved.store(0, std::memory_order_relaxed);
+		Block[i].PatchedSites.store(0, std::memory_order_relaxed);
+		Block[i].Invocations.store(0, std::memory_order_relaxed);
+	}
+}
@@ -0,0 +1,75 @@
+#pragma once
+#include "framework.h"
+#include <atomic>
+
+#define DETOUR_STATS_MAX 1024
+#define DETOUR_STATS_NAME_LENGTH 64
+
+// snapshot record handed to the injector, layout is mirrored in DebugCompiler
+struct DetourStatsRecord
+{
+	INT32 ReplaceNamespace;
+	INT32 ReplaceFunction;
+	INT32 Resolved;
+	INT32 PatchedSites;
+	INT64 Invocations;
+	char ReplaceScriptName[DETOUR_STATS_NAME_LENGTH]; // truncated, empty for builtins
+};
+
+EXPORT INT32 GetDetourStats(DetourStatsRecord* records, INT32 maxRecords);
+
+struct ScriptDetour;
+
+// fixed block of counters indexed by ScriptDetour::StatsIndex. only relaxed increments happen on the vm thread,
+// everything else (formatting) is done when a snapshot is taken. snapshots never touch the detour list itself, the
+// thread registering a detour copies what a record needs into Names and publishes it with a release store of NumPublished.
+class DetourStats
+{
+public:
+	struct Identity
+	{
+		INT32 ReplaceNamespace;
+		INT32 ReplaceFunction;
+		char ReplaceScriptName[DETOUR_STATS_NAME_LENGTH];
+	};
+
+	struct Counters
+	{
+		std::atomic<INT32> Resolved;
+		std::atomic<INT32> PatchedSites;
+		std::atomic<INT64> Invocations;
+	};
+
+	static inline void SetResolved(INT32 index)
+	{
+		if (index >= 0)
+		{
+			Block[index].Resolved.store(1, std::memory_order_relaxed);
+		}
+	}
+
+	static inline void AddPatchedSite(INT32 index)
+	{
+		if (index >= 0)
+		{
+			Block[index].PatchedSites.fetch_add(1, std::memory_order_relaxed);
+		}
+	}
+
+	static inline void AddInvocation(INT32 index)
+	{
+		if (index >= 0)
+		{
+			Block[index].Invocations.fetch_add(1, std::memory_order_relaxed);
+		}
+	}
+
+	static void Publish(const ScriptDetour& detour);
+	static INT32 Snapshot(DetourStatsRecord* records, INT32 maxRecords);
+	static void ClearResolved();
+	static void Clear();
+
+	static Counters Block[DETOUR_STATS_MAX];
+	static Identity Names[DETOUR_STATS_MAX];
+	static std::atomic<INT32> NumPublished;
+};
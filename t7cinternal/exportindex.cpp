@@ -0,0 +1,165 @@
+#include "exportindex.h"
+#include "detours.h"
+#include <algorithm>
+
+#define EXPORTINDEX_KEY(ns, name) (((UINT64)(UINT32)(ns) << 32) | (UINT32)(name))
+
+std::mutex ExportIndex::Lock;
+std::unordered_map<char*, ScriptExportIndex> ExportIndex::Indices;
+
+ScriptExportIndex* ExportIndex::Get(char* buffer)
+{
+	if (!buffer)
+	{
+		return NULL;
+	}
+
+	auto found = Indices.find(buffer);
+	if (found != Indices.end())
+	{
+		auto& index = found->second;
+		if (index.Checksum == *(INT32*)(buffer + 0x8) && index.ExportsOffset == *(INT32*)(buffer + 0x20) && index.NumExports == *(INT16*)(buffer + 0x3A))
+		{
+			return &index;
+		}
+	}
+
+	auto& index = Indices[buffer];
+	Build(buffer, index);
+	return &index;
+}
+
+void ExportIndex::Build(char* buffer, ScriptExportIndex& index)
+{
+	index.Checksum = *(INT32*)(buffer + 0x8);
+	index.ExportsOffset = *(INT32*)(buffer + 0x20);
+	index.NumExports = *(INT16*)(buffer + 0x3A);
+	index.Exports.clear();
+	index.Extents.clear();
+
+	__t7export* currentExport = (__t7export*)(buffer + index.ExportsOffset);
+	std::vector<INT32> offsets;
+	index.Exports.reserve(index.NumExports);
+	offsets.reserve(index.NumExports);
+	for (INT16 i = 0; i < index.NumExports; i++, currentExport++)
+	{
+		index.Exports.push_back({ EXPORTINDEX_KEY(currentExport->funcNS, currentExport->funcName), currentExport->bytecodeOffset });
+		offsets.push_back(currentExport->bytecodeOffset);
+	}
+
+	// stable so that duplicate exports resolve to the first one in the table, same as the linear walks did
+	std::stable_sort(index.Exports.begin(), index.Exports.end(), [](const ScriptExportIndex::Entry& a, const ScriptExportIndex::Entry& b) { return a.Key < b.Key; });
+	std::sort(offsets.begin(), offsets.end());
+	offsets.erase(std::unique(offsets.begin(), offsets.end()), offsets.end());
+
+	// functions are laid out back to back, so each one ends where the next starts and the last one ends with the bytecode section
+	INT32 bytecodeEnd = *(INT32*)(buffer + 0x14) + *(INT32*)(buffer + 0x30);
+	index.Extents.reserve(offsets.size());
+	for (size_t i = 0; i < offsets.size(); i++)
+	{
+		FunctionExtent extent;
+		extent.Start = offsets[i];
+		extent.PrologueEnd = PrologueEnd(buffer, offsets[i]);
+		extent.End = (i + 1 < offsets.size()) ? offsets[i + 1] : bytecodeEnd;
+		if (extent.End < extent.PrologueEnd)
+		{
+			extent.End = extent.PrologueEnd; // bad header, dont hand out a negative extent
+		}
+		index.Extents.push_back(extent);
+	}
+}
+
+INT32 ExportIndex::PrologueEnd(char* buffer, INT32 bytecodeOffset)
+{
+	char* fPos = buffer + bytecodeOffset;
+	auto code = *(UINT16*)fPos;
+
+	if (code == 0xD || code == 0x200D) // CheckClearParams
+	{
+		return bytecodeOffset + 2;
+	}
+
+	// SafeCreateLocalVariables, a count then an aligned hash and a type byte per local
+	fPos += 2;
+	BYTE numParams = *(BYTE*)fPos;
+	fPos += 2;
+	for (BYTE i = 0; i < numParams; i++)
+	{
+		fPos = (char*)(((INT64)fPos + 3) & ~3LL) + 4;
+		fPos += 1; // type
+	}
+	if ((INT64)fPos & 1)
+	{
+		fPos++;
+	}
+	return (INT32)(fPos - buffer);
+}
+
+INT32 ExportIndex::FindExport(char* buffer, INT32 funcNS, INT32 funcName)
+{
+	std::lock_guard<std::mutex> lock(Lock);
+	auto index = Get(buffer);
+	if (!index)
+	{
+		return 0;
+	}
+
+	UINT64 key = EXPORTINDEX_KEY(funcNS, funcName);
+	auto it = std::lower_bound(index->Exports.begin(), index->Exports.end(), key, [](const ScriptExportIndex::Entry& entry, UINT64 key) { return entry.Key < key; });
+	if (it == index->Exports.end() || it->Key != key)
+	{
+		return 0;
+	}
+	return it->BytecodeOffset;
+}
+
+INT32 ExportIndex::FindNextExport(char* buffer, INT32 bytecodeOffset)
+{
+	std::lock_guard<std::mutex> lock(Lock);
+	auto index = Get(buffer);
+	if (!index)
+	{
+		return 0;
+	}
+
+	auto it = std::upper_bound(index->Extents.begin(), index->Extents.end(), bytecodeOffset, [](INT32 offset, const FunctionExtent& extent) { return offset < extent.Start; });
+	if (it == index->Extents.end())
+	{
+		return 0;
+	}
+	return it->Start;
+}
+
+bool ExportIndex::FindExtent(char* buffer, INT32 funcNS, INT32 funcName, FunctionExtent* extent)
+{
+	std::lock_guard<std::mutex> lock(Lock);
+	auto index = Get(buffer);
+	if (!index)
+	{
+		return false;
+	}
+
+	UINT64 key = EXPORTINDEX_KEY(funcNS, funcName);
+	auto found = std::lower_bound(index->Exports.begin(), index->Exports.end(), key, [](const ScriptExportIndex::Entry& entry, UINT64 key) { return entry.Key < key; });
+	if (found == index->Exports.end() || found->Key != key || !found->BytecodeOffset)
+	{
+		return false;
+	}
+
+	INT32 bytecodeOffset = found->BytecodeOffset;
+	auto it = std::lower_bound(index->Extents.begin(), index->Extents.end(), bytecodeOffset, [](const FunctionExtent& current, INT32 offset) { return current.Start < offset; });
+	*extent = *it;
+	return true;
+}
+
+void ExportIndex::Invalidate(char* buffer)
+{
+	std::lock_guard<std::mutex> lock(Lock);
+	Indices.erase(buffer);
+}
+
+void ExportIndex::Clear()
+{
+	std::lock_guard<std::mutex> lock(Lock);
+	Indices.clear();
+}
@@ -0,0 +1,51 @@
+#pragma once
+#include "framework.h"
+#include <vector>
+#include <unordered_map>
+#include <mutex>
+
+struct FunctionExtent
+{
+	INT32 Start;
+	INT32 PrologueEnd; // first opcode after CheckClearParams or SafeCreateLocalVariables
+	INT32 End; // start of the next function, or the end of the bytecode section for the last one
+};
+
+struct ScriptExportIndex
+{
+	struct Entry
+	{
+		UINT64 Key; // (funcNS << 32) | funcName
+		INT32 BytecodeOffset;
+	};
+
+	// header fields we validate against so a reused or reloaded buffer gets rebuilt
+	INT32 Checksum;
+	INT32 ExportsOffset;
+	INT16 NumExports;
+
+	std::vector<Entry> Exports; // sorted by key
+	std::vector<FunctionExtent> Extents; // sorted by start, one per unique function start
+};
+
+// per script buffer index of the __t7export table, built the first time a buffer is queried.
+// queried from both vm threads and the injector, so every lookup holds Lock.
+class ExportIndex
+{
+public:
+	// returns the bytecode offset of the export or 0 if it doesnt exist
+	static INT32 FindExport(char* buffer, INT32 funcNS, INT32 funcName);
+	// returns the first export offset above bytecodeOffset or 0 if bytecodeOffset is the last function in the script
+	static INT32 FindNextExport(char* buffer, INT32 bytecodeOffset);
+	// copies the extent out, false if the export doesnt exist. only describes the buffer as it was when the index was built
+	static bool FindExtent(char* buffer, INT32 funcNS, INT32 funcName, FunctionExtent* extent);
+	static void Invalidate(char* buffer);
+	static void Clear();
+
+private:
+	static ScriptExportIndex* Get(char* buffer);
+	static void Build(char* buffer, ScriptExportIndex& index);
+	static INT32 PrologueEnd(char* buffer, INT32 bytecodeOffset);
+	static std::mutex Lock;
+	static std::unordered_map<char*, ScriptExportIndex> Indices;
+};
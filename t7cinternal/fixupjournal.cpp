@@ -0,0 +1,81 @@
+#include "fixupjournal.h"
+#include <algorithm>
+
+FixupJournal::FixupJournal() : NumEntries(0), LastRestored(0), LastSkipped(0), LastRestoreMicroseconds(0), TotalRestored(0)
+{
+}
+
+INT32 FixupJournal::Restore()
+{
+	LARGE_INTEGER start, end, frequency;
+	QueryPerformanceCounter(&start);
+
+	// sort by address so every page range gets validated with a single VirtualQuery, and so entries in the same script are restored sequentially.
+	// stable so that if a site was patched more than once we restore the value from before the first patch.
+	std::stable_sort(Entries.begin(), Entries.end(), [](const FixupJournalEntry& a, const FixupJournalEntry& b) { return a.Site < b.Site; });
+
+	INT32 restored = 0;
+	INT32 skipped = 0;
+	INT64 regionStart = 0;
+	INT64 regionEnd = 0;
+	bool regionWritable = false;
+	INT64* lastSite = NULL;
+	for (auto it = Entries.begin(); it != Entries.end(); it++)
+	{
+		if (it->Site == lastSite)
+		{
+			continue;
+		}
+		lastSite = it->Site;
+
+		if ((INT64)it->Site < regionStart || (INT64)it->Site >= regionEnd)
+		{
+			MEMORY_BASIC_INFORMATION mbi = { 0 };
+			if (!::VirtualQuery(it->Site, &mbi, sizeof(mbi)))
+			{
+				skipped++;
+				continue;
+			}
+			DWORD mask = (PAGE_READWRITE | PAGE_WRITECOPY | PAGE_EXECUTE_READWRITE | PAGE_EXECUTE_WRITECOPY);
+			regionStart = (INT64)mbi.BaseAddress;
+			regionEnd = regionStart + mbi.RegionSize;
+			regionWritable = (mbi.State == MEM_COMMIT) && (mbi.Protect & mask) && !(mbi.Protect & (PAGE_GUARD | PAGE_NOACCESS));
+		}
+
+		if (!regionWritable || ((INT64)it->Site + (INT64)sizeof(INT64)) > regionEnd || (INT64)it->Opcode < regionStart)
+		{
+			skipped++;
+			continue;
+		}
+
+		*it->Site = it->Original;
+		*it->Opcode = it->OriginalOpcode;
+		restored++;
+	}
+	Entries.clear();
+	NumEntries.store(0, std::memory_order_relaxed);
+
+	QueryPerformanceCounter(&end);
+	QueryPerformanceFrequency(&frequency);
+	LastRestored.store(restored, std::memory_order_relaxed);
+	LastSkipped.store(skipped, std::memory_order_relaxed);
+	LastRestoreMicroseconds.store(((end.QuadPart - start.QuadPart) * 1000000) / frequency.QuadPart, std::memory_order_relaxed);
+	TotalRestored.fetch_add(restored, std::memory_order_relaxed);
+	return restored;
+}
+
+void FixupJournal::Clear()
+{
+	Entries.clear();
+	NumEntries.store(0, std::memory_order_relaxed);
+}
+
+void FixupJournal::GetStats(FixupJournalStats* stats) const
+{
+	stats->NumEntries = NumEntries.load(std::memory_order_relaxed);
+	stats->LastRestored = LastRestored.load(std::memory_order_relaxed);
+	stats->LastSkipped = LastSkipped.load(std::memory_order_relaxed);
+	stats->pad = 0;
+	stats->LastRestoreMicroseconds = LastRestoreMicroseconds.load(std::memory_order_relaxed);
+	stats->TotalRestored = TotalRestored.load(std::memory_order_relaxed);
+}
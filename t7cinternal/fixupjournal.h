@@ -0,0 +1,47 @@
+#pragma once
+#include "framework.h"
+#include <vector>
+#include <atomic>
+
+struct FixupJournalEntry
+{
+	INT64* Site;
+	INT64 Original;
+	INT16* Opcode; // builtin calls are respoofed to script calls along with the operand, so the opcode goes back too
+	INT16 OriginalOpcode;
+};
+
+struct FixupJournalStats
+{
+	INT32 NumEntries;
+	INT32 LastRestored;
+	INT32 LastSkipped;
+	INT32 pad;
+	INT64 LastRestoreMicroseconds;
+	INT64 TotalRestored;
+};
+
+// append-only record of every call site operand we overwrote, restored in one pass when detours are reset.
+// only the vm thread touches the entries, the counters are published as relaxed atomics for the exporting thread.
+class FixupJournal
+{
+public:
+	FixupJournal();
+	inline void Append(INT64* site, INT64 original, INT16* opcode)
+	{
+		Entries.push_back({ site, original, opcode, *opcode });
+		NumEntries.store((INT32)Entries.size(), std::memory_order_relaxed);
+	}
+	INT32 Restore();
+	void Clear();
+	INT32 Count() const { return (INT32)Entries.size(); }
+	void GetStats(FixupJournalStats* stats) const;
+
+private:
+	std::vector<FixupJournalEntry> Entries;
+	std::atomic<INT32> NumEntries;
+	std::atomic<INT32> LastRestored;
+	std::atomic<INT32> LastSkipped;
+	std::atomic<INT64> LastRestoreMicroseconds;
+	std::atomic<INT64> TotalRestored;
+};
@@ -1,5 +1,6 @@
 #include "framework.h"
 
+#ifdef _WIN32
 #pragma section(".offsets",read,write)
 // this is the result of severe brain damage
 // this is a function used as MSELECT(steam_offset, msstore_offset)
@@ -40,6 +41,7 @@ void NTAPI tls_callback(PVOID DllHandle, DWORD dwReason, PVOID)
 EXTERN_C const
 PIMAGE_TLS_CALLBACK tls_callback_func = tls_callback;
 #pragma const_seg()
+#endif
 
 void chgmem(__int64 addy, __int32 size, void* copy)
 {
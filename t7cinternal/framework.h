@@ -1,5 +1,6 @@
 #pragma once
 
+#ifdef _WIN32
 #define WIN32_LEAN_AND_MEAN             // Exclude rarely-used stuff from Windows headers
 // Windows Header Files
 #include <windows.h>
@@ -25,11 +26,17 @@
 #define ObjectBasicInformation 0
 #define ObjectNameInformation 1
 #define ObjectTypeInformation 2
+#else
+#include "pal.h"
+#include <string>
+#include <vector>
+#include <iostream>
+#endif
 #define EXPORT extern "C" __declspec(dllexport)
 
 constexpr uint32_t fnv_base_32 = 0x4B9ACE2F;
 
-inline uint32_t fnv1a(const char* key) {
+constexpr uint32_t fnv1a(const char* key) {
 
 	const char* data = key;
 	uint32_t hash = 0x4B9ACE2F;
@@ -54,8 +61,15 @@ template <typename T> void chgmem(__int64 addy, T copy)
 
 void chgmem(__int64 addy, __int32 size, void* copy);
 
+#ifdef _WIN32
 extern const char MSELECT[];
 
 #define IS_WINSTORE (*(uint8_t*)(MSELECT + 0xC) == (uint8_t)0xd0)
 #define OFFSET_S(off) (*(uint64_t*)((uint64_t)(NtCurrentTeb()->ProcessEnvironmentBlock) + 0x10) + (uint64_t)off)
-#define REBASE(steam, msstore) ((uint64_t(__fastcall*)(uint64_t, uint64_t))(char*)MSELECT)(steam, msstore)
\ No newline at end of file
+#define REBASE(steam, msstore) ((uint64_t(__fastcall*)(uint64_t, uint64_t))(char*)MSELECT)(steam, msstore)
+#else
+// off windows the game image is emulated with the steam layout
+#define IS_WINSTORE false
+#define OFFSET_S(off) (PAL_ImageBase + (uint64_t)(off))
+#define REBASE(steam, msstore) (PAL_ImageBase + (uint64_t)(steam))
+#endif
\ No newline at end of file
@@ -0,0 +1,245 @@
+#include "hotloadcache.h"
+#include "hotloaddelta.h"
+#include "assetcache.h"
+#include "offsets.h"
+
+typedef INT32(__fastcall* tSL_GetString)(const char* str, INT32 user, INT32 type);
+typedef INT32(__fastcall* tSL_GetStringOfSize)(const char* str, INT32 user, INT32 len, INT32 type);
+typedef void(__fastcall* tSL_TransferRefToUser)(INT32 scrStr, INT32 user);
+typedef void(__fastcall* tGscObjResolve)(INT32 inst, const char* obj, INT32 unk);
+typedef INT32(__fastcall* tScr_ExecThread)(INT32 inst, void* func, INT32 numParams, void* val, INT32 self);
+typedef INT32(__fastcall* tScr_FreeThread)(INT32 inst, INT32 thread);
+
+std::unordered_map<UINT64, HotloadCache::InternedString> HotloadCache::Strings;
+HotloadCache::LinkedObject HotloadCache::LastObject[2];
+INT32 HotloadCache::CacheGeneration = -1;
+HotloadCacheStats HotloadCache::Stats = { 0 };
+
+EXPORT bool HotloadScriptCached(char* buff, INT32 size, INT32 vm, INT32* error)
+{
+	return HotloadCache::Hotload(buff, size, vm, error);
+}
+
+EXPORT void GetHotloadCacheStats(HotloadCacheStats* stats)
+{
+	HotloadCache::GetStats(stats);
+}
+
+UINT64 HotloadCache::Hash(const char* data, size_t size)
+{
+	// fnv-1a constants over 8 byte words, whole buffers go through here on every hotload. not fnv-1a itself: the multiply only
+	// carries bits upward, so each word also folds the high half back down before the next one is mixed in
+	UINT64 hash = 0xCBF29CE484222325 ^ size;
+	size_t i = 0;
+	for (; i + 8 <= size; i += 8)
+	{
+		UINT64 word;
+		memcpy(&word, data + i, 8);
+		hash ^= word;
+		hash *= 0x100000001B3;
+		hash ^= hash >> 29;
+	}
+	for (; i < size; i++)
+	{
+		hash ^= (BYTE)data[i];
+		hash *= 0x100000001B3;
+	}
+	return hash;
+}
+
+void HotloadCache::CheckGeneration()
+{
+	// a ui transition or map load drops the vm, the string references we hold and every linked object go with it.
+	// not the lookup generation, removing detours bumps that before every full hotload while the vm lives on
+	INT32 generation = ScriptAssetCache::VmGeneration();
+	if (generation == CacheGeneration)
+	{
+		return;
+	}
+	CacheGeneration = generation;
+	Strings.clear();
+	for (auto& object : LastObject)
+	{
+		object.Hash = 0;
+		object.Buffer = NULL;
+		object.Image.clear();
+		object.Image.shrink_to_fit();
+		object.Functions.clear();
+		object.Imports.clear();
+	}
+	HotloadDelta::Reset();
+}
+
+INT32 HotloadCache::Intern(const char* text)
+{
+	size_t length = strlen(text);
+	UINT64 key = Hash(text, length);
+	auto found = Strings.find(key);
+	if (found != Strings.end() && found->second.Text.size() == length && !memcmp(found->second.Text.data(), text, length))
+	{
+		Stats.StringHits++;
+		return found->second.ScrStr;
+	}
+	Stats.StringMisses++;
+
+	// one reference per string per generation, owned by the hotload user
+	INT32 scrStr;
+	if (IS_WINSTORE)
+	{
+		scrStr = ((tSL_GetStringOfSize)OFF_SL_GetStringOfSize)(text, 0, (INT32)length, 0x18);
+		auto refs = (volatile long*)(OFF_SL_StringRefs + 28llu * (UINT32)scrStr);
+		if (*((unsigned char*)refs + 2) & 1)
+		{
+			_InterlockedDecrement(refs);
+		}
+		else
+		{
+			_InterlockedOr(refs, 0x10000u);
+		}
+	}
+	else
+	{
+		scrStr = ((tSL_GetString)OFF_SL_GetString)(text, 0, 0x18);
+		((tSL_TransferRefToUser)OFF_SL_TransferRefToUser)(scrStr, 1);
+	}
+
+	// a hash collision keeps the first string cached, the second is just linked uncached
+	if (found == Strings.end())
+	{
+		Strings[key] = { scrStr, std::string(text, length) };
+	}
+	return scrStr;
+}
+
+void HotloadCache::LinkStrings(char* buff)
+{
+	const char* stringsPtr = *(INT32*)(0x18 + buff) + buff;
+	UINT16 numStrings = *(UINT16*)(0x38 + buff);
+	for (int i = 0; i < numStrings; i++)
+	{
+		const char* strValue = *(INT32*)stringsPtr + buff;
+		int numEntries = *(char*)(stringsPtr + 4);
+		stringsPtr += 8;
+
+		INT32 scrStr = Intern(strValue);
+		for (int j = 0; j < numEntries; j++)
+		{
+			*(INT32*)(*(INT32*)stringsPtr + buff) = scrStr;
+			stringsPtr += 4;
+		}
+	}
+}
+
+// the operand a linked import writes, calls have a param count and a flags byte in front of it
+INT64 HotloadCache::ImportOperand(INT64 site, BYTE flags)
+{
+	return (site + 2 + ((flags & HOTLOAD_IMPORT_CALL) ? 2 : 0) + 7) & 0xFFFFFFFFFFFFFFF8;
+}
+
+void HotloadCache::Rebase(char* buff, INT32 size, const char* from)
+{
+	// resolve wrote absolute pointers for calls into the script itself, those have to follow it to the new buffer
+	INT64 delta = buff - from;
+	INT64 at = *(INT32*)(buff + 0x24);
+	UINT16 numImports = *(UINT16*)(buff + 0x3C);
+	for (UINT16 i = 0; i < numImports && at >= 0 && at + 12 <= size; i++)
+	{
+		UINT16 numRefs = *(UINT16*)(buff + at + 8);
+		BYTE flags = *(BYTE*)(buff + at + 11);
+		for (UINT16 j = 0; j < numRefs && at + 16 + 4 * j <= size; j++)
+		{
+			INT32 site = *(INT32*)(buff + at + 12 + 4 * j);
+			INT64 operand = ImportOperand(site, flags);
+			if (site < 0 || operand + 8 > size)
+			{
+				continue;
+			}
+			INT64* target = (INT64*)(buff + operand);
+			if (*target >= (INT64)from && *target < (INT64)from + size)
+			{
+				*target += delta;
+			}
+		}
+		at += 12 + 4 * (INT64)numRefs;
+	}
+}
+
+void HotloadCache::RunAutoexecs(char* buff, INT32 vm)
+{
+	const char* exportsPtr = *(INT32*)(0x20 + buff) + buff;
+	UINT16 numExports = *(UINT16*)(0x3A + buff);
+	for (int i = 0; i < numExports; i++)
+	{
+		char flags = *(exportsPtr + 17);
+		if (flags & 0x2) // autoexec
+		{
+			RunAutoexec(*(INT32*)(exportsPtr + 0x4) + buff, vm);
+		}
+		exportsPtr += 20;
+	}
+}
+
+void HotloadCache::RunAutoexec(char* fPos, INT32 vm)
+{
+	INT32 thread = ((tScr_ExecThread)OFF_Scr_ExecThread)(vm, fPos, 0, 0, 0);
+	((tScr_FreeThread)OFF_Scr_FreeThread)(vm, thread);
+}
+
+bool HotloadCache::Hotload(char* buff, INT32 size, INT32 vm, INT32* error)
+{
+	if (!buff || size < HOTLOAD_HEADER_SIZE || *(INT64*)buff != HOTLOAD_MAGIC)
+	{
+		*error = HOTLOAD_ERROR_BADBUFF;
+		return false;
+	}
+
+	// animtree references are never linked, resolve would leave the scripts using them pointing at nothing
+	if (*(BYTE*)(buff + 0x45))
+	{
+		*error = HOTLOAD_ERROR_ANIMS;
+		return false;
+	}
+
+	vm = vm ? 1 : 0;
+	CheckGeneration();
+	Stats.Hotloads++;
+
+	// hashed before linking writes string ids into it, so it compares against what the injector sent last time
+	UINT64 hash = Hash(buff, size);
+	LinkedObject& last = LastObject[vm];
+	if (last.Buffer && last.Hash == hash && last.Image.size() == (size_t)size)
+	{
+		// the injector already pointed detours at this buffer, so it gets the linked image rather than running the old one
+		Stats.Unchanged++;
+		memcpy(buff, last.Image.data(), size);
+		if (buff != last.Buffer)
+		{
+			Rebase(buff, size, last.Buffer);
+			last.Image.assign(buff, buff + size);
+		}
+		last.Buffer = buff;
+		last.Functions.clear();
+		last.Imports.clear();
+		RunAutoexecs(buff, vm);
+		return true;
+	}
+
+	LinkStrings(buff);
+	((tGscObjResolve)OFF_GscObjResolve)(vm, buff, 0);
+
+	last.Hash = hash;
+	last.Buffer = buff;
+	last.Image.assign(buff, buff + size);
+	last.Functions.clear();
+	last.Imports.clear();
+
+	RunAutoexecs(buff, vm);
+	return true;
+}
+
+void HotloadCache::GetStats(HotloadCacheStats* stats)
+{
+	*stats = Stats;
+	stats->NumStrings = (INT32)Strings.size();
+	stats->Generation = CacheGeneration;
+}
@@ -0,0 +1,82 @@
+#pragma once
+#include "framework.h"
+#include <unordered_map>
+#include <vector>
+#include <string>
+
+#define HOTLOAD_MAGIC 0x1C000A0D43534780
+#define HOTLOAD_ERROR_BADBUFF 1
+#define HOTLOAD_ERROR_ANIMS 6 // the script uses animtrees, which a hotload cant link
+#define HOTLOAD_HEADER_SIZE 0x50
+#define HOTLOAD_IMPORT_CALL 0x6 // IsFunction | IsMethod, an import with neither is a GetFunction
+
+struct HotloadCacheStats
+{
+	INT64 Hotloads;
+	INT64 Unchanged; // byte identical to the previous hotload, linked by copying the cached image
+	INT64 StringHits;
+	INT64 StringMisses;
+	INT32 NumStrings;
+	INT32 Generation;
+};
+
+// same contract as HotloadScript_Steam/WinStore, but resident in the dll so the caches survive between hotloads
+EXPORT bool HotloadScriptCached(char* buff, INT32 size, INT32 vm, INT32* error);
+EXPORT void GetHotloadCacheStats(HotloadCacheStats* stats);
+
+// every string a hotload links is interned once per vm lifetime, so repeated hotloads reuse the reference we already hold
+// instead of taking a new one each pass. the last linked object per vm is kept, and a byte identical buffer skips string linking and resolve.
+class HotloadCache
+{
+	friend class HotloadDelta;
+
+public:
+	static bool Hotload(char* buff, INT32 size, INT32 vm, INT32* error);
+	static void GetStats(HotloadCacheStats* stats);
+
+private:
+	struct InternedString
+	{
+		INT32 ScrStr;
+		std::string Text;
+	};
+
+	struct LiveFunction
+	{
+		char* Start;
+		INT32 Capacity; // bytes a new body can take without touching the next function
+	};
+
+	struct ResolvedImport
+	{
+		INT32 Function;
+		INT32 Namespace;
+		BYTE NumParams;
+		BYTE Flags;
+		UINT16 Opcode;
+		INT64 Operand;
+	};
+
+	struct LinkedObject
+	{
+		UINT64 Hash;
+		char* Buffer; // hotload buffers are never freed, resolved calls inside the image can point back into this one
+		std::vector<char> Image; // the buffer as it was right after resolve, before anything ran or patched it. dropped once a delta patches it
+		// taken from the image on the first delta, so later deltas link against what resolve wrote rather than what earlier deltas left
+		std::unordered_map<UINT64, LiveFunction> Functions;
+		std::unordered_map<UINT64, ResolvedImport> Imports;
+	};
+
+	static void CheckGeneration();
+	static UINT64 Hash(const char* data, size_t size);
+	static INT32 Intern(const char* text);
+	static void LinkStrings(char* buff);
+	static INT64 ImportOperand(INT64 site, BYTE flags);
+	static void Rebase(char* buff, INT32 size, const char* from);
+	static void RunAutoexecs(char* buff, INT32 vm);
+	static void RunAutoexec(char* fPos, INT32 vm);
+	static std::unordered_map<UINT64, InternedString> Strings;
+	static LinkedObject LastObject[2];
+	static INT32 CacheGeneration;
+	static HotloadCacheStats Stats;
+};
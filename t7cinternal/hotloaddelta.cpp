@@ -0,0 +1,447 @@
+#include "hotloaddelta.h"
+#include "detours.h"
+#include "offsets.h"
+#include <algorithm>
+#include <climits>
+
+#define HOTLOAD_FUNCTION_KEY(ns, name) (((UINT64)(UINT32)(ns) << 32) | (UINT32)(name))
+#define HOTLOAD_IMPORT_KEY(name, ns, params, flags) (HOTLOAD_FUNCTION_KEY(name, ns) ^ (((UINT64)(flags) << 8) | (params)))
+
+std::vector<char*> HotloadDelta::ArenaBlocks;
+char* HotloadDelta::ArenaTop = NULL;
+char* HotloadDelta::ArenaEnd = NULL;
+HotloadDeltaStats HotloadDelta::Stats = { 0 };
+bool HotloadDelta::HasRelocated[2] = { false, false };
+
+EXPORT bool HotloadScriptDelta(char* delta, INT32 size, INT32 vm, INT32* error)
+{
+	return HotloadDelta::Apply(delta, size, vm, error);
+}
+
+EXPORT void GetHotloadDeltaStats(HotloadDeltaStats* stats)
+{
+	HotloadDelta::GetStats(stats);
+}
+
+bool HotloadDelta::Parse(char* delta, INT32 size, std::vector<const HotloadDeltaFunction*>& records)
+{
+	if (!delta || size < (INT32)sizeof(HotloadDeltaHeader))
+	{
+		return false;
+	}
+
+	auto header = (HotloadDeltaHeader*)delta;
+	if (header->Magic != HOTLOAD_DELTA_MAGIC || header->Version != HOTLOAD_DELTA_VERSION || header->NumFunctions < 0 || header->StringsSize < 0)
+	{
+		return false;
+	}
+
+	INT64 at = sizeof(HotloadDeltaHeader);
+	INT64 end = (INT64)size - header->StringsSize;
+	if (end < at || (header->StringsSize && delta[size - 1]))
+	{
+		return false;
+	}
+
+	records.reserve(header->NumFunctions);
+	for (INT16 i = 0; i < header->NumFunctions; i++)
+	{
+		if (at + (INT64)sizeof(HotloadDeltaFunction) > end)
+		{
+			return false;
+		}
+
+		auto record = (const HotloadDeltaFunction*)(delta + at);
+		if (record->Size <= 0 || record->NumStrings < 0 || record->NumImports < 0 || record->NumLazy < 0)
+		{
+			return false;
+		}
+
+		auto strings = (const HotloadDeltaString*)(record + 1);
+		auto imports = (const HotloadDeltaImport*)(strings + record->NumStrings);
+		auto lazy = (const HotloadDeltaLazy*)(imports + record->NumImports);
+		at = (INT64)((const char*)(lazy + record->NumLazy) - delta);
+		at = (at + record->Size + 7) & ~7ll;
+		if (at > end)
+		{
+			return false;
+		}
+
+		for (INT16 j = 0; j < record->NumStrings; j++)
+		{
+			if (strings[j].Text < 0 || strings[j].Text >= header->StringsSize)
+			{
+				return false;
+			}
+		}
+		records.push_back(record);
+	}
+	return true;
+}
+
+bool HotloadDelta::BuildTables(HotloadCache::LinkedObject& object)
+{
+	// a half built table would let the next delta link against it, so a bad image leaves both empty
+	if (ReadTables(object))
+	{
+		return true;
+	}
+	object.Functions.clear();
+	object.Imports.clear();
+	return false;
+}
+
+bool HotloadDelta::ReadTables(HotloadCache::LinkedObject& object)
+{
+	const char* image = object.Image.data();
+	INT64 size = (INT64)object.Image.size();
+	if (size < HOTLOAD_HEADER_SIZE)
+	{
+		return false;
+	}
+
+	INT32 exportsOffset = *(INT32*)(image + 0x20);
+	UINT16 numExports = *(UINT16*)(image + 0x3A);
+	INT32 bytecodeEnd = *(INT32*)(image + 0x14) + *(INT32*)(image + 0x30);
+	if (exportsOffset < 0 || exportsOffset + (INT64)numExports * (INT64)sizeof(__t7export) > size || bytecodeEnd > size)
+	{
+		return false;
+	}
+
+	// bodies are laid out back to back with 8 nulls in front of each, so one can grow up to the nulls of the next
+	auto exports = (const __t7export*)(image + exportsOffset);
+	std::vector<INT32> starts;
+	starts.reserve(numExports);
+	for (UINT16 i = 0; i < numExports; i++)
+	{
+		starts.push_back(exports[i].bytecodeOffset);
+	}
+	std::sort(starts.begin(), starts.end());
+
+	for (UINT16 i = 0; i < numExports; i++)
+	{
+		INT32 start = exports[i].bytecodeOffset;
+		auto next = std::upper_bound(starts.begin(), starts.end(), start);
+		INT32 end = (next == starts.end()) ? bytecodeEnd : (*next - 8);
+		if (start <= 0 || end <= start)
+		{
+			return false;
+		}
+		object.Functions.emplace(HOTLOAD_FUNCTION_KEY(exports[i].funcNS, exports[i].funcName), HotloadCache::LiveFunction{ object.Buffer + start, end - start });
+	}
+
+	// the first reference of every import already holds what resolve wrote for it
+	INT64 at = *(INT32*)(image + 0x24);
+	UINT16 numImports = *(UINT16*)(image + 0x3C);
+	for (UINT16 i = 0; i < numImports; i++)
+	{
+		if (at < 0 || at + 12 > size)
+		{
+			return false;
+		}
+
+		HotloadCache::ResolvedImport import;
+		import.Function = *(INT32*)(image + at);
+		import.Namespace = *(INT32*)(image + at + 4);
+		UINT16 numRefs = *(UINT16*)(image + at + 8);
+		import.NumParams = *(BYTE*)(image + at + 10);
+		import.Flags = *(BYTE*)(image + at + 11);
+		if (numRefs)
+		{
+			INT32 site = *(INT32*)(image + at + 12);
+			INT64 operand = HotloadCache::ImportOperand(site, import.Flags);
+			if (site < 0 || operand + 8 > size)
+			{
+				return false;
+			}
+			import.Opcode = *(UINT16*)(image + site);
+			import.Operand = *(INT64*)(image + operand);
+			object.Imports[HOTLOAD_IMPORT_KEY(import.Function, import.Namespace, import.NumParams, import.Flags)] = import;
+		}
+		at += 12 + 4 * (INT64)numRefs;
+	}
+	return true;
+}
+
+INT32 HotloadDelta::Link(HotloadCache::LinkedObject& object, const char* strings, StagedFunction& staged)
+{
+	auto record = staged.Record;
+	INT64 target = (INT64)staged.Target;
+	char* body = staged.Body.data();
+	auto inBody = [&](INT64 address, INT32 width) { return address >= target && address + width <= target + record->Size; };
+
+	auto stringFixups = (const HotloadDeltaString*)(record + 1);
+	for (INT16 i = 0; i < record->NumStrings; i++)
+	{
+		if (!inBody(target + stringFixups[i].Offset, 4))
+		{
+			return HOTLOAD_ERROR_BADDELTA;
+		}
+		*(INT32*)(body + stringFixups[i].Offset) = HotloadCache::Intern(strings + stringFixups[i].Text);
+	}
+
+	// only imports the object already linked can be copied, anything new needs a real resolve
+	auto importFixups = (const HotloadDeltaImport*)(stringFixups + record->NumStrings);
+	for (INT16 i = 0; i < record->NumImports; i++)
+	{
+		auto& fixup = importFixups[i];
+		auto found = object.Imports.find(HOTLOAD_IMPORT_KEY(fixup.Function, fixup.Namespace, fixup.NumParams, fixup.Flags));
+		if (found == object.Imports.end() || found->second.Function != fixup.Function || found->second.Namespace != fixup.Namespace || found->second.NumParams != fixup.NumParams || found->second.Flags != fixup.Flags)
+		{
+			return HOTLOAD_ERROR_UNRESOLVED;
+		}
+
+		INT64 site = target + fixup.Offset;
+		INT64 operand = HotloadCache::ImportOperand(site, fixup.Flags);
+		if (!inBody(site, 2) || !inBody(operand, 8))
+		{
+			return HOTLOAD_ERROR_BADDELTA;
+		}
+		*(UINT16*)(body + fixup.Offset) = found->second.Opcode;
+		*(INT64*)(body + (operand - target)) = found->second.Operand;
+	}
+
+	// lazy functions find their script by a relative offset to its name, which has to stay in the linked object
+	auto lazyFixups = (const HotloadDeltaLazy*)(importFixups + record->NumImports);
+	for (INT16 i = 0; i < record->NumLazy; i++)
+	{
+		INT64 site = target + lazyFixups[i].Offset;
+		INT64 operand = ((site + 2 + 3) & 0xFFFFFFFFFFFFFFFC) + 8;
+		INT64 name = lazyFixups[i].Target;
+		if (!inBody(site, 2) || !inBody(operand, 4) || name < 0 || name >= (INT64)object.Image.size() || !memchr(object.Image.data() + name, 0, object.Image.size() - name))
+		{
+			return HOTLOAD_ERROR_BADDELTA;
+		}
+		INT64 distance = (INT64)object.Buffer + name - (site + 2);
+		if (distance < INT_MIN || distance > INT_MAX)
+		{
+			return HOTLOAD_ERROR_UNRESOLVED;
+		}
+		*(INT32*)(body + (operand - target)) = (INT32)distance;
+	}
+	return 0;
+}
+
+char* HotloadDelta::AllocNear(char* near, SIZE_T size)
+{
+	// first free region above the object that the whole block fits in, so every body in it can reach the object
+	MEMORY_BASIC_INFORMATION info;
+	INT64 limit = (INT64)near + HOTLOAD_ARENA_REACH - (INT64)size;
+	for (INT64 at = ((INT64)near + 0xFFFF) & ~0xFFFFll; at <= limit; at = (INT64)info.BaseAddress + info.RegionSize)
+	{
+		if (!VirtualQuery((void*)at, &info, sizeof(info)) || !info.RegionSize)
+		{
+			break;
+		}
+
+		INT64 start = ((INT64)info.BaseAddress + 0xFFFF) & ~0xFFFFll;
+		if (info.State == MEM_FREE && start <= limit && start + (INT64)size <= (INT64)info.BaseAddress + (INT64)info.RegionSize)
+		{
+			if (char* block = (char*)VirtualAlloc((void*)start, size, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE))
+			{
+				return block;
+			}
+		}
+	}
+
+	// anything is better than nothing, only bodies with lazy functions need the object in reach
+	return (char*)VirtualAlloc(NULL, size, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+}
+
+char* HotloadDelta::ArenaAlloc(INT32 size, char* near)
+{
+	// same layout the compiler uses, 8 nulls then a body starting 8 past a 16 byte boundary, so aligned operands stay aligned
+	char* at = (char*)((((INT64)ArenaTop + 15) & 0xFFFFFFFFFFFFFFF0) + 8);
+	if (!ArenaTop || at + size > ArenaEnd || ArenaEnd - near > HOTLOAD_ARENA_REACH || near - ArenaTop > HOTLOAD_ARENA_REACH)
+	{
+		SIZE_T blockSize = ((SIZE_T)size + 16 + 0xFFF) & ~(SIZE_T)0xFFF;
+		if (blockSize < HOTLOAD_ARENA_BLOCK)
+		{
+			blockSize = HOTLOAD_ARENA_BLOCK;
+		}
+
+		char* block = AllocNear(near, blockSize);
+		if (!block)
+		{
+			return NULL;
+		}
+		ArenaBlocks.push_back(block);
+		ArenaEnd = block + blockSize;
+		at = block + 8;
+	}
+	ArenaTop = at + size;
+	Stats.ArenaBytes += size;
+	return at;
+}
+
+bool HotloadDelta::CanRedirect(INT32 vm)
+{
+	// detours only check calls on the server vm and are dropped at the ui level
+	return !vm && !*(BYTE*)(OFF_s_runningUILevel);
+}
+
+void HotloadDelta::EnableRedirects()
+{
+	if (!ScriptDetours::DetoursEnabled)
+	{
+		ScriptDetours::DetoursEnabled = true;
+		ScriptDetours::InstallHooks();
+	}
+
+	// linking later would drop the entries we are about to add
+	if (!ScriptDetours::DetoursLinked)
+	{
+		ScriptDetours::LinkDetours();
+	}
+}
+
+bool HotloadDelta::Apply(char* delta, INT32 size, INT32 vm, INT32* error)
+{
+	LARGE_INTEGER start, end, frequency;
+	QueryPerformanceCounter(&start);
+
+	vm = vm ? 1 : 0;
+	HotloadCache::CheckGeneration();
+	Stats.Deltas++;
+
+	std::vector<const HotloadDeltaFunction*> records;
+	if (!Parse(delta, size, records))
+	{
+		Stats.Rejected++;
+		*error = HOTLOAD_ERROR_BADDELTA;
+		return false;
+	}
+
+	auto header = (HotloadDeltaHeader*)delta;
+	const char* strings = delta + size - header->StringsSize;
+	auto& object = HotloadCache::LastObject[vm];
+	if (!object.Buffer || object.Hash != header->BaseHash || (object.Functions.empty() && !BuildTables(object)))
+	{
+		Stats.Rejected++;
+		*error = HOTLOAD_ERROR_STALE;
+		return false;
+	}
+
+	// place and link everything before writing anything, so a delta that cant be applied leaves the running object alone
+	std::vector<StagedFunction> staged(records.size());
+	for (size_t i = 0; i < records.size(); i++)
+	{
+		auto record = records[i];
+		auto& function = staged[i];
+		function.Record = record;
+		function.Key = HOTLOAD_FUNCTION_KEY(record->Namespace, record->Function);
+
+		auto live = object.Functions.find(function.Key);
+		if (live == object.Functions.end())
+		{
+			*error = HOTLOAD_ERROR_STALE;
+		}
+		else if (record->Size <= live->second.Capacity && !(record->Hints & HOTLOAD_DELTA_SUSPENDS))
+		{
+			function.Target = live->second.Start;
+			function.Relocated = false;
+			*error = 0;
+		}
+		else if (!CanRedirect(vm))
+		{
+			*error = HOTLOAD_ERROR_NODETOURS;
+		}
+		else
+		{
+			function.Target = ArenaAlloc(record->Size, object.Buffer);
+			function.Relocated = true;
+			*error = function.Target ? 0 : HOTLOAD_ERROR_NODETOURS;
+		}
+
+		if (!*error && ((INT64)function.Target & 0xF) != 8)
+		{
+			*error = HOTLOAD_ERROR_BADDELTA;
+		}
+
+		if (!*error)
+		{
+			auto body = (const char*)(((const HotloadDeltaLazy*)((const HotloadDeltaImport*)((const HotloadDeltaString*)(record + 1) + record->NumStrings) + record->NumImports)) + record->NumLazy);
+			function.Body.assign(body, body + record->Size);
+			*error = Link(object, strings, function);
+		}
+
+		if (*error)
+		{
+			Stats.Rejected++;
+			return false;
+		}
+	}
+
+	for (auto& function : staged)
+	{
+		memcpy(function.Target, function.Body.data(), function.Body.size());
+		if (!function.Relocated)
+		{
+			Stats.Patched++;
+			continue;
+		}
+
+		// calls into every earlier copy go to the new one, the first copy was linked to the same detour by an earlier relocation
+		auto& live = object.Functions[function.Key];
+		EnableRedirects();
+		ScriptDetours::RetargetFixup((INT64)live.Start, (INT64)function.Target, function.Record->Size);
+		ScriptDetours::RegisterRuntimeDetour((INT64)function.Target, function.Record->Function, function.Record->Namespace, HOTLOAD_DETOUR_NAME, live.Start);
+		live.Start = function.Target;
+		live.Capacity = function.Record->Size;
+		HasRelocated[vm] = true;
+		Stats.Relocated++;
+	}
+
+	// the cached image no longer matches what is running, so a later full hotload of the same bytes has to relink
+	object.Hash = header->NewHash;
+	object.Image.clear();
+	object.Image.shrink_to_fit();
+
+	for (auto& function : staged)
+	{
+		if (function.Record->Flags & 0x2) // autoexec
+		{
+			HotloadCache::RunAutoexec(function.Target, vm);
+		}
+	}
+
+	QueryPerformanceCounter(&end);
+	QueryPerformanceFrequency(&frequency);
+	Stats.LastMicroseconds = ((end.QuadPart - start.QuadPart) * 1000000) / frequency.QuadPart;
+	*error = 0;
+	return true;
+}
+
+void HotloadDelta::GetStats(HotloadDeltaStats* stats)
+{
+	*stats = Stats;
+}
+
+void HotloadDelta::Reset()
+{
+	// only called when the vm generation moves (ui level or map load), never for a full hotload, so nothing can still be running
+	// out of the arena
+	for (auto block : ArenaBlocks)
+	{
+		VirtualFree(block, 0, MEM_RELEASE);
+	}
+	ArenaBlocks.clear();
+	ArenaTop = NULL;
+	ArenaEnd = NULL;
+	Stats.ArenaBytes = 0;
+	HasRelocated[0] = HasRelocated[1] = false;
+}
+
+void HotloadDelta::DetoursRemoved()
+{
+	// relocated bodies are only reached through their detours, so an object that had any cant take another delta. the arena stays,
+	// threads suspended in those bodies still resume there
+	for (INT32 vm = 0; vm < 2; vm++)
+	{
+		if (HasRelocated[vm])
+		{
+			HotloadCache::LastObject[vm].Hash = 0;
+			HasRelocated[vm] = false;
+		}
+	}
+}
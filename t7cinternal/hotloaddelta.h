@@ -0,0 +1,116 @@
+#pragma once
+#include "framework.h"
+#include "hotloadcache.h"
+#include <vector>
+
+#define HOTLOAD_DELTA_MAGIC 0x544C4448 // HDLT
+#define HOTLOAD_DELTA_VERSION 1
+#define HOTLOAD_ARENA_BLOCK 0x40000
+#define HOTLOAD_ARENA_REACH 0x7FFF0000ll // lazy function operands are 32 bit offsets into the linked object
+#define HOTLOAD_DETOUR_NAME "<hotload>" // never a parsetree, so a relink leaves these pending instead of matching a real script
+#define HOTLOAD_DELTA_SUSPENDS 0x1 // the live body has a wait or a script call in it, so a thread can be parked inside
+
+#define HOTLOAD_ERROR_BADDELTA 2
+#define HOTLOAD_ERROR_STALE 3 // the runtime did not link the object the delta was made against, send the whole script
+#define HOTLOAD_ERROR_UNRESOLVED 4 // an import the linked object never resolved, or a lazy string out of reach of the new body
+#define HOTLOAD_ERROR_NODETOURS 5 // a function has to move but calls into it cant be redirected here (csc or ui level)
+
+// header, NumFunctions records, then StringsSize bytes of null terminated strings the records index into.
+// a record is followed by its fixups, then Size bytes of unlinked body padded to 8.
+struct HotloadDeltaHeader
+{
+	INT32 Magic;
+	INT16 Version;
+	INT16 NumFunctions;
+	UINT64 BaseHash; // HotloadCache::Hash of the object the runtime should have linked last
+	UINT64 NewHash; // what the runtime reports as linked afterwards, the next delta has to be made against it
+	INT32 StringsSize;
+	INT32 pad;
+};
+
+struct HotloadDeltaFunction
+{
+	INT32 Namespace;
+	INT32 Function;
+	INT32 Size;
+	INT16 NumStrings;
+	INT16 NumImports;
+	INT16 NumLazy;
+	BYTE Flags; // export flags, changed autoexecs are run again once everything is written
+	BYTE Hints; // HOTLOAD_DELTA_*, older compilers leave this 0
+};
+
+// offsets are from the start of the body
+struct HotloadDeltaString
+{
+	INT32 Offset; // the string id operand
+	INT32 Text;
+};
+
+struct HotloadDeltaImport
+{
+	INT32 Offset; // the opcode, same as an import table reference
+	INT32 Function;
+	INT32 Namespace;
+	BYTE NumParams;
+	BYTE Flags;
+	INT16 pad;
+};
+
+struct HotloadDeltaLazy
+{
+	INT32 Offset; // the opcode
+	INT32 Target; // script name string in the linked object
+};
+
+struct HotloadDeltaStats
+{
+	INT64 Deltas;
+	INT64 Rejected;
+	INT64 Patched; // bodies rewritten where they were
+	INT64 Relocated; // bodies moved to the arena
+	INT64 ArenaBytes;
+	INT64 LastMicroseconds;
+};
+
+// applies a compiler generated delta to the last object HotloadScriptCached linked for the vm.
+// returns false with *error set and nothing written if any part of it cant be linked, the injector then sends the whole script.
+EXPORT bool HotloadScriptDelta(char* delta, INT32 size, INT32 vm, INT32* error);
+EXPORT void GetHotloadDeltaStats(HotloadDeltaStats* stats);
+
+// function bodies that still fit and that no thread can be parked in are rewritten in place. anything else goes to a side arena and
+// calls into the old body are redirected with a runtime detour, so threads already running or suspended in the old body finish it.
+// where calls cant be redirected (csc, ui level) a body a thread can be parked in makes the delta fail and the whole script is sent.
+// the arena lives as long as the vm, a relocated body may still hold a suspended thread after its detour is removed.
+class HotloadDelta
+{
+public:
+	static bool Apply(char* delta, INT32 size, INT32 vm, INT32* error);
+	static void GetStats(HotloadDeltaStats* stats);
+	static void Reset();
+	static void DetoursRemoved();
+
+private:
+	struct StagedFunction
+	{
+		const HotloadDeltaFunction* Record;
+		UINT64 Key;
+		char* Target;
+		bool Relocated;
+		std::vector<char> Body;
+	};
+
+	static bool Parse(char* delta, INT32 size, std::vector<const HotloadDeltaFunction*>& records);
+	static bool BuildTables(HotloadCache::LinkedObject& object);
+	static bool ReadTables(HotloadCache::LinkedObject& object);
+	static INT32 Link(HotloadCache::LinkedObject& object, const char* strings, StagedFunction& staged);
+	static char* ArenaAlloc(INT32 size, char* near);
+	static char* AllocNear(char* near, SIZE_T size);
+	static bool CanRedirect(INT32 vm);
+	static void EnableRedirects();
+	static std::vector<char*> ArenaBlocks;
+	static char* ArenaTop;
+	static char* ArenaEnd;
+	static HotloadDeltaStats Stats;
+	static bool HasRelocated[2];
+};
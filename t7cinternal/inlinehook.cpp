@@ -0,0 +1,137 @@
+#include "inlinehook.h"
+
+std::vector<InlineHookRecord> InlineHook::Hooks;
+
+INT32 InlineHook::InstructionLength(const BYTE* code)
+{
+	const BYTE* p = code;
+	if ((*p & 0xF0) == 0x40) // rex
+	{
+		p++;
+	}
+
+	BYTE op = *p++;
+	if (op >= 0x50 && op <= 0x5F) // push/pop reg
+	{
+		return (INT32)(p - code);
+	}
+
+	INT32 immSize = 0;
+	switch (op)
+	{
+		// add, sub, xor, cmp, test, mov, lea with a modrm operand
+		case 0x01: case 0x03: case 0x29: case 0x2B: case 0x31: case 0x33: case 0x39: case 0x3B: case 0x85: case 0x89: case 0x8B: case 0x8D:
+			break;
+		case 0x83: // group 1 r/m, imm8
+			immSize = 1;
+			break;
+		case 0x81: // group 1 r/m, imm32
+			immSize = 4;
+			break;
+		default:
+			return 0;
+	}
+
+	BYTE modrm = *p++;
+	BYTE mod = modrm >> 6;
+	BYTE rm = modrm & 7;
+	if (mod != 3)
+	{
+		if (rm == 4)
+		{
+			BYTE sib = *p++;
+			if (mod == 0 && (sib & 7) == 5)
+			{
+				p += 4;
+			}
+		}
+		else if (mod == 0 && rm == 5)
+		{
+			return 0; // rip relative, would need fixing up in the trampoline
+		}
+		p += (mod == 1) ? 1 : (mod == 2) ? 4 : 0;
+	}
+	else if (op == 0x8D)
+	{
+		return 0;
+	}
+	p += immSize;
+	return (INT32)(p - code);
+}
+
+void InlineHook::WriteJump(BYTE* at, INT64 destination)
+{
+	at[0] = 0xFF;
+	at[1] = 0x25;
+	*(INT32*)(at + 2) = 0;
+	*(INT64*)(at + 6) = destination;
+}
+
+INT64 InlineHook::Install(INT64 target, INT64 replacement)
+{
+	InlineHookRecord* record = NULL;
+	for (auto it = Hooks.begin(); it != Hooks.end(); it++)
+	{
+		if (it->Target == target)
+		{
+			record = &*it;
+			break;
+		}
+	}
+
+	// trampolines are kept after removal so a hook can be reinstalled without relocating the prologue again
+	if (!record)
+	{
+		INT32 stolen = 0;
+		while (stolen < INLINEHOOK_JMP_SIZE)
+		{
+			INT32 length = InstructionLength((BYTE*)target + stolen);
+			if (!length || stolen + length > INLINEHOOK_MAX_STOLEN)
+			{
+				return 0;
+			}
+			stolen += length;
+		}
+
+		BYTE* trampoline = (BYTE*)VirtualAlloc(NULL, stolen + INLINEHOOK_JMP_SIZE, MEM_COMMIT | MEM_RESERVE, PAGE_EXECUTE_READWRITE);
+		if (!trampoline)
+		{
+			return 0;
+		}
+		memcpy(trampoline, (void*)target, stolen);
+		WriteJump(trampoline + stolen, target + stolen);
+
+		Hooks.push_back({ target, (INT64)trampoline, stolen });
+		record = &Hooks.back();
+		memcpy(record->Stolen, (void*)target, stolen);
+	}
+
+	BYTE patch[INLINEHOOK_MAX_STOLEN];
+	WriteJump(patch, replacement);
+	memset(patch + INLINEHOOK_JMP_SIZE, 0xCC, record->StolenSize - INLINEHOOK_JMP_SIZE);
+	chgmem(target, record->StolenSize, patch);
+	FlushInstructionCache(GetCurrentProcess(), (void*)target, record->StolenSize);
+	return record->Trampoline;
+}
+
+void InlineHook::Remove(INT64 target)
+{
+	for (auto it = Hooks.begin(); it != Hooks.end(); it++)
+	{
+		if (it->Target != target)
+		{
+			continue;
+		}
+		chgmem(target, it->StolenSize, it->Stolen);
+		FlushInstructionCache(GetCurrentProcess(), (void*)target, it->StolenSize);
+		return;
+	}
+}
+
+void InlineHook::RemoveAll()
+{
+	for (auto it = Hooks.begin(); it != Hooks.end(); it++)
+	{
+		Remove(it->Target);
+	}
+}
@@ -0,0 +1,30 @@
+#pragma once
+#include "framework.h"
+#include <vector>
+
+// jmp qword ptr [rip+0] followed by the absolute destination
+#define INLINEHOOK_JMP_SIZE 14
+#define INLINEHOOK_MAX_STOLEN 32
+
+struct InlineHookRecord
+{
+	INT64 Target;
+	INT64 Trampoline;
+	INT32 StolenSize;
+	BYTE Stolen[INLINEHOOK_MAX_STOLEN];
+};
+
+// minimal function entry hook. only relocates a small set of position independent prologue instructions and refuses anything else.
+class InlineHook
+{
+public:
+	// returns the trampoline to call the original function through, or 0 if the prologue could not be relocated
+	static INT64 Install(INT64 target, INT64 replacement);
+	static void Remove(INT64 target);
+	static void RemoveAll();
+
+private:
+	static INT32 InstructionLength(const BYTE* code);
+	static void WriteJump(BYTE* at, INT64 destination);
+	static std::vector<InlineHookRecord> Hooks;
+};
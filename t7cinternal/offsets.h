@@ -1,6 +1,8 @@
 #pragma once
 #include "framework.h"
+#ifdef _WIN32
 #include <winnt.h>
+#endif
 
 // dont mess with these because when I add new games, these macros will change
 
@@ -13,6 +15,7 @@
 #define OFF_GetMethod REBASE(NULL, 0x136CD40)
 #define OFF_Scr_GetMethod REBASE(0x1AF79B0, NULL)
 #define OFF_DB_FindXAssetHeader REBASE(0x1420ED0, 0x14DC380)
+#define OFF_xAssetScriptParseTree REBASE(0x9407AB0, 0xF3B1330)
 #define XASSETTYPE_SCRIPTPARSETREE 0x36u
 #define OFF_s_runningUILevel REBASE(0x168ED91E, 0x148FD0EF)
 #define OFF_Scr_GscObjLink REBASE(0x12CC300, 0x1370AC0)
@@ -23,6 +26,13 @@
 #define OFF_BID_Scr_CastInt REBASE(0x32D71A0, 0x31148E0)
 #define OFF_Scr_CastInt REBASE(0x162E60, 0x1F1EF0)
 #define OFF_ScrVarGlob REBASE(0x51A3500, 0x3F66900)
+#define OFF_SL_GetString REBASE(0x12D7B20, NULL)
+#define OFF_SL_GetStringOfSize REBASE(NULL, 0x137DAF0)
+#define OFF_SL_TransferRefToUser REBASE(0x12D8C60, NULL)
+#define OFF_SL_StringRefs REBASE(NULL, 0x3B1F308)
+#define OFF_GscObjResolve REBASE(0x12CA2B0, 0x136E630)
+#define OFF_Scr_ExecThread REBASE(0x12EA770, 0x1390700)
+#define OFF_Scr_FreeThread REBASE(0x12EAB50, 0x137F4F0)
 
 #define OFF_VM_OP_GetAPIFunction REBASE(0x12D0890, 0x1374E90)
 #define OFF_VM_OP_GetFunction REBASE(0x12D0A30, 0x1374E50)
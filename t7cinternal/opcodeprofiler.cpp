@@ -0,0 +1,193 @@
+#include "opcodeprofiler.h"
+#include "offsets.h"
+#include <algorithm>
+#ifdef _WIN32
+#include <intrin.h>
+#endif
+
+ProfiledHandler OpcodeProfiler::Handlers[OPCODE_PROFILER_MAX_HANDLERS];
+const tVM_Opcode* OpcodeProfiler::Trampolines = OpcodeProfiler::MakeTrampolines(std::make_index_sequence<OPCODE_PROFILER_MAX_HANDLERS>());
+std::unordered_map<INT64, INT32> OpcodeProfiler::HandlerIndices;
+std::unordered_map<INT64, INT32> OpcodeProfiler::TrampolineIndices;
+INT32 OpcodeProfiler::NumHandlers = 0;
+bool OpcodeProfiler::Installed = false;
+bool OpcodeProfiler::Wrapped = false;
+bool OpcodeProfiler::Timing = false;
+INT64 OpcodeProfiler::HandlerTable = 0;
+
+EXPORT bool InstallOpcodeProfiler(bool timing)
+{
+	return OpcodeProfiler::Install(OFF_ScrVm_Opcodes, timing);
+}
+
+EXPORT void UninstallOpcodeProfiler()
+{
+	OpcodeProfiler::Uninstall();
+}
+
+EXPORT INT32 GetOpcodeHistogram(OpcodeHistogramRecord* records, INT32 maxRecords)
+{
+	return OpcodeProfiler::GetHistogram(records, maxRecords);
+}
+
+template <INT32 Index>
+void OpcodeProfiler::Trampoline(INT32 inst, INT64* fs_0, INT64 vmc, bool* terminate)
+{
+	auto& handler = Handlers[Index];
+	auto& counters = handler.Instance[inst & 1];
+	counters.Count++;
+	if (!Timing)
+	{
+		handler.Original(inst, fs_0, vmc, terminate);
+		return;
+	}
+
+	// inclusive, so handlers that dispatch other opcodes also carry their cost
+	UINT64 start = __rdtsc();
+	handler.Original(inst, fs_0, vmc, terminate);
+	counters.Cycles += __rdtsc() - start;
+}
+
+template <size_t... Indices>
+const tVM_Opcode* OpcodeProfiler::MakeTrampolines(std::index_sequence<Indices...>)
+{
+	static const tVM_Opcode trampolines[] = { Trampoline<Indices>... };
+	return trampolines;
+}
+
+bool OpcodeProfiler::Install(INT64 handlerTable, bool timing)
+{
+	if (Installed)
+	{
+		return false;
+	}
+
+	memset(Handlers, 0, sizeof(Handlers));
+	HandlerIndices.clear();
+	NumHandlers = 0;
+	if (TrampolineIndices.empty())
+	{
+		for (INT32 i = 0; i < OPCODE_PROFILER_MAX_HANDLERS; i++)
+		{
+			TrampolineIndices[(INT64)Trampolines[i]] = i;
+		}
+	}
+
+	HandlerTable = handlerTable;
+	Timing = timing;
+	Installed = true;
+	Wrap();
+	return true;
+}
+
+void OpcodeProfiler::Uninstall()
+{
+	if (!Installed)
+	{
+		return;
+	}
+	Unwrap();
+	Installed = false;
+}
+
+bool OpcodeProfiler::Suspend()
+{
+	if (!Installed || !Wrapped)
+	{
+		return false;
+	}
+	Unwrap();
+	return true;
+}
+
+void OpcodeProfiler::Resume()
+{
+	if (Installed && !Wrapped)
+	{
+		Wrap();
+	}
+}
+
+void OpcodeProfiler::Wrap()
+{
+	for (INT32 i = 0; i < NumHandlers; i++)
+	{
+		Handlers[i].NumAliases = 0;
+	}
+
+	INT64 handler_table = HandlerTable;
+	for (INT32 op = 0; op < OPCODE_TABLE_SIZE; op++)
+	{
+		INT64 current = *(INT64*)(handler_table + (op * 8));
+		if (!current)
+		{
+			continue;
+		}
+
+		// handlers are matched by address so a rewrap after a hook change keeps the counts of everything else
+		auto found = HandlerIndices.find(current);
+		INT32 index;
+		if (found != HandlerIndices.end())
+		{
+			index = found->second;
+		}
+		else if (NumHandlers < OPCODE_PROFILER_MAX_HANDLERS)
+		{
+			index = NumHandlers++;
+			Handlers[index].Original = (tVM_Opcode)current;
+			HandlerIndices[current] = index;
+		}
+		else
+		{
+			continue;
+		}
+
+		if (!Handlers[index].NumAliases++)
+		{
+			Handlers[index].FirstOpcode = op;
+		}
+		chgmem<uint64_t>(handler_table + (op * 8), (uint64_t)Trampolines[index]);
+	}
+	Wrapped = true;
+}
+
+void OpcodeProfiler::Unwrap()
+{
+	INT64 handler_table = HandlerTable;
+	for (INT32 op = 0; op < OPCODE_TABLE_SIZE; op++)
+	{
+		// only give back slots that still hold a trampoline, anything written since then is left alone
+		auto found = TrampolineIndices.find(*(INT64*)(handler_table + (op * 8)));
+		if (found == TrampolineIndices.end())
+		{
+			continue;
+		}
+		chgmem<uint64_t>(handler_table + (op * 8), (uint64_t)Handlers[found->second].Original);
+	}
+	Wrapped = false;
+}
+
+INT32 OpcodeProfiler::GetHistogram(OpcodeHistogramRecord* records, INT32 maxRecords)
+{
+	// both come straight from the injector
+	if (!records || maxRecords <= 0)
+	{
+		return 0;
+	}
+
+	std::vector<OpcodeHistogramRecord> histogram;
+	for (INT32 i = 0; i < NumHandlers; i++)
+	{
+		auto& handler = Handlers[i];
+		histogram.push_back({ (INT64)handler.Original, handler.FirstOpcode, handler.NumAliases, handler.Instance[0].Count + handler.Instance[1].Count, handler.Instance[0].Cycles + handler.Instance[1].Cycles });
+	}
+
+	std::sort(histogram.begin(), histogram.end(), [](const OpcodeHistogramRecord& a, const OpcodeHistogramRecord& b)
+	{
+		return a.Count > b.Count;
+	});
+
+	INT32 count = (maxRecords < (INT32)histogram.size()) ? maxRecords : (INT32)histogram.size();
+	memcpy(records, histogram.data(), count * sizeof(OpcodeHistogramRecord));
+	return count;
+}
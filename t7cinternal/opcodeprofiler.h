@@ -0,0 +1,64 @@
+#pragma once
+#include "framework.h"
+#include "detours.h"
+#include <unordered_map>
+#include <utility>
+
+// distinct handlers that can be wrapped at once. the vm uses far fewer than this, aliases share a handler
+#define OPCODE_PROFILER_MAX_HANDLERS 512
+#define OPCODE_TABLE_SIZE 0x2000
+
+struct OpcodeHistogramRecord
+{
+	INT64 Handler;
+	INT32 FirstOpcode;
+	INT32 NumAliases;
+	INT64 Count;
+	INT64 Cycles;
+};
+
+// a line of its own per script instance, so the gsc and csc threads never write the same cache line
+struct alignas(64) ProfiledCounters
+{
+	INT64 Count;
+	INT64 Cycles;
+};
+
+struct ProfiledHandler
+{
+	tVM_Opcode Original;
+	INT32 FirstOpcode;
+	INT32 NumAliases;
+	ProfiledCounters Instance[2];
+};
+
+EXPORT bool InstallOpcodeProfiler(bool timing);
+EXPORT void UninstallOpcodeProfiler();
+EXPORT INT32 GetOpcodeHistogram(OpcodeHistogramRecord* records, INT32 maxRecords);
+
+// wraps every distinct handler in the opcode table with a counting trampoline
+class OpcodeProfiler
+{
+public:
+	static bool Install(INT64 handlerTable, bool timing);
+	static void Uninstall();
+	static INT32 GetHistogram(OpcodeHistogramRecord* records, INT32 maxRecords);
+	// anything that edits the opcode table while profiling must unwrap it first and rewrap after, counts are kept
+	static bool Suspend();
+	static void Resume();
+
+private:
+	template <INT32 Index> static void Trampoline(INT32 inst, INT64* fs_0, INT64 vmc, bool* terminate);
+	template <size_t... Indices> static const tVM_Opcode* MakeTrampolines(std::index_sequence<Indices...>);
+	static void Wrap();
+	static void Unwrap();
+	static ProfiledHandler Handlers[OPCODE_PROFILER_MAX_HANDLERS];
+	static const tVM_Opcode* Trampolines;
+	static std::unordered_map<INT64, INT32> HandlerIndices;
+	static std::unordered_map<INT64, INT32> TrampolineIndices;
+	static INT32 NumHandlers;
+	static bool Installed;
+	static bool Wrapped;
+	static bool Timing;
+	static INT64 HandlerTable;
+};
@@ -0,0 +1,131 @@
+#pragma once
+#include <cstdint>
+
+// game side script variable layout. kept free of windows types so the heap snapshot tooling builds off-target
+
+typedef uint32_t ScrVarIndex_t;
+typedef uint32_t ScrString_t;
+typedef uint64_t ScrVarNameIndex_t;
+typedef uint32_t ScrVarCannonicalName_t;
+
+enum ScrVarType_t
+{
+	VAR_UNDEFINED = 0,
+	VAR_POINTER = 1,
+	VAR_STRING = 2,
+	VAR_ISTRING = 3,
+	VAR_VECTOR = 4,
+	VAR_HASH = 5,
+	VAR_FLOAT = 6,
+	VAR_INTEGER = 7,
+	VAR_UINT64 = 8,
+	VAR_UINTPTR = 9,
+	VAR_ENTITYOFFSET = 10,
+	VAR_CODEPOS = 11,
+	VAR_PRECODEPOS = 12,
+	VAR_APIFUNCTION = 13,
+	VAR_FUNCTION = 14,
+	VAR_STACK = 15,
+	VAR_ANIMATION = 16,
+	VAR_THREAD = 17,
+	VAR_NOTIFYTHREAD = 18,
+	VAR_TIMETHREAD = 19,
+	VAR_CHILDTHREAD = 20,
+	VAR_CLASS = 21,
+	VAR_STRUCT = 22,
+	VAR_REMOVEDENTITY = 23,
+	VAR_ENTITY = 24,
+	VAR_ARRAY = 25,
+	VAR_REMOVEDTHREAD = 26,
+	VAR_FREE = 27,
+	VAR_THREADLIST = 28,
+	VAR_ENTLIST = 29,
+	VAR_COUNT = 30
+};
+
+struct ScrVarChildPair_t
+{
+	ScrVarIndex_t firstChild;
+	ScrVarIndex_t lastChild;
+};
+
+struct ScrVarStackBuffer_t
+{
+	uint8_t* pos;
+	uint8_t* creationPos;
+	uint16_t size;
+	uint16_t bufLen;
+	ScrVarIndex_t threadId;
+	uint8_t buf[1];
+};
+
+union ScrVarValueUnion_t
+{
+	int64_t intValue;
+	int32_t hashValue;
+	uintptr_t uintptrValue;
+	float floatValue;
+	ScrString_t stringValue;
+	const float* vectorValue;
+	uint8_t* codePosValue;
+	ScrVarIndex_t pointerValue;
+	ScrVarStackBuffer_t* stackValue;
+	ScrVarChildPair_t childPair;
+};
+
+struct alignas(8) ScrVarValue_t
+{
+	ScrVarValueUnion_t u;
+	ScrVarType_t type;
+	uint32_t pad;
+};
+
+struct ScrVarRuntimeInfo_t
+{
+	uint32_t nameType : 3;
+	uint32_t flags : 5;
+	uint32_t refCount : 24;
+};
+
+union EntRefUnion
+{
+	uint64_t val;
+};
+
+union alignas(8) ScrVarObjectInfo_t
+{
+	uint64_t object_o;
+	unsigned int size;
+	EntRefUnion entRefUnion;
+	ScrVarIndex_t nextEntId;
+	ScrVarIndex_t self;
+	ScrVarIndex_t free;
+};
+
+struct ScrVarEntityInfo_t
+{
+	uint16_t classNum;
+	uint16_t clientNum;
+};
+
+union ScrVarObjectW_t
+{
+	uint32_t object_w;
+	ScrVarEntityInfo_t varEntityInfo;
+	ScrVarIndex_t stackId;
+};
+
+struct ScrVar_t
+{
+	ScrVarValue_t value; // 0 (size 10)
+	ScrVarRuntimeInfo_t info; // 10 (size 4)
+	ScrVarObjectInfo_t o; // 18 (size 8)
+	ScrVarObjectW_t w; // 20 (size 4)
+	ScrVarNameIndex_t nameIndex; // 28 (size 8)
+	ScrVarIndex_t nextSibling; // 30 (size 4)
+	ScrVarIndex_t prevSibling; // 34 (size 4)
+	ScrVarIndex_t parentId; // 38 (size 4)
+	ScrVarIndex_t nameSearchHashList; // 3C (size 4)
+};
+
+static_assert(sizeof(ScrVar_t) == 0x40, "ScrVar_t must match the game layout");
@@ -0,0 +1,265 @@
+#include "scrvarbench.h"
+#include "scrvarpool.h"
+
+#define SCRVAR_BENCH_DEFAULT_BURST 16
+#define SCRVAR_BENCH_DEFAULT_WINDOW 64
+#define SCRVAR_BENCH_DEFAULT_LIVESET 4096
+
+EXPORT void GetScrVarHeapStats(INT32 inst, ScrVarHeapStats* stats)
+{
+	memset(stats, 0, sizeof(ScrVarHeapStats));
+	if (inst < 0 || inst > 1 || !*SCRVAR_POOL_PTR(inst))
+	{
+		return;
+	}
+
+	ScrVarPoolStats pool;
+	ScrVarPool::GetStats(inst, &pool);
+	ScrVarBench::Measure(*SCRVAR_POOL_PTR(inst), pool.Linked, stats);
+}
+
+EXPORT bool RunScrVarBenchmark(INT32 inst, const ScrVarBenchConfig* config, ScrVarBenchResult* result)
+{
+	return config && result && ScrVarBench::Run(inst, *config, result);
+}
+
+INT32 ScrVarBench::Replica::Alloc(ScrVarType_t type)
+{
+	if (Head < 0)
+	{
+		Failed++;
+		return -1;
+	}
+
+	INT32 index = Head;
+	ScrVar_t& var = Vars[index];
+	INT32 next = (INT32)var.o.size;
+	Head = (next && next < (INT32)Vars.size() && Vars[next].value.type == VAR_FREE) ? next : -1;
+
+	var.value.type = type;
+	var.o.size = 0;
+	if (Last >= 0)
+	{
+		Distance += (index > Last) ? (index - Last) : (Last - index);
+	}
+	Last = index;
+	Allocs++;
+	return index;
+}
+
+void ScrVarBench::Replica::Free(INT32 index)
+{
+	if (index < 0)
+	{
+		return;
+	}
+	Vars[index].value.type = VAR_FREE;
+	Vars[index].o.size = (Head < 0) ? 0 : Head;
+	Head = index;
+	Frees++;
+}
+
+// the head lives somewhere in the vm globals we dont have an offset for, so it is found as the start of the longest chain nothing links into
+INT32 ScrVarBench::FindFreeListHead(const ScrVar_t* vars, INT32 count)
+{
+	auto nextFree = [&](INT32 at) -> INT32
+	{
+		INT32 next = (INT32)vars[at].o.size;
+		return (next > 0 && next < count && vars[next].value.type == VAR_FREE) ? next : -1;
+	};
+
+	std::vector<BYTE> linkedTo(count, 0);
+	for (INT32 i = 0; i < count; i++)
+	{
+		INT32 next = (vars[i].value.type == VAR_FREE) ? nextFree(i) : -1;
+		if (next >= 0)
+		{
+			linkedTo[next] = 1;
+		}
+	}
+
+	// chain lengths are remembered as they are walked, so chains that run into each other are only walked once.
+	// -1 marks a walk in progress, running into one is a cycle and ends the chain there
+	std::vector<INT32> lengths(count, 0);
+	std::vector<INT32> path;
+	INT32 head = -1;
+	INT32 longest = 0;
+	for (INT32 i = 0; i < count; i++)
+	{
+		if (vars[i].value.type != VAR_FREE || linkedTo[i])
+		{
+			continue;
+		}
+
+		path.clear();
+		INT32 at = i;
+		while (at >= 0 && !lengths[at])
+		{
+			lengths[at] = -1;
+			path.push_back(at);
+			at = nextFree(at);
+		}
+
+		INT32 length = (at >= 0 && lengths[at] > 0) ? lengths[at] : 0;
+		for (auto it = path.rbegin(); it != path.rend(); it++)
+		{
+			lengths[*it] = ++length;
+		}
+
+		if (length > longest)
+		{
+			longest = length;
+			head = i;
+		}
+	}
+	return head;
+}
+
+void ScrVarBench::Measure(const ScrVar_t* vars, INT32 count, ScrVarHeapStats* stats)
+{
+	memset(stats, 0, sizeof(ScrVarHeapStats));
+	stats->Capacity = count;
+	for (INT32 i = 0; i < count; i++)
+	{
+		UINT32 type = vars[i].value.type;
+		if (type < VAR_COUNT)
+		{
+			stats->Occupancy[type]++;
+		}
+	}
+	stats->FreeCount = stats->Occupancy[VAR_FREE];
+
+	INT32 head = FindFreeListHead(vars, count);
+	stats->FreeListHead = head;
+	if (head < 0)
+	{
+		return;
+	}
+
+	INT64 distance = 0;
+	INT32 length = 1;
+	for (INT32 at = head; length <= count; length++)
+	{
+		INT32 next = (INT32)vars[at].o.size;
+		if (!next || next >= count || vars[next].value.type != VAR_FREE)
+		{
+			break;
+		}
+		distance += (next > at) ? (next - at) : (at - next);
+		at = next;
+	}
+	stats->FreeListLength = length;
+	stats->AvgFreeListDistance = (length > 1) ? (double)distance / (length - 1) : 0;
+}
+
+bool ScrVarBench::Run(INT32 inst, const ScrVarBenchConfig& config, ScrVarBenchResult* result)
+{
+	memset(result, 0, sizeof(ScrVarBenchResult));
+	if (inst < 0 || inst > 1 || config.Iterations <= 0 || !*SCRVAR_POOL_PTR(inst))
+	{
+		return false;
+	}
+
+	ScrVarPoolStats pool;
+	ScrVarPool::GetStats(inst, &pool);
+	const ScrVar_t* vars = *SCRVAR_POOL_PTR(inst);
+
+	Replica heap;
+	heap.Vars.assign(vars, vars + pool.Linked);
+	heap.Head = FindFreeListHead(heap.Vars.data(), pool.Linked);
+	heap.Last = -1;
+	heap.Allocs = heap.Frees = heap.Failed = 0;
+	heap.Distance = 0;
+
+	switch (config.Pattern)
+	{
+	case SCRVAR_BENCH_BURST:
+		RunBurst(heap, config);
+		break;
+	case SCRVAR_BENCH_LONGLIVED:
+		RunLongLived(heap, config);
+		break;
+	case SCRVAR_BENCH_CHURN:
+		RunChurn(heap, config);
+		break;
+	default:
+		return false;
+	}
+
+	result->Allocs = heap.Allocs;
+	result->Frees = heap.Frees;
+	result->Failed = heap.Failed;
+	result->AvgAllocDistance = (heap.Allocs > 1) ? heap.Distance / (heap.Allocs - 1) : 0;
+	Measure(heap.Vars.data(), (INT32)heap.Vars.size(), &result->After);
+	return true;
+}
+
+void ScrVarBench::RunBurst(Replica& heap, const ScrVarBenchConfig& config)
+{
+	INT32 burst = (config.BurstSize > 0) ? config.BurstSize : SCRVAR_BENCH_DEFAULT_BURST;
+	INT32 window = (config.LiveSet > 0) ? config.LiveSet : SCRVAR_BENCH_DEFAULT_WINDOW;
+	INT32 rowSize = burst + 1;
+
+	// one row per live array, the oldest row is dropped whole when its slot comes around again
+	std::vector<INT32> rows((size_t)window * rowSize, -1);
+	for (INT32 i = 0; i < config.Iterations; i++)
+	{
+		INT32* row = &rows[(size_t)(i % window) * rowSize];
+		for (INT32 j = 0; j < rowSize; j++)
+		{
+			heap.Free(row[j]);
+		}
+
+		row[0] = heap.Alloc(VAR_ARRAY);
+		for (INT32 j = 1; j < rowSize; j++)
+		{
+			row[j] = heap.Alloc(VAR_INTEGER);
+		}
+	}
+}
+
+void ScrVarBench::RunLongLived(Replica& heap, const ScrVarBenchConfig& config)
+{
+	INT32 fields = (config.BurstSize > 0) ? config.BurstSize : SCRVAR_BENCH_DEFAULT_BURST;
+	std::vector<INT32> temps(fields / 4 + 1, -1);
+	for (INT32 i = 0; i < config.Iterations && heap.Head >= 0; i++)
+	{
+		heap.Alloc(VAR_STRUCT);
+		for (INT32 j = 0; j < fields; j++)
+		{
+			heap.Alloc(VAR_INTEGER);
+		}
+
+		// freed in allocation order, so the next struct lands in the gaps back to front
+		for (auto& temp : temps)
+		{
+			temp = heap.Alloc(VAR_STRING);
+		}
+		for (auto temp : temps)
+		{
+			heap.Free(temp);
+		}
+	}
+}
+
+void ScrVarBench::RunChurn(Replica& heap, const ScrVarBenchConfig& config)
+{
+	INT32 liveSet = (config.LiveSet > 0) ? config.LiveSet : SCRVAR_BENCH_DEFAULT_LIVESET;
+	std::vector<INT32> live(liveSet);
+	for (auto& index : live)
+	{
+		index = heap.Alloc(VAR_INTEGER);
+	}
+
+	UINT32 state = (UINT32)config.Seed | 1;
+	for (INT32 i = 0; i < config.Iterations; i++)
+	{
+		// xorshift, fixed by the seed so runs over the same pool are comparable
+		state ^= state << 13;
+		state ^= state >> 17;
+		state ^= state << 5;
+		INT32& slot = live[state % liveSet];
+		heap.Free(slot);
+		slot = heap.Alloc(VAR_INTEGER);
+	}
+}
@@ -0,0 +1,69 @@
+#pragma once
+#include "builtins.h"
+#include <vector>
+
+#define SCRVAR_BENCH_BURST 0 // arrays allocated and dropped whole, a window of them kept alive
+#define SCRVAR_BENCH_LONGLIVED 1 // structs that are never freed, with short lived temporaries between them
+#define SCRVAR_BENCH_CHURN 2 // a fixed size live set with random frees and allocations
+
+struct ScrVarBenchConfig
+{
+	INT32 Pattern;
+	INT32 Iterations;
+	INT32 BurstSize; // variables per array or struct
+	INT32 LiveSet; // arrays kept alive for burst, live variables for churn
+	INT32 Seed;
+};
+
+struct ScrVarHeapStats
+{
+	INT32 Capacity;
+	INT32 FreeCount; // variables typed free, on the list or not
+	INT32 FreeListLength;
+	INT32 FreeListHead;
+	double AvgFreeListDistance; // mean index distance between neighbours on the free list, the allocations the vm will make next
+	INT32 Occupancy[VAR_COUNT];
+};
+
+struct ScrVarBenchResult
+{
+	INT64 Allocs;
+	INT64 Frees;
+	INT64 Failed; // allocations that found the free list empty
+	double AvgAllocDistance; // mean index distance between consecutive allocations of the run
+	ScrVarHeapStats After;
+};
+
+// fills stats from the live pool of inst, read only
+EXPORT void GetScrVarHeapStats(INT32 inst, ScrVarHeapStats* stats);
+EXPORT bool RunScrVarBenchmark(INT32 inst, const ScrVarBenchConfig* config, ScrVarBenchResult* result);
+
+// the vm has no free entry point we can call, so patterns run against a copy of the live pool with the same free list discipline
+// (lifo, linked through o.size, 0 ends the list). same size, same layout and the same starting fragmentation as the real one.
+// that makes where allocations land meaningful, but not how long they take, so runs report locality and occupancy and no timing.
+class ScrVarBench
+{
+public:
+	static void Measure(const ScrVar_t* vars, INT32 count, ScrVarHeapStats* stats);
+	static bool Run(INT32 inst, const ScrVarBenchConfig& config, ScrVarBenchResult* result);
+
+private:
+	struct Replica
+	{
+		std::vector<ScrVar_t> Vars;
+		INT32 Head; // -1 when the free list is empty
+		INT32 Last; // previous allocation, for the distance average
+		INT64 Allocs;
+		INT64 Frees;
+		INT64 Failed;
+		double Distance;
+
+		INT32 Alloc(ScrVarType_t type);
+		void Free(INT32 index);
+	};
+
+	static INT32 FindFreeListHead(const ScrVar_t* vars, INT32 count);
+	static void RunBurst(Replica& heap, const ScrVarBenchConfig& config);
+	static void RunLongLived(Replica& heap, const ScrVarBenchConfig& config);
+	static void RunChurn(Replica& heap, const ScrVarBenchConfig& config);
+};
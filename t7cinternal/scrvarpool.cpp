@@ -0,0 +1,271 @@
+#include "scrvarpool.h"
+#include "offsets.h"
+#include "inlinehook.h"
+
+tScrVar_AllocVariableInternal ScrVarPool::AllocVariableInternal_Original = NULL;
+ScrVarPool::PoolState ScrVarPool::Pools[2] = {};
+
+EXPORT void GetScrVarPoolStats(INT32 inst, ScrVarPoolStats* stats)
+{
+	ScrVarPool::GetStats(inst, stats);
+}
+
+bool ScrVarPool::Grow(INT32 inst, INT32 numVars, bool largePages)
+{
+	if (inst < 0 || inst > 1)
+	{
+		return false;
+	}
+
+	INT32 stock = inst ? SCRVAR_STOCK_CSC_COUNT : SCRVAR_STOCK_COUNT;
+	numVars = (numVars < stock) ? stock : numVars;
+	if (!Install(inst, numVars, largePages))
+	{
+		return false;
+	}
+
+	PoolState& pool = Pools[inst];
+	if (!Commit(pool, numVars))
+	{
+		return false;
+	}
+
+	if (IsRethreaded(pool))
+	{
+		Rethread(pool, 0);
+	}
+
+	if (!AllocVariableInternal_Original)
+	{
+		// no allocator hook to link lazily from, so everything committed goes on the free list now
+		while (pool.Linked < pool.Committed && IsTerminator(pool, pool.Tail))
+		{
+			Link(pool);
+		}
+		return true;
+	}
+
+	Link(pool);
+	return true;
+}
+
+bool ScrVarPool::Install(INT32 inst, INT32 numVars, bool largePages)
+{
+	ScrVar_t** poolPtr = SCRVAR_POOL_PTR(inst);
+	PoolState& pool = Pools[inst];
+	if (pool.Base && *poolPtr == pool.Base)
+	{
+		return true; // already installed
+	}
+
+	INT32 stock = inst ? SCRVAR_STOCK_CSC_COUNT : SCRVAR_STOCK_COUNT;
+	if (!pool.Base)
+	{
+		// large pages cant be committed piecemeal, so the whole requested size is committed now and that is also the limit
+		SIZE_T largePage = largePages ? GetLargePageMinimum() : 0;
+		if (largePage && EnableLockMemoryPrivilege())
+		{
+			SIZE_T size = (SIZE_T)numVars * sizeof(ScrVar_t);
+			size = (size + largePage - 1) & ~(largePage - 1);
+			pool.Base = (ScrVar_t*)VirtualAlloc(NULL, size, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+			if (pool.Base)
+			{
+				pool.Reserved = pool.Committed = (INT32)(size / sizeof(ScrVar_t));
+				pool.LargePages = true;
+			}
+		}
+
+		if (!pool.Base)
+		{
+			pool.Base = (ScrVar_t*)VirtualAlloc(NULL, (SIZE_T)SCRVAR_POOL_RESERVE * sizeof(ScrVar_t), MEM_RESERVE, PAGE_READWRITE);
+			if (!pool.Base)
+			{
+				LOG_ERROR("Failed to reserve the script variable pool");
+				return false;
+			}
+			pool.Reserved = SCRVAR_POOL_RESERVE;
+			pool.Committed = 0;
+		}
+	}
+
+	// first install, or the game put its own pool back. either way the stock pool is the live one and gets copied over once
+	if (!Commit(pool, stock))
+	{
+		return false;
+	}
+	memcpy(pool.Base, *poolPtr, SCRVAR_STOCK_SPACE(inst));
+
+	// a fresh stock list ends on its last variable, but one put back mid level can end anywhere in use or not at all,
+	// so the end is found rather than written. batches only ever go behind a real end
+	pool.Stock = stock;
+	pool.Linked = stock;
+	pool.Tail = FindTerminator(pool, stock);
+	pool.HighWater = 0;
+
+	*poolPtr = pool.Base;
+
+	if (!AllocVariableInternal_Original)
+	{
+		AllocVariableInternal_Original = (tScrVar_AllocVariableInternal)InlineHook::Install(OFF_ScrVar_AllocVariableInternal, (INT64)AllocVariableInternal_Hook);
+	}
+	return true;
+}
+
+bool ScrVarPool::Commit(PoolState& pool, INT32 numVars)
+{
+	if (numVars <= pool.Committed)
+	{
+		return true;
+	}
+
+	INT32 target = ((numVars + SCRVAR_POOL_COMMIT_STEP - 1) / SCRVAR_POOL_COMMIT_STEP) * SCRVAR_POOL_COMMIT_STEP;
+	target = (target > pool.Reserved) ? pool.Reserved : target;
+	if (target <= pool.Committed)
+	{
+		return false; // out of reserved space
+	}
+
+	// fresh pages come back zeroed, they only need to be linked before the vm sees them
+	if (!VirtualAlloc(pool.Base + pool.Committed, (SIZE_T)(target - pool.Committed) * sizeof(ScrVar_t), MEM_COMMIT, PAGE_READWRITE))
+	{
+		LOG_ERROR("Failed to commit %d script variables", target - pool.Committed);
+		return false;
+	}
+	pool.Committed = target;
+	pool.Growths++;
+	return true;
+}
+
+INT32 ScrVarPool::FindTerminator(const PoolState& pool, INT32 count)
+{
+	for (INT32 i = count - 1; i > 0; i--)
+	{
+		if (IsTerminator(pool, i))
+		{
+			return i;
+		}
+	}
+	return -1;
+}
+
+void ScrVarPool::Rethread(PoolState& pool, INT32 highWater)
+{
+	// everything past the stock range was freed with the level, it is linked again batch by batch from the stock end
+	pool.Linked = pool.Stock;
+	pool.Tail = pool.Stock - 1;
+	pool.HighWater = highWater;
+}
+
+void ScrVarPool::Link(PoolState& pool)
+{
+	// once the vm has taken the tail the free list is empty and there is nothing left to append to. a tail freed again
+	// went on the front of a new list and links into it, writing its link would cut that list off
+	if (!IsTerminator(pool, pool.Tail))
+	{
+		return;
+	}
+
+	if (pool.Linked >= pool.Committed && !Commit(pool, pool.Committed + 1))
+	{
+		return;
+	}
+
+	INT32 count = pool.Committed - pool.Linked;
+	count = (count > SCRVAR_POOL_LINK_BATCH) ? SCRVAR_POOL_LINK_BATCH : count;
+	ScrVar_t* batch = pool.Base + pool.Linked;
+	for (INT32 i = 0; i < count; i++)
+	{
+		batch[i].value.type = VAR_FREE;
+		batch[i].o.size = pool.Linked + i + 1;
+	}
+	batch[count - 1].o.size = 0;
+
+	// the old tail is pointed at the batch last, so the vm never follows a link into unthreaded variables
+	pool.Base[pool.Tail].o.size = pool.Linked;
+	pool.Tail = pool.Linked + count - 1;
+	pool.Linked += count;
+}
+
+INT32 __fastcall ScrVarPool::AllocVariableInternal_Hook(unsigned int inst, unsigned int nameType, __int64 a3, unsigned int a4)
+{
+	INT32 index = AllocVariableInternal_Original(inst, nameType, a3, a4);
+	if (inst > 1)
+	{
+		return index;
+	}
+
+	PoolState& pool = Pools[inst];
+	if (!pool.Base || *SCRVAR_POOL_PTR(inst) != pool.Base)
+	{
+		return index;
+	}
+
+	// a level restart can rebuild the free list over the stock range in place, leaving our batches behind an end the vm
+	// never reaches. checked once the vm gets close to the end of that range, from there on the pool grows from the stock end again
+	if (index < pool.Stock && index + SCRVAR_POOL_LOW_WATER >= pool.Stock && IsRethreaded(pool))
+	{
+		Rethread(pool, index);
+	}
+
+	// linked batches are handed out in order behind any reused variables, so the high water mark tells us how close the tail is
+	pool.HighWater = (index > pool.HighWater) ? index : pool.HighWater;
+	if (pool.HighWater + SCRVAR_POOL_LOW_WATER >= pool.Tail)
+	{
+		Link(pool);
+	}
+	return index;
+}
+
+bool ScrVarPool::EnableLockMemoryPrivilege()
+{
+	HANDLE token;
+	if (!OpenProcessToken(GetCurrentProcess(), TOKEN_ADJUST_PRIVILEGES | TOKEN_QUERY, &token))
+	{
+		return false;
+	}
+
+	TOKEN_PRIVILEGES privileges = {};
+	privileges.PrivilegeCount = 1;
+	privileges.Privileges[0].Attributes = SE_PRIVILEGE_ENABLED;
+	bool enabled = LookupPrivilegeValue(NULL, SE_LOCK_MEMORY_NAME, &privileges.Privileges[0].Luid)
+		&& AdjustTokenPrivileges(token, FALSE, &privileges, 0, NULL, NULL)
+		&& GetLastError() == ERROR_SUCCESS; // not_all_assigned when the account doesnt hold the privilege
+	CloseHandle(token);
+	return enabled;
+}
+
+void ScrVarPool::GetStats(INT32 inst, ScrVarPoolStats* stats)
+{
+	memset(stats, 0, sizeof(ScrVarPoolStats));
+	if (inst < 0 || inst > 1)
+	{
+		return;
+	}
+
+	PoolState& pool = Pools[inst];
+	ScrVar_t* vars = *SCRVAR_POOL_PTR(inst);
+	INT32 linked = inst ? SCRVAR_STOCK_CSC_COUNT : SCRVAR_STOCK_COUNT;
+	stats->Capacity = stats->Reserved = linked;
+
+	if (pool.Base && vars == pool.Base)
+	{
+		stats->Installed = 1;
+		stats->Capacity = pool.Committed;
+		stats->Reserved = pool.Reserved;
+		stats->HighWater = pool.HighWater;
+		stats->Growths = pool.Growths;
+		stats->LargePages = pool.LargePages;
+		linked = IsRethreaded(pool) ? pool.Stock : pool.Linked; // batches behind a rebuilt list are unreachable until relinked
+	}
+	stats->Linked = linked;
+
+	if (!vars)
+	{
+		return;
+	}
+	for (INT32 i = 0; i < linked; i++)
+	{
+		stats->FreeCount += vars[i].value.type == VAR_FREE;
+	}
+	stats->FreeCount += stats->Capacity - linked;
+}
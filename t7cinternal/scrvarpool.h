@@ -0,0 +1,72 @@
+#pragma once
+#include "builtins.h"
+#include "offsets.h"
+
+#define SCRVAR_STOCK_COUNT 130000
+#define SCRVAR_STOCK_CSC_COUNT 65000
+#define SCRVAR_STOCK_SPACE(inst) (sizeof(ScrVar_t) * (inst ? SCRVAR_STOCK_CSC_COUNT : SCRVAR_STOCK_COUNT))
+
+#define SCRVAR_POOL_RESERVE 0x1000000 // variables of address space reserved up front, 1GB
+#define SCRVAR_POOL_COMMIT_STEP 0x10000 // variables committed per growth, 4MB
+#define SCRVAR_POOL_LINK_BATCH 0x1000 // variables threaded onto the free list at a time
+#define SCRVAR_POOL_LOW_WATER 0x400 // link the next batch once allocations get this close to the tail
+
+#define SCRVAR_POOL_PTR(inst) ((ScrVar_t**)((char*)OFF_ScrVarGlob + 128 + ((inst) << 8)))
+
+struct ScrVarPoolStats
+{
+	INT32 Capacity; // committed variables
+	INT32 Reserved;
+	INT32 Linked; // variables the vm can see, everything past this is committed but not on the free list yet
+	INT32 HighWater; // highest index the allocator has handed out
+	INT32 FreeCount;
+	INT32 Growths;
+	INT32 LargePages;
+	INT32 Installed;
+};
+
+EXPORT void GetScrVarPoolStats(INT32 inst, ScrVarPoolStats* stats);
+
+// replaces the stock variable pool with one reserved range that is committed in steps and linked onto the free list in batches.
+// the pool never moves after it is installed, so growing it is a commit and a relink of the old tail, never a copy.
+class ScrVarPool
+{
+public:
+	// numVars is a floor, the pool keeps growing on its own until the reservation runs out
+	static bool Grow(INT32 inst, INT32 numVars, bool largePages);
+	static void GetStats(INT32 inst, ScrVarPoolStats* stats);
+
+private:
+	struct PoolState
+	{
+		ScrVar_t* Base;
+		INT32 Reserved;
+		INT32 Committed;
+		INT32 Linked;
+		INT32 Stock; // variables the game threads itself, at install and on a level restart
+		INT32 Tail; // last linked variable, its free link is 0. -1 when the free list had no end to adopt
+		INT32 HighWater;
+		INT32 Growths;
+		bool LargePages;
+	};
+
+	static bool Install(INT32 inst, INT32 numVars, bool largePages);
+	static bool Commit(PoolState& pool, INT32 numVars);
+	static void Link(PoolState& pool);
+	// free and linking nowhere, the end of the free list
+	static inline bool IsTerminator(const PoolState& pool, INT32 index)
+	{
+		return index >= 0 && pool.Base[index].value.type == VAR_FREE && !pool.Base[index].o.size;
+	}
+	// a list has one end. if the last stock variable is one while our tail still is, the game rebuilt the list over the stock range
+	static inline bool IsRethreaded(const PoolState& pool)
+	{
+		return pool.Tail != pool.Stock - 1 && IsTerminator(pool, pool.Stock - 1) && IsTerminator(pool, pool.Tail);
+	}
+	static INT32 FindTerminator(const PoolState& pool, INT32 count);
+	static void Rethread(PoolState& pool, INT32 highWater);
+	static bool EnableLockMemoryPrivilege();
+	static INT32 __fastcall AllocVariableInternal_Hook(unsigned int inst, unsigned int nameType, __int64 a3, unsigned int a4);
+	static tScrVar_AllocVariableInternal AllocVariableInternal_Original;
+	static PoolState Pools[2];
+};
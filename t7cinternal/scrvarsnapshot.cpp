@@ -0,0 +1,412 @@
+#ifdef _WIN32
+#include "scrvarpool.h"
+#endif
+#include "scrvarsnapshot.h"
+#include <algorithm>
+#include <cstring>
+#include <cstdio>
+
+#ifdef _WIN32
+EXPORT INT32 CaptureScrVarSnapshot(INT32 inst, uint8_t* buffer, INT32 bufferSize)
+{
+	if (inst < 0 || inst > 1 || !*SCRVAR_POOL_PTR(inst))
+	{
+		return 0;
+	}
+
+	ScrVarPoolStats pool;
+	ScrVarPool::GetStats(inst, &pool);
+	std::vector<uint8_t> snapshot;
+	ScrVarSnapshot::Capture(*SCRVAR_POOL_PTR(inst), pool.Linked, (uint16_t)inst, snapshot);
+
+	// the full size is always returned, call again with a bigger buffer if it didnt fit
+	if (buffer && bufferSize >= (INT32)snapshot.size())
+	{
+		memcpy(buffer, snapshot.data(), snapshot.size());
+	}
+	return (INT32)snapshot.size();
+}
+#endif
+
+static const char* ScrVarTypeNames[VAR_COUNT] =
+{
+	"undefined", "pointer", "string", "istring", "vector", "hash", "float", "integer", "uint64", "uintptr",
+	"entityoffset", "codepos", "precodepos", "apifunction", "function", "stack", "animation", "thread", "notifythread", "timethread",
+	"childthread", "class", "struct", "removedentity", "entity", "array", "removedthread", "free", "threadlist", "entlist",
+};
+
+const char* ScrVarSnapshot::TypeName(uint32_t type)
+{
+	return (type < VAR_COUNT) ? ScrVarTypeNames[type] : "unknown";
+}
+
+uint32_t ScrVarSnapshot::RefCountBucket(uint32_t refCount)
+{
+	uint32_t bucket = 0;
+	while (refCount)
+	{
+		bucket++;
+		refCount >>= 1;
+	}
+	return (bucket < SCRVAR_REFCOUNT_BUCKETS) ? bucket : SCRVAR_REFCOUNT_BUCKETS - 1;
+}
+
+void ScrVarSnapshot::PutVarint(std::vector<uint8_t>& out, uint32_t value)
+{
+	while (value >= 0x80)
+	{
+		out.push_back((uint8_t)(value | 0x80));
+		value >>= 7;
+	}
+	out.push_back((uint8_t)value);
+}
+
+bool ScrVarSnapshot::GetVarint(const uint8_t*& at, const uint8_t* end, uint32_t& value)
+{
+	value = 0;
+	for (uint32_t shift = 0; shift < 35; shift += 7)
+	{
+		if (at >= end)
+		{
+			return false;
+		}
+		uint8_t byte = *at++;
+		value |= (uint32_t)(byte & 0x7F) << shift;
+		if (!(byte & 0x80))
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+void ScrVarSnapshot::Capture(const ScrVar_t* vars, uint32_t count, uint16_t inst, std::vector<uint8_t>& out)
+{
+	// per capture, the injector export and the builtin can capture at the same time
+	std::vector<uint32_t> children(count, 0);
+
+	ScrVarSnapshotHeader header = {};
+	header.Magic = SCRVAR_SNAPSHOT_MAGIC;
+	header.Version = SCRVAR_SNAPSHOT_VERSION;
+	header.Inst = inst;
+	header.Capacity = count;
+
+	size_t tablesOffset = sizeof(ScrVarSnapshotHeader);
+	size_t recordsOffset = tablesOffset + sizeof(uint32_t) * VAR_COUNT * (1 + SCRVAR_REFCOUNT_BUCKETS);
+	out.assign(recordsOffset, 0);
+	uint32_t* typeCounts = (uint32_t*)(out.data() + tablesOffset);
+	uint32_t* refCounts = typeCounts + VAR_COUNT;
+
+	auto isLive = [&](uint32_t index)
+	{
+		uint32_t type = vars[index].value.type;
+		return type < VAR_COUNT && type != VAR_FREE;
+	};
+
+	for (uint32_t i = 0; i < count; i++)
+	{
+		if (!isLive(i))
+		{
+			continue;
+		}
+		uint32_t type = vars[i].value.type;
+		header.NumLive++;
+		typeCounts[type]++;
+		refCounts[type * SCRVAR_REFCOUNT_BUCKETS + RefCountBucket(vars[i].info.refCount)]++;
+
+		// 0 is never handed out as an object, so it doubles as no parent
+		uint32_t parent = vars[i].parentId;
+		if (parent && parent < count && parent != i)
+		{
+			children[parent]++;
+		}
+	}
+
+	uint32_t lastId = 0;
+	for (uint32_t i = 0; i < count; i++)
+	{
+		if (!children[i] || !isLive(i))
+		{
+			continue;
+		}
+		uint32_t parent = vars[i].parentId;
+		bool hasParent = parent && parent < count && parent != i && isLive(parent);
+
+		PutVarint(out, i - lastId);
+		PutVarint(out, hasParent ? parent + 1 : 0);
+		out.push_back((uint8_t)vars[i].value.type);
+		PutVarint(out, children[i]);
+		lastId = i;
+		header.NumParents++;
+	}
+
+	header.ParentDataSize = (uint32_t)(out.size() - recordsOffset);
+	memcpy(out.data(), &header, sizeof(header));
+}
+
+bool ScrVarSnapshot::Parse(const uint8_t* data, size_t size, ScrVarSnapshotData& out)
+{
+	size_t tablesSize = sizeof(out.TypeCounts) + sizeof(out.RefCounts);
+	if (!data || size < sizeof(ScrVarSnapshotHeader) + tablesSize)
+	{
+		return false;
+	}
+
+	memcpy(&out.Header, data, sizeof(ScrVarSnapshotHeader));
+	if (out.Header.Magic != SCRVAR_SNAPSHOT_MAGIC || out.Header.Version != SCRVAR_SNAPSHOT_VERSION)
+	{
+		return false;
+	}
+
+	const uint8_t* at = data + sizeof(ScrVarSnapshotHeader);
+	memcpy(out.TypeCounts, at, sizeof(out.TypeCounts));
+	memcpy(out.RefCounts, at + sizeof(out.TypeCounts), sizeof(out.RefCounts));
+	at += tablesSize;
+
+	const uint8_t* end = data + size;
+	if ((size_t)(end - at) < out.Header.ParentDataSize)
+	{
+		return false;
+	}
+	end = at + out.Header.ParentDataSize;
+
+	out.Parents.clear();
+	// the count comes from the file, a record is at least four bytes so the data it claims to hold caps it
+	out.Parents.reserve((out.Header.NumParents < out.Header.ParentDataSize / 4) ? out.Header.NumParents : out.Header.ParentDataSize / 4);
+	uint32_t id = 0;
+	for (uint32_t i = 0; i < out.Header.NumParents; i++)
+	{
+		uint32_t delta, parent, children;
+		if (!GetVarint(at, end, delta) || !GetVarint(at, end, parent) || at >= end)
+		{
+			return false;
+		}
+		uint8_t type = *at++;
+		if (!GetVarint(at, end, children))
+		{
+			return false;
+		}
+
+		id += delta;
+		out.Parents.push_back({ id, parent ? parent - 1 : SCRVAR_NO_PARENT, children, type });
+	}
+	return at == end;
+}
+
+void ScrVarSnapshot::Diff(const ScrVarSnapshotData& before, const ScrVarSnapshotData& after, ScrVarSnapshotDiff& out)
+{
+	out.LiveBefore = (int32_t)before.Header.NumLive;
+	out.LiveAfter = (int32_t)after.Header.NumLive;
+	out.Types.clear();
+	out.Parents.clear();
+
+	for (uint32_t type = 0; type < VAR_COUNT; type++)
+	{
+		if (before.TypeCounts[type] != after.TypeCounts[type])
+		{
+			out.Types.push_back({ (uint8_t)type, (int32_t)before.TypeCounts[type], (int32_t)after.TypeCounts[type] });
+		}
+	}
+	std::sort(out.Types.begin(), out.Types.end(), [](const ScrVarTypeDelta& a, const ScrVarTypeDelta& b)
+	{
+		int32_t da = a.After - a.Before, db = b.After - b.Before;
+		return ((da < 0) ? -da : da) > ((db < 0) ? -db : db);
+	});
+
+	// both lists are sorted by id, so this is a merge
+	auto b = before.Parents.begin();
+	auto a = after.Parents.begin();
+	while (b != before.Parents.end() || a != after.Parents.end())
+	{
+		bool takeBefore = a == after.Parents.end() || (b != before.Parents.end() && b->Id < a->Id);
+		bool takeAfter = b == before.Parents.end() || (a != after.Parents.end() && a->Id < b->Id);
+		if (!takeBefore && !takeAfter && b->Type != a->Type)
+		{
+			// same slot, different object
+			out.Parents.push_back({ b->Id, b->ParentId, b->Type, (int32_t)b->Children, 0 });
+			out.Parents.push_back({ a->Id, a->ParentId, a->Type, 0, (int32_t)a->Children });
+			b++;
+			a++;
+			continue;
+		}
+
+		if (takeBefore)
+		{
+			out.Parents.push_back({ b->Id, b->ParentId, b->Type, (int32_t)b->Children, 0 });
+			b++;
+		}
+		else if (takeAfter)
+		{
+			out.Parents.push_back({ a->Id, a->ParentId, a->Type, 0, (int32_t)a->Children });
+			a++;
+		}
+		else
+		{
+			if (a->Children != b->Children)
+			{
+				out.Parents.push_back({ a->Id, a->ParentId, a->Type, (int32_t)b->Children, (int32_t)a->Children });
+			}
+			b++;
+			a++;
+		}
+	}
+	std::stable_sort(out.Parents.begin(), out.Parents.end(), [](const ScrVarParentDelta& x, const ScrVarParentDelta& y)
+	{
+		return (x.After - x.Before) > (y.After - y.Before);
+	});
+}
+
+void ScrVarSnapshot::FormatAncestry(const ScrVarSnapshotData& snapshot, uint32_t parentId, std::string& out)
+{
+	char line[64];
+	for (int depth = 0; depth < 4 && parentId != SCRVAR_NO_PARENT; depth++)
+	{
+		auto it = std::lower_bound(snapshot.Parents.begin(), snapshot.Parents.end(), parentId, [](const ScrVarParentRecord& record, uint32_t id) { return record.Id < id; });
+		if (it == snapshot.Parents.end() || it->Id != parentId)
+		{
+			snprintf(line, sizeof(line), " <- #%u", parentId);
+			out += line;
+			return;
+		}
+		snprintf(line, sizeof(line), " <- #%u %s", it->Id, TypeName(it->Type));
+		out += line;
+		parentId = it->ParentId;
+	}
+}
+
+void ScrVarSnapshot::FormatSummary(const ScrVarSnapshotData& snapshot, size_t maxParents, std::string& out)
+{
+	char line[256];
+	snprintf(line, sizeof(line), "inst %u: %u live of %u, %u parents\n", snapshot.Header.Inst, snapshot.Header.NumLive, snapshot.Header.Capacity, snapshot.Header.NumParents);
+	out += line;
+
+	std::vector<uint32_t> types;
+	for (uint32_t type = 0; type < VAR_COUNT; type++)
+	{
+		if (snapshot.TypeCounts[type])
+		{
+			types.push_back(type);
+		}
+	}
+	std::sort(types.begin(), types.end(), [&](uint32_t a, uint32_t b) { return snapshot.TypeCounts[a] > snapshot.TypeCounts[b]; });
+	for (uint32_t type : types)
+	{
+		snprintf(line, sizeof(line), "  %-14s %8u  refs", TypeName(type), snapshot.TypeCounts[type]);
+		out += line;
+		for (uint32_t bucket = 0; bucket < SCRVAR_REFCOUNT_BUCKETS; bucket++)
+		{
+			if (snapshot.RefCounts[type][bucket])
+			{
+				if (bucket)
+				{
+					snprintf(line, sizeof(line), " [%u+]:%u", 1u << (bucket - 1), snapshot.RefCounts[type][bucket]);
+				}
+				else
+				{
+					snprintf(line, sizeof(line), " [0]:%u", snapshot.RefCounts[type][bucket]);
+				}
+				out += line;
+			}
+		}
+		out += "\n";
+	}
+
+	std::vector<const ScrVarParentRecord*> parents;
+	for (auto& record : snapshot.Parents)
+	{
+		parents.push_back(&record);
+	}
+	size_t count = (parents.size() < maxParents) ? parents.size() : maxParents;
+	std::partial_sort(parents.begin(), parents.begin() + count, parents.end(), [](const ScrVarParentRecord* a, const ScrVarParentRecord* b) { return a->Children > b->Children; });
+	for (size_t i = 0; i < count; i++)
+	{
+		snprintf(line, sizeof(line), "  #%u %s: %u children", parents[i]->Id, TypeName(parents[i]->Type), parents[i]->Children);
+		out += line;
+		FormatAncestry(snapshot, parents[i]->ParentId, out);
+		out += "\n";
+	}
+}
+
+void ScrVarSnapshot::FormatDiff(const ScrVarSnapshotDiff& diff, const ScrVarSnapshotData& after, size_t maxParents, std::string& out)
+{
+	char line[256];
+	snprintf(line, sizeof(line), "live %d -> %d (%+d)\n", diff.LiveBefore, diff.LiveAfter, diff.LiveAfter - diff.LiveBefore);
+	out += line;
+
+	for (auto& type : diff.Types)
+	{
+		snprintf(line, sizeof(line), "  %-14s %8d -> %-8d (%+d)\n", TypeName(type.Type), type.Before, type.After, type.After - type.Before);
+		out += line;
+	}
+
+	size_t count = 0;
+	for (auto& parent : diff.Parents)
+	{
+		if (count++ >= maxParents || parent.After <= parent.Before)
+		{
+			break;
+		}
+		snprintf(line, sizeof(line), "  #%u %s: %d -> %d children (%+d)", parent.Id, TypeName(parent.Type), parent.Before, parent.After, parent.After - parent.Before);
+		out += line;
+		FormatAncestry(after, parent.ParentId, out);
+		out += "\n";
+	}
+}
+
+#ifdef SCRVAR_SNAPSHOT_TOOL
+// g++ -std=c++14 -DSCRVAR_SNAPSHOT_TOOL scrvarsnapshot.cpp -o scrvardiff
+// scrvardiff <snapshot>: summary. scrvardiff <before> <after>: growth between the two
+static bool ReadSnapshot(const char* path, ScrVarSnapshotData& out)
+{
+	FILE* file = fopen(path, "rb");
+	if (!file)
+	{
+		fprintf(stderr, "cant open %s\n", path);
+		return false;
+	}
+	std::vector<uint8_t> data;
+	uint8_t chunk[0x10000];
+	size_t read;
+	while ((read = fread(chunk, 1, sizeof(chunk), file)) > 0)
+	{
+		data.insert(data.end(), chunk, chunk + read);
+	}
+	fclose(file);
+
+	if (!ScrVarSnapshot::Parse(data.data(), data.size(), out))
+	{
+		fprintf(stderr, "%s is not a valid snapshot\n", path);
+		return false;
+	}
+	return true;
+}
+
+int main(int argc, char** argv)
+{
+	if (argc < 2 || argc > 3)
+	{
+		fprintf(stderr, "usage: %s <snapshot> [newer snapshot]\n", argv[0]);
+		return 1;
+	}
+
+	ScrVarSnapshotData before, after;
+	if (!ReadSnapshot(argv[1], before) || (argc == 3 && !ReadSnapshot(argv[2], after)))
+	{
+		return 1;
+	}
+
+	std::string text;
+	if (argc == 2)
+	{
+		ScrVarSnapshot::FormatSummary(before, 32, text);
+	}
+	else
+	{
+		ScrVarSnapshotDiff diff;
+		ScrVarSnapshot::Diff(before, after, diff);
+		ScrVarSnapshot::FormatDiff(diff, after, 32, text);
+	}
+	fputs(text.c_str(), stdout);
+	return 0;
+}
+#endif
@@ -0,0 +1,83 @@
+#pragma once
+#include "scrvar.h"
+#include <vector>
+#include <string>
+
+#define SCRVAR_SNAPSHOT_MAGIC 0x4E535653 // SVSN
+#define SCRVAR_SNAPSHOT_VERSION 1
+#define SCRVAR_REFCOUNT_BUCKETS 25 // 0, 1, 2-3, 4-7 ... refcounts are 24 bits
+#define SCRVAR_NO_PARENT 0xFFFFFFFF
+
+// header, then TypeCounts[VAR_COUNT], RefCounts[VAR_COUNT][SCRVAR_REFCOUNT_BUCKETS], then ParentDataSize bytes of parent records.
+// a parent record is varint(id - previous id), varint(parent id + 1, 0 for none), type byte, varint(children), sorted by id
+struct ScrVarSnapshotHeader
+{
+	uint32_t Magic;
+	uint16_t Version;
+	uint16_t Inst;
+	uint32_t Capacity;
+	uint32_t NumLive;
+	uint32_t NumParents;
+	uint32_t ParentDataSize;
+};
+
+struct ScrVarParentRecord
+{
+	uint32_t Id;
+	uint32_t ParentId; // SCRVAR_NO_PARENT for roots
+	uint32_t Children;
+	uint8_t Type;
+};
+
+struct ScrVarSnapshotData
+{
+	ScrVarSnapshotHeader Header;
+	uint32_t TypeCounts[VAR_COUNT];
+	uint32_t RefCounts[VAR_COUNT][SCRVAR_REFCOUNT_BUCKETS];
+	std::vector<ScrVarParentRecord> Parents;
+};
+
+struct ScrVarTypeDelta
+{
+	uint8_t Type;
+	int32_t Before;
+	int32_t After;
+};
+
+// an index reused by a different kind of object shows up as one parent shrinking to 0 and another growing from 0
+struct ScrVarParentDelta
+{
+	uint32_t Id;
+	uint32_t ParentId;
+	uint8_t Type;
+	int32_t Before;
+	int32_t After;
+};
+
+struct ScrVarSnapshotDiff
+{
+	int32_t LiveBefore;
+	int32_t LiveAfter;
+	std::vector<ScrVarTypeDelta> Types; // changed types only, largest change first
+	std::vector<ScrVarParentDelta> Parents; // changed parents only, most growth first
+};
+
+// compact heap snapshots of a script variable pool. nothing here touches the game, so snapshots can be parsed and diffed offline.
+// build scrvarsnapshot.cpp with SCRVAR_SNAPSHOT_TOOL defined for a command line dumper and differ.
+class ScrVarSnapshot
+{
+public:
+	// one pass over the pool for the tables, one over the parents for the records
+	static void Capture(const ScrVar_t* vars, uint32_t count, uint16_t inst, std::vector<uint8_t>& out);
+	static bool Parse(const uint8_t* data, size_t size, ScrVarSnapshotData& out);
+	static void Diff(const ScrVarSnapshotData& before, const ScrVarSnapshotData& after, ScrVarSnapshotDiff& out);
+	static void FormatSummary(const ScrVarSnapshotData& snapshot, size_t maxParents, std::string& out);
+	static void FormatDiff(const ScrVarSnapshotDiff& diff, const ScrVarSnapshotData& after, size_t maxParents, std::string& out);
+	static const char* TypeName(uint32_t type);
+	static uint32_t RefCountBucket(uint32_t refCount);
+
+private:
+	static void PutVarint(std::vector<uint8_t>& out, uint32_t value);
+	static bool GetVarint(const uint8_t*& at, const uint8_t* end, uint32_t& value);
+	static void FormatAncestry(const ScrVarSnapshotData& snapshot, uint32_t parentId, std::string& out);
+};
@@ -0,0 +1,230 @@
+#include "testing.h"
+#include "asynclog.h"
+#include <string>
+#include <vector>
+#include <mutex>
+#include <thread>
+#include <unistd.h>
+
+// everything the drain thread wrote, the sink is deleted by the drain thread so the text lives out here
+static std::mutex CapturedLock;
+static std::string Captured;
+
+class CaptureSink : public LogSink
+{
+public:
+	void Write(const char* text, size_t length) override
+	{
+		std::lock_guard<std::mutex> lock(CapturedLock);
+		Captured.append(text, length);
+	}
+};
+
+static void TestRingOrderAndFull()
+{
+	MpscRing<int, 8> ring;
+	for (int i = 0; i < 8; i++)
+	{
+		CHECK(ring.TryPush([&](int& value) { value = i; }));
+	}
+	CHECK(!ring.TryPush([](int& value) { value = -1; }));
+
+	int expected = 0;
+	bool ordered = true;
+	while (ring.TryPop([&](int value) { ordered &= value == expected++; }));
+	CHECK(ordered);
+	CHECK_EQ(expected, 8);
+	CHECK(!ring.TryPop([](int) {}));
+	CHECK(ring.TryPush([](int& value) { value = 8; }));
+}
+
+static void TestRingProducers()
+{
+	// four producers against one consumer, every value arrives exactly once and in order per producer
+	const int numProducers = 4;
+	const int perProducer = 100000;
+	static MpscRing<int, 64> ring;
+	std::vector<std::thread> producers;
+	for (int p = 0; p < numProducers; p++)
+	{
+		producers.emplace_back([p]()
+		{
+			for (int i = 0; i < perProducer; i++)
+			{
+				while (!ring.TryPush([&](int& value) { value = (p << 24) | i; }))
+				{
+					std::this_thread::yield();
+				}
+			}
+		});
+	}
+
+	int next[numProducers] = {};
+	int received = 0;
+	bool ordered = true;
+	while (received < numProducers * perProducer)
+	{
+		if (!ring.TryPop([&](int value)
+		{
+			int p = value >> 24;
+			ordered &= (value & 0xFFFFFF) == next[p]++;
+			received++;
+		}))
+		{
+			std::this_thread::yield();
+		}
+	}
+	for (auto& producer : producers)
+	{
+		producer.join();
+	}
+	CHECK(ordered);
+	for (int p = 0; p < numProducers; p++)
+	{
+		CHECK_EQ(next[p], perProducer);
+	}
+}
+
+static LogRecord MakeRecord(const char* format)
+{
+	LogRecord record = {};
+	record.Format = format;
+	return record;
+}
+
+static void AddArg(LogRecord& record, LogArgType type, uint64_t value)
+{
+	record.Types[record.NumArgs] = type;
+	record.Args[record.NumArgs++] = value;
+}
+
+static void TestFormat()
+{
+	char out[256];
+	LogRecord record = MakeRecord("%d %u %5.2f %s %x%% %c");
+	double d = 3.14159;
+	uint64_t bits;
+	memcpy(&bits, &d, sizeof(bits));
+	AddArg(record, LOG_ARG_INT, (uint64_t)(int64_t)-5);
+	AddArg(record, LOG_ARG_UINT, 0xFFFFFFFFu);
+	AddArg(record, LOG_ARG_DOUBLE, bits);
+	strcpy(record.Text, "text");
+	record.TextOffsets[record.NumArgs] = 0;
+	AddArg(record, LOG_ARG_STRING, 1);
+	AddArg(record, LOG_ARG_UINT, 0xBEEF);
+	AddArg(record, LOG_ARG_INT, 'z');
+	size_t length = AsyncLog::Format(record, out, sizeof(out));
+	CHECK(!strcmp(out, "-5 4294967295  3.14 text beef% z"));
+	CHECK_EQ(length, strlen(out));
+
+	// the length modifiers in the format are replaced by the stored width, msvc's I64 included
+	record = MakeRecord("%lld %I64x %hd");
+	AddArg(record, LOG_ARG_INT64, (uint64_t)-1234567890123ll);
+	AddArg(record, LOG_ARG_UINT64, 0x123456789ull);
+	AddArg(record, LOG_ARG_INT, (uint64_t)(int64_t)-2);
+	AsyncLog::Format(record, out, sizeof(out));
+	CHECK(!strcmp(out, "-1234567890123 123456789 -2"));
+
+	// missing arguments and unknown conversions are left as written, null strings print like printf
+	record = MakeRecord("%d %s %q");
+	AddArg(record, LOG_ARG_INT, 1);
+	record.TextOffsets[record.NumArgs] = 0xFFFF;
+	AddArg(record, LOG_ARG_STRING, 0);
+	AsyncLog::Format(record, out, sizeof(out));
+	CHECK(!strcmp(out, "1 (null) %q"));
+	record = MakeRecord("%d and %d");
+	AddArg(record, LOG_ARG_INT, 1);
+	AsyncLog::Format(record, out, sizeof(out));
+	CHECK(!strcmp(out, "1 and %d"));
+
+	// truncated, but always terminated
+	record = MakeRecord("a long line %d");
+	AddArg(record, LOG_ARG_INT, 12345);
+	CHECK_EQ(AsyncLog::Format(record, out, 8), 7);
+	CHECK(!strcmp(out, "a long "));
+	CHECK_EQ(AsyncLog::Format(record, out, 0), 0);
+}
+
+static int Evaluations = 0;
+
+static int Evaluate()
+{
+	return ++Evaluations;
+}
+
+static void TestWriteAndDrain()
+{
+	Captured.clear();
+	AsyncLog::SetSink(new CaptureSink());
+
+	// strings are copied when the line is written, not when it is drained
+	char name[16];
+	strcpy(name, "first");
+	LOG_INFO("line %d from %s", 1, name);
+	strcpy(name, "gone");
+	LOG_ERROR("line %d at %p", 2, (void*)0x10);
+	LOG_AT(LOG_LEVEL_DEBUG, "compiled out %d", Evaluate());
+	AsyncLog::Stop();
+
+	const char* expected = "line 1 from first\nline 2 at 0x10\n";
+	CHECK(Captured == expected);
+	CHECK_EQ(Evaluations, 0);
+
+	// stopped, the next line starts it again
+	Captured.clear();
+	AsyncLog::SetSink(new CaptureSink());
+	LOG_WARN("again");
+	AsyncLog::Stop();
+	CHECK(Captured == "again\n");
+}
+
+static void TestFileSink()
+{
+	char path[64];
+	snprintf(path, sizeof(path), "asynclogtest-%d.log", (int)getpid());
+	remove(path);
+	LogSink* sink = AsyncLog::CreateSink(LOG_SINK_FILE, path);
+	CHECK(sink != nullptr);
+	CHECK(!AsyncLog::CreateSink(LOG_SINK_FILE, nullptr));
+	if (!sink)
+	{
+		return;
+	}
+	AsyncLog::SetSink(sink);
+	for (int i = 0; i < 100; i++)
+	{
+		LOG_INFO("%d", i);
+	}
+	AsyncLog::Stop();
+
+	std::string expected;
+	for (int i = 0; i < 100; i++)
+	{
+		expected += std::to_string(i) + "\n";
+	}
+	std::string text;
+	FILE* file = fopen(path, "rb");
+	CHECK(file != NULL);
+	if (file)
+	{
+		char buffer[512];
+		size_t count;
+		while ((count = fread(buffer, 1, sizeof(buffer), file)))
+		{
+			text.append(buffer, count);
+		}
+		fclose(file);
+	}
+	CHECK(text == expected);
+	remove(path);
+}
+
+int main()
+{
+	RUN_TEST(TestRingOrderAndFull);
+	RUN_TEST(TestRingProducers);
+	RUN_TEST(TestFormat);
+	RUN_TEST(TestWriteAndDrain);
+	RUN_TEST(TestFileSink);
+	return TEST_RESULT();
+}
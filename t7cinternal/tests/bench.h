@@ -0,0 +1,43 @@
+#pragma once
+#include <chrono>
+#include <cstdio>
+#include <cstdint>
+#include <cstdlib>
+
+// timing for the runtime benchmarks. ctest runs them with a short budget so they stay cheap in ci,
+// pass a scale as the first argument for numbers worth comparing
+static double BenchScale = 1.0;
+
+static inline void BenchInit(int argc, char** argv)
+{
+	if (argc > 1)
+	{
+		BenchScale = atof(argv[1]);
+		if (BenchScale <= 0)
+		{
+			BenchScale = 1.0;
+		}
+	}
+}
+
+static inline int64_t BenchIterations(int64_t base)
+{
+	int64_t n = (int64_t)(base * BenchScale);
+	return n ? n : 1;
+}
+
+// keeps results alive without the compiler being able to see through it
+static volatile uint64_t BenchSink = 0;
+
+// runs body(i) for every i below iterations and prints ns per iteration
+template <typename F> static double Bench(const char* name, int64_t iterations, F body)
+{
+	auto start = std::chrono::steady_clock::now();
+	for (int64_t i = 0; i < iterations; i++)
+	{
+		body(i);
+	}
+	double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / (double)iterations;
+	printf("  %-44s %10.2f ns/op\n", name, ns);
+	return ns;
+}
@@ -0,0 +1,290 @@
+#include "testing.h"
+#include "vmemu.h"
+#include "scriptbuilder.h"
+#include "detours.h"
+#include "assetcache.h"
+#include "exportindex.h"
+#include "detourstats.h"
+#include "opcodeprofiler.h"
+#include <atomic>
+#include <thread>
+
+EXPORT void RemoveDetours();
+
+#define EMU_BUILTIN_VALUE 7
+
+static void GScr_emu_value(int scriptInst)
+{
+	VmEmu::Return(VAR_INTEGER, EMU_BUILTIN_VALUE);
+}
+
+static INT64 Run(char* buffer, const char* function, INT32 inst = 0)
+{
+	EmuVar result = { 0, VAR_UNDEFINED };
+	if (!VmEmu::Call(buffer, function, {}, &result, inst))
+	{
+		printf("%s: %s\n", function, VmEmu::LastError.c_str());
+		return -0xDEAD;
+	}
+	return (result.Type == VAR_INTEGER) ? result.Value : -0xBAD;
+}
+
+static char* Load(const char* name, const ScriptBuilder& script, INT32 inst = 0)
+{
+	return VmEmu::Load(name, script.Build(), inst);
+}
+
+// emu_dtarget::value returns 1, the replacements in the detour script return 2 for it and 3 for the builtin
+struct DetourScene
+{
+	char* Target;
+	char* Detour;
+	char* Caller;
+	char* ClientCaller;
+	size_t ClientSize;
+	std::vector<EmuDetour> Detours;
+};
+
+static bool BuildScene(DetourScene& scene)
+{
+	VmEmu::Reset();
+	RemoveDetours();
+	ScriptDetours::EagerFixups = false;
+
+	ScriptBuilder target("emu_dtarget");
+	target.Function("value");
+	target.GetByte(1);
+	target.Op(EMU_Return);
+	scene.Target = Load("scripts/emu/dtarget.gsc", target);
+
+	ScriptBuilder detour("emu_detour");
+	detour.Function("value_hook");
+	detour.GetByte(2);
+	detour.Op(EMU_Return);
+	scene.Detours.push_back({ "scripts/emu/dtarget.gsc", "emu_dtarget", "value", detour.FunctionOffset(), detour.Here() - detour.FunctionOffset() });
+	detour.Function("builtin_hook");
+	detour.GetByte(3);
+	detour.Op(EMU_Return);
+	scene.Detours.push_back({ NULL, NULL, "emu_value", detour.FunctionOffset(), detour.Here() - detour.FunctionOffset() });
+	scene.Detour = Load("scripts/emu/detour.gsc", detour);
+
+	ScriptBuilder caller("emu_caller");
+	caller.Function("script");
+	caller.Op(EMU_PreScriptCall);
+	caller.Call("emu_dtarget", "value", 0);
+	caller.Op(EMU_Return);
+	caller.Function("builtin");
+	caller.Op(EMU_PreScriptCall);
+	caller.Call(NULL, "emu_value", 0);
+	caller.Op(EMU_Return);
+	scene.Caller = Load("scripts/emu/caller.gsc", caller);
+	scene.ClientCaller = Load("scripts/emu/caller.csc", caller, 1);
+	scene.ClientSize = caller.Build().size();
+	return scene.Target && scene.Detour && scene.Caller && scene.ClientCaller;
+}
+
+static void EnableDetours(DetourScene& scene, bool eager)
+{
+	auto records = DetourRecords(scene.Detours);
+	RegisterDetours(records.data(), (int)scene.Detours.size(), (INT64)scene.Detour);
+	ScriptDetours::EagerFixups = eager;
+	ScriptDetours::DetoursEnabled = true;
+	ScriptDetours::InstallHooks();
+	ScriptDetours::LinkDetours();
+}
+
+static void TestEagerFixups()
+{
+	static bool builtin = false;
+	if (!builtin)
+	{
+		VmEmu::AddBuiltin("emu_value", GScr_emu_value, 0, 0);
+		builtin = true;
+	}
+
+	DetourScene scene;
+	CHECK(BuildScene(scene));
+	if (!scene.Caller)
+	{
+		return;
+	}
+	CHECK_EQ(Run(scene.Caller, "script"), 1);
+	CHECK_EQ(Run(scene.Caller, "builtin"), EMU_BUILTIN_VALUE);
+
+	EnableDetours(scene, true);
+	FixupJournalStats stats;
+	GetFixupJournalStats(&stats);
+	CHECK_EQ(stats.NumEntries, 2); // both gsc sites, nothing in the csc copy
+
+	// patched before they ever ran
+	CHECK_EQ(Run(scene.Caller, "script"), 2);
+	CHECK_EQ(Run(scene.Caller, "builtin"), 3);
+
+	RemoveDetours();
+	CHECK_EQ(Run(scene.Caller, "script"), 1);
+	CHECK_EQ(Run(scene.Caller, "builtin"), EMU_BUILTIN_VALUE);
+}
+
+static void TestEagerSkipsClientScripts()
+{
+	DetourScene scene;
+	CHECK(BuildScene(scene));
+	if (!scene.ClientCaller)
+	{
+		return;
+	}
+
+	// the csc copy calls the same native, the eager pass must not send it into gsc bytecode
+	std::vector<BYTE> before(scene.ClientCaller, scene.ClientCaller + scene.ClientSize);
+	EnableDetours(scene, true);
+	CHECK(!memcmp(before.data(), scene.ClientCaller, before.size()));
+	CHECK_EQ(Run(scene.ClientCaller, "builtin", 1), EMU_BUILTIN_VALUE);
+	CHECK_EQ(Run(scene.Caller, "builtin"), 3);
+	RemoveDetours();
+}
+
+static void TestEagerFixupsWhileProfiling()
+{
+	DetourScene scene;
+	CHECK(BuildScene(scene));
+
+	// the table holds trampolines while the profiler is wrapping it, the eager pass has to see through them
+	CHECK(InstallOpcodeProfiler(false));
+	EnableDetours(scene, true);
+	FixupJournalStats stats;
+	GetFixupJournalStats(&stats);
+	CHECK_EQ(stats.NumEntries, 2);
+	CHECK_EQ(Run(scene.Caller, "script"), 2);
+	CHECK_EQ(Run(scene.Caller, "builtin"), 3);
+
+	OpcodeHistogramRecord records[OPCODE_PROFILER_MAX_HANDLERS];
+	CHECK(GetOpcodeHistogram(records, OPCODE_PROFILER_MAX_HANDLERS) > 0);
+	CHECK(records[0].Count > 0);
+	UninstallOpcodeProfiler();
+	RemoveDetours();
+	CHECK_EQ(Run(scene.Caller, "builtin"), EMU_BUILTIN_VALUE);
+}
+
+static void TestCachedMissSeesLink()
+{
+	DetourScene scene;
+	CHECK(BuildScene(scene));
+	EnableDetours(scene, false);
+
+	ScriptAssetCacheStats before, after;
+	GetScriptAssetCacheStats(&before);
+	CHECK(!ScriptDetours::FindScriptParsetree("scripts/emu/late.gsc"));
+	CHECK(!ScriptDetours::FindScriptParsetree("scripts/emu/late.gsc"));
+	GetScriptAssetCacheStats(&after);
+	CHECK_EQ(after.NegativeHits - before.NegativeHits, 1);
+
+	// swap a script for it so the pool count comes back to the value the miss was cached at
+	ScriptBuilder late("emu_late");
+	late.Function("value");
+	late.GetByte(4);
+	late.Op(EMU_Return);
+	VmEmu::Unload("scripts/emu/caller.csc");
+	CHECK(Load("scripts/emu/late.gsc", late));
+	CHECK(ScriptDetours::FindScriptParsetree("scripts/emu/late.gsc"));
+
+	// the link hook belongs to the cache, so misses are still kept, and still dropped on a link, with the detour hooks gone
+	RemoveDetours();
+	ScriptDetours::RemoveHooks();
+	CHECK(ScriptDetours::LinkHookInstalled);
+	GetScriptAssetCacheStats(&before);
+	CHECK(!ScriptDetours::FindScriptParsetree("scripts/emu/missing.gsc"));
+	CHECK(!ScriptDetours::FindScriptParsetree("scripts/emu/missing.gsc"));
+	GetScriptAssetCacheStats(&after);
+	CHECK_EQ(after.NegativeHits - before.NegativeHits, 1);
+	CHECK_EQ(after.Misses - before.Misses, 1);
+
+	ScriptBuilder missing("emu_missing");
+	missing.Function("value");
+	missing.GetByte(5);
+	missing.Op(EMU_Return);
+	VmEmu::Unload("scripts/emu/late.gsc");
+	CHECK(Load("scripts/emu/missing.gsc", missing));
+	CHECK(ScriptDetours::FindScriptParsetree("scripts/emu/missing.gsc"));
+}
+
+static void TestSharedCachesAcrossThreads()
+{
+	DetourScene scene;
+	CHECK(BuildScene(scene));
+
+	// the gsc and csc vm threads share these, hammer them from two threads at once
+	bool ok[2] = { true, true };
+	auto worker = [&](INT32 id)
+	{
+		for (INT32 i = 0; i < 20000; i++)
+		{
+			ok[id] &= ScriptDetours::FindScriptParsetree("scripts/emu/dtarget.gsc") != 0;
+			ok[id] &= ExportIndex::FindExport(scene.Target, (INT32)fnv1a("emu_dtarget"), (INT32)fnv1a("value")) != 0;
+			if (!(i % 64))
+			{
+				ScriptAssetCache::Invalidate();
+				ExportIndex::Invalidate(scene.Target);
+			}
+		}
+	};
+	std::thread client(worker, 1);
+	worker(0);
+	client.join();
+	CHECK(ok[0] && ok[1]);
+}
+
+static void TestDetourStatsSnapshot()
+{
+	DetourScene scene;
+	CHECK(BuildScene(scene));
+	EnableDetours(scene, false);
+	CHECK_EQ(Run(scene.Caller, "script"), 2);
+
+	DetourStatsRecord records[4];
+	CHECK_EQ(GetDetourStats(records, 4), 2);
+	CHECK_EQ(records[0].ReplaceFunction, (INT32)fnv1a("value"));
+	CHECK(!strcmp(records[0].ReplaceScriptName, "scripts/emu/dtarget.gsc"));
+	CHECK_EQ(records[0].Resolved, 1);
+	CHECK_EQ(records[0].Invocations, 1);
+	CHECK(!records[1].ReplaceScriptName[0]);
+	CHECK_EQ(GetDetourStats(records, 1), 1);
+
+	// snapshots from another thread while detours are registered and removed underneath them
+	std::atomic<bool> done(false);
+	bool ok = true;
+	std::thread injector([&]()
+	{
+		DetourStatsRecord snapshot[DETOUR_STATS_MAX];
+		while (!done.load())
+		{
+			INT32 count = GetDetourStats(snapshot, DETOUR_STATS_MAX);
+			ok &= count >= 0 && count <= 2;
+		}
+	});
+	auto detours = DetourRecords(scene.Detours);
+	for (INT32 i = 0; i < 2000; i++)
+	{
+		RegisterDetours(detours.data(), (int)scene.Detours.size(), (INT64)scene.Detour);
+	}
+	done = true;
+	injector.join();
+	CHECK(ok);
+	RemoveDetours();
+	CHECK_EQ(GetDetourStats(records, 4), 0);
+}
+
+int main()
+{
+	if (!VmEmu::Attach())
+	{
+		printf("emulator: %s\n", VmEmu::LastError.c_str());
+		return 1;
+	}
+	RUN_TEST(TestEagerFixups);
+	RUN_TEST(TestEagerSkipsClientScripts);
+	RUN_TEST(TestEagerFixupsWhileProfiling);
+	RUN_TEST(TestCachedMissSeesLink);
+	RUN_TEST(TestSharedCachesAcrossThreads);
+	RUN_TEST(TestDetourStatsSnapshot);
+	return TEST_RESULT();
+}
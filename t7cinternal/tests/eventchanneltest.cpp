@@ -0,0 +1,223 @@
+#include "testing.h"
+#include "eventchannel.h"
+#include <string>
+#include <mutex>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// in memory transport, refuses the first Refusals connects the way a reader that isnt up yet would
+struct MemoryTransportState
+{
+	std::mutex Lock;
+	std::string Received;
+	int Refusals;
+	int Connects;
+	int Sends;
+};
+
+static MemoryTransportState Memory;
+
+class MemoryTransport : public EventTransport
+{
+public:
+	bool Connect() override
+	{
+		std::lock_guard<std::mutex> lock(Memory.Lock);
+		Memory.Connects++;
+		return Memory.Refusals-- <= 0;
+	}
+
+	bool Send(const char* data, size_t length) override
+	{
+		std::lock_guard<std::mutex> lock(Memory.Lock);
+		Memory.Received.append(data, length);
+		Memory.Sends++;
+		return true;
+	}
+
+	void Close() override {}
+};
+
+static void ResetMemory(int refusals)
+{
+	std::lock_guard<std::mutex> lock(Memory.Lock);
+	Memory.Received.clear();
+	Memory.Refusals = refusals;
+	Memory.Connects = 0;
+	Memory.Sends = 0;
+}
+
+static void TestPostAndStop()
+{
+	ResetMemory(0);
+	EventChannel::SetTransport(new MemoryTransport());
+	EventChannelStats before, after;
+	EventChannel::GetStats(&before);
+	CHECK(EventChannel::Post("split"));
+	CHECK(EventChannel::Post("reset\n"));
+	CHECK(!EventChannel::Post(NULL));
+	EventChannel::Stop();
+
+	// lines are terminated for the reader, ones that already are arent terminated twice
+	CHECK(Memory.Received == "split\r\nreset\n");
+	CHECK_EQ(Memory.Connects, 1);
+	EventChannel::GetStats(&after);
+	CHECK_EQ(after.Posted - before.Posted, 2);
+	CHECK_EQ(after.Sent - before.Sent, 2);
+	CHECK(after.LastLatency >= 0);
+
+	// text longer than an event is cut, not spilled into the next one
+	ResetMemory(0);
+	EventChannel::SetTransport(new MemoryTransport());
+	std::string longText(1000, 'x');
+	CHECK(EventChannel::Post(longText.c_str()));
+	EventChannel::Stop();
+	CHECK_EQ(Memory.Received.size(), EVENT_CHANNEL_MAX_TEXT);
+	CHECK(Memory.Received.compare(Memory.Received.size() - 2, 2, "\r\n") == 0);
+}
+
+static void TestReconnect()
+{
+	// the reader comes up late, events posted before that are held and sent once it does
+	ResetMemory(2);
+	EventChannel::SetTransport(new MemoryTransport());
+	EventChannelStats before, after;
+	EventChannel::GetStats(&before);
+	CHECK(EventChannel::Post("a"));
+	CHECK(EventChannel::Post("b"));
+	for (int i = 0; i < 200; i++)
+	{
+		EventChannel::GetStats(&after);
+		if (after.Sent - before.Sent == 2)
+		{
+			break;
+		}
+		usleep(5000);
+	}
+	EventChannel::Stop();
+	EventChannel::GetStats(&after);
+	CHECK_EQ(after.Sent - before.Sent, 2);
+	CHECK_EQ(after.Connects - before.Connects, 1);
+	CHECK(Memory.Connects >= 3);
+	CHECK(Memory.Received == "a\r\nb\r\n");
+}
+
+// seconds in the setgametime command right in front of the index'th line holding command, -1 if there isnt one
+static double GameTimeBefore(const std::string& text, const char* command, int index)
+{
+	std::string line = std::string("\n") + command + "\r\n";
+	size_t at = 0;
+	for (int i = 0; i <= index; i++)
+	{
+		at = text.find(line, at);
+		if (at == std::string::npos)
+		{
+			return -1;
+		}
+		at++;
+	}
+	size_t timing = text.rfind("\nsetgametime ", at - 1);
+	if (timing == std::string::npos || text.find('\n', timing + 1) != at - 1)
+	{
+		return -1;
+	}
+	return atof(text.c_str() + timing + strlen("\nsetgametime "));
+}
+
+static void TestSplitTiming()
+{
+	// off by default, the posted text goes out unchanged
+	ResetMemory(0);
+	EventChannel::SetTransport(new MemoryTransport());
+	CHECK(EventChannel::Post("starttimer"));
+	CHECK(EventChannel::Post("split"));
+	EventChannel::Stop();
+	CHECK(Memory.Received == "starttimer\r\nsplit\r\n");
+
+	// no run started, nothing to measure the split against
+	EventChannel::SetSplitTiming(true);
+	ResetMemory(0);
+	EventChannel::SetTransport(new MemoryTransport());
+	CHECK(EventChannel::Post("split"));
+	EventChannel::Stop();
+	CHECK(Memory.Received == "split\r\n");
+
+	// the reader only comes up a while after the splits were posted, the game time still says when they were
+	ResetMemory(3);
+	EventChannel::SetTransport(new MemoryTransport());
+	CHECK(EventChannel::Post("starttimer"));
+	usleep(20000);
+	CHECK(EventChannel::Post("split"));
+	usleep(20000);
+	CHECK(EventChannel::Post("startorsplit"));
+	CHECK(EventChannel::Post("reset"));
+	CHECK(EventChannel::Post("startorsplit"));
+	for (int i = 0; i < 200 && Memory.Connects < 4; i++)
+	{
+		usleep(5000);
+	}
+	EventChannel::Stop();
+	EventChannelStats stats;
+	EventChannel::GetStats(&stats);
+	CHECK(stats.LastLatency > 100000);
+
+	const std::string& text = Memory.Received;
+	CHECK(!text.compare(0, strlen("starttimer\r\ninitgametime\r\nsetgametime 0\r\nsetgametime 0."), "starttimer\r\ninitgametime\r\nsetgametime 0\r\nsetgametime 0."));
+	double first = GameTimeBefore(text, "split", 0);
+	double second = GameTimeBefore(text, "startorsplit", 0);
+	CHECK(first >= 0.02 && first < 0.1);
+	CHECK(second >= first + 0.02 && second < 0.1);
+
+	// after the reset startorsplit starts a new run instead of splitting the old one
+	size_t reset = text.find("reset\r\n");
+	CHECK(reset != std::string::npos && text.compare(reset, std::string::npos, "reset\r\nstartorsplit\r\ninitgametime\r\nsetgametime 0\r\n") == 0);
+
+	ResetMemory(0);
+	EventChannel::SetTransport(new MemoryTransport());
+	CHECK(EventChannel::Post("reset"));
+	EventChannel::Stop();
+	EventChannel::SetSplitTiming(false);
+}
+
+static void TestUnixSocket()
+{
+	// the default transport against a listener standing in for livesplit
+	int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+	CHECK(listener >= 0);
+	sockaddr_un address = {};
+	address.sun_family = AF_UNIX;
+	strncpy(address.sun_path, EVENT_CHANNEL_LIVESPLIT, sizeof(address.sun_path) - 1);
+	unlink(EVENT_CHANNEL_LIVESPLIT);
+	CHECK(!bind(listener, (sockaddr*)&address, sizeof(address)));
+	CHECK(!listen(listener, 1));
+
+	EventChannel::SetTransport(EventChannel::CreateDefaultTransport());
+	CHECK(EventChannel::Post("start"));
+	CHECK(EventChannel::Post("split"));
+	int client = accept(listener, NULL, NULL);
+	CHECK(client >= 0);
+	EventChannel::Stop();
+
+	// stop closed the connection, so this reads to the end of everything sent
+	std::string received;
+	char buffer[256];
+	ssize_t count;
+	while (client >= 0 && (count = read(client, buffer, sizeof(buffer))) > 0)
+	{
+		received.append(buffer, count);
+	}
+	CHECK(received == "start\r\nsplit\r\n");
+	close(client);
+	close(listener);
+	unlink(EVENT_CHANNEL_LIVESPLIT);
+}
+
+int main()
+{
+	RUN_TEST(TestPostAndStop);
+	RUN_TEST(TestReconnect);
+	RUN_TEST(TestSplitTiming);
+	RUN_TEST(TestUnixSocket);
+	return TEST_RESULT();
+}
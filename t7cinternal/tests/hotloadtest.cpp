@@ -0,0 +1,357 @@
+#include "testing.h"
+#include "vmemu.h"
+#include "hotloadcache.h"
+#include "hotloaddelta.h"
+#include "scriptbuilder.h"
+#include <cstdlib>
+
+EXPORT void RemoveDetours();
+
+// a copy of a compiled fixture, the way the injector writes one into the game. hotload buffers are never freed
+static char* HotloadBuffer(const char* file, INT32* size)
+{
+	std::vector<BYTE> data;
+	if (!VmEmu::ReadFile(std::string(T7_TEST_SCRIPTS) + file, data))
+	{
+		return NULL;
+	}
+	char* buffer = (char*)aligned_alloc(0x10, (data.size() + 0xF) & ~0xFull);
+	memcpy(buffer, data.data(), data.size());
+	*size = (INT32)data.size();
+	return buffer;
+}
+
+// a built object in a buffer of its own, the same way
+static char* HotloadBuffer(const ScriptBuilder& builder, INT32* size)
+{
+	std::vector<BYTE> data = builder.Build();
+	char* buffer = (char*)aligned_alloc(0x10, (data.size() + 0xF) & ~0xFull);
+	memcpy(buffer, data.data(), data.size());
+	*size = (INT32)data.size();
+	return buffer;
+}
+
+static INT64 Run(char* buffer, const char* function, const std::vector<INT64>& args)
+{
+	EmuVar result = { 0, VAR_UNDEFINED };
+	if (!VmEmu::Call(buffer, function, args, &result))
+	{
+		printf("%s: %s\n", function, VmEmu::LastError.c_str());
+		return -0xDEAD;
+	}
+	return (result.Type == VAR_INTEGER) ? result.Value : -0xBAD;
+}
+
+static void TestUnchangedRehotload()
+{
+	VmEmu::Reset();
+	INT32 size, error = 0;
+	char* first = HotloadBuffer("core.gscc", &size);
+	char* second = HotloadBuffer("core.gscc", &size);
+	CHECK(first && second);
+	if (!first || !second)
+	{
+		return;
+	}
+
+	CHECK(HotloadScriptCached(first, size, 0, &error));
+	CHECK_EQ(Run(first, "fib", { 10 }), 55);
+
+	HotloadCacheStats before, after;
+	GetHotloadCacheStats(&before);
+	CHECK(HotloadScriptCached(second, size, 0, &error));
+	GetHotloadCacheStats(&after);
+	CHECK_EQ(after.Unchanged, before.Unchanged + 1);
+
+	// resolve pointed fib and steps at functions in the first buffer, the copy has to call its own
+	memset(first + 0x40, 0xFF, size - 0x40);
+	CHECK_EQ(Run(second, "fib", { 10 }), 55);
+	CHECK_EQ(Run(second, "steps", { 27 }), 111);
+}
+
+static void TestCacheSurvivesDetourRemoval()
+{
+	// the injector removes detours before every full hotload, the vm and the references the cache holds live on
+	VmEmu::Reset();
+	INT32 size, error = 0;
+	char* first = HotloadBuffer("core.gscc", &size);
+	char* second = HotloadBuffer("core.gscc", &size);
+	CHECK(first && second);
+	if (!first || !second)
+	{
+		return;
+	}
+
+	CHECK(HotloadScriptCached(first, size, 0, &error));
+	HotloadCacheStats before, after;
+	GetHotloadCacheStats(&before);
+	RemoveDetours();
+	CHECK(HotloadScriptCached(second, size, 0, &error));
+	GetHotloadCacheStats(&after);
+	CHECK_EQ(after.Generation, before.Generation);
+	CHECK_EQ(after.Unchanged, before.Unchanged + 1);
+	CHECK_EQ(Run(second, "fib", { 10 }), 55);
+
+	// an edited script takes no new references for the strings the last one already linked
+	ScriptBuilder named("emu_named"), edited("emu_named");
+	named.Function("name");
+	named.Op(EMU_CheckClearParams);
+	named.GetString("shared");
+	named.Op(EMU_Return);
+	edited.Function("name");
+	edited.Op(EMU_CheckClearParams);
+	edited.GetString("added");
+	edited.Op(EMU_DecTop);
+	edited.GetString("shared");
+	edited.Op(EMU_Return);
+	INT32 namedSize, editedSize;
+	char* namedBuffer = HotloadBuffer(named, &namedSize);
+	char* editedBuffer = HotloadBuffer(edited, &editedSize);
+	RemoveDetours();
+	CHECK(HotloadScriptCached(namedBuffer, namedSize, 0, &error));
+	RemoveDetours();
+	GetHotloadCacheStats(&before);
+	CHECK(HotloadScriptCached(editedBuffer, editedSize, 0, &error));
+	GetHotloadCacheStats(&after);
+	CHECK_EQ(after.StringHits, before.StringHits + 1);
+	CHECK_EQ(after.StringMisses, before.StringMisses + 1);
+	CHECK_EQ(after.NumStrings, before.NumStrings + 1);
+	EmuVar namedResult = { 0, VAR_UNDEFINED }, editedResult = { 0, VAR_UNDEFINED };
+	CHECK(VmEmu::Call(namedBuffer, "name", {}, &namedResult) && VmEmu::Call(editedBuffer, "name", {}, &editedResult));
+	CHECK(namedResult.Type == VAR_STRING && editedResult.Type == VAR_STRING && namedResult.Value == editedResult.Value);
+
+	// a ui transition does end the vm, and everything cached with it
+	VmEmu::SetUILevel(true);
+	GetHotloadCacheStats(&before);
+	CHECK(HotloadScriptCached(HotloadBuffer(edited, &editedSize), editedSize, 0, &error));
+	GetHotloadCacheStats(&after);
+	CHECK(after.Generation != before.Generation);
+	CHECK_EQ(after.Unchanged, before.Unchanged);
+	CHECK_EQ(after.StringMisses, before.StringMisses + 2);
+	CHECK_EQ(after.NumStrings, 2);
+	VmEmu::SetUILevel(false);
+}
+
+static void TestShortHeader()
+{
+	// every header field the link reads has to be inside the buffer
+	char buffer[0x48] = { 0 };
+	*(UINT64*)buffer = HOTLOAD_MAGIC;
+	INT32 error = 0;
+	CHECK(!HotloadScriptCached(buffer, sizeof(buffer), 0, &error));
+	CHECK_EQ(error, HOTLOAD_ERROR_BADBUFF);
+}
+
+static void TestAnimTreesRejected()
+{
+	VmEmu::Reset();
+	INT32 size, error = 0;
+	char* buffer = HotloadBuffer("core.gscc", &size);
+	CHECK(buffer != NULL);
+	if (!buffer)
+	{
+		return;
+	}
+
+	// the animtree count sits right after the include count
+	buffer[0x45] = 1;
+	HotloadCacheStats before, after;
+	GetHotloadCacheStats(&before);
+	CHECK(!HotloadScriptCached(buffer, size, 0, &error));
+	CHECK_EQ(error, HOTLOAD_ERROR_ANIMS);
+	GetHotloadCacheStats(&after);
+	CHECK_EQ(after.Hotloads, before.Hotloads);
+}
+
+static bool ApplyDelta(const char* file, INT32 vm, INT32* error, INT32 truncate = 0)
+{
+	std::vector<BYTE> data;
+	if (!VmEmu::ReadFile(std::string(T7_TEST_SCRIPTS) + file, data))
+	{
+		*error = -1;
+		return false;
+	}
+	return HotloadScriptDelta((char*)data.data(), (INT32)data.size() - truncate, vm, error);
+}
+
+// the fixture delta cut down to the function named only (all of them if null), marked as one a thread can be parked in
+static std::vector<BYTE> SuspendingDelta(const char* file, const char* only)
+{
+	std::vector<BYTE> data, result;
+	if (!VmEmu::ReadFile(std::string(T7_TEST_SCRIPTS) + file, data))
+	{
+		return result;
+	}
+	auto header = (HotloadDeltaHeader*)data.data();
+	result.assign(data.begin(), data.begin() + sizeof(HotloadDeltaHeader));
+	size_t at = sizeof(HotloadDeltaHeader);
+	INT16 kept = 0;
+	for (INT16 i = 0; i < header->NumFunctions; i++)
+	{
+		auto record = (HotloadDeltaFunction*)(data.data() + at);
+		size_t end = at + sizeof(HotloadDeltaFunction) + record->NumStrings * sizeof(HotloadDeltaString) + record->NumImports * sizeof(HotloadDeltaImport)
+			+ record->NumLazy * sizeof(HotloadDeltaLazy) + record->Size;
+		end = (end + 7) & ~7ull;
+		if (!only || record->Function == (INT32)fnv1a(only))
+		{
+			record->Hints |= HOTLOAD_DELTA_SUSPENDS;
+			result.insert(result.end(), data.begin() + at, data.begin() + end);
+			kept++;
+		}
+		at = end;
+	}
+	result.insert(result.end(), data.begin() + at, data.end());
+	((HotloadDeltaHeader*)result.data())->NumFunctions = kept;
+	return result;
+}
+
+static void TestDeltaPatch()
+{
+	VmEmu::Reset();
+	INT32 size, error = 0;
+	char* buffer = HotloadBuffer("core.gscc", &size);
+	CHECK(buffer != NULL);
+	if (!buffer)
+	{
+		return;
+	}
+	CHECK(HotloadScriptCached(buffer, size, 0, &error));
+	CHECK_EQ(Run(buffer, "sum", { 3 }), 3);
+
+	// a cut off delta is rejected before anything is written
+	CHECK(!ApplyDelta("core_edit.delta", 0, &error, 8));
+	CHECK_EQ(error, HOTLOAD_ERROR_BADDELTA);
+	CHECK_EQ(Run(buffer, "sum", { 3 }), 3);
+
+	HotloadDeltaStats before, after;
+	GetHotloadDeltaStats(&before);
+	CHECK(ApplyDelta("core_edit.delta", 0, &error));
+	GetHotloadDeltaStats(&after);
+	CHECK_EQ(after.Deltas, before.Deltas + 1);
+
+	// sum keeps its size, collatz grows and moves, steps still calls it through the old body
+	CHECK_EQ(Run(buffer, "sum", { 3 }), 1003);
+	CHECK_EQ(Run(buffer, "steps", { 27 }), 111007);
+	CHECK_EQ(Run(buffer, "fib", { 10 }), 55);
+
+	// the object it was made against is gone now
+	CHECK(!ApplyDelta("core_edit.delta", 0, &error));
+	CHECK_EQ(error, HOTLOAD_ERROR_STALE);
+}
+
+static void TestDeltaSuspends()
+{
+	VmEmu::Reset();
+	INT32 size, error = 0;
+	char* buffer = HotloadBuffer("core.gscc", &size);
+	CHECK(buffer != NULL);
+	if (!buffer)
+	{
+		return;
+	}
+	CHECK(HotloadScriptCached(buffer, size, 0, &error));
+
+	// sum still fits, but a thread could be parked in it, so it moves like collatz does instead of being overwritten
+	std::vector<BYTE> delta = SuspendingDelta("core_edit.delta", NULL);
+	HotloadDeltaStats before, after;
+	GetHotloadDeltaStats(&before);
+	CHECK(HotloadScriptDelta((char*)delta.data(), (INT32)delta.size(), 0, &error));
+	GetHotloadDeltaStats(&after);
+	CHECK_EQ(after.Patched, before.Patched);
+	CHECK_EQ(after.Relocated, before.Relocated + 2);
+	CHECK_EQ(Run(buffer, "steps", { 27 }), 111007);
+
+	// the client vm cant redirect calls, there the same function is refused and the whole script gets sent
+	char* client = HotloadBuffer("core.gscc", &size);
+	CHECK(HotloadScriptCached(client, size, 1, &error));
+	std::vector<BYTE> sum = SuspendingDelta("core_edit.delta", "sum");
+	GetHotloadDeltaStats(&before);
+	CHECK(!HotloadScriptDelta((char*)sum.data(), (INT32)sum.size(), 1, &error));
+	CHECK_EQ(error, HOTLOAD_ERROR_NODETOURS);
+	GetHotloadDeltaStats(&after);
+	CHECK_EQ(after.Patched, before.Patched);
+	CHECK_EQ(after.Rejected, before.Rejected + 1);
+
+	// without the hint it is rewritten in place like before
+	((HotloadDeltaFunction*)(sum.data() + sizeof(HotloadDeltaHeader)))->Hints = 0;
+	CHECK(HotloadScriptDelta((char*)sum.data(), (INT32)sum.size(), 1, &error));
+	GetHotloadDeltaStats(&after);
+	CHECK_EQ(after.Patched, before.Patched + 1);
+}
+
+static void TestArenaOutlivesDetours()
+{
+	VmEmu::Reset();
+	INT32 size, error = 0;
+	char* buffer = HotloadBuffer("core.gscc", &size);
+	CHECK(buffer != NULL);
+	if (!buffer)
+	{
+		return;
+	}
+	CHECK(HotloadScriptCached(buffer, size, 0, &error));
+	CHECK(ApplyDelta("core_edit.delta", 0, &error));
+	HotloadDeltaStats relocated, after;
+	GetHotloadDeltaStats(&relocated);
+	CHECK(relocated.ArenaBytes > 0);
+
+	// the injector removes detours before every full hotload, threads parked in the moved collatz still resume in the arena
+	RemoveDetours();
+	char* full = HotloadBuffer("core.gscc", &size);
+	CHECK(HotloadScriptCached(full, size, 0, &error));
+	CHECK_EQ(Run(full, "sum", { 3 }), 3);
+	GetHotloadDeltaStats(&after);
+	CHECK_EQ(after.ArenaBytes, relocated.ArenaBytes);
+
+	// the full hotload linked a fresh object, deltas against it go on filling the same arena
+	CHECK(ApplyDelta("core_edit.delta", 0, &error));
+	GetHotloadDeltaStats(&after);
+	CHECK(after.ArenaBytes > relocated.ArenaBytes);
+
+	// the vm going away is what frees it
+	VmEmu::SetUILevel(true);
+	CHECK(HotloadScriptCached(HotloadBuffer("core.gscc", &size), size, 0, &error));
+	GetHotloadDeltaStats(&after);
+	CHECK_EQ(after.ArenaBytes, 0);
+	VmEmu::SetUILevel(false);
+}
+
+static void TestDeltaLazy()
+{
+	VmEmu::Reset();
+	INT32 size, error = 0;
+	char* target = VmEmu::LoadScript("scripts/emu/target.gsc", "target.gscc");
+	char* buffer = HotloadBuffer("lazy.gscc", &size);
+	CHECK(target && buffer);
+	if (!target || !buffer)
+	{
+		return;
+	}
+	CHECK(HotloadScriptCached(buffer, size, 0, &error));
+	CHECK_EQ(Run(buffer, "main", {}), 42);
+
+	CHECK(ApplyDelta("lazy_edit.delta", 0, &error));
+	CHECK_EQ(Run(buffer, "main", {}), 42);
+
+	// the rewritten lazy reference still names the target script
+	VmEmu::Unload("scripts/emu/target.gsc");
+	CHECK_EQ(Run(buffer, "main", {}), -2);
+}
+
+int main()
+{
+	if (!VmEmu::Attach())
+	{
+		printf("emulator: %s\n", VmEmu::LastError.c_str());
+		return 1;
+	}
+	RUN_TEST(TestUnchangedRehotload);
+	RUN_TEST(TestCacheSurvivesDetourRemoval);
+	RUN_TEST(TestShortHeader);
+	RUN_TEST(TestAnimTreesRejected);
+	RUN_TEST(TestDeltaPatch);
+	RUN_TEST(TestDeltaSuspends);
+	RUN_TEST(TestArenaOutlivesDetours);
+	RUN_TEST(TestDeltaLazy);
+	return TEST_RESULT();
+}
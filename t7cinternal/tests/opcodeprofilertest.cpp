@@ -0,0 +1,176 @@
+#include "testing.h"
+#include "opcodeprofiler.h"
+#include <cstddef>
+#include <vector>
+
+// synthetic handler tables, no emulator. each handler counts its own calls so the trampolines can be checked against them
+static INT64 Calls[3];
+
+static void HandlerA(INT32 inst, INT64* fs_0, INT64 vmc, bool* terminate)
+{
+	Calls[0]++;
+}
+
+static void HandlerB(INT32 inst, INT64* fs_0, INT64 vmc, bool* terminate)
+{
+	Calls[1]++;
+}
+
+static void HandlerC(INT32 inst, INT64* fs_0, INT64 vmc, bool* terminate)
+{
+	Calls[2]++;
+}
+
+// A at 0x10 and 0x11, B at 0x20 and 0x1000, C at 0x30 only, everything else empty
+static std::vector<INT64> MakeTable()
+{
+	std::vector<INT64> table(OPCODE_TABLE_SIZE, 0);
+	table[0x10] = (INT64)HandlerA;
+	table[0x11] = (INT64)HandlerA;
+	table[0x20] = (INT64)HandlerB;
+	table[0x1000] = (INT64)HandlerB;
+	table[0x30] = (INT64)HandlerC;
+	return table;
+}
+
+static void Dispatch(const std::vector<INT64>& table, INT32 op, INT32 inst = 0)
+{
+	bool terminate = false;
+	((tVM_Opcode)table[op])(inst, NULL, 0, &terminate);
+}
+
+static const OpcodeHistogramRecord* FindRecord(const OpcodeHistogramRecord* records, INT32 count, tVM_Opcode handler)
+{
+	for (INT32 i = 0; i < count; i++)
+	{
+		if (records[i].Handler == (INT64)handler)
+		{
+			return &records[i];
+		}
+	}
+	return NULL;
+}
+
+static void TestWrapAndMerge()
+{
+	auto table = MakeTable();
+	auto original = table;
+	memset(Calls, 0, sizeof(Calls));
+	CHECK(OpcodeProfiler::Install((INT64)table.data(), false));
+	CHECK(!OpcodeProfiler::Install((INT64)table.data(), false));
+
+	// every handler is wrapped, aliases share a trampoline and empty slots stay empty
+	CHECK(table[0x10] != original[0x10]);
+	CHECK_EQ(table[0x10], table[0x11]);
+	CHECK_EQ(table[0x20], table[0x1000]);
+	CHECK(table[0x10] != table[0x20]);
+	CHECK_EQ(table[0x40], 0);
+
+	for (INT32 i = 0; i < 5; i++)
+	{
+		Dispatch(table, 0x10);
+	}
+	Dispatch(table, 0x11, 1);
+	Dispatch(table, 0x20);
+	Dispatch(table, 0x1000, 1);
+	Dispatch(table, 0x30);
+	CHECK_EQ(Calls[0], 6);
+	CHECK_EQ(Calls[1], 2);
+	CHECK_EQ(Calls[2], 1);
+
+	OpcodeHistogramRecord records[8];
+	INT32 count = OpcodeProfiler::GetHistogram(records, 8);
+	CHECK_EQ(count, 3);
+	CHECK_EQ(records[0].Handler, (INT64)HandlerA); // sorted by count
+	auto a = FindRecord(records, count, HandlerA);
+	auto b = FindRecord(records, count, HandlerB);
+	CHECK(a && b);
+	if (a && b)
+	{
+		CHECK_EQ(a->Count, 6); // both instances
+		CHECK_EQ(a->NumAliases, 2);
+		CHECK_EQ(a->FirstOpcode, 0x10);
+		CHECK_EQ(b->Count, 2);
+		CHECK_EQ(b->FirstOpcode, 0x20);
+	}
+	CHECK_EQ(OpcodeProfiler::GetHistogram(records, 1), 1);
+	CHECK_EQ(OpcodeProfiler::GetHistogram(records, -1), 0);
+	CHECK_EQ(OpcodeProfiler::GetHistogram(NULL, 8), 0);
+
+	OpcodeProfiler::Uninstall();
+	CHECK(table == original);
+}
+
+static void TestSuspendKeepsCounts()
+{
+	auto table = MakeTable();
+	memset(Calls, 0, sizeof(Calls));
+	CHECK(OpcodeProfiler::Install((INT64)table.data(), false));
+	Dispatch(table, 0x10);
+	Dispatch(table, 0x20);
+
+	// a hook written while suspended replaces B at one alias, it gets its own counts and A keeps its own
+	CHECK(OpcodeProfiler::Suspend());
+	CHECK(!OpcodeProfiler::Suspend());
+	CHECK_EQ(table[0x20], (INT64)HandlerB);
+	table[0x20] = (INT64)HandlerC;
+	OpcodeProfiler::Resume();
+	Dispatch(table, 0x10);
+	Dispatch(table, 0x20);
+	Dispatch(table, 0x1000);
+
+	OpcodeHistogramRecord records[8];
+	INT32 count = OpcodeProfiler::GetHistogram(records, 8);
+	auto a = FindRecord(records, count, HandlerA);
+	auto b = FindRecord(records, count, HandlerB);
+	auto c = FindRecord(records, count, HandlerC);
+	CHECK(a && b && c);
+	if (a && b && c)
+	{
+		CHECK_EQ(a->Count, 2);
+		CHECK_EQ(b->Count, 2);
+		CHECK_EQ(b->NumAliases, 1);
+		CHECK_EQ(c->Count, 1);
+		CHECK_EQ(c->NumAliases, 2);
+	}
+
+	// anything written over a trampoline is left alone on uninstall
+	table[0x11] = (INT64)HandlerB;
+	OpcodeProfiler::Uninstall();
+	CHECK_EQ(table[0x10], (INT64)HandlerA);
+	CHECK_EQ(table[0x11], (INT64)HandlerB);
+	CHECK_EQ(table[0x20], (INT64)HandlerC);
+	CHECK_EQ(table[0x1000], (INT64)HandlerB);
+}
+
+static void TestTiming()
+{
+	auto table = MakeTable();
+	CHECK(OpcodeProfiler::Install((INT64)table.data(), true));
+	for (INT32 i = 0; i < 100; i++)
+	{
+		Dispatch(table, 0x30, i & 1);
+	}
+	OpcodeHistogramRecord records[8];
+	INT32 count = OpcodeProfiler::GetHistogram(records, 8);
+	auto c = FindRecord(records, count, HandlerC);
+	CHECK(c && c->Count == 100 && c->Cycles > 0);
+	OpcodeProfiler::Uninstall();
+}
+
+static void TestCounterLayout()
+{
+	// the gsc and csc counters of one handler must never share a cache line, or with the handler pointer both threads read
+	CHECK_EQ(sizeof(ProfiledCounters), 64);
+	CHECK_EQ(offsetof(ProfiledHandler, Instance) % 64, 0);
+	CHECK_EQ((INT64)&((ProfiledHandler*)0)->Instance[1] - (INT64)&((ProfiledHandler*)0)->Instance[0], 64);
+}
+
+int main()
+{
+	RUN_TEST(TestWrapAndMerge);
+	RUN_TEST(TestSuspendKeepsCounts);
+	RUN_TEST(TestTiming);
+	RUN_TEST(TestCounterLayout);
+	return TEST_RESULT();
+}
@@ -0,0 +1,369 @@
+#include "testing.h"
+#include "bench.h"
+#include "framework.h"
+#include "detourtable.h"
+#include "vmemu.h"
+#include "scriptbuilder.h"
+#include "exportindex.h"
+#include "bytecodepatch.h"
+#include "asynclog.h"
+#include <unordered_map>
+#include <random>
+#include <string>
+
+EXPORT void RemoveDetours();
+
+// pointers that look like the ones CheckDetour sees, 8 byte aligned inside a few hundred megabytes of image
+static std::vector<INT64> BenchPointers(size_t count, UINT64 seed)
+{
+	std::mt19937_64 rng(seed);
+	std::vector<INT64> pointers(count);
+	for (auto& p : pointers)
+	{
+		p = 0x140000000ll + (INT64)(rng() % 0x10000000ull) * 8;
+	}
+	return pointers;
+}
+
+// the unordered_map LinkedDetours used to be against the table that replaced it. nearly every call CheckDetour sees is
+// not detoured, so the miss is the case that matters, the hit is there to show it didnt get worse
+static void BenchDetourTable()
+{
+	printf("detour table lookup\n");
+	for (size_t numDetours : { (size_t)10, (size_t)1000, (size_t)100000 })
+	{
+		auto targets = BenchPointers(numDetours, 1);
+		auto probes = BenchPointers(0x10000, 2);
+		std::vector<ScriptDetour*> detours(numDetours);
+		std::vector<std::pair<INT64, ScriptDetour*>> entries;
+		std::unordered_map<INT64, ScriptDetour*> map;
+		for (size_t i = 0; i < numDetours; i++)
+		{
+			detours[i] = (ScriptDetour*)(0x1000 + i * 0x40);
+			entries.push_back({ targets[i], detours[i] });
+			map[targets[i]] = detours[i];
+		}
+		DetourTable table;
+		table.Build(entries);
+
+		// both have to agree on every target and every probe before their timings mean anything
+		bool agree = table.Count() == map.size();
+		for (size_t i = 0; i < numDetours; i++)
+		{
+			agree = agree && table.Find(targets[i]) == map[targets[i]]; // a repeated target keeps the later detour in both
+		}
+		for (INT64 probe : probes)
+		{
+			auto found = map.find(probe);
+			agree = agree && table.Find(probe) == ((found == map.end()) ? NULL : found->second);
+		}
+		CHECK(agree);
+
+		INT64 iterations = BenchIterations(2000000);
+		char name[64];
+		snprintf(name, sizeof(name), "%zu detours, miss, unordered_map", numDetours);
+		double mapMiss = Bench(name, iterations, [&](INT64 i)
+		{
+			auto found = map.find(probes[i & 0xFFFF]);
+			BenchSink += (found != map.end());
+		});
+		snprintf(name, sizeof(name), "%zu detours, miss, DetourTable", numDetours);
+		double tableMiss = Bench(name, iterations, [&](INT64 i)
+		{
+			BenchSink += (table.Find(probes[i & 0xFFFF]) != NULL);
+		});
+		snprintf(name, sizeof(name), "%zu detours, hit, unordered_map", numDetours);
+		Bench(name, iterations, [&](INT64 i)
+		{
+			BenchSink += (UINT64)map.find(targets[i % numDetours])->second;
+		});
+		snprintf(name, sizeof(name), "%zu detours, hit, DetourTable", numDetours);
+		Bench(name, iterations, [&](INT64 i)
+		{
+			BenchSink += (UINT64)table.Find(targets[i % numDetours]);
+		});
+		printf("  miss speedup %.2fx\n", mapMiss / tableMiss);
+	}
+}
+
+#define BENCH_CORPUS_SCRIPTS 16
+#define BENCH_CORPUS_SITES 128 // per script, one in 8 calls the detoured function
+
+static double ElapsedMicroseconds(std::chrono::steady_clock::time_point start)
+{
+	return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+}
+
+// a synthetic corpus of call heavy scripts run with no detours, with detours patched lazily by CheckDetour the first time
+// each site runs, and with the eager pass patching every site when detours link
+static void BenchDetourFixups()
+{
+	printf("lazy vs eager detour fixups (%d scripts x %d call sites)\n", BENCH_CORPUS_SCRIPTS, BENCH_CORPUS_SITES);
+	const char* modes[] = { "no detours", "lazy", "eager" };
+	for (int mode = 0; mode < 3; mode++)
+	{
+		VmEmu::Reset();
+		RemoveDetours();
+
+		ScriptBuilder target("emu_btarget");
+		target.Function("value");
+		target.GetByte(1);
+		target.Op(EMU_Return);
+		target.Function("other");
+		target.GetByte(2);
+		target.Op(EMU_Return);
+		char* targetBuffer = VmEmu::Load("scripts/emu/btarget.gsc", target.Build());
+
+		ScriptBuilder detour("emu_bdetour");
+		detour.Function("value_hook");
+		detour.GetByte(3);
+		detour.Op(EMU_Return);
+		std::vector<EmuDetour> detours = { { "scripts/emu/btarget.gsc", "emu_btarget", "value", detour.FunctionOffset(), detour.Here() - detour.FunctionOffset() } };
+		char* detourBuffer = VmEmu::Load("scripts/emu/bdetour.gsc", detour.Build());
+
+		std::vector<char*> corpus;
+		for (int i = 0; i < BENCH_CORPUS_SCRIPTS; i++)
+		{
+			ScriptBuilder caller("emu_bcaller");
+			caller.Function("run");
+			for (int site = 0; site < BENCH_CORPUS_SITES; site += 8)
+			{
+				caller.CallSites("emu_btarget", "value", 1);
+				caller.CallSites("emu_btarget", "other", 7);
+			}
+			caller.Op(EMU_End);
+			corpus.push_back(VmEmu::Load(("scripts/emu/bcaller" + std::to_string(i) + ".gsc").c_str(), caller.Build()));
+		}
+		CHECK(targetBuffer && detourBuffer && corpus.back());
+		if (!targetBuffer || !detourBuffer || !corpus.back())
+		{
+			return;
+		}
+
+		double linkMicroseconds = 0;
+		if (mode)
+		{
+			auto records = DetourRecords(detours);
+			RegisterDetours(records.data(), (int)detours.size(), (INT64)detourBuffer);
+			ScriptDetours::EagerFixups = mode == 2;
+			ScriptDetours::DetoursEnabled = true;
+			ScriptDetours::InstallHooks();
+			auto start = std::chrono::steady_clock::now();
+			ScriptDetours::LinkDetours();
+			linkMicroseconds = ElapsedMicroseconds(start);
+		}
+
+		bool ok = true;
+		auto runCorpus = [&](INT64)
+		{
+			for (char* script : corpus)
+			{
+				ok = VmEmu::Call(script, "run", {}, NULL) && ok;
+			}
+		};
+		auto start = std::chrono::steady_clock::now();
+		runCorpus(0);
+		double firstMicroseconds = ElapsedMicroseconds(start);
+
+		char name[64];
+		snprintf(name, sizeof(name), "%s, corpus pass", modes[mode]);
+		double pass = Bench(name, BenchIterations(2000), runCorpus);
+		CHECK(ok);
+		printf("    %.2f ns per call site, link %.1f us, first pass %.1f us\n", pass / (BENCH_CORPUS_SCRIPTS * BENCH_CORPUS_SITES), linkMicroseconds, firstMicroseconds);
+		RemoveDetours();
+		ScriptDetours::EagerFixups = false;
+	}
+}
+
+#define BENCH_EXPORTS 512
+
+// what every export lookup did before the index, walk the __t7export table until the key matches
+static INT32 LinearFindExport(char* buffer, INT32 funcNS, INT32 funcName)
+{
+	auto current = (__t7export*)(buffer + *(INT32*)(buffer + 0x20));
+	for (INT16 i = 0; i < *(INT16*)(buffer + 0x3A); i++, current++)
+	{
+		if (current->funcNS == funcNS && current->funcName == funcName)
+		{
+			return current->bytecodeOffset;
+		}
+	}
+	return 0;
+}
+
+// export lookups against a stock sized script, hit on a random export and a miss on one that isnt there
+static void BenchExportLookup()
+{
+	printf("export lookup (%d exports)\n", BENCH_EXPORTS);
+	VmEmu::Reset();
+	ScriptBuilder script("emu_bexports");
+	std::vector<INT32> names;
+	for (int i = 0; i < BENCH_EXPORTS; i++)
+	{
+		std::string name = "func" + std::to_string(i);
+		script.Function(name.c_str());
+		script.GetByte(1);
+		script.Op(EMU_Return);
+		names.push_back((INT32)fnv1a(name.c_str()));
+	}
+	char* buffer = VmEmu::Load("scripts/emu/bexports.gsc", script.Build());
+	CHECK(buffer != NULL);
+	if (!buffer)
+	{
+		return;
+	}
+
+	INT32 ns = (INT32)fnv1a("emu_bexports");
+	bool agree = true;
+	for (INT32 name : names)
+	{
+		agree = agree && ExportIndex::FindExport(buffer, ns, name) == LinearFindExport(buffer, ns, name);
+	}
+	agree = agree && !ExportIndex::FindExport(buffer, ns, (INT32)fnv1a("missing"));
+	CHECK(agree);
+
+	auto probes = BenchPointers(0x1000, 3);
+	INT64 iterations = BenchIterations(1000000);
+	double linear = Bench("hit, linear walk", iterations, [&](INT64 i)
+	{
+		BenchSink += LinearFindExport(buffer, ns, names[probes[i & 0xFFF] % BENCH_EXPORTS]);
+	});
+	double indexed = Bench("hit, ExportIndex", iterations, [&](INT64 i)
+	{
+		BenchSink += ExportIndex::FindExport(buffer, ns, names[probes[i & 0xFFF] % BENCH_EXPORTS]);
+	});
+	Bench("miss, linear walk", iterations, [&](INT64 i)
+	{
+		BenchSink += LinearFindExport(buffer, ns, (INT32)i | 1);
+	});
+	Bench("miss, ExportIndex", iterations, [&](INT64 i)
+	{
+		BenchSink += ExportIndex::FindExport(buffer, ns, (INT32)i | 1);
+	});
+	printf("  hit speedup %.2fx\n", linear / indexed);
+}
+
+#define BENCH_PATCH_SIZE 0x800
+
+// a 2 KB region written the way compiler::patchbyte() did, one resolved and journaled byte at a time, against one batch
+static void BenchBytecodePatches()
+{
+	printf("bytecode patching (%d bytes)\n", BENCH_PATCH_SIZE);
+	VmEmu::Reset();
+	BytecodePatcher::Reset();
+	ScriptBuilder script("emu_bpatch");
+	script.Function("body");
+	for (int i = 0; i < BENCH_PATCH_SIZE / 2; i++)
+	{
+		script.Op(EMU_Nop);
+	}
+	script.Op(EMU_End);
+	char* buffer = VmEmu::Load("scripts/emu/bpatch.gsc", script.Build());
+	CHECK(buffer != NULL);
+	if (!buffer)
+	{
+		return;
+	}
+
+	INT32 start = (INT32)(VmEmu::FindExport(buffer, "body") - (INT64)buffer);
+	std::vector<BYTE> original(buffer + start, buffer + start + BENCH_PATCH_SIZE);
+	std::vector<BYTE> data(original);
+	bool ok = true;
+	INT64 iterations = BenchIterations(20); // the per byte side is milliseconds a pass
+	double single = Bench("per byte", iterations, [&](INT64)
+	{
+		for (INT32 i = 0; i < BENCH_PATCH_SIZE; i++)
+		{
+			BytecodeEdit edit = { "scripts/emu/bpatch.gsc", start + i, 1, i };
+			ok = BytecodePatcher::Apply(&edit, 1, data.data(), (INT32)data.size()) == 1 && ok;
+		}
+		ok = BytecodePatcher::Undo(-1) == BENCH_PATCH_SIZE && ok;
+	});
+	double batch = Bench("one batch", iterations, [&](INT64)
+	{
+		BytecodeEdit edit = { "scripts/emu/bpatch.gsc", start, BENCH_PATCH_SIZE, 0 };
+		ok = BytecodePatcher::Apply(&edit, 1, data.data(), (INT32)data.size()) == BENCH_PATCH_SIZE && ok;
+		ok = BytecodePatcher::Undo(-1) == 1 && ok;
+	});
+	CHECK(ok);
+	CHECK(!memcmp(original.data(), buffer + start, BENCH_PATCH_SIZE));
+	printf("  batch speedup %.2fx\n", single / batch);
+}
+
+class DiscardLogSink : public LogSink
+{
+public:
+	void Write(const char* text, size_t length) override
+	{
+		BenchSink += length;
+	}
+};
+
+// what a log line costs the vm thread now, against the vsprintf nlog did before it went anywhere, and what the drain
+// thread pays to format it later
+static void BenchAsyncLog()
+{
+	printf("async log\n");
+	INT64 iterations = BenchIterations(2000000);
+	static MpscRing<LogRecord, LOG_RING_SIZE> ring;
+	LogRecord encoded = {};
+	Bench("ring push and pop", iterations, [&](INT64 i)
+	{
+		ring.TryPush([&](LogRecord& record) { record.Format = "%d"; record.NumArgs = 1; record.Args[0] = (uint64_t)i; });
+		ring.TryPop([&](const LogRecord& record) { BenchSink += record.Args[0]; });
+	});
+
+	// in chunks the ring can hold, with the drain thread catching up untimed in between, so no line is timed as a drop
+	AsyncLog::SetSink(new DiscardLogSink());
+	INT64 chunks = (iterations + LOG_RING_SIZE / 2 - 1) / (LOG_RING_SIZE / 2);
+	double written = 0;
+	for (INT64 chunk = 0; chunk < chunks; chunk++)
+	{
+		auto start = std::chrono::steady_clock::now();
+		for (INT32 i = 0; i < LOG_RING_SIZE / 2; i++)
+		{
+			LOG_INFO("called with %d parameters by %s", i, "bench");
+		}
+		written += std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+		AsyncLog::Stop();
+	}
+	printf("  %-44s %10.2f ns/op\n", "LOG_INFO, vm thread", written / (chunks * (LOG_RING_SIZE / 2)));
+
+	char line[LOG_RECORD_SIZE];
+	double printed = Bench("vsprintf equivalent", iterations, [&](INT64 i)
+	{
+		BenchSink += snprintf(line, sizeof(line), "called with %d parameters by %s", (INT32)i, "bench");
+	});
+
+	encoded.Format = "called with %d parameters by %s";
+	encoded.NumArgs = 2;
+	encoded.Types[0] = LOG_ARG_INT;
+	encoded.Types[1] = LOG_ARG_STRING;
+	encoded.TextOffsets[1] = 0;
+	strcpy(encoded.Text, "bench");
+	double formatted = Bench("AsyncLog::Format, drain thread", iterations, [&](INT64 i)
+	{
+		encoded.Args[0] = (uint64_t)i;
+		BenchSink += AsyncLog::Format(encoded, line, sizeof(line));
+	});
+	char expected[LOG_RECORD_SIZE];
+	snprintf(expected, sizeof(expected), "called with %d parameters by %s", (INT32)(iterations - 1), "bench");
+	CHECK(!strcmp(line, expected));
+	printf("  format overhead over snprintf %.2fx\n", formatted / printed);
+}
+
+int main(int argc, char** argv)
+{
+	BenchInit(argc, argv);
+	if (!VmEmu::Attach())
+	{
+		printf("emulator: %s\n", VmEmu::LastError.c_str());
+		return 1;
+	}
+	BenchDetourTable();
+	BenchDetourFixups();
+	BenchExportLookup();
+	BenchBytecodePatches();
+	BenchAsyncLog();
+	return TEST_RESULT();
+}
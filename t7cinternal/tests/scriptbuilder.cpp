@@ -0,0 +1,210 @@
+#include "scriptbuilder.h"
+
+#define SCRIPTBUILDER_IMPORT_GETFUNCTION 1
+#define SCRIPTBUILDER_IMPORT_CALL 2
+
+ScriptBuilder::ScriptBuilder(const char* ns)
+{
+	Namespace = (INT32)fnv1a(ns);
+}
+
+void ScriptBuilder::Align(INT32 alignment)
+{
+	while (Here() % alignment)
+	{
+		Code.push_back(0);
+	}
+}
+
+void ScriptBuilder::Emit(const void* data, size_t size)
+{
+	Code.insert(Code.end(), (const BYTE*)data, (const BYTE*)data + size);
+}
+
+INT32 ScriptBuilder::Here() const
+{
+	return SCRIPTBUILDER_CODE_START + (INT32)Code.size();
+}
+
+INT32 ScriptBuilder::FunctionOffset() const
+{
+	return Exports.empty() ? 0 : Exports.back().Offset;
+}
+
+void ScriptBuilder::Function(const char* name, BYTE flags)
+{
+	Align(8);
+	Exports.push_back({ Here(), (INT32)fnv1a(name), flags });
+}
+
+void ScriptBuilder::Op(EmuOp op)
+{
+	Align(2);
+	UINT16 raw = VmEmu::RawOpcode(op);
+	Emit(&raw, 2);
+}
+
+void ScriptBuilder::GetByte(UINT16 value)
+{
+	Op(EMU_GetByte);
+	Emit(&value, 2);
+}
+
+void ScriptBuilder::AddImport(const char* ns, const char* function, BYTE numParams, BYTE kind, INT32 ref)
+{
+	INT32 name = (INT32)fnv1a(function);
+	INT32 space = ns ? (INT32)fnv1a(ns) : 0;
+	for (auto& import : Imports)
+	{
+		if (import.Name == name && import.Namespace == space && import.NumParams == numParams && import.Kind == kind)
+		{
+			import.Refs.push_back(ref);
+			return;
+		}
+	}
+	Imports.push_back({ name, space, numParams, kind, { ref } });
+}
+
+void ScriptBuilder::Call(const char* ns, const char* function, BYTE numParams)
+{
+	// opcode, param count, then the qword operand resolve writes
+	Op(EMU_ScriptFunctionCall);
+	INT32 op = Here() - 2;
+	Code.push_back(numParams);
+	Align(8);
+	Code.resize(Code.size() + 8);
+	AddImport(ns, function, numParams, SCRIPTBUILDER_IMPORT_CALL, op);
+}
+
+void ScriptBuilder::GetFunction(const char* ns, const char* function)
+{
+	Op(EMU_GetFunction);
+	INT32 op = Here() - 2;
+	Align(8);
+	Code.resize(Code.size() + 8);
+	AddImport(ns, function, 0, SCRIPTBUILDER_IMPORT_GETFUNCTION, op);
+}
+
+void ScriptBuilder::CallPointer(BYTE numParams)
+{
+	Op(EMU_ScriptFunctionCallPointer);
+	Code.push_back(numParams);
+	Code.push_back(0);
+}
+
+void ScriptBuilder::GetString(const char* text)
+{
+	Op(EMU_GetString);
+	Align(4);
+	INT32 operand = Here();
+	Code.resize(Code.size() + 4);
+	for (auto& string : Strings)
+	{
+		if (string.Text == text)
+		{
+			string.Refs.push_back(operand);
+			return;
+		}
+	}
+	Strings.push_back({ text, { operand } });
+}
+
+void ScriptBuilder::CallSites(const char* ns, const char* function, INT32 count)
+{
+	for (INT32 i = 0; i < count; i++)
+	{
+		Op(EMU_PreScriptCall);
+		Call(ns, function, 0);
+		Op(EMU_DecTop);
+	}
+}
+
+std::vector<BYTE> ScriptBuilder::Build() const
+{
+	std::vector<BYTE> data(SCRIPTBUILDER_CODE_START + Code.size(), 0);
+	if (!Code.empty())
+	{
+		memcpy(data.data() + SCRIPTBUILDER_CODE_START, Code.data(), Code.size());
+	}
+	while (data.size() % 8)
+	{
+		data.push_back(0);
+	}
+
+	INT32 exports = (INT32)data.size();
+	for (auto& e : Exports)
+	{
+		__t7export entry = { -1, e.Offset, e.Name, Namespace, (INT32)e.Flags << 8 };
+		data.insert(data.end(), (BYTE*)&entry, (BYTE*)(&entry + 1));
+	}
+
+	INT32 imports = (INT32)data.size();
+	for (auto& i : Imports)
+	{
+		UINT16 numRefs = (UINT16)i.Refs.size();
+		data.insert(data.end(), (BYTE*)&i.Name, (BYTE*)&i.Name + 4);
+		data.insert(data.end(), (BYTE*)&i.Namespace, (BYTE*)&i.Namespace + 4);
+		data.insert(data.end(), (BYTE*)&numRefs, (BYTE*)&numRefs + 2);
+		data.push_back(i.NumParams);
+		data.push_back(i.Kind);
+		data.insert(data.end(), (BYTE*)i.Refs.data(), (BYTE*)(i.Refs.data() + i.Refs.size()));
+	}
+
+	// the text first, then a record per string of its offset, ref count and the refs
+	std::vector<INT32> texts;
+	for (auto& string : Strings)
+	{
+		texts.push_back((INT32)data.size());
+		data.insert(data.end(), string.Text.c_str(), string.Text.c_str() + string.Text.size() + 1);
+	}
+	while (data.size() % 4)
+	{
+		data.push_back(0);
+	}
+	INT32 strings = (INT32)data.size();
+	for (size_t i = 0; i < Strings.size(); i++)
+	{
+		BYTE record[8] = { 0 };
+		*(INT32*)record = texts[i];
+		record[4] = (BYTE)Strings[i].Refs.size();
+		data.insert(data.end(), record, record + 8);
+		data.insert(data.end(), (BYTE*)Strings[i].Refs.data(), (BYTE*)(Strings[i].Refs.data() + Strings[i].Refs.size()));
+	}
+	INT32 end = (INT32)data.size();
+
+	BYTE* header = data.data();
+	*(UINT64*)header = 0x1C000A0D43534780;
+	*(INT32*)(header + 0x0C) = end; // includes
+	*(INT32*)(header + 0x10) = end; // animtrees
+	*(INT32*)(header + 0x14) = SCRIPTBUILDER_CODE_START;
+	*(INT32*)(header + 0x18) = strings;
+	*(INT32*)(header + 0x1C) = end; // debug strings
+	*(INT32*)(header + 0x20) = exports;
+	*(INT32*)(header + 0x24) = imports;
+	*(INT32*)(header + 0x28) = end; // fixups
+	*(INT32*)(header + 0x2C) = end; // profile
+	*(INT32*)(header + 0x30) = exports - SCRIPTBUILDER_CODE_START;
+	*(INT32*)(header + 0x34) = 0x50; // empty name
+	*(UINT16*)(header + 0x38) = (UINT16)Strings.size();
+	*(UINT16*)(header + 0x3A) = (UINT16)Exports.size();
+	*(UINT16*)(header + 0x3C) = (UINT16)Imports.size();
+	return data;
+}
+
+std::vector<BYTE> DetourRecords(const std::vector<EmuDetour>& detours)
+{
+	std::vector<BYTE> data(detours.size() * 256, 0);
+	for (size_t i = 0; i < detours.size(); i++)
+	{
+		INT32* record = (INT32*)&data[i * 256];
+		record[1] = detours[i].Namespace ? (INT32)fnv1a(detours[i].Namespace) : 0;
+		record[2] = (INT32)fnv1a(detours[i].Function);
+		record[3] = detours[i].FixupOffset;
+		record[4] = detours[i].FixupSize;
+		if (detours[i].Script)
+		{
+			strncpy((char*)(record + 5), detours[i].Script, 256 - 5 * 4 - 1);
+		}
+	}
+	return data;
+}
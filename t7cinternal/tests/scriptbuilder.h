@@ -0,0 +1,80 @@
+#pragma once
+#include "vmemu.h"
+#include <string>
+#include <vector>
+
+#define SCRIPTBUILDER_CODE_START 0x80 // header, then the name, then bytecode. exports and imports follow the bytecode
+
+// one replacement for RegisterDetours. a NULL script detours the builtin named by Function
+struct EmuDetour
+{
+	const char* Script;
+	const char* Namespace;
+	const char* Function;
+	INT32 FixupOffset; // into the object passed as scriptOffset
+	INT32 FixupSize;
+};
+
+// assembles t7 script objects in the layout T7ScriptObject writes, for tests that need bytecode the fixtures dont have
+// (call sites by the hundred, csc callers, detour targets). imports are linked by the emulator's GscObjResolve, so the
+// opcodes and operands that come out are the ones the compiler would have produced.
+class ScriptBuilder
+{
+public:
+	explicit ScriptBuilder(const char* ns);
+
+	// starts an export. functions are 8 byte aligned and each one has to end with Return or End
+	void Function(const char* name, BYTE flags = 0);
+	void Op(EmuOp op);
+	void GetByte(UINT16 value);
+	// import calls, resolved against loaded scripts first and builtins after
+	void Call(const char* ns, const char* function, BYTE numParams);
+	void GetFunction(const char* ns, const char* function);
+	// calls the function reference on top of the stack
+	void CallPointer(BYTE numParams);
+	// pushes a string, linked through the string table like a compiled one
+	void GetString(const char* text);
+	// count statements calling function with no arguments
+	void CallSites(const char* ns, const char* function, INT32 count);
+	// offset of the function being written, and of the next byte, from the start of the object
+	INT32 FunctionOffset() const;
+	INT32 Here() const;
+
+	std::vector<BYTE> Build() const;
+
+private:
+	struct Export
+	{
+		INT32 Offset;
+		INT32 Name;
+		BYTE Flags;
+	};
+
+	struct Import
+	{
+		INT32 Name;
+		INT32 Namespace;
+		BYTE NumParams;
+		BYTE Kind;
+		std::vector<INT32> Refs;
+	};
+
+	void Align(INT32 alignment);
+	void Emit(const void* data, size_t size);
+	void AddImport(const char* ns, const char* function, BYTE numParams, BYTE kind, INT32 ref);
+
+	struct String
+	{
+		std::string Text;
+		std::vector<INT32> Refs;
+	};
+
+	INT32 Namespace;
+	std::vector<BYTE> Code;
+	std::vector<String> Strings;
+	std::vector<Export> Exports;
+	std::vector<Import> Imports;
+};
+
+// RegisterDetours' 256 byte records
+std::vector<BYTE> DetourRecords(const std::vector<EmuDetour>& detours);
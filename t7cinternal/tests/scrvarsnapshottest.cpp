@@ -0,0 +1,155 @@
+#include "testing.h"
+#include "scrvarsnapshot.h"
+#include <cstdio>
+#include <cstring>
+#include <thread>
+
+// a struct at 1 holding three integers and an array at 5, the array holding two integers plus extra more. everything else is free
+static std::vector<ScrVar_t> MakePool(uint32_t count, uint32_t extra)
+{
+	std::vector<ScrVar_t> vars(count);
+	for (auto& var : vars)
+	{
+		var.value.type = VAR_FREE;
+	}
+	auto make = [&](uint32_t index, ScrVarType_t type, uint32_t parent, uint32_t refCount)
+	{
+		vars[index].value.type = type;
+		vars[index].parentId = parent;
+		vars[index].info.refCount = refCount;
+	};
+	make(1, VAR_STRUCT, 0, 1);
+	make(2, VAR_INTEGER, 1, 0);
+	make(3, VAR_INTEGER, 1, 0);
+	make(4, VAR_INTEGER, 1, 0);
+	make(5, VAR_ARRAY, 1, 3);
+	for (uint32_t i = 6; i < 8 + extra; i++)
+	{
+		make(i, VAR_INTEGER, 5, 0);
+	}
+	return vars;
+}
+
+static void TestRoundTrip()
+{
+	auto vars = MakePool(64, 0);
+	std::vector<uint8_t> data;
+	ScrVarSnapshot::Capture(vars.data(), (uint32_t)vars.size(), 1, data);
+
+	ScrVarSnapshotData snapshot;
+	CHECK(ScrVarSnapshot::Parse(data.data(), data.size(), snapshot));
+	CHECK_EQ(snapshot.Header.Inst, 1);
+	CHECK_EQ(snapshot.Header.Capacity, 64);
+	CHECK_EQ(snapshot.Header.NumLive, 7);
+	CHECK_EQ(snapshot.TypeCounts[VAR_INTEGER], 5);
+	CHECK_EQ(snapshot.RefCounts[VAR_ARRAY][ScrVarSnapshot::RefCountBucket(3)], 1);
+	CHECK_EQ(snapshot.Parents.size(), 2);
+	if (snapshot.Parents.size() == 2)
+	{
+		CHECK_EQ(snapshot.Parents[0].Id, 1);
+		CHECK_EQ(snapshot.Parents[0].ParentId, SCRVAR_NO_PARENT);
+		CHECK_EQ(snapshot.Parents[0].Children, 4);
+		CHECK_EQ(snapshot.Parents[1].Id, 5);
+		CHECK_EQ(snapshot.Parents[1].ParentId, 1);
+		CHECK_EQ(snapshot.Parents[1].Children, 2);
+		CHECK_EQ(snapshot.Parents[1].Type, VAR_ARRAY);
+	}
+}
+
+static void TestRejectsBadData()
+{
+	auto vars = MakePool(64, 0);
+	std::vector<uint8_t> data;
+	ScrVarSnapshot::Capture(vars.data(), (uint32_t)vars.size(), 0, data);
+
+	ScrVarSnapshotData snapshot;
+	bool anyParsed = false;
+	for (size_t size = 0; size < data.size(); size++)
+	{
+		anyParsed |= ScrVarSnapshot::Parse(data.data(), size, snapshot);
+	}
+	CHECK(!anyParsed);
+	CHECK(!ScrVarSnapshot::Parse(NULL, data.size(), snapshot));
+
+	// a header claiming billions of records is turned down without reserving room for them first
+	ScrVarSnapshotHeader header;
+	memcpy(&header, data.data(), sizeof(header));
+	header.NumParents = 0xFFFFFFFF;
+	memcpy(data.data(), &header, sizeof(header));
+	CHECK(!ScrVarSnapshot::Parse(data.data(), data.size(), snapshot));
+	CHECK(snapshot.Parents.capacity() <= header.ParentDataSize);
+
+	header.Magic = 0;
+	memcpy(data.data(), &header, sizeof(header));
+	CHECK(!ScrVarSnapshot::Parse(data.data(), data.size(), snapshot));
+}
+
+static void TestDiff()
+{
+	auto beforeVars = MakePool(64, 0);
+	auto afterVars = MakePool(64, 3);
+	std::vector<uint8_t> beforeData, afterData;
+	ScrVarSnapshot::Capture(beforeVars.data(), (uint32_t)beforeVars.size(), 0, beforeData);
+	ScrVarSnapshot::Capture(afterVars.data(), (uint32_t)afterVars.size(), 0, afterData);
+
+	ScrVarSnapshotData before, after;
+	CHECK(ScrVarSnapshot::Parse(beforeData.data(), beforeData.size(), before));
+	CHECK(ScrVarSnapshot::Parse(afterData.data(), afterData.size(), after));
+	ScrVarSnapshotDiff diff;
+	ScrVarSnapshot::Diff(before, after, diff);
+	CHECK_EQ(diff.LiveBefore, 7);
+	CHECK_EQ(diff.LiveAfter, 10);
+	CHECK_EQ(diff.Types.size(), 1);
+	CHECK_EQ(diff.Parents.size(), 1);
+
+	std::string text;
+	ScrVarSnapshot::FormatDiff(diff, after, 8, text);
+	CHECK(text == "live 7 -> 10 (+3)\n  integer               5 -> 8        (+3)\n  #5 array: 2 -> 5 children (+3) <- #1 struct\n");
+
+	// the same pair for the scrvardiff run that follows this test
+	auto write = [](const char* path, const std::vector<uint8_t>& data)
+	{
+		FILE* file = fopen(path, "wb");
+		CHECK(file != NULL);
+		if (file)
+		{
+			fwrite(data.data(), 1, data.size(), file);
+			fclose(file);
+		}
+	};
+	write("scrvarsnapshottest-before.svsn", beforeData);
+	write("scrvarsnapshottest-after.svsn", afterData);
+}
+
+static void TestConcurrentCapture()
+{
+	// the injector export and the builtin can capture at the same time, neither sees the other's counts
+	auto small = MakePool(20000, 0);
+	auto large = MakePool(20000, 1000);
+	bool matched[2] = { true, true };
+	auto capture = [&](const std::vector<ScrVar_t>& vars, uint32_t children, bool& ok)
+	{
+		for (int i = 0; i < 100; i++)
+		{
+			std::vector<uint8_t> data;
+			ScrVarSnapshotData snapshot;
+			ScrVarSnapshot::Capture(vars.data(), (uint32_t)vars.size(), 0, data);
+			ok &= ScrVarSnapshot::Parse(data.data(), data.size(), snapshot) && snapshot.Parents.size() == 2 && snapshot.Parents[1].Children == children;
+		}
+	};
+	std::thread first(capture, std::cref(small), 2, std::ref(matched[0]));
+	std::thread second(capture, std::cref(large), 1002, std::ref(matched[1]));
+	first.join();
+	second.join();
+	CHECK(matched[0]);
+	CHECK(matched[1]);
+}
+
+int main()
+{
+	RUN_TEST(TestRoundTrip);
+	RUN_TEST(TestRejectsBadData);
+	RUN_TEST(TestDiff);
+	RUN_TEST(TestConcurrentCapture);
+	return TEST_RESULT();
+}
@@ -0,0 +1,171 @@
+#include "testing.h"
+#include "vmemu.h"
+#include "scrvarpool.h"
+#include "scrvarbench.h"
+#include <vector>
+
+// the pool and its allocator hook are process wide, so each test leaves the next one an installed pool to start from
+
+// allocates count variables, false if the allocator ran dry or handed out one that was still in use
+static bool AllocUnique(INT32 count, std::vector<bool>& taken, INT32* highest)
+{
+	for (INT32 i = 0; i < count; i++)
+	{
+		INT32 index = VmEmu::AllocVariable(0);
+		if (!index)
+		{
+			return false;
+		}
+		if (index >= (INT32)taken.size())
+		{
+			taken.resize(index + 1);
+		}
+		if (taken[index])
+		{
+			return false;
+		}
+		taken[index] = true;
+		*highest = (index > *highest) ? index : *highest;
+	}
+	return true;
+}
+
+static void TestGrowth()
+{
+	VmEmu::ResetVariables(0);
+	CHECK(ScrVarPool::Grow(0, SCRVAR_STOCK_COUNT + 4 * SCRVAR_POOL_LINK_BATCH, false));
+
+	// batches are linked as the vm gets close to the tail, not all at once
+	ScrVarPoolStats stats;
+	GetScrVarPoolStats(0, &stats);
+	CHECK_EQ(stats.Installed, 1);
+	CHECK_EQ(stats.Linked, SCRVAR_STOCK_COUNT + SCRVAR_POOL_LINK_BATCH);
+	CHECK(stats.Capacity >= SCRVAR_STOCK_COUNT + 4 * SCRVAR_POOL_LINK_BATCH);
+
+	std::vector<bool> taken;
+	INT32 highest = 0;
+	CHECK(AllocUnique(SCRVAR_STOCK_COUNT + 2 * SCRVAR_POOL_LINK_BATCH, taken, &highest));
+	CHECK(highest >= SCRVAR_STOCK_COUNT + SCRVAR_POOL_LINK_BATCH);
+	GetScrVarPoolStats(0, &stats);
+	CHECK(stats.Linked > highest);
+	CHECK_EQ(stats.HighWater, highest);
+}
+
+static void TestRestart()
+{
+	// a restart rebuilds the list over the stock range only, the batches behind the old end are not reachable anymore
+	VmEmu::RestartVariables(0);
+	ScrVarPoolStats stats;
+	GetScrVarPoolStats(0, &stats);
+	CHECK_EQ(stats.Installed, 1);
+	CHECK_EQ(stats.Linked, SCRVAR_STOCK_COUNT);
+
+	// and the pool grows past the stock end again instead of running dry there
+	std::vector<bool> taken;
+	INT32 highest = 0;
+	CHECK(AllocUnique(SCRVAR_STOCK_COUNT + SCRVAR_POOL_LINK_BATCH, taken, &highest));
+	CHECK(highest >= SCRVAR_STOCK_COUNT);
+	GetScrVarPoolStats(0, &stats);
+	CHECK(stats.Linked > highest);
+
+	// the same restart seen by a grow before the vm gets to the stock end
+	VmEmu::RestartVariables(0);
+	CHECK(ScrVarPool::Grow(0, SCRVAR_STOCK_COUNT, false));
+	GetScrVarPoolStats(0, &stats);
+	CHECK_EQ(stats.Linked, SCRVAR_STOCK_COUNT + SCRVAR_POOL_LINK_BATCH);
+	taken.clear();
+	highest = 0;
+	CHECK(AllocUnique(SCRVAR_STOCK_COUNT + SCRVAR_POOL_LINK_BATCH, taken, &highest));
+}
+
+static void TestReinstall()
+{
+	// the game put its own pool back mid level. it is full, then ten variables were freed, so its list ends on the first
+	// of those and the last stock variable is in use
+	VmEmu::ResetVariables(0);
+	for (INT32 i = 1; i < SCRVAR_STOCK_COUNT; i++)
+	{
+		VmEmu::AllocVariable(0);
+	}
+	CHECK(!VmEmu::AllocVariable(0));
+	for (INT32 i = 10; i < 20; i++)
+	{
+		VmEmu::FreeVariable(0, i);
+	}
+
+	CHECK(ScrVarPool::Grow(0, SCRVAR_STOCK_COUNT, false));
+	ScrVar_t* vars = *SCRVAR_POOL_PTR(0);
+	CHECK(vars[SCRVAR_STOCK_COUNT - 1].value.type != VAR_FREE);
+
+	// the freed ones come back first, then the pool grows behind the end of their list
+	std::vector<bool> taken;
+	INT32 highest = 0;
+	CHECK(AllocUnique(10, taken, &highest));
+	CHECK_EQ(highest, 19);
+	CHECK(AllocUnique(SCRVAR_POOL_LINK_BATCH, taken, &highest));
+	CHECK(highest >= SCRVAR_STOCK_COUNT);
+	CHECK(taken.size() <= SCRVAR_STOCK_COUNT - 1 || !taken[SCRVAR_STOCK_COUNT - 1]);
+	CHECK(vars[SCRVAR_STOCK_COUNT - 1].value.type != VAR_FREE);
+}
+
+static void TestHeapStats()
+{
+	// a short list, a long one with hundreds of chains running into it, and a cycle nothing links into
+	std::vector<ScrVar_t> vars(1000);
+	auto link = [&](INT32 from, INT32 to)
+	{
+		vars[from].value.type = VAR_FREE;
+		vars[from].o.size = to;
+	};
+	link(2, 3);
+	link(3, 0);
+	for (INT32 i = 10; i < 500; i++)
+	{
+		link(i, i + 1);
+	}
+	link(500, 0);
+	link(501, 502);
+	link(502, 501);
+	for (INT32 i = 600; i < 1000; i++)
+	{
+		link(i, 10);
+	}
+
+	ScrVarHeapStats stats;
+	ScrVarBench::Measure(vars.data(), (INT32)vars.size(), &stats);
+	CHECK_EQ(stats.Capacity, 1000);
+	CHECK_EQ(stats.FreeCount, 2 + 491 + 2 + 400);
+	CHECK_EQ(stats.FreeListHead, 600);
+	CHECK_EQ(stats.FreeListLength, 492);
+
+	// patterns run against a copy, the live pool is left as it was
+	ScrVarBenchConfig config = {};
+	config.Pattern = SCRVAR_BENCH_CHURN;
+	config.Iterations = 10000;
+	config.LiveSet = 256;
+	config.Seed = 1;
+	ScrVarHeapStats before, after;
+	GetScrVarHeapStats(0, &before);
+	ScrVarBenchResult result;
+	CHECK(RunScrVarBenchmark(0, &config, &result));
+	GetScrVarHeapStats(0, &after);
+	CHECK_EQ(result.Allocs, 256 + 10000);
+	CHECK_EQ(result.Frees, 10000);
+	CHECK_EQ(result.Failed, 0);
+	CHECK_EQ(after.FreeListHead, before.FreeListHead);
+	CHECK_EQ(after.FreeCount, before.FreeCount);
+}
+
+int main()
+{
+	if (!VmEmu::Attach())
+	{
+		printf("emulator: %s\n", VmEmu::LastError.c_str());
+		return 1;
+	}
+	RUN_TEST(TestGrowth);
+	RUN_TEST(TestRestart);
+	RUN_TEST(TestReinstall);
+	RUN_TEST(TestHeapStats);
+	return TEST_RESULT();
+}
@@ -0,0 +1,37 @@
+#pragma once
+#include <cstdio>
+#include <cstdint>
+
+// minimal checks for the runtime tests. a failed check is reported and the test keeps going, main returns the failure count
+static int TestFailures = 0;
+
+#define CHECK(cond) \
+	do \
+	{ \
+		if (!(cond)) \
+		{ \
+			printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+			TestFailures++; \
+		} \
+	} while (0)
+
+#define CHECK_EQ(a, b) \
+	do \
+	{ \
+		long long _a = (long long)(a), _b = (long long)(b); \
+		if (_a != _b) \
+		{ \
+			printf("%s:%d: CHECK_EQ(%s, %s) failed: %lld != %lld\n", __FILE__, __LINE__, #a, #b, _a, _b); \
+			TestFailures++; \
+		} \
+	} while (0)
+
+#define RUN_TEST(test) \
+	do \
+	{ \
+		int _failures = TestFailures; \
+		test(); \
+		printf("%s %s\n", (_failures == TestFailures) ? "[ ok ]" : "[fail]", #test); \
+	} while (0)
+
+#define TEST_RESULT() (TestFailures ? 1 : 0)
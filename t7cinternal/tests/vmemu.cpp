@@ -0,0 +1,1141 @@
+#include "vmemu.h"
+#include "offsets.h"
+#include "builtins.h"
+#include "Opcodes.h"
+#include "vmframe.h"
+#include "scrvar.h"
+#include "scrvarpool.h"
+#include <fstream>
+#include <cstdlib>
+
+// covers every offset in offsets.h and builtins.cpp
+#define EMU_IMAGE_SIZE 0x16A00000
+#define EMU_POOL_SIZE 0x100
+#define EMU_MAX_LOCALS 0x10000
+
+// ScrVmPub for each inst. builtins read the parameter count and the stack top from here
+#define EMU_SCRVMPUB(inst) (REBASE(0x51A3840, 0x3F66B50) + 0x8A40llu * (inst))
+#define EMU_Scr_AddInt REBASE(0x12E9870, NULL)
+#define EMU_Scr_Error REBASE(0x12EA430, NULL)
+#define EMU_SL_GetString REBASE(0x12D7B20, NULL)
+#define EMU_SL_TransferRefToUser REBASE(0x12D8C60, NULL)
+#define EMU_GscObjResolve REBASE(0x12CA2B0, NULL)
+#define EMU_Scr_ExecThread REBASE(0x12EA770, NULL)
+#define EMU_Scr_FreeThread REBASE(0x12EAB50, NULL)
+
+typedef void(__fastcall* tGscObjResolve)(INT32 inst, char* obj, INT32 unk);
+
+BYTE VmEmu::AliasTable[0x4000];
+UINT16 VmEmu::RawOpcodes[0x100];
+char* VmEmu::Image = NULL;
+EmuVar VmEmu::Stack[0x1000];
+std::vector<EmuCall> VmEmu::Calls;
+std::vector<EmuVar> VmEmu::Locals;
+std::vector<SPTEntry> VmEmu::Pool;
+std::vector<std::string> VmEmu::Strings;
+std::vector<BuiltinFunctionDef*> VmEmu::BuiltinDefs;
+EmuVar* VmEmu::BuiltinParams = NULL;
+INT32 VmEmu::NumBuiltinParams = 0;
+EmuVar VmEmu::BuiltinResult;
+std::vector<ScrVar_t> VmEmu::StockVars[2];
+INT32 VmEmu::FreeHeads[2];
+UINT64 VmEmu::Dispatches = 0;
+INT32 VmEmu::Threads = 0;
+INT32 VmEmu::DispatchTable = 0;
+std::string VmEmu::LastError;
+
+bool VmEmu::ReadFile(const std::string& path, std::vector<BYTE>& data)
+{
+	std::ifstream file(path, std::ios::binary);
+	if (!file)
+	{
+		return false;
+	}
+	data.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+	return true;
+}
+
+bool VmEmu::LoadAliasTable()
+{
+	std::vector<BYTE> db;
+	if (!ReadFile(T7_OPCODE_DB, db))
+	{
+		Error("cant read %s", T7_OPCODE_DB);
+		return false;
+	}
+
+	// BinaryFormatter record of the byte[0x4000] ops array in T7MetaV2
+	static const BYTE pattern[] = { 0x0F, 0x03, 0x00, 0x00, 0x00, 0x00, 0x40, 0x00, 0x00, 0x02 };
+	for (size_t i = 0; i + sizeof(pattern) + sizeof(AliasTable) <= db.size(); i++)
+	{
+		if (!memcmp(&db[i], pattern, sizeof(pattern)))
+		{
+			memcpy(AliasTable, &db[i + sizeof(pattern)], sizeof(AliasTable));
+			return true;
+		}
+	}
+	Error("no opcode table in %s", T7_OPCODE_DB);
+	return false;
+}
+
+void VmEmu::WriteThunk(INT64 at, INT64 destination)
+{
+	// a prologue InlineHook can relocate (push rbx, sub rsp, add rsp, pop rbx, mov rax rax x2), then mov rax, destination; jmp rax
+	static const BYTE prologue[] = { 0x53, 0x48, 0x83, 0xEC, 0x20, 0x48, 0x83, 0xC4, 0x20, 0x5B, 0x48, 0x8B, 0xC0, 0x48, 0x8B, 0xC0 };
+	BYTE* code = (BYTE*)at;
+	memcpy(code, prologue, sizeof(prologue));
+	code[16] = 0x48;
+	code[17] = 0xB8;
+	*(INT64*)(code + 18) = destination;
+	code[26] = 0xFF;
+	code[27] = 0xE0;
+}
+
+bool VmEmu::Init()
+{
+	if (Image)
+	{
+		Reset();
+		return true;
+	}
+	if (!LoadAliasTable())
+	{
+		return false;
+	}
+
+	Image = (char*)VirtualAlloc(NULL, EMU_IMAGE_SIZE, MEM_RESERVE | MEM_COMMIT, PAGE_EXECUTE_READWRITE);
+	if (!Image)
+	{
+		Error("cant map the image");
+		return false;
+	}
+	PAL_ImageBase = (uint64_t)Image;
+
+	WriteThunk(OFF_DB_FindXAssetHeader, (INT64)DB_FindXAssetHeader);
+	WriteThunk(OFF_Scr_GscObjLink, (INT64)Scr_GscObjLink);
+	WriteThunk(OFF_Scr_GetFunction, (INT64)Scr_GetFunction);
+	WriteThunk(OFF_Scr_GetMethod, (INT64)Scr_GetMethod);
+	WriteThunk(OFF_ScrVm_GetInt, (INT64)ScrVm_GetInt);
+	WriteThunk(OFF_ScrVm_GetString, (INT64)ScrVm_GetString);
+	WriteThunk(OFF_ScrVm_GetFunc, (INT64)ScrVm_GetFunc);
+	WriteThunk(EMU_Scr_AddInt, (INT64)Scr_AddInt);
+	WriteThunk(EMU_Scr_Error, (INT64)Scr_Error);
+	WriteThunk(EMU_SL_GetString, (INT64)SL_GetString);
+	WriteThunk(EMU_SL_TransferRefToUser, (INT64)SL_TransferRefToUser);
+	WriteThunk(EMU_GscObjResolve, (INT64)GscObjResolve);
+	WriteThunk(EMU_Scr_ExecThread, (INT64)Scr_ExecThread);
+	WriteThunk(EMU_Scr_FreeThread, (INT64)Scr_FreeThread);
+	WriteThunk(OFF_ScrVar_AllocVariableInternal, (INT64)ScrVar_AllocVariableInternal);
+
+	// the handlers the runtime hooks by address live in the image, everything else points straight at the emulator
+	WriteThunk(OFF_VM_OP_GetAPIFunction, (INT64)OP_GetAPIFunction);
+	WriteThunk(OFF_VM_OP_GetFunction, (INT64)OP_GetFunction);
+	WriteThunk(OFF_VM_OP_ScriptFunctionCall, (INT64)OP_ScriptFunctionCall);
+	WriteThunk(OFF_VM_OP_ScriptMethodCall, (INT64)OP_Invalid);
+	WriteThunk(OFF_VM_OP_ScriptThreadCall, (INT64)OP_Invalid);
+	WriteThunk(OFF_VM_OP_ScriptMethodThreadCall, (INT64)OP_Invalid);
+	WriteThunk(OFF_VM_OP_CallBuiltin, (INT64)OP_CallBuiltin);
+	WriteThunk(OFF_VM_OP_CallBuiltinMethod, (INT64)OP_Invalid);
+
+	for (int i = 0; i < 0x100; i++)
+	{
+		RawOpcodes[i] = 0xFFFF;
+	}
+	for (int raw = 0x2000 - 1; raw >= 0; raw--)
+	{
+		if (AliasTable[raw] != EMU_Invalid)
+		{
+			RawOpcodes[AliasTable[raw]] = (UINT16)raw;
+		}
+	}
+
+	// aliases the game has that the db doesnt list. the compiler emits 0x0F for builtin calls and the runtime spoofs to the others
+	AliasTable[0x0F] = EMU_CallBuiltin;
+	AliasTable[0x7E] = EMU_GetFunction;
+	RawOpcodes[EMU_CallBuiltin] = 0x0F;
+	RawOpcodes[EMU_GetFunction] = 0x7E;
+	RawOpcodes[EMU_ScriptFunctionCall] = 0x203;
+	RawOpcodes[EMU_ScriptMethodCall] = 0x207;
+
+	for (int table = 0; table < 2; table++)
+	{
+		auto handlers = (INT64*)OpcodeTable(table);
+		for (int raw = 0; raw < 0x2000; raw++)
+		{
+			handlers[raw] = (INT64)StockHandler((EmuOp)AliasTable[raw]);
+		}
+	}
+
+	// builtin defs the runtime rewrites
+	auto def = (BuiltinFunctionDef*)OFF_IsProfileBuild;
+	def->canonId = fnv1a("isprofilebuild");
+	def->actionFunc = (void*)OP_Nop;
+	BuiltinDefs.push_back(def);
+	def = (BuiltinFunctionDef*)OFF_BID_Scr_CastInt;
+	def->canonId = fnv1a("int");
+	def->min_args = 1;
+	def->max_args = 1;
+	BuiltinDefs.push_back(def);
+
+	Pool.resize(EMU_POOL_SIZE);
+	*(INT64*)OFF_xAssetScriptParseTree = (INT64)Pool.data();
+	Locals.reserve(EMU_MAX_LOCALS);
+	ResetVariables(0);
+	ResetVariables(1);
+	Reset();
+	return true;
+}
+
+bool VmEmu::Attach()
+{
+	static bool attached = false;
+	if (!Init())
+	{
+		return false;
+	}
+	if (!attached)
+	{
+		GSCBuiltins::Init();
+		ScriptDetours::Init();
+		Opcodes::Init();
+		attached = true;
+	}
+	return true;
+}
+
+void VmEmu::Reset()
+{
+	INT32 count = *(INT32*)(OFF_xAssetScriptParseTree + 0x14);
+	for (int i = 0; i < count; i++)
+	{
+		free(Pool[i].Buffer);
+		free(Pool[i].Name);
+		Pool[i] = { 0 };
+	}
+	*(INT32*)(OFF_xAssetScriptParseTree + 0x14) = 0;
+	Strings.assign(1, std::string());
+	Calls.clear();
+	Locals.clear();
+	Dispatches = 0;
+	Threads = 0;
+	DispatchTable = 0;
+	LastError.clear();
+	SetUILevel(false);
+}
+
+void VmEmu::ResetVariables(INT32 inst)
+{
+	StockVars[inst].assign(inst ? SCRVAR_STOCK_CSC_COUNT : SCRVAR_STOCK_COUNT, ScrVar_t());
+	*SCRVAR_POOL_PTR(inst) = StockVars[inst].data();
+	RestartVariables(inst);
+}
+
+void VmEmu::RestartVariables(INT32 inst)
+{
+	// 0 is never handed out, it is what a link to nowhere points at
+	ScrVar_t* vars = *SCRVAR_POOL_PTR(inst);
+	INT32 stock = inst ? SCRVAR_STOCK_CSC_COUNT : SCRVAR_STOCK_COUNT;
+	for (INT32 i = 1; i < stock; i++)
+	{
+		vars[i].value.type = VAR_FREE;
+		vars[i].o.size = (i + 1 < stock) ? i + 1 : 0;
+	}
+	FreeHeads[inst] = 1;
+}
+
+INT32 VmEmu::AllocVariable(INT32 inst)
+{
+	return ((tScrVar_AllocVariableInternal)OFF_ScrVar_AllocVariableInternal)(inst, 0, 0, 0);
+}
+
+void VmEmu::FreeVariable(INT32 inst, INT32 index)
+{
+	ScrVar_t* vars = *SCRVAR_POOL_PTR(inst);
+	vars[index].value.type = VAR_FREE;
+	vars[index].o.size = FreeHeads[inst];
+	FreeHeads[inst] = index;
+}
+
+INT32 VmEmu::ScrVar_AllocVariableInternal(unsigned int inst, unsigned int nameType, __int64 a3, unsigned int a4)
+{
+	ScrVar_t* vars = *SCRVAR_POOL_PTR(inst);
+	INT32 index = FreeHeads[inst];
+	if (!index)
+	{
+		return 0; // the game errors out here
+	}
+	FreeHeads[inst] = (INT32)vars[index].o.size;
+	vars[index].value.type = VAR_UNDEFINED;
+	vars[index].o.size = 0;
+	return index;
+}
+
+void VmEmu::SetUILevel(bool uiLevel)
+{
+	*(BYTE*)OFF_s_runningUILevel = uiLevel;
+}
+
+void VmEmu::Error(const char* fmt, ...)
+{
+	char buffer[256];
+	va_list args;
+	va_start(args, fmt);
+	vsnprintf(buffer, sizeof(buffer), fmt, args);
+	va_end(args);
+	if (LastError.empty())
+	{
+		LastError = buffer;
+	}
+}
+
+INT64 VmEmu::OpcodeTable(INT32 table)
+{
+	return table ? OFF_ScrVm_Opcodes2 : OFF_ScrVm_Opcodes;
+}
+
+UINT16 VmEmu::RawOpcode(EmuOp op)
+{
+	return RawOpcodes[op];
+}
+
+EmuOp VmEmu::LogicalOpcode(UINT16 raw)
+{
+	return (raw < 0x4000) ? (EmuOp)AliasTable[raw] : EMU_Invalid;
+}
+
+INT64 VmEmu::InvalidHandler()
+{
+	return (INT64)OP_Invalid;
+}
+
+template <EmuOp Op> static void OP_Arith(INT32 inst, INT64* fs_0, INT64 vmc, bool* terminate);
+
+tVM_Opcode VmEmu::StockHandler(EmuOp op)
+{
+	switch (op)
+	{
+		case EMU_End: return OP_End;
+		case EMU_Return: return OP_Return;
+		case EMU_GetUndefined: return OP_GetUndefined;
+		case EMU_GetZero: return OP_GetZero;
+		case EMU_GetByte: case EMU_GetUnsignedShort: return OP_GetByte;
+		case EMU_GetNegByte: case EMU_GetNegUnsignedShort: return OP_GetNegByte;
+		case EMU_GetInteger: return OP_GetInteger;
+		case EMU_GetFloat: return OP_GetFloat;
+		case EMU_GetString: return OP_GetString;
+		case EMU_GetAPIFunction: return (tVM_Opcode)OFF_VM_OP_GetAPIFunction;
+		case EMU_GetFunction: return (tVM_Opcode)OFF_VM_OP_GetFunction;
+		case EMU_SafeCreateLocalVariables: return OP_SafeCreateLocalVariables;
+		case EMU_ClearParams: case EMU_CheckClearParams: return OP_CheckClearParams;
+		case EMU_EvalLocalVariableCached: return OP_EvalLocalVariableCached;
+		case EMU_EvalLocalVariableRefCached: return OP_EvalLocalVariableRefCached;
+		case EMU_SetVariableField: return OP_SetVariableField;
+		case EMU_CallBuiltin: return (tVM_Opcode)OFF_VM_OP_CallBuiltin;
+		case EMU_CallBuiltinMethod: return (tVM_Opcode)OFF_VM_OP_CallBuiltinMethod;
+		case EMU_PreScriptCall: return OP_PreScriptCall;
+		case EMU_ScriptFunctionCall: return (tVM_Opcode)OFF_VM_OP_ScriptFunctionCall;
+		case EMU_ScriptFunctionCallPointer: return OP_ScriptFunctionCallPointer;
+		case EMU_ScriptMethodCall: return (tVM_Opcode)OFF_VM_OP_ScriptMethodCall;
+		case EMU_ScriptThreadCall: return (tVM_Opcode)OFF_VM_OP_ScriptThreadCall;
+		case EMU_ScriptMethodThreadCall: return (tVM_Opcode)OFF_VM_OP_ScriptMethodThreadCall;
+		case EMU_DecTop: case EMU_SafeDecTop: return OP_DecTop;
+		case EMU_CastBool: return OP_CastBool;
+		case EMU_BoolNot: return OP_BoolNot;
+		case EMU_JumpOnFalse: return OP_JumpOnFalse;
+		case EMU_JumpOnTrue: return OP_JumpOnTrue;
+		case EMU_JumpOnFalseExpr: return OP_JumpOnFalseExpr;
+		case EMU_JumpOnTrueExpr: return OP_JumpOnTrueExpr;
+		case EMU_Jump: case EMU_JumpBack: return OP_Jump;
+		case EMU_Inc: return OP_Inc;
+		case EMU_Dec: return OP_Dec;
+		case EMU_Bit_Or: return OP_Arith<EMU_Bit_Or>;
+		case EMU_Bit_Xor: return OP_Arith<EMU_Bit_Xor>;
+		case EMU_Bit_And: return OP_Arith<EMU_Bit_And>;
+		case EMU_Equal: return OP_Arith<EMU_Equal>;
+		case EMU_NotEqual: return OP_Arith<EMU_NotEqual>;
+		case EMU_LessThan: return OP_Arith<EMU_LessThan>;
+		case EMU_GreaterThan: return OP_Arith<EMU_GreaterThan>;
+		case EMU_LessThanOrEqualTo: return OP_Arith<EMU_LessThanOrEqualTo>;
+		case EMU_GreaterThanOrEqualTo: return OP_Arith<EMU_GreaterThanOrEqualTo>;
+		case EMU_ShiftLeft: return OP_Arith<EMU_ShiftLeft>;
+		case EMU_ShiftRight: return OP_Arith<EMU_ShiftRight>;
+		case EMU_Plus: return OP_Arith<EMU_Plus>;
+		case EMU_Minus: return OP_Arith<EMU_Minus>;
+		case EMU_Multiply: return OP_Arith<EMU_Multiply>;
+		case EMU_Divide: return OP_Arith<EMU_Divide>;
+		case EMU_Modulus: return OP_Arith<EMU_Modulus>;
+		case EMU_IsDefined: return OP_IsDefined;
+		case EMU_Nop: return OP_Nop;
+		default: return OP_Invalid;
+	}
+}
+
+bool VmEmu::SplitGSIC(const std::vector<BYTE>& data, std::vector<BYTE>& script, std::vector<std::pair<INT32, std::vector<BYTE>>>& fields)
+{
+	fields.clear();
+	if (data.size() < 8 || memcmp(data.data(), "GSIC", 4))
+	{
+		script = data;
+		return true;
+	}
+
+	// field type, then either a byte size or an entry count depending on the type
+	size_t pos = 8;
+	INT32 numFields = *(INT32*)&data[4];
+	for (int i = 0; i < numFields; i++)
+	{
+		if (pos + 8 > data.size())
+		{
+			return false;
+		}
+		INT32 type = *(INT32*)&data[pos];
+		INT32 count = *(INT32*)&data[pos + 4];
+		pos += 8;
+		size_t size;
+		switch (type)
+		{
+			case 0: size = (size_t)count * 256; break; // detours
+			case 3: size = 4 + (size_t)count * 4; break; // direct builtins: export, then import offsets
+			default: size = (size_t)count; break;
+		}
+		if (pos + size > data.size())
+		{
+			return false;
+		}
+		std::vector<BYTE> field(data.begin() + pos, data.begin() + pos + size);
+		if (type == 0 || type == 3)
+		{
+			field.insert(field.begin(), (BYTE*)&count, (BYTE*)&count + 4);
+		}
+		fields.push_back({ type, std::move(field) });
+		pos += size;
+	}
+	script.assign(data.begin() + pos, data.end());
+	return true;
+}
+
+char* VmEmu::Load(const char* name, const std::vector<BYTE>& data, INT32 inst)
+{
+	INT32* count = (INT32*)(OFF_xAssetScriptParseTree + 0x14);
+	if (data.size() < 0x50 || *(UINT64*)data.data() != 0x1C000A0D43534780 || *count >= EMU_POOL_SIZE)
+	{
+		Error("bad script %s", name);
+		return NULL;
+	}
+
+	char* buffer = (char*)aligned_alloc(0x10, (data.size() + 0xF) & ~0xFull);
+	memcpy(buffer, data.data(), data.size());
+	Pool[*count] = { strdup(name), (INT32)data.size(), 0, buffer };
+	(*count)++;
+
+	// through the image so hooks on the link see it
+	((tScr_GscObjLink)OFF_Scr_GscObjLink)(inst, buffer);
+	if (!LastError.empty())
+	{
+		Unload(name);
+		return NULL;
+	}
+	return buffer;
+}
+
+char* VmEmu::LoadScript(const char* name, const char* file, std::vector<std::pair<INT32, std::vector<BYTE>>>* fields)
+{
+	std::vector<BYTE> data, script;
+	std::vector<std::pair<INT32, std::vector<BYTE>>> gsic;
+	if (!ReadFile(std::string(T7_TEST_SCRIPTS) + file, data) || !SplitGSIC(data, script, gsic))
+	{
+		Error("cant read %s", file);
+		return NULL;
+	}
+	if (fields)
+	{
+		*fields = std::move(gsic);
+	}
+	return Load(name, script);
+}
+
+void VmEmu::Unload(const char* name)
+{
+	INT32* count = (INT32*)(OFF_xAssetScriptParseTree + 0x14);
+	for (int i = 0; i < *count; i++)
+	{
+		if (!strcmp(Pool[i].Name, name))
+		{
+			free(Pool[i].Buffer);
+			free(Pool[i].Name);
+			Pool[i] = Pool[*count - 1];
+			Pool[*count - 1] = { 0 };
+			(*count)--;
+			return;
+		}
+	}
+}
+
+INT64 VmEmu::FindExport(char* buffer, const char* function)
+{
+	auto exports = (__t7export*)(buffer + *(INT32*)(buffer + 0x20));
+	INT16 numExports = *(INT16*)(buffer + 0x3A);
+	INT32 hash = (INT32)fnv1a(function);
+	for (int i = 0; i < numExports; i++)
+	{
+		if (exports[i].funcName == hash)
+		{
+			return (INT64)buffer + exports[i].bytecodeOffset;
+		}
+	}
+	return 0;
+}
+
+bool VmEmu::Call(char* buffer, const char* function, const std::vector<INT64>& args, EmuVar* result, INT32 inst)
+{
+	LastError.clear();
+	INT64 target = FindExport(buffer, function);
+	if (!target)
+	{
+		Error("no export %s", function);
+		return false;
+	}
+	return Execute(target, args, result, inst);
+}
+
+bool VmEmu::Execute(INT64 target, const std::vector<INT64>& args, EmuVar* result, INT32 inst)
+{
+	EmuFrame frame = { 0, (INT64)&Stack[0], NULL };
+	INT64* fs_0 = (INT64*)&frame;
+	Stack[0] = { 0, VAR_UNDEFINED };
+	VM_Push(fs_0, VAR_PRECODEPOS, 0);
+	for (auto it = args.rbegin(); it != args.rend(); it++)
+	{
+		VM_Push(fs_0, VAR_INTEGER, *it);
+	}
+	EnterFunction(fs_0, target, 0);
+
+	bool terminate = false;
+	while (!terminate)
+	{
+		UINT16 raw = *(UINT16*)frame.Pos;
+		frame.Pos += 2;
+		if (raw >= 0x2000)
+		{
+			Error("opcode %x out of range at %llx", raw, frame.Pos - 2);
+			break;
+		}
+		Dispatches++;
+		((tVM_Opcode*)OpcodeTable(DispatchTable))[raw](inst, fs_0, 0, &terminate);
+	}
+
+	Calls.clear();
+	Locals.clear();
+	if (result)
+	{
+		*result = Stack[1];
+	}
+	return LastError.empty();
+}
+
+void VmEmu::AddBuiltin(const char* name, tEmuBuiltin func, INT32 minArgs, INT32 maxArgs)
+{
+	auto def = new BuiltinFunctionDef();
+	def->canonId = (INT32)fnv1a(name);
+	def->min_args = minArgs;
+	def->max_args = maxArgs;
+	def->actionFunc = (void*)func;
+	BuiltinDefs.push_back(def);
+}
+
+INT64 VmEmu::GetParam(INT32 index)
+{
+	return ScrVm_GetInt(0, index);
+}
+
+void VmEmu::Return(INT32 type, INT64 value)
+{
+	BuiltinResult = { value, type };
+}
+
+bool VmEmu::Link(char* buffer, INT32 inst)
+{
+	char* entry = buffer + *(INT32*)(buffer + 0x18);
+	UINT16 numStrings = *(UINT16*)(buffer + 0x38);
+	for (int i = 0; i < numStrings; i++)
+	{
+		INT32 id = SL_GetString(buffer + *(INT32*)entry, 0, 0);
+		BYTE numRefs = *(BYTE*)(entry + 4);
+		entry += 8;
+		for (int j = 0; j < numRefs; j++, entry += 4)
+		{
+			*(INT32*)(buffer + *(INT32*)entry) = id;
+		}
+	}
+
+	// through the image, like the game does after linking the strings
+	((tGscObjResolve)EMU_GscObjResolve)(inst, buffer, 0);
+	return LastError.empty();
+}
+
+void VmEmu::GscObjResolve(INT32 inst, char* buffer, INT32 unk)
+{
+	// imports: name, namespace, ref count, param count, flags, then the opcode offsets
+	char* import = buffer + *(INT32*)(buffer + 0x24);
+	UINT16 numImports = *(UINT16*)(buffer + 0x3C);
+	INT32 poolCount = *(INT32*)(OFF_xAssetScriptParseTree + 0x14);
+	for (int i = 0; i < numImports; i++)
+	{
+		INT32 name = *(INT32*)import;
+		INT32 ns = *(INT32*)(import + 4);
+		UINT16 numRefs = *(UINT16*)(import + 8);
+		BYTE kind = *(BYTE*)(import + 11) & 0xF;
+		INT32* refs = (INT32*)(import + 12);
+		import += 12 + numRefs * 4;
+
+		// the object itself first, a hotloaded buffer isnt in the pool yet
+		INT64 script = 0;
+		for (int j = -1; j < poolCount && !script; j++)
+		{
+			char* other = (j < 0) ? buffer : Pool[j].Buffer;
+			auto exports = (__t7export*)(other + *(INT32*)(other + 0x20));
+			INT16 numExports = *(INT16*)(other + 0x3A);
+			for (int k = 0; k < numExports; k++)
+			{
+				if (exports[k].funcName == name && exports[k].funcNS == ns)
+				{
+					script = (INT64)other + exports[k].bytecodeOffset;
+					break;
+				}
+			}
+		}
+
+		INT64 builtin = 0;
+		if (!script)
+		{
+			INT32 type, minArgs, maxArgs;
+			builtin = ((tScr_GetFunction)OFF_Scr_GetFunction)(name, &type, &minArgs, &maxArgs);
+			if (!builtin)
+			{
+				builtin = ((tScr_GetMethod)OFF_Scr_GetMethod)(name, &type, &minArgs, &maxArgs);
+			}
+			if (!builtin)
+			{
+				Error("unresolved import %x::%x", ns, name);
+				return;
+			}
+		}
+
+		for (int j = 0; j < numRefs; j++)
+		{
+			INT64 op = (INT64)buffer + refs[j];
+			EmuOp code;
+			INT64 operand;
+			switch (kind)
+			{
+				case 1: code = script ? EMU_GetFunction : EMU_GetAPIFunction; operand = (op + 2 + 7) & ~7ll; break;
+				case 2: code = script ? EMU_ScriptFunctionCall : EMU_CallBuiltin; operand = (op + 4 + 7) & ~7ll; break;
+				case 3: code = EMU_ScriptThreadCall; operand = (op + 4 + 7) & ~7ll; break;
+				case 4: code = script ? EMU_ScriptMethodCall : EMU_CallBuiltinMethod; operand = (op + 4 + 7) & ~7ll; break;
+				default: code = EMU_ScriptMethodThreadCall; operand = (op + 4 + 7) & ~7ll; break;
+			}
+			*(UINT16*)op = RawOpcode(code);
+			*(INT64*)operand = script ? script : builtin;
+		}
+	}
+}
+
+INT64 VmEmu::DB_FindXAssetHeader(int type, char* name, bool errorIfMissing, int waitTime)
+{
+	INT32 count = *(INT32*)(OFF_xAssetScriptParseTree + 0x14);
+	for (int i = 0; type == XASSETTYPE_SCRIPTPARSETREE && i < count; i++)
+	{
+		if (Pool[i].Name && !strcmp(Pool[i].Name, name))
+		{
+			return (INT64)&Pool[i];
+		}
+	}
+	return 0;
+}
+
+INT64 VmEmu::Scr_GscObjLink(int inst, char* gsc_obj)
+{
+	return Link(gsc_obj, inst) ? 1 : 0;
+}
+
+INT64 VmEmu::Scr_GetFunction(INT32 canonID, INT32* type, INT32* min_args, INT32* max_args)
+{
+	for (auto def : BuiltinDefs)
+	{
+		if (def->canonId == canonID && def->actionFunc)
+		{
+			*type = def->type;
+			*min_args = def->min_args;
+			*max_args = def->max_args;
+			return (INT64)def->actionFunc;
+		}
+	}
+	return 0;
+}
+
+INT64 VmEmu::Scr_GetMethod(INT32 canonID, INT32* type, INT32* min_args, INT32* max_args)
+{
+	return 0;
+}
+
+INT64 VmEmu::ScrVm_GetInt(unsigned int inst, unsigned int index)
+{
+	if ((INT32)index >= NumBuiltinParams)
+	{
+		Error("parameter %d does not exist", index + 1);
+		return 0;
+	}
+	return (BuiltinParams - index)->Value;
+}
+
+char* VmEmu::ScrVm_GetString(unsigned int inst, unsigned int index)
+{
+	if ((INT32)index >= NumBuiltinParams || (BuiltinParams - index)->Type != VAR_STRING)
+	{
+		Error("parameter %d is not a string", index + 1);
+		return (char*)"";
+	}
+	return (char*)Strings[(BuiltinParams - index)->Value].c_str();
+}
+
+INT64 VmEmu::ScrVm_GetFunc(unsigned int inst, unsigned int index)
+{
+	return ScrVm_GetInt(inst, index);
+}
+
+void VmEmu::Scr_AddInt(int inst, INT32 value)
+{
+	Return(VAR_INTEGER, value);
+}
+
+void VmEmu::Scr_Error(unsigned int inst, const char* error, unsigned int terminal)
+{
+	Error("script error: %s", error);
+}
+
+INT32 VmEmu::SL_GetString(const char* str, INT32 user, INT32 type)
+{
+	for (size_t i = 1; i < Strings.size(); i++)
+	{
+		if (Strings[i] == str)
+		{
+			return (INT32)i;
+		}
+	}
+	Strings.push_back(str);
+	return (INT32)Strings.size() - 1;
+}
+
+void VmEmu::SL_TransferRefToUser(INT32 scrStr, INT32 user)
+{
+}
+
+INT32 VmEmu::Scr_ExecThread(INT32 inst, char* func, INT32 numParams, void* val, INT32 self)
+{
+	// there are no waits, so a thread runs to completion before it returns
+	Threads++;
+	Execute((INT64)func, {}, NULL, inst);
+	return Threads;
+}
+
+INT32 VmEmu::Scr_FreeThread(INT32 inst, INT32 thread)
+{
+	return 0;
+}
+
+EmuVar* VmEmu::Top(INT64* fs_0)
+{
+	return (EmuVar*)fs_0[1];
+}
+
+EmuVar* VmEmu::Pop(INT64* fs_0)
+{
+	EmuVar* var = (EmuVar*)fs_0[1];
+	fs_0[1] -= VM_VAR_SIZE;
+	return var;
+}
+
+EmuVar* VmEmu::Local(INT32 index)
+{
+	auto& call = Calls.back();
+	return &Locals[call.LocalsBase + call.NumLocals - 1 - index];
+}
+
+INT64 VmEmu::Truthy(const EmuVar* var)
+{
+	if (var->Type == VAR_FLOAT)
+	{
+		return *(float*)&var->Value != 0;
+	}
+	return var->Type != VAR_UNDEFINED && var->Value != 0;
+}
+
+void VmEmu::EnterFunction(INT64* fs_0, INT64 target, INT64 returnPos)
+{
+	EmuVar* marker = Top(fs_0);
+	while (marker > Stack && marker->Type != VAR_PRECODEPOS)
+	{
+		marker--;
+	}
+	Calls.push_back({ returnPos, marker, Locals.size(), 0 });
+	*fs_0 = target;
+}
+
+void VmEmu::LeaveFunction(INT64* fs_0, bool* terminate)
+{
+	EmuVar result = *Top(fs_0);
+	auto call = Calls.back();
+	Calls.pop_back();
+	Locals.resize(call.LocalsBase);
+	*call.Marker = result;
+	fs_0[1] = (INT64)call.Marker;
+	*fs_0 = call.ReturnPos;
+	*terminate |= !call.ReturnPos;
+}
+
+void VmEmu::OP_Invalid(INT32 inst, INT64* fs_0, INT64 vmc, bool* terminate)
+{
+	UINT16 raw = *(UINT16*)VM_OpcodePos(fs_0);
+	Error("invalid opcode %x (%x)", raw, LogicalOpcode(raw));
+	*terminate = true;
+}
+
+void VmEmu::OP_End(INT32 inst, INT64* fs_0, INT64 vmc, bool* terminate)
+{
+	VM_PushUndefined(fs_0);
+	LeaveFunction(fs_0, terminate);
+}
+
+void VmEmu::OP_Return(INT32 inst, INT64* fs_0, INT64 vmc, bool* terminate)
+{
+	LeaveFunction(fs_0, terminate);
+}
+
+void VmEmu::OP_GetUndefined(INT32 inst, INT64* fs_0, INT64 vmc, bool* terminate)
+{
+	VM_PushUndefined(fs_0);
+}
+
+void VmEmu::OP_GetZero(INT32 inst, INT64* fs_0, INT64 vmc, bool* terminate)
+{
+	VM_Push(fs_0, VAR_INTEGER, 0);
+}
+
+void VmEmu::OP_GetByte(INT32 inst, INT64* fs_0, INT64 vmc, bool* terminate)
+{
+	INT64 operand = VM_Operand(fs_0, 2);
+	VM_Push(fs_0, VAR_INTEGER, *(UINT16*)operand);
+	*fs_0 = operand + 2;
+}
+
+void VmEmu::OP_GetNegByte(INT32 inst, INT64* fs_0, INT64 vmc, bool* terminate)
+{
+	INT64 operand = VM_Operand(fs_0, 2);
+	VM_Push(fs_0, VAR_INTEGER, -(INT64)*(UINT16*)operand);
+	*fs_0 = operand + 2;
+}
+
+void VmEmu::OP_GetInteger(INT32 inst, INT64* fs_0, INT64 vmc, bool* terminate)
+{
+	INT64 operand = VM_Operand(fs_0, 4);
+	VM_Push(fs_0, VAR_INTEGER, *(INT32*)operand);
+	*fs_0 = operand + 4;
+}
+
+void VmEmu::OP_GetFloat(INT32 inst, INT64* fs_0, INT64 vmc, bool* terminate)
+{
+	INT64 operand = VM_Operand(fs_0, 4);
+	VM_Push(fs_0, VAR_FLOAT, *(UINT32*)operand);
+	*fs_0 = operand + 4;
+}
+
+void VmEmu::OP_GetString(INT32 inst, INT64* fs_0, INT64 vmc, bool* terminate)
+{
+	INT64 operand = VM_Operand(fs_0, 4);
+	VM_Push(fs_0, VAR_STRING, *(UINT32*)operand);
+	*fs_0 = operand + 4;
+}
+
+void VmEmu::OP_GetFunction(INT32 inst, INT64* fs_0, INT64 vmc, bool* terminate)
+{
+	INT64 operand = VM_Operand(fs_0, 8);
+	VM_Push(fs_0, VAR_FUNCTION, *(INT64*)operand);
+	*fs_0 = operand + 8;
+}
+
+void VmEmu::OP_GetAPIFunction(INT32 inst, INT64* fs_0, INT64 vmc, bool* terminate)
+{
+	INT64 operand = VM_Operand(fs_0, 8);
+	VM_Push(fs_0, VAR_APIFUNCTION, *(INT64*)operand);
+	*fs_0 = operand + 8;
+}
+
+void VmEmu::OP_SafeCreateLocalVariables(INT32 inst, INT64* fs_0, INT64 vmc, bool* terminate)
+{
+	// count, then a dword and a byte per local. the compiler leaves them empty
+	BYTE count = *(BYTE*)*fs_0;
+	INT64 pos = (*fs_0 + 1 + 3) & ~3ll;
+	for (int i = 0; i < count; i++)
+	{
+		pos += 5;
+		pos = (i + 1 == count) ? ((pos + 1) & ~1ll) : ((pos + 3) & ~3ll);
+	}
+	*fs_0 = pos;
+
+	// parameters are the first locals, the first one is on top
+	auto& call = Calls.back();
+	if (Locals.size() + count > EMU_MAX_LOCALS)
+	{
+		Error("out of locals");
+		*terminate = true;
+		return;
+	}
+	call.NumLocals = count;
+	Locals.resize(call.LocalsBase + count, { 0, VAR_UNDEFINED });
+	for (int i = 0; i < count && Top(fs_0) > call.Marker; i++)
+	{
+		Locals[call.LocalsBase + i] = *Pop(fs_0);
+	}
+	fs_0[1] = (INT64)call.Marker;
+}
+
+void VmEmu::OP_CheckClearParams(INT32 inst, INT64* fs_0, INT64 vmc, bool* terminate)
+{
+	fs_0[1] = (INT64)Calls.back().Marker;
+}
+
+void VmEmu::OP_EvalLocalVariableCached(INT32 inst, INT64* fs_0, INT64 vmc, bool* terminate)
+{
+	EmuVar* local = Local(*(BYTE*)*fs_0);
+	VM_Push(fs_0, local->Type, local->Value);
+	*fs_0 += 2;
+}
+
+void VmEmu::OP_EvalLocalVariableRefCached(INT32 inst, INT64* fs_0, INT64 vmc, bool* terminate)
+{
+	((EmuFrame*)fs_0)->Ref = Local(*(BYTE*)*fs_0);
+	*fs_0 += 2;
+}
+
+void VmEmu::OP_SetVariableField(INT32 inst, INT64* fs_0, INT64 vmc, bool* terminate)
+{
+	*((EmuFrame*)fs_0)->Ref = *Pop(fs_0);
+}
+
+void VmEmu::OP_PreScriptCall(INT32 inst, INT64* fs_0, INT64 vmc, bool* terminate)
+{
+	VM_Push(fs_0, VAR_PRECODEPOS, 0);
+}
+
+void VmEmu::OP_ScriptFunctionCall(INT32 inst, INT64* fs_0, INT64 vmc, bool* terminate)
+{
+	INT64 operand = (*fs_0 + 1 + 7) & ~7ll;
+	EnterFunction(fs_0, *(INT64*)operand, operand + 8);
+}
+
+void VmEmu::OP_CallBuiltin(INT32 inst, INT64* fs_0, INT64 vmc, bool* terminate)
+{
+	BYTE numParams = *(BYTE*)*fs_0;
+	INT64 operand = (*fs_0 + 1 + 7) & ~7ll;
+	*fs_0 = operand + 8;
+
+	EmuVar* top = Top(fs_0);
+	EmuVar* marker = top - numParams;
+	if (marker < Stack || marker->Type != VAR_PRECODEPOS)
+	{
+		Error("builtin call without its parameters");
+		*terminate = true;
+		return;
+	}
+
+	BuiltinParams = top;
+	NumBuiltinParams = numParams;
+	BuiltinResult = { 0, VAR_UNDEFINED };
+	*(INT64*)(EMU_SCRVMPUB(inst) + 32) = (INT64)top;
+	*(UINT32*)(EMU_SCRVMPUB(inst) + 56) = numParams;
+	((tEmuBuiltin)*(INT64*)operand)(inst);
+	NumBuiltinParams = 0;
+	*(UINT32*)(EMU_SCRVMPUB(inst) + 56) = 0;
+
+	*marker = BuiltinResult;
+	fs_0[1] = (INT64)marker;
+	*terminate |= !LastError.empty();
+}
+
+void VmEmu::OP_ScriptFunctionCallPointer(INT32 inst, INT64* fs_0, INT64 vmc, bool* terminate)
+{
+	*fs_0 += 2; // param count, EnterFunction finds the arguments from the precodepos marker
+	EmuVar function = *Pop(fs_0);
+	if (function.Type == VAR_FUNCTION)
+	{
+		EnterFunction(fs_0, function.Value, *fs_0);
+		return;
+	}
+	Error("call through a %d variable", function.Type);
+	*terminate = true;
+}
+
+void VmEmu::OP_DecTop(INT32 inst, INT64* fs_0, INT64 vmc, bool* terminate)
+{
+	Pop(fs_0);
+}
+
+void VmEmu::OP_CastBool(INT32 inst, INT64* fs_0, INT64 vmc, bool* terminate)
+{
+	EmuVar* top = Top(fs_0);
+	*top = { Truthy(top), VAR_INTEGER };
+}
+
+void VmEmu::OP_BoolNot(INT32 inst, INT64* fs_0, INT64 vmc, bool* terminate)
+{
+	EmuVar* top = Top(fs_0);
+	*top = { !Truthy(top), VAR_INTEGER };
+}
+
+void VmEmu::OP_Jump(INT32 inst, INT64* fs_0, INT64 vmc, bool* terminate)
+{
+	INT64 operand = VM_Operand(fs_0, 2);
+	*fs_0 = operand + 2 + *(INT16*)operand;
+}
+
+void VmEmu::OP_JumpOnFalse(INT32 inst, INT64* fs_0, INT64 vmc, bool* terminate)
+{
+	INT64 operand = VM_Operand(fs_0, 2);
+	*fs_0 = operand + 2 + (Truthy(Pop(fs_0)) ? 0 : *(INT16*)operand);
+}
+
+void VmEmu::OP_JumpOnTrue(INT32 inst, INT64* fs_0, INT64 vmc, bool* terminate)
+{
+	INT64 operand = VM_Operand(fs_0, 2);
+	*fs_0 = operand + 2 + (Truthy(Pop(fs_0)) ? *(INT16*)operand : 0);
+}
+
+// the expression forms leave the value on the stack when they jump
+void VmEmu::OP_JumpOnFalseExpr(INT32 inst, INT64* fs_0, INT64 vmc, bool* terminate)
+{
+	INT64 operand = VM_Operand(fs_0, 2);
+	*fs_0 = operand + 2;
+	if (Truthy(Top(fs_0)))
+	{
+		Pop(fs_0);
+		return;
+	}
+	*fs_0 += *(INT16*)operand;
+}
+
+void VmEmu::OP_JumpOnTrueExpr(INT32 inst, INT64* fs_0, INT64 vmc, bool* terminate)
+{
+	INT64 operand = VM_Operand(fs_0, 2);
+	*fs_0 = operand + 2;
+	if (!Truthy(Top(fs_0)))
+	{
+		Pop(fs_0);
+		return;
+	}
+	*fs_0 += *(INT16*)operand;
+}
+
+void VmEmu::OP_Inc(INT32 inst, INT64* fs_0, INT64 vmc, bool* terminate)
+{
+	((EmuFrame*)fs_0)->Ref->Value++;
+}
+
+void VmEmu::OP_Dec(INT32 inst, INT64* fs_0, INT64 vmc, bool* terminate)
+{
+	((EmuFrame*)fs_0)->Ref->Value--;
+}
+
+void VmEmu::OP_IsDefined(INT32 inst, INT64* fs_0, INT64 vmc, bool* terminate)
+{
+	EmuVar* top = Top(fs_0);
+	*top = { top->Type != VAR_UNDEFINED, VAR_INTEGER };
+}
+
+void VmEmu::OP_Nop(INT32 inst, INT64* fs_0, INT64 vmc, bool* terminate)
+{
+}
+
+template <EmuOp Op> static void OP_Arith(INT32 inst, INT64* fs_0, INT64 vmc, bool* terminate)
+{
+	EmuVar* b = (EmuVar*)fs_0[1];
+	EmuVar* a = b - 1;
+	fs_0[1] -= VM_VAR_SIZE;
+
+	if (a->Type == VAR_FLOAT || b->Type == VAR_FLOAT)
+	{
+		float x = (a->Type == VAR_FLOAT) ? *(float*)&a->Value : (float)a->Value;
+		float y = (b->Type == VAR_FLOAT) ? *(float*)&b->Value : (float)b->Value;
+		float value = 0;
+		INT64 compare = -1;
+		switch (Op)
+		{
+			case EMU_Plus: value = x + y; break;
+			case EMU_Minus: value = x - y; break;
+			case EMU_Multiply: value = x * y; break;
+			case EMU_Divide: value = x / y; break;
+			case EMU_Equal: compare = x == y; break;
+			case EMU_NotEqual: compare = x != y; break;
+			case EMU_LessThan: compare = x < y; break;
+			case EMU_GreaterThan: compare = x > y; break;
+			case EMU_LessThanOrEqualTo: compare = x <= y; break;
+			case EMU_GreaterThanOrEqualTo: compare = x >= y; break;
+			default: break;
+		}
+		if (compare >= 0)
+		{
+			*a = { compare, VAR_INTEGER };
+			return;
+		}
+		a->Value = 0;
+		*(float*)&a->Value = value;
+		a->Type = VAR_FLOAT;
+		return;
+	}
+
+	INT32 x = (INT32)a->Value;
+	INT32 y = (INT32)b->Value;
+	INT64 value = 0;
+	switch (Op)
+	{
+		case EMU_Bit_Or: value = x | y; break;
+		case EMU_Bit_Xor: value = x ^ y; break;
+		case EMU_Bit_And: value = x & y; break;
+		case EMU_Equal: value = a->Type == b->Type && a->Value == b->Value; break;
+		case EMU_NotEqual: value = a->Type != b->Type || a->Value != b->Value; break;
+		case EMU_LessThan: value = x < y; break;
+		case EMU_GreaterThan: value = x > y; break;
+		case EMU_LessThanOrEqualTo: value = x <= y; break;
+		case EMU_GreaterThanOrEqualTo: value = x >= y; break;
+		case EMU_ShiftLeft: value = x << y; break;
+		case EMU_ShiftRight: value = x >> y; break;
+		case EMU_Plus: value = x + y; break;
+		case EMU_Minus: value = x - y; break;
+		case EMU_Multiply: value = x * y; break;
+		case EMU_Divide:
+		case EMU_Modulus:
+			if (!y)
+			{
+				((void(__fastcall*)(unsigned int, const char*, unsigned int))EMU_Scr_Error)(inst, "divide by zero", 0);
+				*terminate = true;
+				return;
+			}
+			if (Op == EMU_Modulus)
+			{
+				value = x % y;
+			}
+			else if (x % y)
+			{
+				a->Value = 0;
+				*(float*)&a->Value = (float)x / y;
+				a->Type = VAR_FLOAT;
+				return;
+			}
+			else
+			{
+				value = x / y;
+			}
+			break;
+		default: break;
+	}
+	*a = { (INT64)(INT32)value, VAR_INTEGER };
+}
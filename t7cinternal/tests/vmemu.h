@@ -0,0 +1,234 @@
+#pragma once
+#include "framework.h"
+#include "detours.h"
+#include "builtins.h"
+#include "scrvar.h"
+#include <string>
+#include <vector>
+
+// logical opcodes, same values as ScriptOpCode in T7CompilerLib. the raw values the game uses come from the alias table in T7PCV2.db
+enum EmuOp
+{
+	EMU_End = 0x00,
+	EMU_Return = 0x01,
+	EMU_GetUndefined = 0x02,
+	EMU_GetZero = 0x03,
+	EMU_GetByte = 0x04,
+	EMU_GetNegByte = 0x05,
+	EMU_GetUnsignedShort = 0x06,
+	EMU_GetNegUnsignedShort = 0x07,
+	EMU_GetInteger = 0x08,
+	EMU_GetFloat = 0x09,
+	EMU_GetString = 0x0A,
+	EMU_GetAPIFunction = 0x14,
+	EMU_GetFunction = 0x15,
+	EMU_SafeCreateLocalVariables = 0x17,
+	EMU_EvalLocalVariableCached = 0x19,
+	EMU_ClearParams = 0x25,
+	EMU_CheckClearParams = 0x26,
+	EMU_EvalLocalVariableRefCached = 0x27,
+	EMU_SetVariableField = 0x28,
+	EMU_CallBuiltin = 0x29,
+	EMU_CallBuiltinMethod = 0x2A,
+	EMU_PreScriptCall = 0x2D,
+	EMU_ScriptFunctionCall = 0x2E,
+	EMU_ScriptFunctionCallPointer = 0x2F,
+	EMU_ScriptMethodCall = 0x30,
+	EMU_ScriptThreadCall = 0x32,
+	EMU_ScriptMethodThreadCall = 0x34,
+	EMU_DecTop = 0x36,
+	EMU_CastBool = 0x38,
+	EMU_BoolNot = 0x39,
+	EMU_JumpOnFalse = 0x3B,
+	EMU_JumpOnTrue = 0x3C,
+	EMU_JumpOnFalseExpr = 0x3D,
+	EMU_JumpOnTrueExpr = 0x3E,
+	EMU_Jump = 0x3F,
+	EMU_JumpBack = 0x40,
+	EMU_Inc = 0x41,
+	EMU_Dec = 0x42,
+	EMU_Bit_Or = 0x43,
+	EMU_Bit_Xor = 0x44,
+	EMU_Bit_And = 0x45,
+	EMU_Equal = 0x46,
+	EMU_NotEqual = 0x47,
+	EMU_LessThan = 0x48,
+	EMU_GreaterThan = 0x49,
+	EMU_LessThanOrEqualTo = 0x4A,
+	EMU_GreaterThanOrEqualTo = 0x4B,
+	EMU_ShiftLeft = 0x4C,
+	EMU_ShiftRight = 0x4D,
+	EMU_Plus = 0x4E,
+	EMU_Minus = 0x4F,
+	EMU_Multiply = 0x50,
+	EMU_Divide = 0x51,
+	EMU_Modulus = 0x52,
+	EMU_IsDefined = 0x5F,
+	EMU_SafeDecTop = 0x74,
+	EMU_Nop = 0x75,
+	EMU_Invalid = 0xFF,
+};
+
+// a variable on the vm stack, value at +0 and type at +8 like the game
+struct EmuVar
+{
+	INT64 Value;
+	INT32 Type;
+	INT32 Pad;
+};
+
+// what the handlers get as fs_0. the runtime only ever touches Pos and Top
+struct EmuFrame
+{
+	INT64 Pos;
+	INT64 Top;
+	EmuVar* Ref; // set by EvalLocalVariableRefCached, consumed by SetVariableField, Inc and Dec
+};
+
+struct EmuCall
+{
+	INT64 ReturnPos; // 0 for the function VmEmu::Call entered
+	EmuVar* Marker; // the precodepos pushed before the arguments, the return value replaces it
+	size_t LocalsBase;
+	INT32 NumLocals;
+};
+
+typedef void(__fastcall* tEmuBuiltin)(int scriptInst);
+
+// runs compiled t7 scripts in process, on top of an emulated game image so the runtime can be linked and tested off windows.
+// the image has the steam layout: opcode tables, spt pool, builtin defs and engine functions all sit at the offsets in offsets.h,
+// so the runtime finds, patches and hooks them exactly like it does in the game. only the ops the fixtures need are implemented,
+// anything else hits the invalid opcode handler, which stops the script and reports the op.
+class VmEmu
+{
+public:
+	// maps the image and fills the opcode tables from the alias table. the runtime's own Init functions are left to the caller
+	static bool Init();
+	// Init, then what DllMain does on process attach. only runs the runtime side once per process
+	static bool Attach();
+	// unloads every script and clears the counters, the image and opcode tables are kept
+	static void Reset();
+	// copies a compiled script (without a GSIC header) into the spt pool and links it through Scr_GscObjLink. NULL on failure
+	static char* Load(const char* name, const std::vector<BYTE>& data, INT32 inst = 0);
+	// loads one of the compiled test scripts. fields gets the GSIC fields the compiler emitted, if any
+	static char* LoadScript(const char* name, const char* file, std::vector<std::pair<INT32, std::vector<BYTE>>>* fields = NULL);
+	static void Unload(const char* name);
+	// runs an export of a loaded script with integer arguments, returns false if the script hit an error
+	static bool Call(char* buffer, const char* function, const std::vector<INT64>& args, EmuVar* result, INT32 inst = 0);
+	// runs bytecode from target, same as Call but for any position
+	static bool Execute(INT64 target, const std::vector<INT64>& args, EmuVar* result, INT32 inst = 0);
+	static INT64 FindExport(char* buffer, const char* function);
+	static void AddBuiltin(const char* name, tEmuBuiltin func, INT32 minArgs, INT32 maxArgs);
+	static void SetUILevel(bool uiLevel);
+
+	// the script variable pools and the allocator the runtime hooks. the game keeps each free list head in globals we have no
+	// offset for, the emulator keeps them in FreeHeads
+	// gives the game a fresh stock pool of its own again, like the first level load
+	static void ResetVariables(INT32 inst);
+	// what a level restart does, threads the stock range of whichever pool is installed into a new free list
+	static void RestartVariables(INT32 inst);
+	// allocates through the image, so through any hook on the allocator. 0 when the free list is empty
+	static INT32 AllocVariable(INT32 inst);
+	static void FreeVariable(INT32 inst, INT32 index);
+
+	// raw opcode the game uses for a logical op, and the logical op a raw opcode dispatches to
+	static UINT16 RawOpcode(EmuOp op);
+	static EmuOp LogicalOpcode(UINT16 raw);
+	// stock handler the tables hold for a logical op
+	static tVM_Opcode StockHandler(EmuOp op);
+	static INT64 InvalidHandler();
+	static INT64 OpcodeTable(INT32 table);
+
+	// splits a compiler output into the GSIC fields and the script. fields maps field type -> field data
+	static bool SplitGSIC(const std::vector<BYTE>& data, std::vector<BYTE>& script, std::vector<std::pair<INT32, std::vector<BYTE>>>& fields);
+	static bool ReadFile(const std::string& path, std::vector<BYTE>& data);
+
+	static UINT64 Dispatches; // handler calls made by the dispatch loop
+	static INT32 Threads; // Scr_ExecThread calls, the runtime runs autoexecs through it
+	static INT32 DispatchTable; // 0 dispatches through ScrVm_Opcodes, 1 through ScrVm_Opcodes2
+	static std::string LastError;
+
+	// builtins read their parameters through these, like ScrVm_GetInt in the game
+	static INT64 GetParam(INT32 index);
+	static void Return(INT32 type, INT64 value);
+
+private:
+	static bool LoadAliasTable();
+	static void WriteThunk(INT64 at, INT64 destination);
+	static bool Link(char* buffer, INT32 inst);
+	static void Error(const char* fmt, ...);
+	static EmuVar* Top(INT64* fs_0);
+	static EmuVar* Pop(INT64* fs_0);
+	static EmuVar* Local(INT32 index);
+	static void EnterFunction(INT64* fs_0, INT64 target, INT64 returnPos);
+	static void LeaveFunction(INT64* fs_0, bool* terminate);
+	static INT64 Truthy(const EmuVar* var);
+
+	// engine functions placed in the image
+	static INT64 DB_FindXAssetHeader(int type, char* name, bool errorIfMissing, int waitTime);
+	static INT64 Scr_GscObjLink(int inst, char* gsc_obj);
+	static INT64 Scr_GetFunction(INT32 canonID, INT32* type, INT32* min_args, INT32* max_args);
+	static INT64 Scr_GetMethod(INT32 canonID, INT32* type, INT32* min_args, INT32* max_args);
+	static INT64 ScrVm_GetInt(unsigned int inst, unsigned int index);
+	static char* ScrVm_GetString(unsigned int inst, unsigned int index);
+	static INT64 ScrVm_GetFunc(unsigned int inst, unsigned int index);
+	static void Scr_AddInt(int inst, INT32 value);
+	static void Scr_Error(unsigned int inst, const char* error, unsigned int terminal);
+	static INT32 SL_GetString(const char* str, INT32 user, INT32 type);
+	static void SL_TransferRefToUser(INT32 scrStr, INT32 user);
+	static void GscObjResolve(INT32 inst, char* buffer, INT32 unk);
+	static INT32 ScrVar_AllocVariableInternal(unsigned int inst, unsigned int nameType, __int64 a3, unsigned int a4);
+	static INT32 Scr_ExecThread(INT32 inst, char* func, INT32 numParams, void* val, INT32 self);
+	static INT32 Scr_FreeThread(INT32 inst, INT32 thread);
+
+	// stock opcode handlers
+	static void OP_Invalid(INT32 inst, INT64* fs_0, INT64 vmc, bool* terminate);
+	static void OP_End(INT32 inst, INT64* fs_0, INT64 vmc, bool* terminate);
+	static void OP_Return(INT32 inst, INT64* fs_0, INT64 vmc, bool* terminate);
+	static void OP_GetUndefined(INT32 inst, INT64* fs_0, INT64 vmc, bool* terminate);
+	static void OP_GetZero(INT32 inst, INT64* fs_0, INT64 vmc, bool* terminate);
+	static void OP_GetByte(INT32 inst, INT64* fs_0, INT64 vmc, bool* terminate);
+	static void OP_GetNegByte(INT32 inst, INT64* fs_0, INT64 vmc, bool* terminate);
+	static void OP_GetInteger(INT32 inst, INT64* fs_0, INT64 vmc, bool* terminate);
+	static void OP_GetFloat(INT32 inst, INT64* fs_0, INT64 vmc, bool* terminate);
+	static void OP_GetString(INT32 inst, INT64* fs_0, INT64 vmc, bool* terminate);
+	static void OP_GetFunction(INT32 inst, INT64* fs_0, INT64 vmc, bool* terminate);
+	static void OP_GetAPIFunction(INT32 inst, INT64* fs_0, INT64 vmc, bool* terminate);
+	static void OP_SafeCreateLocalVariables(INT32 inst, INT64* fs_0, INT64 vmc, bool* terminate);
+	static void OP_CheckClearParams(INT32 inst, INT64* fs_0, INT64 vmc, bool* terminate);
+	static void OP_EvalLocalVariableCached(INT32 inst, INT64* fs_0, INT64 vmc, bool* terminate);
+	static void OP_EvalLocalVariableRefCached(INT32 inst, INT64* fs_0, INT64 vmc, bool* terminate);
+	static void OP_SetVariableField(INT32 inst, INT64* fs_0, INT64 vmc, bool* terminate);
+	static void OP_PreScriptCall(INT32 inst, INT64* fs_0, INT64 vmc, bool* terminate);
+	static void OP_ScriptFunctionCall(INT32 inst, INT64* fs_0, INT64 vmc, bool* terminate);
+	static void OP_ScriptFunctionCallPointer(INT32 inst, INT64* fs_0, INT64 vmc, bool* terminate);
+	static void OP_CallBuiltin(INT32 inst, INT64* fs_0, INT64 vmc, bool* terminate);
+	static void OP_DecTop(INT32 inst, INT64* fs_0, INT64 vmc, bool* terminate);
+	static void OP_CastBool(INT32 inst, INT64* fs_0, INT64 vmc, bool* terminate);
+	static void OP_BoolNot(INT32 inst, INT64* fs_0, INT64 vmc, bool* terminate);
+	static void OP_Jump(INT32 inst, INT64* fs_0, INT64 vmc, bool* terminate);
+	static void OP_JumpOnFalse(INT32 inst, INT64* fs_0, INT64 vmc, bool* terminate);
+	static void OP_JumpOnTrue(INT32 inst, INT64* fs_0, INT64 vmc, bool* terminate);
+	static void OP_JumpOnFalseExpr(INT32 inst, INT64* fs_0, INT64 vmc, bool* terminate);
+	static void OP_JumpOnTrueExpr(INT32 inst, INT64* fs_0, INT64 vmc, bool* terminate);
+	static void OP_Inc(INT32 inst, INT64* fs_0, INT64 vmc, bool* terminate);
+	static void OP_Dec(INT32 inst, INT64* fs_0, INT64 vmc, bool* terminate);
+	static void OP_Binary(INT32 inst, INT64* fs_0, INT64 vmc, bool* terminate);
+	static void OP_IsDefined(INT32 inst, INT64* fs_0, INT64 vmc, bool* terminate);
+	static void OP_Nop(INT32 inst, INT64* fs_0, INT64 vmc, bool* terminate);
+
+	static BYTE AliasTable[0x4000];
+	static UINT16 RawOpcodes[0x100];
+	static char* Image;
+	static EmuVar Stack[0x1000];
+	static std::vector<EmuCall> Calls;
+	static std::vector<EmuVar> Locals;
+	static std::vector<SPTEntry> Pool;
+	static std::vector<std::string> Strings;
+	static std::vector<BuiltinFunctionDef*> BuiltinDefs;
+	static EmuVar* BuiltinParams;
+	static INT32 NumBuiltinParams;
+	static EmuVar BuiltinResult;
+	static std::vector<ScrVar_t> StockVars[2];
+	static INT32 FreeHeads[2];
+};
@@ -0,0 +1,323 @@
+#include "testing.h"
+#include "vmemu.h"
+#include "scriptbuilder.h"
+#include "Opcodes.h"
+#include "offsets.h"
+#include "scrvar.h"
+#include "bytecodepatch.h"
+#include "exportindex.h"
+
+EXPORT void RemoveDetours();
+
+#define EMU_BUILTIN_VALUE 7
+
+static void GScr_emu_value(int scriptInst)
+{
+	VmEmu::Return(VAR_INTEGER, EMU_BUILTIN_VALUE);
+}
+
+static INT64 Run(char* buffer, const char* function, const std::vector<INT64>& args)
+{
+	EmuVar result = { 0, VAR_UNDEFINED };
+	if (!VmEmu::Call(buffer, function, args, &result))
+	{
+		printf("%s: %s\n", function, VmEmu::LastError.c_str());
+		return -0xDEAD;
+	}
+	return (result.Type == VAR_INTEGER) ? result.Value : -0xBAD;
+}
+
+static void TestCoreScript()
+{
+	VmEmu::Reset();
+	char* core = VmEmu::LoadScript("scripts/emu/core.gsc", "core.gscc");
+	CHECK(core != NULL);
+	if (!core)
+	{
+		return;
+	}
+
+	// both tables hold the same handlers, so the scripts must take the same path through either
+	UINT64 dispatches[2];
+	for (INT32 table = 0; table < 2; table++)
+	{
+		VmEmu::DispatchTable = table;
+		VmEmu::Dispatches = 0;
+		CHECK_EQ(Run(core, "sum", { 10 }), 45);
+		CHECK_EQ(Run(core, "fib", { 15 }), 610);
+		CHECK_EQ(Run(core, "collatz", { 27 }), 111);
+		dispatches[table] = VmEmu::Dispatches;
+	}
+	CHECK(dispatches[0] > 0);
+	CHECK_EQ(dispatches[0], dispatches[1]);
+}
+
+static void TestLazyQuickening()
+{
+	VmEmu::Reset();
+	char* lazy = VmEmu::LoadScript("scripts/emu/lazy.gsc", "lazy.gscc");
+	char* target = VmEmu::LoadScript("scripts/emu/target.gsc", "target.gscc");
+	CHECK(lazy && target);
+	if (!lazy || !target)
+	{
+		return;
+	}
+
+	// find the lazy reference, its the only 0x16 in the script
+	INT64 entry = VmEmu::FindExport(lazy, "main");
+	INT64 site = 0;
+	for (INT64 op = entry; op < (INT64)lazy + *(INT32*)(lazy + 0x14) + *(INT32*)(lazy + 0x30); op += 2)
+	{
+		if (*(UINT16*)op == OP_GetLazyFunction)
+		{
+			site = op;
+			break;
+		}
+	}
+	CHECK(site != 0);
+
+	CHECK_EQ(Run(lazy, "main", {}), 42);
+	CHECK_EQ(*(UINT16*)site, OP_GetResolvedFunction);
+	CHECK_EQ(Run(lazy, "main", {}), 42);
+
+	// unloading the target changes the generation, so the quickened site goes back to a lazy lookup and misses
+	VmEmu::Unload("scripts/emu/target.gsc");
+	CHECK_EQ(Run(lazy, "main", {}), -1);
+	CHECK_EQ(*(UINT16*)site, OP_GetLazyFunction);
+
+	target = VmEmu::LoadScript("scripts/emu/target.gsc", "target.gscc");
+	CHECK_EQ(Run(lazy, "main", {}), 42);
+	CHECK_EQ(*(UINT16*)site, OP_GetResolvedFunction);
+
+	// swap the target for another copy with nothing looked up in between, so the pool count is back where it was and
+	// only the asset's buffer says the quickened pointer is stale
+	ScriptBuilder replacement("emu_target");
+	replacement.Function("twice");
+	replacement.Op(EMU_CheckClearParams);
+	replacement.GetByte(5);
+	replacement.Op(EMU_Return);
+	VmEmu::Unload("scripts/emu/target.gsc");
+	CHECK(VmEmu::Load("scripts/emu/target.gsc", replacement.Build()));
+	CHECK_EQ(Run(lazy, "main", {}), 5);
+	CHECK_EQ(*(UINT16*)site, OP_GetResolvedFunction);
+}
+
+static void TestLazyDetours()
+{
+	VmEmu::Reset();
+	RemoveDetours();
+	ScriptDetours::EagerFixups = false;
+
+	ScriptBuilder target("emu_ltarget");
+	target.Function("value");
+	target.GetByte(1);
+	target.Op(EMU_Return);
+	char* targetBuffer = VmEmu::Load("scripts/emu/ltarget.gsc", target.Build());
+
+	ScriptBuilder detour("emu_ldetour");
+	detour.Function("value_hook");
+	detour.GetByte(2);
+	detour.Op(EMU_Return);
+	std::vector<EmuDetour> detours = { { "scripts/emu/ltarget.gsc", "emu_ltarget", "value", detour.FunctionOffset(), detour.Here() - detour.FunctionOffset() } };
+	detour.Function("builtin_hook");
+	detour.GetByte(3);
+	detour.Op(EMU_Return);
+	detours.push_back({ NULL, NULL, "emu_value", detour.FunctionOffset(), detour.Here() - detour.FunctionOffset() });
+	char* detourBuffer = VmEmu::Load("scripts/emu/ldetour.gsc", detour.Build());
+
+	// a call, a function reference called through and a builtin call, each the way CheckDetour sees it
+	ScriptBuilder caller("emu_lcaller");
+	caller.Function("call");
+	caller.Op(EMU_PreScriptCall);
+	caller.Call("emu_ltarget", "value", 0);
+	caller.Op(EMU_Return);
+	caller.Function("pointer");
+	caller.Op(EMU_PreScriptCall);
+	caller.GetFunction("emu_ltarget", "value");
+	caller.CallPointer(0);
+	caller.Op(EMU_Return);
+	caller.Function("builtin");
+	caller.Op(EMU_PreScriptCall);
+	caller.Call(NULL, "emu_value", 0);
+	caller.Op(EMU_Return);
+	auto callerData = caller.Build();
+	char* callerBuffer = VmEmu::Load("scripts/emu/lcaller.gsc", callerData);
+	CHECK(targetBuffer && detourBuffer && callerBuffer);
+	if (!targetBuffer || !detourBuffer || !callerBuffer)
+	{
+		return;
+	}
+	CHECK_EQ(Run(callerBuffer, "call", {}), 1);
+	CHECK_EQ(Run(callerBuffer, "pointer", {}), 1);
+	CHECK_EQ(Run(callerBuffer, "builtin", {}), EMU_BUILTIN_VALUE);
+	std::vector<BYTE> linked(callerBuffer, callerBuffer + callerData.size());
+
+	auto records = DetourRecords(detours);
+	CHECK(RegisterDetours(records.data(), (int)detours.size(), (INT64)detourBuffer));
+	ScriptDetours::DetoursEnabled = true;
+	ScriptDetours::InstallHooks();
+	ScriptDetours::LinkDetours();
+
+	// nothing is touched until a site runs
+	FixupJournalStats stats;
+	GetFixupJournalStats(&stats);
+	CHECK_EQ(stats.NumEntries, 0);
+	CHECK(!memcmp(linked.data(), callerBuffer, linked.size()));
+
+	CHECK_EQ(Run(callerBuffer, "call", {}), 2);
+	CHECK_EQ(Run(callerBuffer, "pointer", {}), 2);
+	CHECK_EQ(Run(callerBuffer, "builtin", {}), 3);
+	GetFixupJournalStats(&stats);
+	CHECK_EQ(stats.NumEntries, 3);
+	CHECK(memcmp(linked.data(), callerBuffer, linked.size()));
+
+	// patched sites go straight to the replacement, without journaling them a second time
+	CHECK_EQ(Run(callerBuffer, "call", {}), 2);
+	CHECK_EQ(Run(callerBuffer, "builtin", {}), 3);
+	GetFixupJournalStats(&stats);
+	CHECK_EQ(stats.NumEntries, 3);
+
+	// the journal puts back every operand and the respoofed builtin opcode
+	RemoveDetours();
+	GetFixupJournalStats(&stats);
+	CHECK_EQ(stats.LastRestored, 3);
+	CHECK_EQ(stats.LastSkipped, 0);
+	CHECK(!memcmp(linked.data(), callerBuffer, linked.size()));
+	CHECK_EQ(Run(callerBuffer, "call", {}), 1);
+	CHECK_EQ(Run(callerBuffer, "pointer", {}), 1);
+	CHECK_EQ(Run(callerBuffer, "builtin", {}), EMU_BUILTIN_VALUE);
+	ScriptDetours::RemoveHooks();
+}
+
+// three functions returning 1, 2 and 3, each starting with CheckClearParams
+static char* LoadNumbers(ScriptBuilder& numbers)
+{
+	const char* names[] = { "one", "two", "three" };
+	for (UINT16 i = 0; i < 3; i++)
+	{
+		numbers.Function(names[i]);
+		numbers.Op(EMU_CheckClearParams);
+		numbers.GetByte(i + 1);
+		numbers.Op(EMU_Return);
+	}
+	return VmEmu::Load("scripts/emu/numbers.gsc", numbers.Build());
+}
+
+static void TestBytecodePatches()
+{
+	VmEmu::Reset();
+	BytecodePatcher::Reset();
+	ScriptBuilder numbers("emu_numbers");
+	char* buffer = LoadNumbers(numbers);
+	CHECK(buffer != NULL);
+	if (!buffer)
+	{
+		return;
+	}
+
+	// the GetByte operand sits after CheckClearParams and the GetByte opcode
+	INT32 one = (INT32)(VmEmu::FindExport(buffer, "one") - (INT64)buffer) + 4;
+	INT32 three = (INT32)(VmEmu::FindExport(buffer, "three") - (INT64)buffer) + 4;
+	BYTE data[] = { 9, 8 };
+	BytecodeEdit edits[] = { { "scripts/emu/numbers.gsc", one, 1, 0 }, { "scripts/emu/numbers.gsc", three, 1, 1 } };
+	CHECK_EQ(BytecodePatcher::Apply(edits, 2, data, sizeof(data)), 2);
+	CHECK_EQ(Run(buffer, "one", {}), 9);
+	CHECK_EQ(Run(buffer, "three", {}), 8);
+
+	// a batch is all or nothing, one bad edit leaves every other one unwritten
+	BytecodeEdit outOfBounds[] = { { "scripts/emu/numbers.gsc", one, 1, 1 }, { "scripts/emu/numbers.gsc", *(INT32*)(buffer + 0x28), 2, 0 } };
+	CHECK_EQ(BytecodePatcher::Apply(outOfBounds, 2, data, sizeof(data)), PATCH_ERROR_BOUNDS);
+	BytecodeEdit missing[] = { { "scripts/emu/numbers.gsc", one, 1, 1 }, { "scripts/emu/nothere.gsc", 0, 1, 0 } };
+	CHECK_EQ(BytecodePatcher::Apply(missing, 2, data, sizeof(data)), PATCH_ERROR_NOSCRIPT);
+	BytecodeEdit badData[] = { { "scripts/emu/numbers.gsc", one, 2, 1 } };
+	CHECK_EQ(BytecodePatcher::Apply(badData, 1, data, sizeof(data)), PATCH_ERROR_BADBATCH);
+	CHECK_EQ(Run(buffer, "one", {}), 9);
+
+	// script side batches merge runs of bytes into one edit, and each vm stages its own
+	BytecodePatcher::Begin(0);
+	BytecodePatcher::Stage(0, "scripts/emu/numbers.gsc", one, 5);
+	BytecodePatcher::Stage(0, "scripts/emu/numbers.gsc", one + 1, 0);
+	CHECK(BytecodePatcher::Staging(0));
+	CHECK(!BytecodePatcher::Staging(1));
+	CHECK_EQ(BytecodePatcher::Commit(1), 0);
+	CHECK_EQ(BytecodePatcher::Commit(0), 2);
+	CHECK(!BytecodePatcher::Staging(0));
+	CHECK_EQ(Run(buffer, "one", {}), 5);
+
+	CHECK_EQ(UndoBytecodePatches(1), 1);
+	CHECK_EQ(Run(buffer, "one", {}), 9);
+
+	// unbatched patchbyte calls in a row are one journal batch, undone latest first
+	CHECK_EQ(BytecodePatcher::PatchByte("scripts/emu/numbers.gsc", one, 6), 1);
+	CHECK_EQ(BytecodePatcher::PatchByte("scripts/emu/numbers.gsc", three, 7), 1);
+	CHECK_EQ(BytecodePatcher::PatchByte("scripts/emu/numbers.gsc", one, 4), 1);
+	CHECK_EQ(Run(buffer, "one", {}), 4);
+	CHECK_EQ(Run(buffer, "three", {}), 7);
+	CHECK_EQ(UndoBytecodePatches(1), 1);
+	CHECK_EQ(Run(buffer, "one", {}), 9);
+	CHECK_EQ(Run(buffer, "three", {}), 8);
+	CHECK_EQ(UndoBytecodePatches(-1), 1);
+	CHECK_EQ(Run(buffer, "one", {}), 1);
+	CHECK_EQ(Run(buffer, "three", {}), 3);
+	CHECK_EQ(UndoBytecodePatches(-1), 0);
+}
+
+static void TestFunctionExtents()
+{
+	VmEmu::Reset();
+	BytecodePatcher::Reset();
+	ScriptBuilder numbers("emu_numbers");
+	char* buffer = LoadNumbers(numbers);
+	CHECK(buffer != NULL);
+	if (!buffer)
+	{
+		return;
+	}
+
+	INT32 ns = (INT32)fnv1a("emu_numbers");
+	INT32 one = (INT32)(VmEmu::FindExport(buffer, "one") - (INT64)buffer);
+	INT32 two = (INT32)(VmEmu::FindExport(buffer, "two") - (INT64)buffer);
+	INT32 three = (INT32)(VmEmu::FindExport(buffer, "three") - (INT64)buffer);
+	FunctionExtent extent;
+	CHECK(ExportIndex::FindExtent(buffer, ns, (INT32)fnv1a("one"), &extent));
+	CHECK_EQ(extent.Start, one);
+	CHECK_EQ(extent.PrologueEnd, one + 2);
+	CHECK_EQ(extent.End, two);
+
+	// the last function runs to the end of the bytecode section, not 2 bytes past its start
+	CHECK(ExportIndex::FindExtent(buffer, ns, (INT32)fnv1a("three"), &extent));
+	CHECK_EQ(extent.Start, three);
+	CHECK_EQ(extent.End, *(INT32*)(buffer + 0x14) + *(INT32*)(buffer + 0x30));
+	CHECK(!ExportIndex::FindExtent(buffer, ns, (INT32)fnv1a("four"), &extent));
+	CHECK_EQ(ExportIndex::FindNextExport(buffer, one), two);
+	CHECK_EQ(ExportIndex::FindNextExport(buffer, three), 0);
+
+	// erased bodies end the function straight after the prologue, missing functions are skipped
+	INT32 funcs[] = { ns, (INT32)fnv1a("one"), ns, (INT32)fnv1a("four"), ns, (INT32)fnv1a("three") };
+	CHECK_EQ(EraseScriptFunctions("scripts/emu/numbers.gsc", funcs, 3), 2);
+	CHECK_EQ(Run(buffer, "one", {}), -0xBAD);
+	CHECK_EQ(Run(buffer, "two", {}), 2);
+	CHECK_EQ(Run(buffer, "three", {}), -0xBAD);
+	CHECK_EQ(EraseScriptFunctions("scripts/emu/nothere.gsc", funcs, 3), PATCH_ERROR_NOSCRIPT);
+
+	// erasing is one journaled batch
+	CHECK_EQ(UndoBytecodePatches(1), 1);
+	CHECK_EQ(Run(buffer, "one", {}), 1);
+	CHECK_EQ(Run(buffer, "three", {}), 3);
+}
+
+int main()
+{
+	if (!VmEmu::Attach())
+	{
+		printf("emulator: %s\n", VmEmu::LastError.c_str());
+		return 1;
+	}
+	RUN_TEST(TestCoreScript);
+	RUN_TEST(TestLazyQuickening);
+	VmEmu::AddBuiltin("emu_value", GScr_emu_value, 0, 0);
+	RUN_TEST(TestLazyDetours);
+	RUN_TEST(TestBytecodePatches);
+	RUN_TEST(TestFunctionExtents);
+	return TEST_RESULT();
+}
@@ -0,0 +1,36 @@
+#pragma once
+#include "framework.h"
+
+// the frame every opcode handler receives. fs_0[0] is the instruction pointer (already past the opcode word)
+// and fs_0[1] is the top of the variable stack. variables are 0x10 bytes, pushing writes the slot above the top.
+#define VM_VAR_VALUE 0x10
+#define VM_VAR_TYPE 0x18
+#define VM_VAR_SIZE 0x10
+
+#define VM_TYPE_UNDEFINED 0x0
+#define VM_TYPE_FUNCTION 0xE
+
+// address of the opcode word of the instruction being executed
+inline INT64 VM_OpcodePos(INT64* fs_0)
+{
+	return *fs_0 - 2;
+}
+
+// first operand of the instruction being executed, aligned the way the compiler emits it
+inline INT64 VM_Operand(INT64* fs_0, INT64 alignment)
+{
+	return (*fs_0 + alignment - 1) & ~(alignment - 1);
+}
+
+inline void VM_Push(INT64* fs_0, INT32 type, INT64 value)
+{
+	*(INT32*)(fs_0[1] + VM_VAR_TYPE) = type;
+	*(INT64*)(fs_0[1] + VM_VAR_VALUE) = value;
+	fs_0[1] += VM_VAR_SIZE;
+}
+
+inline void VM_PushUndefined(INT64* fs_0)
+{
+	*(INT32*)(fs_0[1] + VM_VAR_TYPE) = VM_TYPE_UNDEFINED;
+	fs_0[1] += VM_VAR_SIZE;
+}
@@ -0,0 +1,88 @@
+#include "assetcache.h"
+#include "detours.h"
+#include "offsets.h"
+
+std::mutex ScriptAssetCache::Lock;
+std::unordered_map<INT64, ScriptAssetCache::Entry> ScriptAssetCache::Entries;
+ScriptAssetCacheStats ScriptAssetCache::Stats = { 0 };
+BYTE ScriptAssetCache::LastUILevel = 0;
+INT32 ScriptAssetCache::LastPoolCount = -1;
+INT32 ScriptAssetCache::CurrentGeneration = 0;
+
+EXPORT void GetScriptAssetCacheStats(ScriptAssetCacheStats* stats)
+{
+	ScriptAssetCache::GetStats(stats);
+}
+
+void ScriptAssetCache::CheckState()
+{
+	// map loads change the pool, ui transitions unload the game scripts, and either one can turn a miss into a hit
+	BYTE uiLevel = *(BYTE*)(OFF_s_runningUILevel);
+	INT32 poolCount = *(INT32*)(OFF_xAssetScriptParseTree + 0x14);
+	if (uiLevel != LastUILevel || poolCount != LastPoolCount)
+	{
+		Drop();
+		LastUILevel = uiLevel;
+		LastPoolCount = poolCount;
+	}
+}
+
+INT64 ScriptAssetCache::Find(INT64 name, tScriptAssetLookup lookup)
+{
+	std::lock_guard<std::mutex> lock(Lock);
+	CheckState();
+
+	auto found = Entries.find(name);
+	if (found != Entries.end())
+	{
+		auto& entry = found->second;
+		auto spt = (SPTEntry*)entry.Asset;
+		if (spt->Buffer == entry.Buffer && spt->Name == name)
+		{
+			Stats.Hits++;
+			return entry.Asset;
+		}
+		Stats.Stale++;
+		Entries.erase(found);
+	}
+
+	Stats.Misses++;
+	INT64 asset = lookup(name);
+	if (asset)
+	{
+		Entries[name] = { asset, ((SPTEntry*)asset)->Buffer };
+	}
+	return asset;
+}
+
+INT32 ScriptAssetCache::Generation()
+{
+	std::lock_guard<std::mutex> lock(Lock);
+	CheckState();
+	return CurrentGeneration;
+}
+
+void ScriptAssetCache::Invalidate()
+{
+	std::lock_guard<std::mutex> lock(Lock);
+	Drop();
+}
+
+void ScriptAssetCache::Drop()
+{
+	CurrentGeneration++;
+	if (Entries.empty())
+	{
+		return;
+	}
+	Entries.clear();
+	Stats.Invalidations++;
+}
+
+void ScriptAssetCache::GetStats(ScriptAssetCacheStats* stats)
+{
+	std::lock_guard<std::mutex> lock(Lock);
+	*stats = Stats;
+	stats->NumEntries = (INT32)Entries.size();
+	stats->pad = 0;
+}
@@ -0,0 +1,48 @@
+#pragma once
+#include "framework.h"
+#include <unordered_map>
+#include <mutex>
+
+typedef INT64(__fastcall* tScriptAssetLookup)(INT64 name);
+
+struct ScriptAssetCacheStats
+{
+	INT64 Hits;
+	INT64 NegativeHits; // always 0 on t8, kept so both runtimes report the same struct
+	INT64 Misses;
+	INT64 Stale; // positive entries whose asset no longer held the same buffer
+	INT64 Invalidations;
+	INT32 NumEntries;
+	INT32 pad;
+};
+
+EXPORT void GetScriptAssetCacheStats(ScriptAssetCacheStats* stats);
+
+// script name hash -> scriptparsetree entry. dropped whenever the ui level or the scriptparsetree pool changes.
+// misses are not kept: nothing here sees scripts link, and the pool count alone can come back around to a value it had.
+// the gsc and csc vm threads both look scripts up through here, so everything is behind Lock.
+class ScriptAssetCache
+{
+public:
+	static INT64 Find(INT64 name, tScriptAssetLookup lookup);
+	// bumped every time the cache is dropped. anything derived from a lookup is only valid for the generation it was made in
+	static INT32 Generation();
+	static void Invalidate();
+	static void GetStats(ScriptAssetCacheStats* stats);
+
+private:
+	struct Entry
+	{
+		INT64 Asset;
+		char* Buffer;
+	};
+
+	static void CheckState();
+	static void Drop();
+	static std::mutex Lock;
+	static std::unordered_map<INT64, Entry> Entries;
+	static ScriptAssetCacheStats Stats;
+	static BYTE LastUILevel;
+	static INT32 LastPoolCount;
+	static INT32 CurrentGeneration;
+};
@@ -1,6 +1,7 @@
 #include "builtins.h"
 #include "offsets.h"
 #include "detours.h"
+#include "eventchannel.h"
 
 std::unordered_map<int, void*> GSCBuiltins::CustomFunctions;
 tScrVm_GetString GSCBuiltins::ScrVm_GetString;
@@ -10,34 +11,41 @@ tScrVm_AddInt GSCBuiltins::ScrVm_AddInt;
 tScrVm_AddBool GSCBuiltins::ScrVm_AddBool;
 
 // add all custom builtins here
-void GSCBuiltins::Generate()
+constexpr BuiltinDef GSCBuiltins::Builtins[] =
 {
 	// Compiler related functions //
 
 	// compiler::detour()
 	// Link and execute detours included in loaded scripts.
-	AddCustomFunction("detour", GSCBuiltins::GScr_detour);
-	
+	{ t8hash("detour"), GSCBuiltins::GScr_detour },
+
 	// compiler::relinkdetours()
 	// Re-link any detours that did not get linked previously due to script load order, etc.
-	AddCustomFunction("relinkdetours", GSCBuiltins::GScr_relinkDetours);
+	{ t8hash("relinkdetours"), GSCBuiltins::GScr_relinkDetours },
+
+	// compiler::eagerdetours()
+	// Patch every call site of a detoured function in all loaded scripts when detours are linked, instead of on first execution.
+	{ t8hash("eagerdetours"), GSCBuiltins::GScr_eagerDetours },
 
 	// General purpose //
-	
+
 	// compiler::livesplit(str_split_name);
-	// Send a split signal to livesplit through named pipe access.
+	// Send a split signal to livesplit through named pipe access. Queued, the pipe stays open between splits.
+	// Splits are sent with the time since the run started as game time, measured from when the script called this.
 	// <str_split_name>: Name of the split to send to livesplit
-	AddCustomFunction("livesplit", GSCBuiltins::GScr_livesplit);
+	{ t8hash("livesplit"), GSCBuiltins::GScr_livesplit },
 
 	// compiler::nprintln(str_message)
 	// Prints a line of text to an open, untitled notepad window.
 	// <str_message>: Text to print
-	AddCustomFunction("nprintln", GSCBuiltins::GScr_nprintln);
-}
+	{ t8hash("nprintln"), GSCBuiltins::GScr_nprintln },
+};
+
+constexpr BuiltinDispatch GSCBuiltins::Dispatch = MakeBuiltinDispatch(GSCBuiltins::Builtins);
 
 void GSCBuiltins::Init()
 {
-	GSCBuiltins::Generate();
+	static_assert(Dispatch.Seed, "no collision free seed for the builtin table, is a builtin registered twice?");
 	auto builtinFunction = (BuiltinFunctionDef*)OFF_IsProfileBuild;
 	builtinFunction->max_args = 255;
 	builtinFunction->actionFunc = GSCBuiltins::Exec;
@@ -54,24 +62,42 @@ void GSCBuiltins::AddCustomFunction(const char* name, void* funcPtr)
 	CustomFunctions[t8hash(name)] = funcPtr;
 }
 
+EXPORT void SetLiveSplitGameTime(bool enabled)
+{
+	EventChannel::SetSplitTiming(enabled);
+}
+
 INT64 GSCBuiltins::Exec(int scriptInst)
 {
 	auto numParams = ScrVm_GetNumParam(scriptInst);
-	nlog("called with %d parameters", numParams); // TODO
+	LOG_TRACE("called with %d parameters", numParams);
 	if (!numParams)
 	{
 		return ScrVm_AddBool(scriptInst, 0);
 	}
 
 	INT32 func = ScrVm_GetInt(scriptInst, 0);
-	if (CustomFunctions.find(func) == CustomFunctions.end())
+
+	// runtime additions can replace a builtin, so they win when there are any
+	if (!CustomFunctions.empty())
+	{
+		auto found = CustomFunctions.find(func);
+		if (found != CustomFunctions.end())
+		{
+			reinterpret_cast<INT64(__fastcall*)(int)>(found->second)(scriptInst);
+			return ScrVm_AddBool(scriptInst, 0);
+		}
+	}
+
+	auto builtin = Dispatch.Find(func);
+	if (!builtin)
 	{
 		// unknown builtin
 		nlog("unknown builtin %p", func);
 		return ScrVm_AddBool(scriptInst, 0);
 	}
 
-	reinterpret_cast<INT64(__fastcall*)(int)>(CustomFunctions[func])(scriptInst);
+	builtin(scriptInst);
 	return ScrVm_AddBool(scriptInst, 0);
 }
 
@@ -90,56 +116,42 @@ void GSCBuiltins::GScr_nprintln(int scriptInst)
 
 void GSCBuiltins::GScr_detour(int scriptInst)
 {
-	if (scriptInst)
+	if (scriptInst >= SCRIPT_INSTANCE_COUNT)
 	{
 		return;
 	}
-	ScriptDetours::DetoursEnabled = true;
+	ScriptDetours::Contexts[scriptInst].DetoursEnabled = true;
 }
 
 void GSCBuiltins::GScr_relinkDetours(int scriptInst)
 {
-	if (scriptInst)
+	if (scriptInst >= SCRIPT_INSTANCE_COUNT)
 	{
 		return;
 	}
-	ScriptDetours::LinkDetours();
+	ScriptDetours::LinkDetours(scriptInst);
 }
 
-void GSCBuiltins::GScr_livesplit(int scriptInst)
+void GSCBuiltins::GScr_eagerDetours(int scriptInst)
 {
-	if (scriptInst)
+	if (scriptInst >= SCRIPT_INSTANCE_COUNT)
 	{
 		return;
 	}
-
-	HANDLE livesplit = CreateFile("\\\\.\\pipe\\LiveSplit", GENERIC_READ | GENERIC_WRITE, FILE_SHARE_WRITE, NULL, OPEN_EXISTING, 0, NULL);
-	if (!livesplit)
+	ScriptDetours::Contexts[scriptInst].EagerFixups = true;
+	if (ScriptDetours::Contexts[scriptInst].DetoursLinked)
 	{
-		return;
+		ScriptDetours::ApplyEagerFixups(scriptInst);
 	}
-
-	const char* message = ScrVm_GetString(0, 1);
-	WriteFile(livesplit, message, strlen(message), nullptr, NULL);
-	CloseHandle(livesplit);
 }
 
-
-void GSCBuiltins::nlog(const char* str, ...)
+void GSCBuiltins::GScr_livesplit(int scriptInst)
 {
-	va_list ap;
-	HWND notepad, edit;
-	char buf[256];
-
-	va_start(ap, str);
-	vsprintf(buf, str, ap);
-	va_end(ap);
-	strcat_s(buf, 256, "\r\n");
-	notepad = FindWindow(NULL, "Untitled - Notepad");
-	if (!notepad)
+	if (scriptInst)
 	{
-		notepad = FindWindow(NULL, "*Untitled - Notepad");
+		return;
 	}
-	edit = FindWindowEx(notepad, NULL, "EDIT", NULL);
-	SendMessage(edit, EM_REPLACESEL, TRUE, (LPARAM)buf);
+
+	// timestamped and queued here, the pipe is written from the channel thread
+	EventChannel::Post(ScrVm_GetString(0, 1));
 }
\ No newline at end of file
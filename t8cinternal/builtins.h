@@ -1,6 +1,11 @@
 #pragma once
 #include "framework.h"
 #include <unordered_map>
+#include "builtindispatch.h"
+#include "asynclog.h"
+
+// opt in to game time commands around livesplit starts and splits, see EventChannel::SetSplitTiming
+EXPORT void SetLiveSplitGameTime(bool enabled);
 
 struct alignas(8) BuiltinFunctionDef
 {
@@ -11,14 +16,14 @@ struct alignas(8) BuiltinFunctionDef
 	int type;
 };
 
-inline uint32_t t8hash(const char* key) {
+constexpr uint32_t t8hash(const char* key) {
 
 	const char* data = key;
 	uint32_t hash = 0x4B9ACE2F;
 
 	while(*data)
 	{
-		char c = tolower(*data);
+		char c = (*data >= 'A' && *data <= 'Z') ? (*data + ('a' - 'A')) : *data; // tolower isnt constexpr
 		hash = ((c + hash) ^ ((c + hash) << 10)) + (((c + hash) ^ ((c + hash) << 10)) >> 6);
 		data++;
 	}
@@ -45,15 +50,23 @@ public:
 
 private:
 	static INT64 Exec(int scriptInst);
-	static void Generate();
+	static const BuiltinDef Builtins[];
+	static const BuiltinDispatch Dispatch;
+	// builtins added at runtime through AddCustomFunction
 	static std::unordered_map<int, void*> CustomFunctions;
 
 private:
 	static void GScr_nprintln(int scriptInst);
 	static void GScr_detour(int scriptInst);
 	static void GScr_relinkDetours(int scriptInst);
+	static void GScr_eagerDetours(int scriptInst);
 	static void GScr_livesplit(int scriptInst);
 
 public:
-	static void nlog(const char* str, ...);
+	// queued for the log drain thread, never blocks the vm
+	template <typename... Args>
+	static void nlog(const char* str, Args... args)
+	{
+		AsyncLog::Write(LOG_LEVEL_INFO, str, args...);
+	}
 };
\ No newline at end of file
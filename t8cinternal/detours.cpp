@@ -2,6 +2,8 @@
 #include "detours.h"
 #include "offsets.h"
 #include "builtins.h"
+#include "exportindex.h"
+#include "assetcache.h"
 
 // Note: Some auto-exec scripts will not get detoured due to the way linking works in the game
 
@@ -14,15 +16,10 @@ struct ReadScriptDetour
 	INT32 FixupSize;
 };
 
-tScr_GetFunction ScriptDetours::Scr_GetFunction = NULL;
-tScr_GetMethod ScriptDetours::Scr_GetMethod = NULL;
 tDB_FindXAssetHeader ScriptDetours::DB_FindXAssetHeader = NULL;
 tScr_GscObjLink ScriptDetours::Scr_GscObjLink = NULL;
-char* ScriptDetours::GSC_OBJ = NULL;
 
-std::vector<ScriptDetour*> ScriptDetours::RegisteredDetours;
-std::unordered_map<INT64, ScriptDetour*> ScriptDetours::LinkedDetours;
-std::unordered_map<INT64*, INT64> ScriptDetours::AppliedFixups;
+DetourContext ScriptDetours::Contexts[SCRIPT_INSTANCE_COUNT];
 tVM_Opcode ScriptDetours::VM_OP_GetFunction_Old = NULL;
 tVM_Opcode ScriptDetours::VM_OP_GetAPIFunction_Old = NULL;
 tVM_Opcode ScriptDetours::VM_OP_ScriptFunctionCall_Old = NULL;
@@ -31,11 +28,32 @@ tVM_Opcode ScriptDetours::VM_OP_ScriptThreadCall_Old = NULL;
 tVM_Opcode ScriptDetours::VM_OP_ScriptMethodThreadCall_Old = NULL;
 tVM_Opcode ScriptDetours::VM_OP_CallBuiltin_Old = NULL;
 tVM_Opcode ScriptDetours::VM_OP_CallBuiltinMethod_Old = NULL;
-bool ScriptDetours::DetoursLinked = false;
-bool ScriptDetours::DetoursReset = true;
-bool ScriptDetours::DetoursEnabled = false;
 bool ScriptDetours::DetoursInitialized = false;
 
+void ScriptDetours::ResetContext(INT32 inst)
+{
+	auto& context = Contexts[inst];
+	for (auto it = context.AppliedFixups.begin(); it != context.AppliedFixups.end(); it++)
+	{
+		*it->first = it->second.Original;
+		*it->second.Opcode = it->second.OriginalOpcode;
+	}
+	context.AppliedFixups.clear();
+	context.DetoursReset = true;
+	context.DetoursLinked = false;
+	context.DetoursEnabled = false;
+}
+
+void ScriptDetours::ClearContext(INT32 inst)
+{
+	auto& context = Contexts[inst];
+	ResetContext(inst);
+	context.RegisteredDetours.clear();
+	context.LinkedEntries.clear();
+	context.LinkedDetours.Clear();
+	context.GSC_OBJ = NULL;
+}
+
 EXPORT void ResetDetours()
 {
 	if (!ScriptDetours::DetoursInitialized)
@@ -45,14 +63,12 @@ EXPORT void ResetDetours()
 #ifdef DETOUR_LOGGING
 	GSCBuiltins::nlog("Resetting detours...");
 #endif
-	for (auto it = ScriptDetours::AppliedFixups.begin(); it != ScriptDetours::AppliedFixups.end(); it++)
+	for (INT32 inst = 0; inst < SCRIPT_INSTANCE_COUNT; inst++)
 	{
-		*it->first = it->second;
+		ScriptDetours::ResetContext(inst);
 	}
-	ScriptDetours::AppliedFixups.clear();
-	ScriptDetours::DetoursReset = true;
-	ScriptDetours::DetoursLinked = false;
-	ScriptDetours::DetoursEnabled = false;
+	ExportIndex::Clear();
+	ScriptAssetCache::Invalidate();
 }
 
 EXPORT void RemoveDetours()
@@ -64,45 +80,50 @@ EXPORT void RemoveDetours()
 #ifdef DETOUR_LOGGING
 	GSCBuiltins::nlog("Removing detours...");
 #endif
-	for (auto it = ScriptDetours::RegisteredDetours.begin(); it != ScriptDetours::RegisteredDetours.end(); it++)
+	for (INT32 inst = 0; inst < SCRIPT_INSTANCE_COUNT; inst++)
 	{
-		free(*it);
+		ScriptDetours::ClearContext(inst);
 	}
-	ResetDetours();
-	ScriptDetours::RegisteredDetours.clear();
-	ScriptDetours::DetoursLinked = false;
+	ExportIndex::Clear();
 }
 
 EXPORT bool RegisterDetours(void* DetourData, int NumDetours, INT64 scriptOffset)
+{
+	return RegisterInstanceDetours(DetourData, NumDetours, scriptOffset, 0);
+}
+
+// registers detours for a single vm instance, leaving the other instance's detours in place
+EXPORT bool RegisterInstanceDetours(void* DetourData, int NumDetours, INT64 scriptOffset, INT32 inst)
 {
 	if (!ScriptDetours::DetoursInitialized)
 	{
 		return true;
 	}
-	RemoveDetours();
-	ScriptDetours::GSC_OBJ = (char*)scriptOffset;
+	if (inst < 0 || inst >= SCRIPT_INSTANCE_COUNT)
+	{
+		return false;
+	}
+	ScriptDetours::ClearContext(inst);
+	auto& context = ScriptDetours::Contexts[inst];
+	context.GSC_OBJ = (char*)scriptOffset;
 	
 #ifdef DETOUR_LOGGING
-	GSCBuiltins::nlog("Registering %d detours in script %p...", NumDetours, scriptOffset);
+	GSCBuiltins::nlog("Registering %d detours in script %p for inst %d...", NumDetours, scriptOffset, inst);
 #endif
 
 	INT64 base = (INT64)DetourData;
 	for (int i = 0; i < NumDetours; i++)
 	{
 		ReadScriptDetour* read_detour = (ReadScriptDetour*)(base + (i * 256));
-		ScriptDetour* detour = new ScriptDetour();
-		detour->hFixup = read_detour->FixupOffset + scriptOffset;
-		detour->ReplaceFunction = read_detour->ReplaceFunction;
-		detour->ReplaceNamespace = read_detour->ReplaceNamespace;
-		detour->FixupSize = read_detour->FixupSize;
+		INT64 scriptName = *(INT64*)((INT64)read_detour + sizeof(ReadScriptDetour));
+		context.RegisteredDetours.push_back({ scriptName, read_detour->ReplaceNamespace, read_detour->ReplaceFunction, read_detour->FixupOffset + scriptOffset, read_detour->FixupSize, false });
 #ifdef DETOUR_LOGGING
+		ScriptDetour* detour = &context.RegisteredDetours.back();
 		GSCBuiltins::nlog("Detour Parsed: {FixupName:%x, ReplaceNamespace:%x, ReplaceFunction:%x, FixupOffset:%x, FixupSize:%x} {FixupMin:%p, FixupMax:%p}", read_detour->FixupName, read_detour->ReplaceNamespace, read_detour->ReplaceFunction, read_detour->FixupOffset, read_detour->FixupSize, detour->hFixup, detour->hFixup + detour->FixupSize);
 #endif
-		detour->ReplaceScriptName = *(INT64*)((INT64)read_detour + sizeof(ReadScriptDetour));
-		ScriptDetours::RegisteredDetours.push_back(detour);
 	}
 
-	ScriptDetours::DetoursLinked = false;
+	context.DetoursLinked = false;
 	return true;
 }
 
@@ -112,13 +133,20 @@ void ScriptDetours::InstallHooks()
 	GSCBuiltins::nlog("Installing hooks...");
 #endif
 
-	// initialize methods
-	Scr_GetFunction = (tScr_GetFunction)OFF_Scr_GetFunction;
-	Scr_GetMethod = (tScr_GetMethod)OFF_Scr_GetMethod;
+	// initialize methods. each vm instance resolves builtins through its own tables
+	Contexts[0].GetFunction = (tScr_GetFunction)OFF_Scr_GetFunction;
+	Contexts[0].GetMethod = (tScr_GetMethod)OFF_Scr_GetMethod;
+	Contexts[1].GetFunction = (tScr_GetFunction)OFF_CScr_GetFunction;
+	Contexts[1].GetMethod = (tScr_GetMethod)OFF_CScr_GetMethod;
+	for (INT32 inst = 0; inst < SCRIPT_INSTANCE_COUNT; inst++)
+	{
+		Contexts[inst].DetoursReset = true;
+	}
 	DB_FindXAssetHeader = (tDB_FindXAssetHeader)OFF_DB_FindXAssetHeader;
 	Scr_GscObjLink = (tScr_GscObjLink)OFF_Scr_GscObjLink;
 
-	// opcodes to hook:
+	// opcodes to hook. these stay even with eager fixups: lazy mode is the default, and t8 has no link hook, so scripts
+	// loaded after LinkDetours are only ever patched here
 	VTableReplace(0x5d8, VM_OP_GetFunction, &VM_OP_GetFunction_Old);
 	VTableReplace(0x6f7, VM_OP_GetAPIFunction, &VM_OP_GetAPIFunction_Old);
 	VTableReplace(0x75c, VM_OP_ScriptFunctionCall, &VM_OP_ScriptFunctionCall_Old);
@@ -134,8 +162,13 @@ void ScriptDetours::InstallHooks()
 
 INT64 ScriptDetours::FindScriptParsetree(INT64 name)
 {
-	SPTEntry* currentSpt = (SPTEntry*)*(INT64*)OFFSET(0x912BBB0);
-	INT32 sptCount = *(INT32*)OFFSET(0x912BBB0 + 0x14);
+	return ScriptAssetCache::Find(name, LookupScriptParsetree);
+}
+
+INT64 ScriptDetours::LookupScriptParsetree(INT64 name)
+{
+	SPTEntry* currentSpt = (SPTEntry*)*(INT64*)OFF_xAssetScriptParseTree;
+	INT32 sptCount = *(INT32*)(OFF_xAssetScriptParseTree + 0x14);
 	for (int i = 0; i < sptCount; i++, currentSpt++)
 	{
 		if (!currentSpt->Name) continue;
@@ -147,12 +180,13 @@ INT64 ScriptDetours::FindScriptParsetree(INT64 name)
 	return 0;
 }
 
-void ScriptDetours::LinkDetours()
+void ScriptDetours::LinkDetours(INT32 inst)
 {
-	LinkedDetours.clear();
-	for (auto it = RegisteredDetours.begin(); it != RegisteredDetours.end(); it++)
+	auto& context = Contexts[inst];
+	context.LinkedEntries.clear();
+	for (auto it = context.RegisteredDetours.begin(); it != context.RegisteredDetours.end(); it++)
 	{
-		auto detour = *it;
+		auto detour = &*it;
 		if (detour->ReplaceScriptName) // not a builtin
 		{
 #ifdef DETOUR_LOGGING
@@ -173,25 +207,13 @@ void ScriptDetours::LinkDetours()
 #endif
 			// locate the target export to link
 			auto buffer = *(char**)(asset + 0x10);
-			auto exportsOffset = *(INT32*)(buffer + 0x30);
-			auto exports = (INT64)(exportsOffset + buffer);
-			auto numExports = *(INT16*)(buffer + 0x1E);
-			__t8export* currentExport = (__t8export*)exports;
-			for (INT16 i = 0; i < numExports; i++, currentExport++)
+			auto bytecodeOffset = ExportIndex::FindExport(buffer, detour->ReplaceNamespace, detour->ReplaceFunction);
+			if (bytecodeOffset)
 			{
-				if (currentExport->funcName != detour->ReplaceFunction)
-				{
-					continue;
-				}
-				if (currentExport->funcNS != detour->ReplaceNamespace)
-				{
-					continue;
-				}
 #ifdef DETOUR_LOGGING
-				GSCBuiltins::nlog("Found export at %p!", (INT64)buffer + currentExport->bytecodeOffset);
+				GSCBuiltins::nlog("Found export at %p!", (INT64)buffer + bytecodeOffset);
 #endif
-				LinkedDetours[(INT64)buffer + currentExport->bytecodeOffset] = detour;
-				break;
+				context.LinkedEntries.push_back({ (INT64)buffer + bytecodeOffset, detour });
 			}
 		}
 		else
@@ -202,21 +224,150 @@ void ScriptDetours::LinkDetours()
 			INT32 discardType;
 			INT32 discardMinParams;
 			INT32 discardMaxParams;
-			auto hReplace = Scr_GetFunction(detour->ReplaceFunction, &discardType, &discardMinParams, &discardMaxParams);
+			auto hReplace = context.GetFunction(detour->ReplaceFunction, &discardType, &discardMinParams, &discardMaxParams);
 			if (!hReplace)
 			{
-				hReplace = Scr_GetMethod(detour->ReplaceFunction, &discardType, &discardMinParams, &discardMaxParams);
+				hReplace = context.GetMethod(detour->ReplaceFunction, &discardType, &discardMinParams, &discardMaxParams);
 			}
 			if (hReplace)
 			{
 #ifdef DETOUR_LOGGING
 				GSCBuiltins::nlog("Found function definition at %p!", hReplace);
 #endif
-				LinkedDetours[hReplace] = detour;
+				auto& other = Contexts[inst ^ 1];
+				INT64 hOther = other.GetFunction ? other.GetFunction(detour->ReplaceFunction, &discardType, &discardMinParams, &discardMaxParams) : 0;
+				if (!hOther && other.GetMethod)
+				{
+					hOther = other.GetMethod(detour->ReplaceFunction, &discardType, &discardMinParams, &discardMaxParams);
+				}
+				detour->SharedTarget = hOther == hReplace;
+				context.LinkedEntries.push_back({ hReplace, detour });
 			}
 		}
 	}
-	DetoursLinked = true;
+	context.LinkedDetours.Build(context.LinkedEntries);
+	context.DetoursLinked = true;
+
+	if (context.EagerFixups)
+	{
+		ApplyEagerFixups(inst);
+	}
+}
+
+struct EagerCallOpcode
+{
+	INT64 Hook;
+	INT64 Original;
+	INT32 Offset; // same meaning as the CheckDetour offset
+	INT16 Spoof; // opcode to rewrite to when a builtin call becomes a script call, 0 to leave it alone
+};
+
+static EagerCallOpcode EagerCallOpcodes[8];
+
+void ScriptDetours::ApplyEagerFixups(INT32 inst)
+{
+	auto& context = Contexts[inst];
+
+	// the table may hold either our hooks or the stock handlers depending on if hooks are installed, so match both
+	EagerCallOpcodes[0] = { (INT64)VM_OP_GetFunction, (INT64)VM_OP_GetFunction_Old, 0, 0 };
+	EagerCallOpcodes[1] = { (INT64)VM_OP_GetAPIFunction, (INT64)VM_OP_GetAPIFunction_Old, 0, 0 };
+	EagerCallOpcodes[2] = { (INT64)VM_OP_ScriptFunctionCall, (INT64)VM_OP_ScriptFunctionCall_Old, 1, 0 };
+	EagerCallOpcodes[3] = { (INT64)VM_OP_ScriptMethodCall, (INT64)VM_OP_ScriptMethodCall_Old, 1, 0 };
+	EagerCallOpcodes[4] = { (INT64)VM_OP_ScriptThreadCall, (INT64)VM_OP_ScriptThreadCall_Old, 1, 0 };
+	EagerCallOpcodes[5] = { (INT64)VM_OP_ScriptMethodThreadCall, (INT64)VM_OP_ScriptMethodThreadCall_Old, 1, 0 };
+	EagerCallOpcodes[6] = { (INT64)VM_OP_CallBuiltin, (INT64)VM_OP_CallBuiltin_Old, 1, 0x75c };
+	EagerCallOpcodes[7] = { (INT64)VM_OP_CallBuiltinMethod, (INT64)VM_OP_CallBuiltinMethod_Old, 1, 0x7f2 };
+
+	// nothing is restored on map change unless detours are enabled, so dont touch anything until they are
+	if (!context.DetoursEnabled || !context.LinkedDetours.Count())
+	{
+		return;
+	}
+
+	// t8 objects carry nothing saying which vm loaded them and both share the one pool, so this walks every buffer.
+	// what keeps a context to its own call sites is the target: script targets live in buffers only this instance
+	// links against, and builtins both instances resolve to the same native are left to CheckDetour, which knows inst.
+	INT32 numPatched = 0;
+	SPTEntry* currentSpt = (SPTEntry*)*(INT64*)OFF_xAssetScriptParseTree;
+	INT32 sptCount = *(INT32*)(OFF_xAssetScriptParseTree + 0x14);
+	for (int i = 0; i < sptCount; i++, currentSpt++)
+	{
+		if (!currentSpt->Name) continue;
+		if (!currentSpt->Buffer) continue;
+		if (!currentSpt->size) continue;
+		numPatched += PatchScriptBuffer(context, currentSpt->Buffer, currentSpt->size);
+	}
+
+#ifdef DETOUR_LOGGING
+	GSCBuiltins::nlog("Eagerly patched %d call sites for inst %d", numPatched, inst);
+#endif
+}
+
+INT32 ScriptDetours::PatchScriptBuffer(DetourContext& context, char* buffer, INT32 size)
+{
+	// call operands are always qword aligned absolute pointers once linked, so any aligned qword that points
+	// at a linked target is a candidate, and the opcode in front of it confirms it.
+	INT64 bufferStart = (INT64)buffer;
+	INT64 bufferEnd = bufferStart + size;
+
+	INT32 numPatched = 0;
+	INT64 handler_table = OFF_ScrVm_Opcodes;
+	for (INT64* fixupPtr = (INT64*)((bufferStart + 7) & 0xFFFFFFFFFFFFFFF8); (INT64)(fixupPtr + 1) <= bufferEnd; fixupPtr++)
+	{
+		ScriptDetour* detour = context.LinkedDetours.Find(*fixupPtr);
+		if (!detour || !detour->hFixup || detour->SharedTarget)
+		{
+			continue;
+		}
+
+		// the opcode sits 2 to 10 bytes in front of the operand depending on the offset and alignment. prefer the closest.
+		for (INT64 op = (INT64)fixupPtr - 2; op >= (INT64)fixupPtr - 10 && op >= bufferStart; op -= 2)
+		{
+			UINT16 code = *(UINT16*)op;
+			if (code >= 0x4000)
+			{
+				continue;
+			}
+
+			INT64 handler = *(INT64*)(handler_table + (code * 8));
+			EagerCallOpcode* match = NULL;
+			for (int i = 0; i < ARRAYSIZE(EagerCallOpcodes); i++)
+			{
+				if (EagerCallOpcodes[i].Hook != handler && EagerCallOpcodes[i].Original != handler)
+				{
+					continue;
+				}
+				if (((op + 2 + 7 + EagerCallOpcodes[i].Offset) & 0xFFFFFFFFFFFFFFF8) != (INT64)fixupPtr)
+				{
+					continue;
+				}
+				match = &EagerCallOpcodes[i];
+				break;
+			}
+
+			if (!match)
+			{
+				continue;
+			}
+
+			INT64 fs_pos = op + 2;
+			if (detour->hFixup <= fs_pos && fs_pos < (detour->hFixup + detour->FixupSize))
+			{
+				break; // call from inside the detour itself, leave it alone
+			}
+
+			context.AppliedFixups.emplace(fixupPtr, AppliedFixup{ *fixupPtr, (INT16*)op, *(INT16*)op });
+			*fixupPtr = detour->hFixup;
+			if (match->Spoof)
+			{
+				*(INT16*)op = match->Spoof;
+			}
+			context.DetoursReset = false;
+			numPatched++;
+			break;
+		}
+	}
+	return numPatched;
 }
 
 void ScriptDetours::VTableReplace(INT32 original_code, tVM_Opcode ReplaceFunc, tVM_Opcode* OutOld)
@@ -295,44 +446,50 @@ void ScriptDetours::VM_OP_CallBuiltinMethod(INT32 inst, INT64* fs_0, INT64 vmc,
 
 bool ScriptDetours::CheckDetour(INT32 inst, INT64* fs_0, INT32 offset)
 {
-	if (!DetoursEnabled)
+	if ((UINT32)inst >= SCRIPT_INSTANCE_COUNT)
+	{
+		return false;
+	}
+	auto& context = Contexts[inst];
+	if (!context.DetoursEnabled)
 	{
 		return false;
 	}
 	// detours are not supported in UI level
 	if (*(BYTE*)(OFF_s_runningUILevel))
 	{
-		if (!ScriptDetours::DetoursReset)
+		if (!context.DetoursReset)
 		{
 			ResetDetours();
 		}
 		return false;
 	}
-	if (inst)
-	{
-		// csc is not supported at this time
-		return false;
-	}
 	bool fixupApplied = false;
-	if (!DetoursLinked)
+	INT64* fixupPtr = (INT64*)((*fs_0 + 7 + offset) & 0xFFFFFFFFFFFFFFF8);
+	INT64 ptrval = *fixupPtr;
+	if (!context.DetoursLinked)
 	{
-		LinkDetours();
+		LinkDetours(inst);
+		if (*fixupPtr != ptrval)
+		{
+			return true; // the eager pass already patched this call site
+		}
 	}
-	INT64 ptrval = *(INT64*)((*fs_0 + 7 + offset) & 0xFFFFFFFFFFFFFFF8);
-	if (LinkedDetours.find(ptrval) != LinkedDetours.end() && LinkedDetours[ptrval]->hFixup)
+	ScriptDetour* detour = context.LinkedDetours.Find(ptrval);
+	if (detour && detour->hFixup)
 	{
 		INT64 fs_pos = *fs_0;
 		// if pointer is below fixup or above it, the pointer is not within the detour and thus can be fixed up
-		if (LinkedDetours[ptrval]->hFixup > fs_pos || ((LinkedDetours[ptrval]->hFixup + LinkedDetours[ptrval]->FixupSize) <= fs_pos))
+		if (detour->hFixup > fs_pos || ((detour->hFixup + detour->FixupSize) <= fs_pos))
 		{
 #ifdef DETOUR_LOGGING
-			GSCBuiltins::nlog("Replaced call at %p to fixup %p! Opcode: %x", (INT64)((*fs_0 + 7 + offset) & 0xFFFFFFFFFFFFFFF8), LinkedDetours[ptrval]->hFixup, *(INT16*)(*fs_0 - 2));
+			GSCBuiltins::nlog("Replaced call at %p to fixup %p! Opcode: %x Inst: %d", (INT64)fixupPtr, detour->hFixup, *(INT16*)(*fs_0 - 2), inst);
 #endif
-			AppliedFixups[(INT64*)((*fs_0 + 7 + offset) & 0xFFFFFFFFFFFFFFF8)] = ptrval;
-			*(INT64*)((*fs_0 + 7 + offset) & 0xFFFFFFFFFFFFFFF8) = LinkedDetours[ptrval]->hFixup;
-			DetoursReset = false;
+			context.AppliedFixups.emplace(fixupPtr, AppliedFixup{ ptrval, (INT16*)(*fs_0 - 2), *(INT16*)(*fs_0 - 2) });
+			*fixupPtr = detour->hFixup;
+			context.DetoursReset = false;
 			fixupApplied = true;
 		}
 	}
 	return fixupApplied;
-}
+}
\ No newline at end of file
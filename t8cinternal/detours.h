@@ -1,6 +1,8 @@
 #pragma once
 #include "framework.h"
+#include "detourtable.h"
 #include <vector>
+#include <deque>
 #include <unordered_map>
 
 struct ScriptDetour
@@ -10,6 +12,7 @@ struct ScriptDetour
 	INT32 ReplaceFunction;
 	INT64 hFixup;
 	INT32 FixupSize;
+	bool SharedTarget; // a native the other instance resolves to as well, only CheckDetour can tell whose call site it is
 };
 
 struct __t8export
@@ -37,22 +40,48 @@ typedef INT64(__fastcall* tScr_GetMethod)(INT32 canonID, INT32* type, INT32* min
 typedef INT64(__fastcall* tDB_FindXAssetHeader)(int type, char* name, bool errorIfMissing, int waitTime);
 typedef INT64(__fastcall* tScr_GscObjLink)(int inst, char* gsc_obj);
 
-#define DETOUR_LOGGING
+//#define DETOUR_LOGGING
+
+// an overwritten call site operand and the opcode in front of it, as they were before the first patch
+struct AppliedFixup
+{
+	INT64 Original;
+	INT16* Opcode; // builtin calls are respoofed to script calls along with the operand, so the opcode goes back too
+	INT16 OriginalOpcode;
+};
+
+// 0 = gsc, 1 = csc
+#define SCRIPT_INSTANCE_COUNT 2
+
+// all detour state belonging to a single script vm instance
+struct DetourContext
+{
+	std::deque<ScriptDetour> RegisteredDetours; // by value, so pointers into it stay valid until the context is cleared
+	std::vector<std::pair<INT64, ScriptDetour*>> LinkedEntries;
+	DetourTable LinkedDetours;
+	std::unordered_map<INT64*, AppliedFixup> AppliedFixups;
+	tScr_GetFunction GetFunction;
+	tScr_GetMethod GetMethod;
+	char* GSC_OBJ;
+	bool DetoursLinked;
+	bool DetoursReset;
+	bool DetoursEnabled;
+	bool EagerFixups; // set by eagerdetours from this instance only, survives reregistering like the global did
+};
+
+EXPORT bool RegisterInstanceDetours(void* DetourData, int NumDetours, INT64 scriptOffset, INT32 inst);
 
 class ScriptDetours
 {
 public:
-	static std::vector<ScriptDetour*> RegisteredDetours;
-	static std::unordered_map<INT64, ScriptDetour*> LinkedDetours;
-	static std::unordered_map<INT64*, INT64> AppliedFixups;
+	static DetourContext Contexts[SCRIPT_INSTANCE_COUNT];
 	static INT64 FindScriptParsetree(INT64 name);
-	static bool DetoursLinked;
-	static bool DetoursReset;
-	static bool DetoursEnabled;
 	static bool DetoursInitialized;
-	static char* GSC_OBJ;
 	static void InstallHooks();
-	static void LinkDetours();
+	static void LinkDetours(INT32 inst);
+	static void ApplyEagerFixups(INT32 inst);
+	static void ResetContext(INT32 inst);
+	static void ClearContext(INT32 inst);
 
 private:
 	static void VTableReplace(INT32 sub_offset, tVM_Opcode ReplaceFunc, tVM_Opcode* OutOld);
@@ -65,8 +94,8 @@ private:
 	static void VM_OP_CallBuiltin(INT32 inst, INT64* fs_0, INT64 vmc, bool* terminate);
 	static void VM_OP_CallBuiltinMethod(INT32 inst, INT64* fs_0, INT64 vmc, bool* terminate);
 	static bool CheckDetour(INT32 inst, INT64* fs_0, INT32 offset = 0);
-	static tScr_GetFunction Scr_GetFunction;
-	static tScr_GetMethod Scr_GetMethod;
+	static INT32 PatchScriptBuffer(DetourContext& context, char* buffer, INT32 size);
+	static INT64 LookupScriptParsetree(INT64 name);
 	static tScr_GscObjLink Scr_GscObjLink;
 	static tDB_FindXAssetHeader DB_FindXAssetHeader;
 	static tVM_Opcode VM_OP_GetFunction_Old;
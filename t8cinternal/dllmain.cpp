@@ -3,6 +3,7 @@
 #include "builtins.h"
 #include "detours.h"
 #include "LazyLink.h"
+#include "eventchannel.h"
 
 BOOL APIENTRY DllMain( HMODULE hModule,
                        DWORD  ul_reason_for_call,
@@ -18,9 +19,30 @@ BOOL APIENTRY DllMain( HMODULE hModule,
         break;
     case DLL_THREAD_ATTACH:
     case DLL_THREAD_DETACH:
+        break;
     case DLL_PROCESS_DETACH:
+        // a non null lpReserved means the process is exiting and every other thread, the log and channel threads
+        // included, is already gone, so we drain on this one. otherwise we are being unloaded, the injector should
+        // have called ShutdownRuntime first. waiting on the threads here would be under the loader lock
+        if (lpReserved)
+        {
+            AsyncLog::Stop(true);
+            EventChannel::Stop(true);
+        }
+        else
+        {
+            AsyncLog::RequestStop();
+            EventChannel::RequestStop();
+        }
         break;
     }
     return TRUE;
 }
 
+// call before FreeLibrary on the runtime, waits for the log and channel threads to flush and exit
+EXPORT void ShutdownRuntime()
+{
+    AsyncLog::Stop();
+    EventChannel::Stop();
+}
+
@@ -0,0 +1,100 @@
+#include "exportindex.h"
+#include "detours.h"
+#include <algorithm>
+
+#define EXPORTINDEX_KEY(ns, name) (((UINT64)(UINT32)(ns) << 32) | (UINT32)(name))
+
+std::mutex ExportIndex::Lock;
+std::unordered_map<char*, ScriptExportIndex> ExportIndex::Indices;
+
+ScriptExportIndex* ExportIndex::Get(char* buffer)
+{
+	if (!buffer)
+	{
+		return NULL;
+	}
+
+	auto found = Indices.find(buffer);
+	if (found != Indices.end())
+	{
+		auto& index = found->second;
+		if (index.Checksum == *(INT32*)(buffer + 0x8) && index.ExportsOffset == *(INT32*)(buffer + 0x30) && index.NumExports == *(INT16*)(buffer + 0x1E))
+		{
+			return &index;
+		}
+	}
+
+	auto& index = Indices[buffer];
+	Build(buffer, index);
+	return &index;
+}
+
+void ExportIndex::Build(char* buffer, ScriptExportIndex& index)
+{
+	index.Checksum = *(INT32*)(buffer + 0x8);
+	index.ExportsOffset = *(INT32*)(buffer + 0x30);
+	index.NumExports = *(INT16*)(buffer + 0x1E);
+	index.Exports.clear();
+	index.Offsets.clear();
+
+	__t8export* currentExport = (__t8export*)(buffer + index.ExportsOffset);
+	index.Exports.reserve(index.NumExports);
+	index.Offsets.reserve(index.NumExports);
+	for (INT16 i = 0; i < index.NumExports; i++, currentExport++)
+	{
+		index.Exports.push_back({ EXPORTINDEX_KEY(currentExport->funcNS, currentExport->funcName), currentExport->bytecodeOffset });
+		index.Offsets.push_back(currentExport->bytecodeOffset);
+	}
+
+	// stable so that duplicate exports resolve to the first one in the table, same as the linear walks did
+	std::stable_sort(index.Exports.begin(), index.Exports.end(), [](const ScriptExportIndex::Entry& a, const ScriptExportIndex::Entry& b) { return a.Key < b.Key; });
+	std::sort(index.Offsets.begin(), index.Offsets.end());
+	index.Offsets.erase(std::unique(index.Offsets.begin(), index.Offsets.end()), index.Offsets.end());
+}
+
+INT32 ExportIndex::FindExport(char* buffer, INT32 funcNS, INT32 funcName)
+{
+	std::lock_guard<std::mutex> lock(Lock);
+	auto index = Get(buffer);
+	if (!index)
+	{
+		return 0;
+	}
+
+	UINT64 key = EXPORTINDEX_KEY(funcNS, funcName);
+	auto it = std::lower_bound(index->Exports.begin(), index->Exports.end(), key, [](const ScriptExportIndex::Entry& entry, UINT64 key) { return entry.Key < key; });
+	if (it == index->Exports.end() || it->Key != key)
+	{
+		return 0;
+	}
+	return it->BytecodeOffset;
+}
+
+INT32 ExportIndex::FindNextExport(char* buffer, INT32 bytecodeOffset)
+{
+	std::lock_guard<std::mutex> lock(Lock);
+	auto index = Get(buffer);
+	if (!index)
+	{
+		return 0;
+	}
+
+	auto it = std::upper_bound(index->Offsets.begin(), index->Offsets.end(), bytecodeOffset);
+	if (it == index->Offsets.end())
+	{
+		return 0;
+	}
+	return *it;
+}
+
+void ExportIndex::Invalidate(char* buffer)
+{
+	std::lock_guard<std::mutex> lock(Lock);
+	Indices.erase(buffer);
+}
+
+void ExportIndex::Clear()
+{
+	std::lock_guard<std::mutex> lock(Lock);
+	Indices.clear();
+}
@@ -0,0 +1,41 @@
+#pragma once
+#include "framework.h"
+#include <vector>
+#include <unordered_map>
+#include <mutex>
+
+struct ScriptExportIndex
+{
+	struct Entry
+	{
+		UINT64 Key; // (funcNS << 32) | funcName
+		INT32 BytecodeOffset;
+	};
+
+	// header fields we validate against so a reused or reloaded buffer gets rebuilt
+	INT32 Checksum;
+	INT32 ExportsOffset;
+	INT16 NumExports;
+
+	std::vector<Entry> Exports; // sorted by key
+	std::vector<INT32> Offsets; // sorted, unique function start offsets
+};
+
+// per script buffer index of the __t8export table, built the first time a buffer is queried.
+// queried from both vm threads and the injector, so every lookup holds Lock.
+class ExportIndex
+{
+public:
+	// returns the bytecode offset of the export or 0 if it doesnt exist
+	static INT32 FindExport(char* buffer, INT32 funcNS, INT32 funcName);
+	// returns the first export offset above bytecodeOffset or 0 if bytecodeOffset is the last function in the script
+	static INT32 FindNextExport(char* buffer, INT32 bytecodeOffset);
+	static void Invalidate(char* buffer);
+	static void Clear();
+
+private:
+	static ScriptExportIndex* Get(char* buffer);
+	static void Build(char* buffer, ScriptExportIndex& index);
+	static std::mutex Lock;
+	static std::unordered_map<char*, ScriptExportIndex> Indices;
+};